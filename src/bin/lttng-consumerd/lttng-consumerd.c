@@ -54,7 +54,7 @@
 
 /* threads (channel handling, poll, metadata, sessiond) */
 
-static pthread_t channel_thread, data_thread, metadata_thread,
+static pthread_t channel_thread, metadata_thread,
 		sessiond_thread, metadata_timer_thread, health_thread;
 
 /* to count the number of times the user pressed ctrl+c */
@@ -299,12 +299,119 @@ static void set_ulimit(void)
 	}
 }
 
+/*
+ * Get the number of data stream poll threads from the environment, falling
+ * back to the default on an invalid value.
+ */
+static unsigned int get_nr_data_threads(void)
+{
+	const char *env;
+	char *endptr;
+	unsigned long value;
+
+	env = lttng_secure_getenv(DEFAULT_CONSUMERD_DATA_THREADS_ENV);
+	if (!env) {
+		goto default_value;
+	}
+
+	errno = 0;
+	value = strtoul(env, &endptr, 10);
+	if (errno || *env == '\0' || *endptr != '\0' || value == 0 ||
+			value > UINT_MAX) {
+		WARN("Invalid value \"%s\" for %s, using %u data thread(s)",
+				env, DEFAULT_CONSUMERD_DATA_THREADS_ENV,
+				DEFAULT_CONSUMERD_DATA_THREADS);
+		goto default_value;
+	}
+	return (unsigned int) value;
+
+default_value:
+	return DEFAULT_CONSUMERD_DATA_THREADS;
+}
+
+/*
+ * Get the number of sub-buffer writer threads from the environment, falling
+ * back to the default on an invalid value.
+ */
+static unsigned int get_nr_writers(void)
+{
+	const char *env;
+	char *endptr;
+	unsigned long value;
+
+	env = lttng_secure_getenv(DEFAULT_CONSUMERD_WRITER_THREADS_ENV);
+	if (!env) {
+		goto default_value;
+	}
+
+	errno = 0;
+	value = strtoul(env, &endptr, 10);
+	if (errno || *env == '\0' || *endptr != '\0' || value > UINT_MAX) {
+		WARN("Invalid value \"%s\" for %s, using %u writer thread(s)",
+				env, DEFAULT_CONSUMERD_WRITER_THREADS_ENV,
+				DEFAULT_CONSUMERD_WRITER_THREADS);
+		goto default_value;
+	}
+	return (unsigned int) value;
+
+default_value:
+	return DEFAULT_CONSUMERD_WRITER_THREADS;
+}
+
+/*
+ * Get the number of bytes read from a data stream each time it is found
+ * ready from the environment, falling back to the default on an invalid
+ * value. A size suffix (k, M or G) is accepted.
+ */
+static uint64_t get_drain_budget(void)
+{
+	const char *env;
+	uint64_t value;
+
+	env = lttng_secure_getenv(DEFAULT_CONSUMERD_DRAIN_BUDGET_ENV);
+	if (!env) {
+		goto default_value;
+	}
+
+	if (utils_parse_size_suffix(env, &value) < 0) {
+		WARN("Invalid value \"%s\" for %s, using a drain budget of %d bytes",
+				env, DEFAULT_CONSUMERD_DRAIN_BUDGET_ENV,
+				DEFAULT_CONSUMERD_DRAIN_BUDGET);
+		goto default_value;
+	}
+	return value;
+
+default_value:
+	return DEFAULT_CONSUMERD_DRAIN_BUDGET;
+}
+
+/*
+ * Get whether the tracefiles in tracefile rotation are reused from the
+ * environment. They are not reused by default.
+ */
+static bool get_tracefile_reuse(void)
+{
+	const char *env;
+
+	env = lttng_secure_getenv(DEFAULT_CONSUMERD_TRACEFILE_REUSE_ENV);
+	if (!env || !strcmp(env, "0")) {
+		return false;
+	}
+	if (strcmp(env, "1")) {
+		WARN("Invalid value \"%s\" for %s, tracefiles are not reused",
+				env, DEFAULT_CONSUMERD_TRACEFILE_REUSE_ENV);
+		return false;
+	}
+	return true;
+}
+
 /*
  * main
  */
 int main(int argc, char **argv)
 {
 	int ret = 0, retval = 0;
+	unsigned int i, nr_data_threads_started = 0, nr_writers_started = 0;
 	void *status;
 	struct lttng_consumer_local_data *tmp_ctx;
 
@@ -416,13 +523,16 @@ int main(int argc, char **argv)
 
 	/* create the consumer instance with and assign the callbacks */
 	ctx = lttng_consumer_create(opt_type, lttng_consumer_read_subbuffer,
-		NULL, lttng_consumer_on_recv_stream, NULL);
+		NULL, lttng_consumer_on_recv_stream, NULL,
+		get_nr_data_threads(), get_nr_writers());
 	if (!ctx) {
 		retval = -1;
 		goto exit_init_data;
 	}
 
 	lttng_consumer_set_command_sock_path(ctx, command_sock_path);
+	lttng_consumer_set_tracefile_reuse(get_tracefile_reuse());
+	lttng_consumer_set_drain_budget(get_drain_budget());
 	if (*error_sock_path == '\0') {
 		switch (opt_type) {
 		case LTTNG_CONSUMER_KERNEL:
@@ -472,10 +582,10 @@ int main(int argc, char **argv)
 	lttng_consumer_set_error_sock(ctx, ret);
 
 	/*
-	 * Block RT signals used for UST periodical metadata flush and the live
-	 * timer in main, and create a dedicated thread to handle these signals.
+	 * Set up the timer wheel servicing the UST periodical metadata flush,
+	 * live and monitoring timers of the channels from a dedicated thread.
 	 */
-	if (consumer_signal_init()) {
+	if (consumer_timer_init()) {
 		retval = -1;
 		goto exit_init_data;
 	}
@@ -528,14 +638,34 @@ int main(int argc, char **argv)
 		goto exit_metadata_thread;
 	}
 
-	/* Create thread to manage the polling/writing of trace data */
-	ret = pthread_create(&data_thread, default_pthread_attr(),
-			consumer_thread_data_poll, (void *) ctx);
-	if (ret) {
-		errno = ret;
-		PERROR("pthread_create");
-		retval = -1;
-		goto exit_data_thread;
+	/* Create threads to write the sub-buffers handed by the data threads */
+	DBG("Starting %u writer thread(s)", ctx->nr_writers);
+	for (i = 0; i < ctx->nr_writers; i++) {
+		ret = pthread_create(&ctx->writers[i].thread,
+				default_pthread_attr(), consumer_thread_writer,
+				(void *) &ctx->writers[i]);
+		if (ret) {
+			errno = ret;
+			PERROR("pthread_create");
+			retval = -1;
+			goto exit_writer_thread;
+		}
+		nr_writers_started++;
+	}
+
+	/* Create threads to manage the polling/writing of trace data */
+	DBG("Starting %u data thread(s)", ctx->nr_data_threads);
+	for (i = 0; i < ctx->nr_data_threads; i++) {
+		ret = pthread_create(&ctx->data_threads[i].thread,
+				default_pthread_attr(), consumer_thread_data_poll,
+				(void *) &ctx->data_threads[i]);
+		if (ret) {
+			errno = ret;
+			PERROR("pthread_create");
+			retval = -1;
+			goto exit_data_thread;
+		}
+		nr_data_threads_started++;
 	}
 
 	/* Create the thread to manage the reception of fds */
@@ -593,13 +723,27 @@ exit_metadata_timer_thread:
 	}
 exit_sessiond_thread:
 
-	ret = pthread_join(data_thread, &status);
-	if (ret) {
-		errno = ret;
-		PERROR("pthread_join data_thread");
-		retval = -1;
-	}
 exit_data_thread:
+	for (i = 0; i < nr_data_threads_started; i++) {
+		ret = pthread_join(ctx->data_threads[i].thread, &status);
+		if (ret) {
+			errno = ret;
+			PERROR("pthread_join data_thread");
+			retval = -1;
+		}
+	}
+
+exit_writer_thread:
+	/* No stream is handed to the writer threads once the data threads exited. */
+	consumer_stop_writers(ctx);
+	for (i = 0; i < nr_writers_started; i++) {
+		ret = pthread_join(ctx->writers[i].thread, &status);
+		if (ret) {
+			errno = ret;
+			PERROR("pthread_join writer_thread");
+			retval = -1;
+		}
+	}
 
 	ret = pthread_join(metadata_thread, &status);
 	if (ret) {
@@ -79,6 +79,11 @@ struct relay_connection *connection_create(struct lttcomm_sock *sock,
 	urcu_ref_init(&conn->ref);
 	conn->type = type;
 	conn->sock = sock;
+	if (type == RELAY_DATA) {
+		conn->data_state.id = DATA_CONNECTION_STATE_RECEIVE_HEADER;
+		conn->data_state.left_to_receive =
+				sizeof(struct lttcomm_relayd_data_hdr);
+	}
 	lttng_ht_node_init_ulong(&conn->sock_n, (unsigned long) conn->sock->fd);
 end:
 	return conn;
@@ -90,6 +95,7 @@ static void rcu_free_connection(struct rcu_head *head)
 		caa_container_of(head, struct relay_connection, rcu_node);
 
 	lttcomm_destroy_sock(conn->sock);
+	lttng_dynamic_buffer_reset(&conn->data_state.bundle);
 	if (conn->viewer_session) {
 		viewer_session_destroy(conn->viewer_session);
 		conn->viewer_session = NULL;
@@ -108,12 +114,7 @@ static void connection_release(struct urcu_ref *ref)
 		caa_container_of(ref, struct relay_connection, ref);
 
 	if (conn->in_socket_ht) {
-		struct lttng_ht_iter iter;
-		int ret;
-
-		iter.iter.node = &conn->sock_n.node;
-		ret = lttng_ht_del(conn->socket_ht, &iter);
-		assert(!ret);
+		connection_ht_del(conn);
 	}
 
 	if (conn->session) {
@@ -145,3 +146,16 @@ void connection_ht_add(struct lttng_ht *relay_connections_ht,
 	conn->in_socket_ht = 1;
 	conn->socket_ht = relay_connections_ht;
 }
+
+void connection_ht_del(struct relay_connection *conn)
+{
+	struct lttng_ht_iter iter;
+	int ret;
+
+	assert(conn->in_socket_ht);
+	iter.iter.node = &conn->sock_n.node;
+	ret = lttng_ht_del(conn->socket_ht, &iter);
+	assert(!ret);
+	conn->in_socket_ht = 0;
+	conn->socket_ht = NULL;
+}
@@ -28,10 +28,15 @@
 #include <urcu/list.h>
 
 #include <common/hashtable/hashtable.h>
+#include <common/dynamic-buffer.h>
 #include <common/sessiond-comm/sessiond-comm.h>
+#include <common/sessiond-comm/relayd.h>
 
 #include "session.h"
 
+struct relay_worker;
+struct relay_write_item;
+
 enum connection_type {
 	RELAY_CONNECTION_UNKNOWN    = 0,
 	RELAY_DATA                  = 1,
@@ -40,6 +45,58 @@ enum connection_type {
 	RELAY_VIEWER_NOTIFICATION   = 4,
 };
 
+enum data_connection_state_id {
+	DATA_CONNECTION_STATE_RECEIVE_HEADER = 0,
+	DATA_CONNECTION_STATE_RECEIVE_PAYLOAD = 1,
+	DATA_CONNECTION_STATE_RECEIVE_BUNDLE = 2,
+};
+
+/*
+ * Reception state of a data connection. Data connections are read without
+ * blocking, so a packet can be received over many poll events.
+ */
+struct data_connection_state {
+	enum data_connection_state_id id;
+	/* Bytes received and left to receive in the current state. */
+	uint64_t received;
+	uint64_t left_to_receive;
+	/*
+	 * Header being received, in network byte order, or header of the
+	 * payload being received, in host byte order.
+	 */
+	struct lttcomm_relayd_data_hdr header;
+	/* The packet is the first of a new trace file. */
+	bool rotate_index;
+	/* Bundle of packets being received, see RELAYD_DATA_BUNDLE_SEQ_NUM. */
+	struct lttng_dynamic_buffer bundle;
+	/* Session of the stream of the payload being received. */
+	uint64_t session_id;
+	/*
+	 * With writer threads, payload being received in place of the
+	 * writes above. NULL until write memory is reserved for it.
+	 */
+	struct relay_write_item *write_item;
+	/* The connection is not polled until write memory is released. */
+	bool waiting_write_memory;
+	/* A writer thread failed to write data received on the connection. */
+	int write_error;
+};
+
+/*
+ * LTTNG_VIEWER_GET_NEXT_INDEXES request of a viewer connection waiting for
+ * an index to be published. Only accessed by the live worker handling the
+ * connection.
+ */
+struct viewer_index_wait {
+	bool pending;
+	/* Session the viewer waits on, a reference is held while pending. */
+	struct relay_session *session;
+	/* CLOCK_MONOTONIC deadline of the request, in nanoseconds. */
+	uint64_t deadline;
+	/* Member of the live worker's list of pending waits. */
+	struct cds_list_head node;
+};
+
 /*
  * Internal structure to map a socket with the corresponding session.
  * A hashtable indexed on the socket FD is used for the lookups.
@@ -49,7 +106,10 @@ enum connection_type {
  * from the live worker thread.
  *
  * The connections between the consumerd/sessiond and the relayd are only
- * handled by the "main" worker thread (as in, the worker thread in main.c).
+ * handled by one of the "main" worker threads (as in, the worker threads in
+ * main.c) at a time. A data connection can be handed off to the worker of
+ * its session between two packets, after which it is only accessed by that
+ * worker.
  *
  * This is why there are no back references to connections from the
  * sessions and session list.
@@ -81,6 +141,31 @@ struct relay_connection {
 
 	bool version_check_done;
 
+	/*
+	 * RELAYD_CAPABILITY_* (RELAY_CONTROL connection type) or
+	 * LTTNG_VIEWER_CAPABILITY_* (RELAY_VIEWER_COMMAND connection type)
+	 * negotiated with the peer during the version check.
+	 */
+	uint32_t capabilities;
+
+	/*
+	 * Indexes received and not acknowledged yet. Only used for
+	 * RELAY_CONTROL connections using pipelined indexes.
+	 */
+	uint32_t indexes_unacked;
+
+	/*
+	 * Worker thread handling the connection. Only valid for
+	 * RELAY_CONTROL and RELAY_DATA connection types.
+	 */
+	struct relay_worker *worker;
+
+	/* Only used for RELAY_DATA connection type. */
+	struct data_connection_state data_state;
+
+	/* Only used for RELAY_VIEWER_COMMAND connection type. */
+	struct viewer_index_wait index_wait;
+
 	/*
 	 * Node member of connection within global socket hash table.
 	 */
@@ -98,5 +183,6 @@ bool connection_get(struct relay_connection *connection);
 void connection_put(struct relay_connection *connection);
 void connection_ht_add(struct lttng_ht *relay_connections_ht,
 		struct relay_connection *conn);
+void connection_ht_del(struct relay_connection *conn);
 
 #endif /* _CONNECTION_H */
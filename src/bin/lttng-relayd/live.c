@@ -29,6 +29,7 @@
 #include <sys/mman.h>
 #include <sys/mount.h>
 #include <sys/resource.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -45,12 +46,15 @@
 #include <common/compat/poll.h>
 #include <common/compat/socket.h>
 #include <common/compat/endian.h>
+#include <common/compat/time.h>
 #include <common/defaults.h>
+#include <common/dynamic-buffer.h>
 #include <common/futex.h>
 #include <common/index/index.h>
 #include <common/sessiond-comm/sessiond-comm.h>
 #include <common/sessiond-comm/inet.h>
 #include <common/sessiond-comm/relayd.h>
+#include <common/time.h>
 #include <common/uri.h>
 #include <common/utils.h>
 
@@ -72,17 +76,43 @@
 static struct lttng_uri *live_uri;
 
 /*
- * This pipe is used to inform the worker thread that a command is queued and
- * ready to be processed.
+ * Live worker thread. The viewer connections are distributed across the live
+ * workers by the dispatcher and stay on the same worker for their whole
+ * lifetime.
  */
-static int live_conn_pipe[2] = { -1, -1 };
+struct live_worker {
+	unsigned int index;
+	pthread_t thread;
+	/*
+	 * This pipe is used to inform the worker thread that a connection is
+	 * queued and ready to be processed.
+	 */
+	int conn_pipe[2];
+	/* Number of viewer connections handled by the worker. */
+	unsigned long nr_connections;
+	/*
+	 * This pipe is used to wake up the worker thread when an index is
+	 * published while some of its connections wait for one. At most one
+	 * wakeup byte is in flight, as tracked by wakeup_pending.
+	 */
+	int wake_pipe[2];
+	int wakeup_pending;
+	/* Number of connections of the worker waiting for an index. */
+	unsigned long nr_index_waiters;
+	/*
+	 * Connections with a pending LTTNG_VIEWER_GET_NEXT_INDEXES request.
+	 * Only accessed by the worker thread.
+	 */
+	struct cds_list_head index_waits;
+};
 
 /* Shared between threads */
 static int live_dispatch_thread_exit;
 
 static pthread_t live_listener_thread;
 static pthread_t live_dispatcher_thread;
-static pthread_t live_worker_thread;
+static struct live_worker *live_workers;
+static unsigned int nr_live_workers;
 
 /*
  * Relay command queue.
@@ -102,8 +132,18 @@ static pthread_mutex_t last_relay_viewer_session_id_lock =
 static
 void cleanup_relayd_live(void)
 {
+	unsigned int i;
+
 	DBG("Cleaning up");
 
+	if (live_workers) {
+		for (i = 0; i < nr_live_workers; i++) {
+			utils_close_pipe(live_workers[i].conn_pipe);
+			utils_close_pipe(live_workers[i].wake_pipe);
+		}
+		free(live_workers);
+		live_workers = NULL;
+	}
 	free(live_uri);
 }
 
@@ -633,6 +673,26 @@ error_sock_control:
 	return NULL;
 }
 
+/*
+ * Select the live worker thread handling the fewest viewer connections.
+ */
+static
+struct live_worker *live_worker_select(void)
+{
+	unsigned int i;
+	struct live_worker *selected = &live_workers[0];
+
+	for (i = 1; i < nr_live_workers; i++) {
+		struct live_worker *worker = &live_workers[i];
+
+		if (uatomic_read(&worker->nr_connections) <
+				uatomic_read(&selected->nr_connections)) {
+			selected = worker;
+		}
+	}
+	return selected;
+}
+
 /*
  * This thread manages the dispatching of the requests to worker threads
  */
@@ -643,6 +703,7 @@ void *thread_dispatcher(void *data)
 	ssize_t ret;
 	struct cds_wfcq_node *node;
 	struct relay_connection *conn = NULL;
+	struct live_worker *worker;
 
 	DBG("[thread] Live viewer relay dispatcher started");
 
@@ -677,8 +738,10 @@ void *thread_dispatcher(void *data)
 				break;
 			}
 			conn = caa_container_of(node, struct relay_connection, qnode);
-			DBG("Dispatching viewer request waiting on sock %d",
-					conn->sock->fd);
+			worker = live_worker_select();
+			uatomic_inc(&worker->nr_connections);
+			DBG("Dispatching viewer request waiting on sock %d to live worker %u",
+					conn->sock->fd, worker->index);
 
 			/*
 			 * Inform worker thread of the new request. This
@@ -686,9 +749,10 @@ void *thread_dispatcher(void *data)
 			 * the data will be read at some point in time
 			 * or wait to the end of the world :)
 			 */
-			ret = lttng_write(live_conn_pipe[1], &conn, sizeof(conn));
+			ret = lttng_write(worker->conn_pipe[1], &conn, sizeof(conn));
 			if (ret < 0) {
 				PERROR("write conn pipe");
+				uatomic_dec(&worker->nr_connections);
 				connection_put(conn);
 				goto error;
 			}
@@ -718,12 +782,15 @@ error_testpoint:
 }
 
 /*
- * Establish connection with the viewer and check the versions.
+ * Establish connection with the viewer and check the versions. The protocol
+ * extensions supported by the relay daemon are advertised in the reply when
+ * the viewer asks for them through the command version.
  *
  * Return 0 on success or else negative value.
  */
 static
-int viewer_connect(struct relay_connection *conn)
+int viewer_connect(struct lttng_viewer_cmd *recv_hdr,
+		struct relay_connection *conn)
 {
 	int ret;
 	struct lttng_viewer_connect reply, msg;
@@ -771,6 +838,13 @@ int viewer_connect(struct relay_connection *conn)
 		goto end;
 	}
 
+	if (be32toh(recv_hdr->cmd_version) ==
+			LTTNG_VIEWER_CONNECT_CMD_CAPABILITIES) {
+		conn->capabilities = LTTNG_VIEWER_CAPABILITIES_ALL;
+		reply.minor |= conn->capabilities <<
+				LTTNG_VIEWER_CAPABILITIES_SHIFT;
+	}
+
 	reply.major = htobe32(reply.major);
 	reply.minor = htobe32(reply.minor);
 	if (conn->type == RELAY_VIEWER_COMMAND) {
@@ -794,7 +868,8 @@ int viewer_connect(struct relay_connection *conn)
 
 	health_code_update();
 
-	DBG("Version check done using protocol %u.%u", conn->major, conn->minor);
+	DBG("Version check done using protocol %u.%u (capabilities 0x%x)",
+			conn->major, conn->minor, conn->capabilities);
 	ret = 0;
 
 end:
@@ -1268,50 +1343,22 @@ index_ready:
 }
 
 /*
- * Send the next index for a stream.
+ * Fill viewer_index with the next index of a viewer stream, or with a status
+ * telling why none can be sent. The index is consumed, that is the following
+ * call returns the next one, only when the status is LTTNG_VIEWER_INDEX_OK.
+ *
+ * viewer_index is filled in network byte order, except for its flags which
+ * are left to the caller.
  *
  * Return 0 on success or else a negative value.
  */
 static
-int viewer_get_next_index(struct relay_connection *conn)
+int viewer_stream_get_next_index(struct relay_viewer_stream *vstream,
+		struct lttng_viewer_index *viewer_index)
 {
 	int ret;
-	struct lttng_viewer_get_next_index request_index;
-	struct lttng_viewer_index viewer_index;
 	struct ctf_packet_index packet_index;
-	struct relay_viewer_stream *vstream = NULL;
-	struct relay_stream *rstream = NULL;
-	struct ctf_trace *ctf_trace = NULL;
-	struct relay_viewer_stream *metadata_viewer_stream = NULL;
-
-	assert(conn);
-
-	DBG("Viewer get next index");
-
-	memset(&viewer_index, 0, sizeof(viewer_index));
-	health_code_update();
-
-	ret = recv_request(conn->sock, &request_index, sizeof(request_index));
-	if (ret < 0) {
-		goto end;
-	}
-	health_code_update();
-
-	vstream = viewer_stream_get_by_id(be64toh(request_index.stream_id));
-	if (!vstream) {
-		DBG("Client requested index of unknown stream id %" PRIu64,
-				be64toh(request_index.stream_id));
-		viewer_index.status = htobe32(LTTNG_VIEWER_INDEX_ERR);
-		goto send_reply;
-	}
-
-	/* Use back. ref. Protected by refcounts. */
-	rstream = vstream->stream;
-	ctf_trace = rstream->trace;
-
-	/* metadata_viewer_stream may be NULL. */
-	metadata_viewer_stream =
-			ctf_trace_get_viewer_metadata_stream(ctf_trace);
+	struct relay_stream *rstream = vstream->stream;
 
 	pthread_mutex_lock(&rstream->lock);
 
@@ -1319,8 +1366,9 @@ int viewer_get_next_index(struct relay_connection *conn)
 	 * The viewer should not ask for index on metadata stream.
 	 */
 	if (rstream->is_metadata) {
-		viewer_index.status = htobe32(LTTNG_VIEWER_INDEX_HUP);
-		goto send_reply;
+		viewer_index->status = htobe32(LTTNG_VIEWER_INDEX_HUP);
+		ret = 0;
+		goto end_unlock;
 	}
 
 	/* Try to open an index if one is needed for that stream. */
@@ -1332,23 +1380,25 @@ int viewer_get_next_index(struct relay_connection *conn)
 			 * packet arrives, it might not be ready at the
 			 * beginning of the session
 			 */
-			viewer_index.status = htobe32(LTTNG_VIEWER_INDEX_RETRY);
+			viewer_index->status = htobe32(LTTNG_VIEWER_INDEX_RETRY);
 		} else {
 			/* Unhandled error. */
-			viewer_index.status = htobe32(LTTNG_VIEWER_INDEX_ERR);
+			viewer_index->status = htobe32(LTTNG_VIEWER_INDEX_ERR);
 		}
-		goto send_reply;
+		ret = 0;
+		goto end_unlock;
 	}
 
-	ret = check_index_status(vstream, rstream, ctf_trace, &viewer_index);
+	ret = check_index_status(vstream, rstream, rstream->trace, viewer_index);
 	if (ret < 0) {
-		goto error_put;
+		goto end_unlock;
 	} else if (ret == 1) {
 		/*
 		 * We have no index to send and check_index_status has populated
 		 * viewer_index's status.
 		 */
-		goto send_reply;
+		ret = 0;
+		goto end_unlock;
 	}
 	/* At this point, ret is 0 thus we will be able to read the index. */
 	assert(!ret);
@@ -1374,40 +1424,33 @@ int viewer_get_next_index(struct relay_connection *conn)
 					vstream->channel_name);
 		}
 		if (ret < 0) {
-			goto error_put;
+			goto end_unlock;
 		}
 		ret = open(fullpath, O_RDONLY);
 		if (ret < 0) {
 			PERROR("Relay opening trace file");
-			goto error_put;
+			goto end_unlock;
 		}
 		vstream->stream_fd = stream_fd_create(ret);
 		if (!vstream->stream_fd) {
 			if (close(ret)) {
 				PERROR("close");
 			}
-			goto error_put;
+			ret = -1;
+			goto end_unlock;
 		}
 	}
 
-	ret = check_new_streams(conn);
-	if (ret < 0) {
-		viewer_index.status = htobe32(LTTNG_VIEWER_INDEX_ERR);
-		goto send_reply;
-	} else if (ret == 1) {
-		viewer_index.flags |= LTTNG_VIEWER_FLAG_NEW_STREAM;
-	}
-
 	ret = lttng_index_file_read(vstream->index_file, &packet_index);
 	if (ret) {
 		ERR("Relay error reading index file %d",
 				vstream->index_file->fd);
-		viewer_index.status = htobe32(LTTNG_VIEWER_INDEX_ERR);
-		goto send_reply;
-	} else {
-		viewer_index.status = htobe32(LTTNG_VIEWER_INDEX_OK);
-		vstream->index_sent_seqcount++;
+		viewer_index->status = htobe32(LTTNG_VIEWER_INDEX_ERR);
+		ret = 0;
+		goto end_unlock;
 	}
+	viewer_index->status = htobe32(LTTNG_VIEWER_INDEX_OK);
+	vstream->index_sent_seqcount++;
 
 	/*
 	 * Indexes are stored in big endian, no need to switch before sending.
@@ -1415,31 +1458,97 @@ int viewer_get_next_index(struct relay_connection *conn)
 	DBG("Sending viewer index for stream %" PRIu64 " offset %" PRIu64,
 		rstream->stream_handle,
 		be64toh(packet_index.offset));
-	viewer_index.offset = packet_index.offset;
-	viewer_index.packet_size = packet_index.packet_size;
-	viewer_index.content_size = packet_index.content_size;
-	viewer_index.timestamp_begin = packet_index.timestamp_begin;
-	viewer_index.timestamp_end = packet_index.timestamp_end;
-	viewer_index.events_discarded = packet_index.events_discarded;
-	viewer_index.stream_id = packet_index.stream_id;
+	viewer_index->offset = packet_index.offset;
+	viewer_index->packet_size = packet_index.packet_size;
+	viewer_index->content_size = packet_index.content_size;
+	viewer_index->timestamp_begin = packet_index.timestamp_begin;
+	viewer_index->timestamp_end = packet_index.timestamp_end;
+	viewer_index->events_discarded = packet_index.events_discarded;
+	viewer_index->stream_id = packet_index.stream_id;
 
-send_reply:
-	if (rstream) {
-		pthread_mutex_unlock(&rstream->lock);
+end_unlock:
+	pthread_mutex_unlock(&rstream->lock);
+	return ret;
+}
+
+/*
+ * Return true if the trace of the given metadata viewer stream has metadata
+ * that was not sent to the viewer yet.
+ */
+static
+bool viewer_metadata_pending(struct relay_viewer_stream *metadata_viewer_stream)
+{
+	bool pending;
+
+	pthread_mutex_lock(&metadata_viewer_stream->stream->lock);
+	DBG("get next index metadata check: recv %" PRIu64
+			" sent %" PRIu64,
+		metadata_viewer_stream->stream->metadata_received,
+		metadata_viewer_stream->metadata_sent);
+	pending = !metadata_viewer_stream->stream->metadata_received ||
+			metadata_viewer_stream->stream->metadata_received >
+				metadata_viewer_stream->metadata_sent;
+	pthread_mutex_unlock(&metadata_viewer_stream->stream->lock);
+	return pending;
+}
+
+/*
+ * Send the next index for a stream.
+ *
+ * Return 0 on success or else a negative value.
+ */
+static
+int viewer_get_next_index(struct relay_connection *conn)
+{
+	int ret;
+	struct lttng_viewer_get_next_index request_index;
+	struct lttng_viewer_index viewer_index;
+	struct relay_viewer_stream *vstream = NULL;
+	struct relay_viewer_stream *metadata_viewer_stream = NULL;
+
+	assert(conn);
+
+	DBG("Viewer get next index");
+
+	memset(&viewer_index, 0, sizeof(viewer_index));
+	health_code_update();
+
+	ret = recv_request(conn->sock, &request_index, sizeof(request_index));
+	if (ret < 0) {
+		goto end;
 	}
+	health_code_update();
 
-	if (metadata_viewer_stream) {
-		pthread_mutex_lock(&metadata_viewer_stream->stream->lock);
-		DBG("get next index metadata check: recv %" PRIu64
-				" sent %" PRIu64,
-			metadata_viewer_stream->stream->metadata_received,
-			metadata_viewer_stream->metadata_sent);
-		if (!metadata_viewer_stream->stream->metadata_received ||
-				metadata_viewer_stream->stream->metadata_received >
-					metadata_viewer_stream->metadata_sent) {
-			viewer_index.flags |= LTTNG_VIEWER_FLAG_NEW_METADATA;
+	vstream = viewer_stream_get_by_id(be64toh(request_index.stream_id));
+	if (!vstream) {
+		DBG("Client requested index of unknown stream id %" PRIu64,
+				be64toh(request_index.stream_id));
+		viewer_index.status = htobe32(LTTNG_VIEWER_INDEX_ERR);
+		goto send_reply;
+	}
+
+	/* metadata_viewer_stream may be NULL. */
+	metadata_viewer_stream =
+			ctf_trace_get_viewer_metadata_stream(vstream->stream->trace);
+
+	ret = viewer_stream_get_next_index(vstream, &viewer_index);
+	if (ret < 0) {
+		goto end;
+	}
+
+	if (viewer_index.status == htobe32(LTTNG_VIEWER_INDEX_OK)) {
+		ret = check_new_streams(conn);
+		if (ret < 0) {
+			viewer_index.status = htobe32(LTTNG_VIEWER_INDEX_ERR);
+		} else if (ret == 1) {
+			viewer_index.flags |= LTTNG_VIEWER_FLAG_NEW_STREAM;
 		}
-		pthread_mutex_unlock(&metadata_viewer_stream->stream->lock);
+	}
+
+send_reply:
+	if (metadata_viewer_stream &&
+			viewer_metadata_pending(metadata_viewer_stream)) {
+		viewer_index.flags |= LTTNG_VIEWER_FLAG_NEW_METADATA;
 	}
 
 	viewer_index.flags = htobe32(viewer_index.flags);
@@ -1464,13 +1573,386 @@ end:
 		viewer_stream_put(vstream);
 	}
 	return ret;
+}
 
-error_put:
-	pthread_mutex_unlock(&rstream->lock);
-	if (metadata_viewer_stream) {
-		viewer_stream_put(metadata_viewer_stream);
+static
+uint64_t get_monotonic_time_ns(void)
+{
+	struct timespec ts;
+
+	if (lttng_clock_gettime(CLOCK_MONOTONIC, &ts)) {
+		PERROR("clock_gettime");
+		return 0;
 	}
-	viewer_stream_put(vstream);
+	return (uint64_t) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ * Append the next index of every data stream of the session known to the
+ * viewer to reply, as struct lttng_viewer_stream_index. Streams without an
+ * index available are skipped. The LTTNG_VIEWER_FLAG_NEW_METADATA flag is
+ * set in flags if any trace of the session has new metadata.
+ *
+ * Return the number of indexes appended which are not inactive stream
+ * beacons, or a negative value on error. nr_streams is set to the number
+ * of data streams inspected.
+ */
+static
+int collect_next_indexes(struct relay_session *session,
+		struct lttng_dynamic_buffer *reply, uint32_t *nr_streams,
+		uint32_t *flags)
+{
+	int ret, nr_ready = 0;
+	struct lttng_ht_iter iter;
+	struct ctf_trace *ctf_trace;
+
+	*nr_streams = 0;
+
+	rcu_read_lock();
+	cds_lfht_for_each_entry(session->ctf_traces_ht->ht, &iter.iter,
+			ctf_trace, node.node) {
+		struct relay_stream *stream;
+		struct relay_viewer_stream *metadata_viewer_stream;
+
+		health_code_update();
+
+		if (!ctf_trace_get(ctf_trace)) {
+			continue;
+		}
+
+		cds_list_for_each_entry_rcu(stream, &ctf_trace->stream_list,
+				stream_node) {
+			struct relay_viewer_stream *vstream;
+			struct lttng_viewer_stream_index entry;
+			uint32_t status;
+			bool sent;
+
+			if (stream->is_metadata) {
+				continue;
+			}
+			vstream = viewer_stream_get_by_id(stream->stream_handle);
+			if (!vstream) {
+				continue;
+			}
+			pthread_mutex_lock(&stream->lock);
+			sent = vstream->sent_flag;
+			pthread_mutex_unlock(&stream->lock);
+			if (!sent) {
+				/* The viewer does not know about this stream yet. */
+				viewer_stream_put(vstream);
+				continue;
+			}
+			(*nr_streams)++;
+
+			memset(&entry, 0, sizeof(entry));
+			ret = viewer_stream_get_next_index(vstream, &entry.index);
+			if (ret < 0) {
+				viewer_stream_put(vstream);
+				ctf_trace_put(ctf_trace);
+				goto end;
+			}
+			status = be32toh(entry.index.status);
+			if (status == LTTNG_VIEWER_INDEX_RETRY) {
+				viewer_stream_put(vstream);
+				continue;
+			}
+			if (status != LTTNG_VIEWER_INDEX_INACTIVE) {
+				nr_ready++;
+			}
+			entry.viewer_stream_id = htobe64(stream->stream_handle);
+			ret = lttng_dynamic_buffer_append(reply, &entry,
+					sizeof(entry));
+			viewer_stream_put(vstream);
+			if (ret) {
+				ctf_trace_put(ctf_trace);
+				goto end;
+			}
+		}
+
+		metadata_viewer_stream =
+				ctf_trace_get_viewer_metadata_stream(ctf_trace);
+		if (metadata_viewer_stream) {
+			if (viewer_metadata_pending(metadata_viewer_stream)) {
+				*flags |= LTTNG_VIEWER_FLAG_NEW_METADATA;
+			}
+			viewer_stream_put(metadata_viewer_stream);
+		}
+		ctf_trace_put(ctf_trace);
+	}
+	ret = nr_ready;
+end:
+	rcu_read_unlock();
+	return ret;
+}
+
+/*
+ * Start waiting for the indexes of a session on behalf of a viewer
+ * connection. The reference on the session is owned by the wait.
+ *
+ * The waiter counts are raised before the indexes are first looked at, so
+ * an index published concurrently either is seen by the worker or wakes
+ * it up.
+ */
+static
+void index_wait_begin(struct live_worker *worker,
+		struct relay_connection *conn, struct relay_session *session,
+		uint32_t timeout_ms)
+{
+	struct viewer_index_wait *wait = &conn->index_wait;
+
+	assert(!wait->pending);
+	wait->pending = true;
+	wait->session = session;
+	wait->deadline = get_monotonic_time_ns() +
+			(uint64_t) timeout_ms * NSEC_PER_MSEC;
+	cds_list_add_tail(&wait->node, &worker->index_waits);
+	uatomic_inc(&session->nr_index_waiters);
+	uatomic_inc(&worker->nr_index_waiters);
+	cmm_smp_mb();
+}
+
+static
+void index_wait_end(struct live_worker *worker, struct relay_connection *conn)
+{
+	struct viewer_index_wait *wait = &conn->index_wait;
+
+	if (!wait->pending) {
+		return;
+	}
+	cds_list_del(&wait->node);
+	uatomic_dec(&wait->session->nr_index_waiters);
+	uatomic_dec(&worker->nr_index_waiters);
+	session_put(wait->session);
+	wait->session = NULL;
+	wait->pending = false;
+}
+
+/*
+ * Reply to the pending LTTNG_VIEWER_GET_NEXT_INDEXES request of a connection
+ * if an index is ready, if the session is gone or if the deadline has
+ * passed. The request stays pending otherwise.
+ *
+ * Return 0 on success or else a negative value.
+ */
+static
+int index_wait_try_complete(struct live_worker *worker,
+		struct relay_connection *conn, uint64_t now)
+{
+	int ret;
+	uint32_t nr_streams, flags = 0, status;
+	bool closed;
+	struct lttng_dynamic_buffer reply;
+	struct lttng_viewer_indexes *reply_hdr;
+	struct viewer_index_wait *wait = &conn->index_wait;
+
+	lttng_dynamic_buffer_init(&reply);
+	ret = lttng_dynamic_buffer_set_size(&reply, sizeof(*reply_hdr));
+	if (ret) {
+		goto end;
+	}
+
+	ret = collect_next_indexes(wait->session, &reply, &nr_streams, &flags);
+	if (ret < 0) {
+		goto end;
+	}
+	pthread_mutex_lock(&wait->session->lock);
+	closed = wait->session->connection_closed;
+	pthread_mutex_unlock(&wait->session->lock);
+
+	if (ret > 0) {
+		status = LTTNG_VIEWER_INDEXES_OK;
+	} else if (!nr_streams && closed) {
+		status = LTTNG_VIEWER_INDEXES_HUP;
+	} else if (now >= wait->deadline) {
+		status = LTTNG_VIEWER_INDEXES_TIMEOUT;
+	} else {
+		/* Nothing to report yet, keep waiting. */
+		ret = 0;
+		goto end;
+	}
+
+	ret = check_new_streams(conn);
+	if (ret < 0) {
+		goto end;
+	} else if (ret == 1) {
+		flags |= LTTNG_VIEWER_FLAG_NEW_STREAM;
+	}
+
+	reply_hdr = (struct lttng_viewer_indexes *) reply.data;
+	memset(reply_hdr, 0, sizeof(*reply_hdr));
+	reply_hdr->status = htobe32(status);
+	reply_hdr->flags = htobe32(flags);
+	reply_hdr->indexes_count = htobe32((reply.size - sizeof(*reply_hdr)) /
+			sizeof(struct lttng_viewer_stream_index));
+	index_wait_end(worker, conn);
+
+	health_code_update();
+	ret = send_response(conn->sock, reply.data, reply.size);
+	if (ret < 0) {
+		goto end;
+	}
+	health_code_update();
+	DBG("Sent %" PRIu32 " viewer indexes with status %" PRIu32,
+			be32toh(reply_hdr->indexes_count), status);
+	ret = 0;
+end:
+	lttng_dynamic_buffer_reset(&reply);
+	return ret;
+}
+
+/*
+ * Send the next index of every stream of a session having one ready, waiting
+ * up to the requested timeout for one to be published. The live worker keeps
+ * serving its other connections while the request is pending.
+ *
+ * Return 0 on success or else a negative value.
+ */
+static
+int viewer_get_next_indexes(struct live_worker *worker,
+		struct relay_connection *conn)
+{
+	int ret;
+	struct lttng_viewer_get_next_indexes request;
+	struct lttng_viewer_indexes reply;
+	struct relay_session *session = NULL;
+
+	DBG("Viewer get next indexes");
+
+	if (!(conn->capabilities & LTTNG_VIEWER_CAPABILITY_GET_NEXT_INDEXES)) {
+		ERR("Viewer get next indexes on a connection which did not negotiate it");
+		ret = -1;
+		goto end;
+	}
+
+	health_code_update();
+
+	ret = recv_request(conn->sock, &request, sizeof(request));
+	if (ret < 0) {
+		goto end;
+	}
+	health_code_update();
+
+	session = session_get_by_id(be64toh(request.session_id));
+	if (!session || !viewer_session_is_attached(conn->viewer_session,
+			session)) {
+		DBG("Client requested indexes of unknown or unattached session id %" PRIu64,
+				be64toh(request.session_id));
+		memset(&reply, 0, sizeof(reply));
+		reply.status = htobe32(LTTNG_VIEWER_INDEXES_ERR);
+		ret = send_response(conn->sock, &reply, sizeof(reply));
+		goto end;
+	}
+
+	index_wait_begin(worker, conn, session, be32toh(request.timeout_ms));
+	/* The session reference is now owned by the wait. */
+	session = NULL;
+	ret = index_wait_try_complete(worker, conn, get_monotonic_time_ns());
+end:
+	if (session) {
+		session_put(session);
+	}
+	return ret;
+}
+
+/*
+ * Wake up the live workers with viewers waiting for an index of the given
+ * session. Called when an index of the session is published or when one of
+ * its streams is closed.
+ */
+void relayd_live_notify_index(struct relay_session *session)
+{
+	unsigned int i;
+
+	/* Order the publication of the index before reading the waiters. */
+	cmm_smp_mb();
+	if (!uatomic_read(&session->nr_index_waiters)) {
+		return;
+	}
+
+	for (i = 0; i < nr_live_workers; i++) {
+		struct live_worker *worker = &live_workers[i];
+		ssize_t ret;
+
+		if (!uatomic_read(&worker->nr_index_waiters) ||
+				uatomic_cmpxchg(&worker->wakeup_pending, 0, 1)) {
+			continue;
+		}
+		ret = lttng_write(worker->wake_pipe[1], "!", 1);
+		if (ret < 1) {
+			PERROR("write live worker wake pipe");
+		}
+	}
+}
+
+/*
+ * Send len bytes of the trace file fd, starting at offset, on the viewer
+ * socket. The data is sent with sendfile(2) to avoid copying it through a
+ * user space buffer, falling back to pread(2) and a regular send if the file
+ * does not support it. The file position of fd is left untouched so it can
+ * be used concurrently.
+ *
+ * Return 0 on success else a negative value.
+ */
+static
+int send_packet_data(struct lttcomm_sock *sock, int fd, off_t offset,
+		size_t len)
+{
+	int ret;
+	ssize_t copied;
+	size_t sent = 0;
+	char *data = NULL;
+
+	while (sent < len) {
+		copied = sendfile(sock->fd, fd, &offset, len - sent);
+		if (copied < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (sent == 0 && (errno == EINVAL || errno == ENOSYS)) {
+				goto fallback;
+			}
+			PERROR("sendfile trace file fd %d", fd);
+			ret = -1;
+			goto end;
+		} else if (copied == 0) {
+			ERR("Unexpected end of trace file fd %d at offset %jd",
+					fd, (intmax_t) offset);
+			ret = -1;
+			goto end;
+		}
+		sent += copied;
+	}
+	ret = 0;
+	goto end;
+
+fallback:
+	data = zmalloc(len);
+	if (!data) {
+		PERROR("relay data zmalloc");
+		ret = -1;
+		goto end;
+	}
+	while (sent < len) {
+		copied = pread(fd, data + sent, len - sent, offset + sent);
+		if (copied < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			PERROR("Relay reading trace file, fd: %d", fd);
+			ret = -1;
+			goto end;
+		} else if (copied == 0) {
+			ERR("Unexpected end of trace file fd %d", fd);
+			ret = -1;
+			goto end;
+		}
+		sent += copied;
+	}
+	copied = send_response(sock, data, len);
+	ret = copied < 0 ? -1 : 0;
+
+end:
+	free(data);
 	return ret;
 }
 
@@ -1483,12 +1965,13 @@ static
 int viewer_get_packet(struct relay_connection *conn)
 {
 	int ret, send_data = 0;
-	char *data = NULL;
 	uint32_t len = 0;
-	ssize_t read_len;
+	uint64_t offset;
+	struct stat statbuf;
 	struct lttng_viewer_get_packet get_packet_info;
 	struct lttng_viewer_trace_packet reply;
 	struct relay_viewer_stream *vstream = NULL;
+	struct stream_fd *stream_fd = NULL;
 
 	DBG2("Relay get data packet");
 
@@ -1509,30 +1992,45 @@ int viewer_get_packet(struct relay_connection *conn)
 		DBG("Client requested packet of unknown stream id %" PRIu64,
 				be64toh(get_packet_info.stream_id));
 		reply.status = htobe32(LTTNG_VIEWER_GET_PACKET_ERR);
-		goto send_reply_nolock;
+		goto send_reply;
 	}
 
+	/*
+	 * The stream lock is only held to grab a reference to the trace file of
+	 * the viewer stream, which can be swapped by a tracefile rotation. The
+	 * data is read without it so viewers do not serialize against the
+	 * ingestion of the stream.
+	 */
 	pthread_mutex_lock(&vstream->stream->lock);
-
-	len = be32toh(get_packet_info.len);
-	data = zmalloc(len);
-	if (!data) {
-		PERROR("relay data zmalloc");
+	stream_fd = vstream->stream_fd;
+	if (stream_fd) {
+		stream_fd_get(stream_fd);
+	}
+	pthread_mutex_unlock(&vstream->stream->lock);
+	if (!stream_fd) {
+		DBG("Client requested packet of stream id %" PRIu64
+				" with no trace file opened",
+				be64toh(get_packet_info.stream_id));
 		goto error;
 	}
 
-	ret = lseek(vstream->stream_fd->fd, be64toh(get_packet_info.offset),
-			SEEK_SET);
+	len = be32toh(get_packet_info.len);
+	offset = be64toh(get_packet_info.offset);
+
+	/*
+	 * Validate the requested range before replying since the data can't be
+	 * replaced by an error status once the reply is sent.
+	 */
+	ret = fstat(stream_fd->fd, &statbuf);
 	if (ret < 0) {
-		PERROR("lseek fd %d to offset %" PRIu64, vstream->stream_fd->fd,
-			be64toh(get_packet_info.offset));
+		PERROR("fstat trace file fd %d", stream_fd->fd);
 		goto error;
 	}
-	read_len = lttng_read(vstream->stream_fd->fd, data, len);
-	if (read_len < len) {
-		PERROR("Relay reading trace file, fd: %d, offset: %" PRIu64,
-				vstream->stream_fd->fd,
-				be64toh(get_packet_info.offset));
+	if (offset > (uint64_t) statbuf.st_size ||
+			len > (uint64_t) statbuf.st_size - offset) {
+		ERR("Client requested %" PRIu32 " bytes at offset %" PRIu64
+				" beyond the end of trace file fd %d",
+				len, offset, stream_fd->fd);
 		goto error;
 	}
 	reply.status = htobe32(LTTNG_VIEWER_GET_PACKET_OK);
@@ -1544,25 +2042,21 @@ error:
 	reply.status = htobe32(LTTNG_VIEWER_GET_PACKET_ERR);
 
 send_reply:
-	if (vstream) {
-		pthread_mutex_unlock(&vstream->stream->lock);
-	}
-send_reply_nolock:
 	reply.flags = htobe32(reply.flags);
 
 	health_code_update();
 
 	ret = send_response(conn->sock, &reply, sizeof(reply));
 	if (ret < 0) {
-		goto end_free;
+		goto end;
 	}
 	health_code_update();
 
 	if (send_data) {
 		health_code_update();
-		ret = send_response(conn->sock, data, len);
+		ret = send_packet_data(conn->sock, stream_fd->fd, offset, len);
 		if (ret < 0) {
-			goto end_free;
+			goto end;
 		}
 		health_code_update();
 	}
@@ -1570,9 +2064,10 @@ send_reply_nolock:
 	DBG("Sent %u bytes for stream %" PRIu64, len,
 			be64toh(get_packet_info.stream_id));
 
-end_free:
-	free(data);
 end:
+	if (stream_fd) {
+		stream_fd_put(stream_fd);
+	}
 	if (vstream) {
 		viewer_stream_put(vstream);
 	}
@@ -1844,8 +2339,8 @@ void live_relay_unknown_command(struct relay_connection *conn)
  * Process the commands received on the control socket
  */
 static
-int process_control(struct lttng_viewer_cmd *recv_hdr,
-		struct relay_connection *conn)
+int process_control(struct live_worker *worker,
+		struct lttng_viewer_cmd *recv_hdr, struct relay_connection *conn)
 {
 	int ret = 0;
 	uint32_t msg_value;
@@ -1864,7 +2359,7 @@ int process_control(struct lttng_viewer_cmd *recv_hdr,
 
 	switch (msg_value) {
 	case LTTNG_VIEWER_CONNECT:
-		ret = viewer_connect(conn);
+		ret = viewer_connect(recv_hdr, conn);
 		break;
 	case LTTNG_VIEWER_LIST_SESSIONS:
 		ret = viewer_list_sessions(conn);
@@ -1890,6 +2385,9 @@ int process_control(struct lttng_viewer_cmd *recv_hdr,
 	case LTTNG_VIEWER_DETACH_SESSION:
 		ret = viewer_detach_session(conn);
 		break;
+	case LTTNG_VIEWER_GET_NEXT_INDEXES:
+		ret = viewer_get_next_indexes(worker, conn);
+		break;
 	default:
 		ERR("Received unknown viewer command (%u)",
 				be32toh(recv_hdr->cmd));
@@ -1903,10 +2401,14 @@ end:
 }
 
 static
-void cleanup_connection_pollfd(struct lttng_poll_event *events, int pollfd)
+void cleanup_connection_pollfd(struct live_worker *worker,
+		struct lttng_poll_event *events, struct relay_connection *conn)
 {
 	int ret;
+	int pollfd = conn->sock->fd;
 
+	index_wait_end(worker, conn);
+	uatomic_dec(&worker->nr_connections);
 	(void) lttng_poll_del(events, pollfd);
 
 	ret = close(pollfd);
@@ -1916,20 +2418,77 @@ void cleanup_connection_pollfd(struct lttng_poll_event *events, int pollfd)
 }
 
 /*
- * This thread does the actual work
+ * Complete the pending index waits of a worker which can be, either because
+ * an index was published or because their deadline has passed. Connections
+ * failing to receive their reply are closed.
+ */
+static
+void process_index_waits(struct live_worker *worker,
+		struct lttng_poll_event *events)
+{
+	uint64_t now = get_monotonic_time_ns();
+	struct viewer_index_wait *wait, *tmp;
+
+	cds_list_for_each_entry_safe(wait, tmp, &worker->index_waits, node) {
+		struct relay_connection *conn = caa_container_of(wait,
+				struct relay_connection, index_wait);
+
+		health_code_update();
+
+		if (index_wait_try_complete(worker, conn, now) < 0) {
+			cleanup_connection_pollfd(worker, events, conn);
+			/* Put "create" ownership reference. */
+			connection_put(conn);
+			DBG("Viewer connection closed while waiting for indexes");
+		}
+	}
+}
+
+/*
+ * Return the poll timeout, in milliseconds, after which the earliest pending
+ * index wait of the worker expires, or -1 if none is pending.
+ */
+static
+int index_waits_poll_timeout(struct live_worker *worker)
+{
+	uint64_t now, deadline = UINT64_MAX;
+	struct viewer_index_wait *wait;
+
+	if (cds_list_empty(&worker->index_waits)) {
+		return -1;
+	}
+	cds_list_for_each_entry(wait, &worker->index_waits, node) {
+		if (wait->deadline < deadline) {
+			deadline = wait->deadline;
+		}
+	}
+	now = get_monotonic_time_ns();
+	if (deadline <= now) {
+		return 0;
+	}
+	/* Round up so the wait does not wake up right before the deadline. */
+	return (int) min((deadline - now + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC,
+			(uint64_t) INT_MAX);
+}
+
+/*
+ * This thread does the actual work. Each ready viewer connection gets one
+ * command processed per poll iteration so a viewer pulling large packets does
+ * not starve the other viewers handled by the same worker.
  */
 static
 void *thread_worker(void *data)
 {
 	int ret, err = -1;
 	uint32_t nb_fd;
+	struct live_worker *worker = data;
 	struct lttng_poll_event events;
 	struct lttng_ht *viewer_connections_ht;
 	struct lttng_ht_iter iter;
 	struct lttng_viewer_cmd recv_hdr;
 	struct relay_connection *destroy_conn;
 
-	DBG("[thread] Live viewer relay worker started");
+	DBG("[thread] Live viewer relay worker %u started", worker->index);
 
 	rcu_register_thread();
 
@@ -1950,7 +2509,12 @@ void *thread_worker(void *data)
 		goto error_poll_create;
 	}
 
-	ret = lttng_poll_add(&events, live_conn_pipe[0], LPOLLIN | LPOLLRDHUP);
+	ret = lttng_poll_add(&events, worker->conn_pipe[0], LPOLLIN | LPOLLRDHUP);
+	if (ret < 0) {
+		goto error;
+	}
+
+	ret = lttng_poll_add(&events, worker->wake_pipe[0], LPOLLIN | LPOLLRDHUP);
 	if (ret < 0) {
 		goto error;
 	}
@@ -1958,13 +2522,17 @@ void *thread_worker(void *data)
 restart:
 	while (1) {
 		int i;
+		bool index_published = false;
 
 		health_code_update();
 
-		/* Infinite blocking call, waiting for transmission */
+		/*
+		 * Blocking call, waiting for transmission or for the earliest
+		 * pending index wait to expire.
+		 */
 		DBG3("Relayd live viewer worker thread polling...");
 		health_poll_entry();
-		ret = lttng_poll_wait(&events, -1);
+		ret = lttng_poll_wait(&events, index_waits_poll_timeout(worker));
 		health_poll_exit();
 		if (ret < 0) {
 			/*
@@ -2003,11 +2571,11 @@ restart:
 			}
 
 			/* Inspect the relay conn pipe for new connection. */
-			if (pollfd == live_conn_pipe[0]) {
+			if (pollfd == worker->conn_pipe[0]) {
 				if (revents & LPOLLIN) {
 					struct relay_connection *conn;
 
-					ret = lttng_read(live_conn_pipe[0],
+					ret = lttng_read(worker->conn_pipe[0],
 							&conn, sizeof(conn));
 					if (ret < 0) {
 						goto error;
@@ -2023,6 +2591,24 @@ restart:
 					ERR("Unexpected poll events %u for sock %d", revents, pollfd);
 					goto error;
 				}
+			} else if (pollfd == worker->wake_pipe[0]) {
+				if (revents & LPOLLIN) {
+					char buf[16];
+
+					/*
+					 * Clear the flag before looking at the
+					 * waits so a later publication writes
+					 * a new wakeup byte.
+					 */
+					uatomic_set(&worker->wakeup_pending, 0);
+					cmm_smp_mb();
+					(void) read(worker->wake_pipe[0], buf,
+							sizeof(buf));
+					index_published = true;
+				} else {
+					ERR("Relay live wake pipe error");
+					goto error;
+				}
 			} else {
 				/* Connection activity. */
 				struct relay_connection *conn;
@@ -2032,27 +2618,45 @@ restart:
 					continue;
 				}
 
+				if ((revents & LPOLLIN) && conn->index_wait.pending) {
+					/*
+					 * A new command cancels the pending
+					 * index wait, which is answered first.
+					 */
+					conn->index_wait.deadline = 0;
+					ret = index_wait_try_complete(worker,
+							conn, 0);
+					if (ret < 0) {
+						cleanup_connection_pollfd(worker, &events, conn);
+						/* Put "create" ownership reference. */
+						connection_put(conn);
+						/* Put local "get_by_sock" reference. */
+						connection_put(conn);
+						continue;
+					}
+				}
+
 				if (revents & LPOLLIN) {
 					ret = conn->sock->ops->recvmsg(conn->sock, &recv_hdr,
 							sizeof(recv_hdr), 0);
 					if (ret <= 0) {
 						/* Connection closed. */
-						cleanup_connection_pollfd(&events, pollfd);
+						cleanup_connection_pollfd(worker, &events, conn);
 						/* Put "create" ownership reference. */
 						connection_put(conn);
 						DBG("Viewer control conn closed with %d", pollfd);
 					} else {
-						ret = process_control(&recv_hdr, conn);
+						ret = process_control(worker, &recv_hdr, conn);
 						if (ret < 0) {
 							/* Clear the session on error. */
-							cleanup_connection_pollfd(&events, pollfd);
+							cleanup_connection_pollfd(worker, &events, conn);
 							/* Put "create" ownership reference. */
 							connection_put(conn);
 							DBG("Viewer connection closed with %d", pollfd);
 						}
 					}
 				} else if (revents & (LPOLLERR | LPOLLHUP | LPOLLRDHUP)) {
-					cleanup_connection_pollfd(&events, pollfd);
+					cleanup_connection_pollfd(worker, &events, conn);
 					/* Put "create" ownership reference. */
 					connection_put(conn);
 				} else {
@@ -2064,6 +2668,10 @@ restart:
 				connection_put(conn);
 			}
 		}
+
+		if (index_published || index_waits_poll_timeout(worker) == 0) {
+			process_index_waits(worker, &events);
+		}
 	}
 
 exit:
@@ -2076,14 +2684,13 @@ error:
 			destroy_conn,
 			sock_n.node) {
 		health_code_update();
+		index_wait_end(worker, destroy_conn);
 		connection_put(destroy_conn);
 	}
 	rcu_read_unlock();
 error_poll_create:
 	lttng_ht_destroy(viewer_connections_ht);
 viewer_connections_ht_error:
-	/* Close relay conn pipes */
-	utils_close_pipe(live_conn_pipe);
 	if (err) {
 		DBG("Viewer worker thread exited with error");
 	}
@@ -2102,12 +2709,73 @@ error_testpoint:
 }
 
 /*
- * Create the relay command pipe to wake thread_manage_apps.
- * Closed in cleanup().
+ * Allocate the live worker threads state and create the pipes used to hand
+ * them connections. The pipes are closed in cleanup_relayd_live().
+ *
+ * Return 0 on success else a negative value.
  */
-static int create_conn_pipe(void)
+static
+int init_live_workers(unsigned int nr_workers)
 {
-	return utils_create_pipe_cloexec(live_conn_pipe);
+	int ret = 0;
+	unsigned int i;
+
+	if (!nr_workers) {
+		long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		nr_workers = nr_cpus > 0 ? (unsigned int) nr_cpus : 1;
+	}
+
+	live_workers = zmalloc(nr_workers * sizeof(*live_workers));
+	if (!live_workers) {
+		PERROR("zmalloc live workers");
+		ret = -1;
+		goto end;
+	}
+	nr_live_workers = nr_workers;
+
+	for (i = 0; i < nr_live_workers; i++) {
+		struct live_worker *worker = &live_workers[i];
+
+		worker->index = i;
+		CDS_INIT_LIST_HEAD(&worker->index_waits);
+		worker->conn_pipe[0] = worker->conn_pipe[1] = -1;
+		worker->wake_pipe[0] = worker->wake_pipe[1] = -1;
+		ret = utils_create_pipe_cloexec(worker->conn_pipe);
+		if (ret < 0) {
+			goto end;
+		}
+		ret = utils_create_pipe_cloexec_nonblock(worker->wake_pipe);
+		if (ret < 0) {
+			goto end;
+		}
+	}
+	DBG("Relay using %u live worker threads", nr_live_workers);
+end:
+	return ret;
+}
+
+/*
+ * Join the first nr_workers live worker threads.
+ *
+ * Return 0 on success else a negative value.
+ */
+static
+int join_live_workers(unsigned int nr_workers)
+{
+	int ret, retval = 0;
+	unsigned int i;
+	void *status;
+
+	for (i = 0; i < nr_workers; i++) {
+		ret = pthread_join(live_workers[i].thread, &status);
+		if (ret) {
+			errno = ret;
+			PERROR("pthread_join live worker");
+			retval = -1;
+		}
+	}
+	return retval;
 }
 
 int relayd_live_join(void)
@@ -2122,10 +2790,7 @@ int relayd_live_join(void)
 		retval = -1;
 	}
 
-	ret = pthread_join(live_worker_thread, &status);
-	if (ret) {
-		errno = ret;
-		PERROR("pthread_join live worker");
+	if (join_live_workers(nr_live_workers)) {
 		retval = -1;
 	}
 
@@ -2144,11 +2809,12 @@ int relayd_live_join(void)
 /*
  * main
  */
-int relayd_live_create(struct lttng_uri *uri)
+int relayd_live_create(struct lttng_uri *uri, unsigned int nr_workers)
 {
 	int ret = 0, retval = 0;
 	void *status;
 	int is_root;
+	unsigned int nr_workers_started = 0;
 
 	if (!uri) {
 		retval = -1;
@@ -2167,8 +2833,8 @@ int relayd_live_create(struct lttng_uri *uri)
 		}
 	}
 
-	/* Setup the thread apps communication pipe. */
-	if (create_conn_pipe()) {
+	/* Setup the worker threads communication pipes. */
+	if (init_live_workers(nr_workers)) {
 		retval = -1;
 		goto exit_init_data;
 	}
@@ -2192,14 +2858,19 @@ int relayd_live_create(struct lttng_uri *uri)
 		goto exit_dispatcher_thread;
 	}
 
-	/* Setup the worker thread */
-	ret = pthread_create(&live_worker_thread, default_pthread_attr(),
-			thread_worker, NULL);
-	if (ret) {
-		errno = ret;
-		PERROR("pthread_create viewer worker");
-		retval = -1;
-		goto exit_worker_thread;
+	/* Setup the worker threads */
+	for (nr_workers_started = 0; nr_workers_started < nr_live_workers;
+			nr_workers_started++) {
+		struct live_worker *worker = &live_workers[nr_workers_started];
+
+		ret = pthread_create(&worker->thread, default_pthread_attr(),
+				thread_worker, worker);
+		if (ret) {
+			errno = ret;
+			PERROR("pthread_create viewer worker");
+			retval = -1;
+			goto exit_worker_thread;
+		}
 	}
 
 	/* Setup the listener thread */
@@ -2223,14 +2894,10 @@ int relayd_live_create(struct lttng_uri *uri)
 	 */
 
 exit_listener_thread:
-
-	ret = pthread_join(live_worker_thread, &status);
-	if (ret) {
-		errno = ret;
-		PERROR("pthread_join live worker");
+exit_worker_thread:
+	if (join_live_workers(nr_workers_started)) {
 		retval = -1;
 	}
-exit_worker_thread:
 
 	ret = pthread_join(live_dispatcher_thread, &status);
 	if (ret) {
@@ -23,10 +23,12 @@
 #include <common/uri.h>
 
 #include "lttng-relayd.h"
+#include "session.h"
 
-int relayd_live_create(struct lttng_uri *live_uri);
+int relayd_live_create(struct lttng_uri *live_uri, unsigned int nr_workers);
 int relayd_live_stop(void);
 int relayd_live_join(void);
+void relayd_live_notify_index(struct relay_session *session);
 
 struct relay_viewer_stream *live_find_viewer_stream_by_id(uint64_t stream_id);
 
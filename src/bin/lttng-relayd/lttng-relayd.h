@@ -21,10 +21,15 @@
  */
 
 #include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <urcu.h>
 #include <urcu/wfcqueue.h>
 
 #include <common/hashtable/hashtable.h>
+#include <common/sessiond-comm/relayd.h>
+
+struct relay_connection;
 
 /*
  * Queue used to enqueue relay requests
@@ -35,6 +40,83 @@ struct relay_conn_queue {
 	int32_t futex;
 };
 
+/*
+ * Statistics of a worker thread. nr_connections is updated atomically by
+ * the dispatcher and the workers; the other counters are only updated by
+ * the worker itself.
+ */
+struct relay_worker_stats {
+	/* Connections assigned to the worker. */
+	unsigned long nr_connections;
+	/* Data connections handed off to the worker of their session. */
+	unsigned long nr_handoffs;
+	unsigned long nr_control_cmds;
+	unsigned long nr_data_packets;
+	uint64_t data_bytes;
+	/* Data connections which waited for write memory. */
+	unsigned long nr_write_memory_waits;
+};
+
+/*
+ * Worker thread handling control and data connections. All the
+ * connections of a session are handled by the worker which received its
+ * RELAYD_CREATE_SESSION command.
+ */
+struct relay_worker {
+	unsigned int index;
+	pthread_t thread;
+	/*
+	 * Pipe used to hand connections to the worker, either by the
+	 * dispatcher or by another worker.
+	 */
+	int conn_pipe[2];
+	/*
+	 * Pipe used to splice data from a data connection to a stream file.
+	 * Only created when the splice receive mode is enabled.
+	 */
+	int splice_pipe[2];
+	/* Buffer used to receive metadata, grown as needed. */
+	char *data_buffer;
+	unsigned int data_buffer_size;
+	/*
+	 * Data connections of the worker which are not polled until write
+	 * memory is released by the writer threads, and whether a wakeup
+	 * was sent through the connection pipe (a NULL connection) since.
+	 */
+	unsigned long nr_write_memory_waiters;
+	int write_memory_wakeup_pending;
+	struct relay_worker_stats stats;
+};
+
+/*
+ * Data packet, or bundle of data packets, received by a worker thread and
+ * queued to a writer thread. The data follows the structure.
+ */
+struct relay_write_item {
+	struct cds_wfcq_node node;
+	/* Connection on which the data was received. A reference is held. */
+	struct relay_connection *conn;
+	/* Header of the packet or bundle, in host byte order. */
+	struct lttcomm_relayd_data_hdr header;
+	char data[];
+};
+
+/*
+ * Writer thread writing the data queued by the worker threads to the
+ * stream files, so that slow writes do not hold back the reception of
+ * data. All the data of a session is written by the same writer thread,
+ * in the order it was received. Only the data counters of the statistics
+ * are used.
+ */
+struct relay_writer {
+	unsigned int index;
+	pthread_t thread;
+	struct cds_wfcq_head head;
+	struct cds_wfcq_tail tail;
+	int32_t futex;
+	struct relay_worker_stats stats;
+};
+
 /*
  * Contains stream indexed by ID. This is important since many commands lookup
  * streams only by ID thus also keeping them in this hash table makes the
@@ -45,6 +127,7 @@ extern struct lttng_ht *relay_streams_ht;
 extern struct lttng_ht *viewer_streams_ht;
 
 extern char *opt_output_path;
+extern int opt_tracefile_reuse;
 extern const char *tracing_group_name;
 extern const char * const config_section_name;
 
@@ -32,6 +32,24 @@
 #define LTTNG_VIEWER_NAME_MAX		255
 #define LTTNG_VIEWER_HOST_NAME_MAX	64
 
+/*
+ * A viewer setting the cmd_version of its LTTNG_VIEWER_CONNECT command to
+ * LTTNG_VIEWER_CONNECT_CMD_CAPABILITIES asks the relay daemon for the
+ * protocol extensions it supports. They are returned as
+ * LTTNG_VIEWER_CAPABILITY_* bits in the upper part of the minor version of
+ * the reply. Older relay daemons ignore the command version and reply with a
+ * plain minor version, that is without any capability.
+ */
+#define LTTNG_VIEWER_CONNECT_CMD_CAPABILITIES	1
+#define LTTNG_VIEWER_CAPABILITIES_SHIFT		16
+#define LTTNG_VIEWER_MINOR_MASK	\
+	((1U << LTTNG_VIEWER_CAPABILITIES_SHIFT) - 1)
+
+/* The relay daemon understands LTTNG_VIEWER_GET_NEXT_INDEXES. */
+#define LTTNG_VIEWER_CAPABILITY_GET_NEXT_INDEXES	(1U << 0)
+#define LTTNG_VIEWER_CAPABILITIES_ALL	\
+	LTTNG_VIEWER_CAPABILITY_GET_NEXT_INDEXES
+
 /* Flags in reply to get_next_index and get_packet. */
 enum {
 	/* New metadata is required to read this packet. */
@@ -50,6 +68,7 @@ enum lttng_viewer_command {
 	LTTNG_VIEWER_GET_NEW_STREAMS	= 7,
 	LTTNG_VIEWER_CREATE_SESSION	= 8,
 	LTTNG_VIEWER_DETACH_SESSION	= 9,
+	LTTNG_VIEWER_GET_NEXT_INDEXES	= 10,
 };
 
 enum lttng_viewer_attach_return_code {
@@ -70,6 +89,13 @@ enum lttng_viewer_next_index_return_code {
 	LTTNG_VIEWER_INDEX_EOF		= 6, /* End of index file. */
 };
 
+enum lttng_viewer_next_indexes_return_code {
+	LTTNG_VIEWER_INDEXES_OK		= 1, /* At least one index is ready. */
+	LTTNG_VIEWER_INDEXES_TIMEOUT	= 2, /* No index ready before timeout. */
+	LTTNG_VIEWER_INDEXES_HUP	= 3, /* No stream left in the session. */
+	LTTNG_VIEWER_INDEXES_ERR	= 4, /* Unknown or unattached session. */
+};
+
 enum lttng_viewer_get_packet_return_code {
 	LTTNG_VIEWER_GET_PACKET_OK	= 1,
 	LTTNG_VIEWER_GET_PACKET_RETRY	= 2,
@@ -191,6 +217,38 @@ struct lttng_viewer_index {
 	uint32_t flags;		/* LTTNG_VIEWER_FLAG_* */
 } __attribute__ ((__packed__));
 
+/*
+ * LTTNG_VIEWER_GET_NEXT_INDEXES payload.
+ *
+ * Wait until the next index of at least one stream of the session is
+ * available, or until the timeout expires. A timeout of 0 returns
+ * immediately. The reply holds at most one index per stream, for every
+ * stream which has an index (or a HUP) ready, followed by the inactive
+ * stream beacons when nothing else is ready.
+ *
+ * Only sent when the relay daemon advertised
+ * LTTNG_VIEWER_CAPABILITY_GET_NEXT_INDEXES; viewers otherwise poll each
+ * stream with LTTNG_VIEWER_GET_NEXT_INDEX.
+ */
+struct lttng_viewer_get_next_indexes {
+	uint64_t session_id;
+	uint32_t timeout_ms;
+} LTTNG_PACKED;
+
+struct lttng_viewer_stream_index {
+	uint64_t viewer_stream_id;	/* Stream id sent by attach/new streams. */
+	struct lttng_viewer_index index;
+} LTTNG_PACKED;
+
+struct lttng_viewer_indexes {
+	/* enum lttng_viewer_next_indexes_return_code */
+	uint32_t status;
+	uint32_t flags;		/* LTTNG_VIEWER_FLAG_* */
+	uint32_t indexes_count;
+	/* struct lttng_viewer_stream_index */
+	char index_list[];
+} LTTNG_PACKED;
+
 /*
  * LTTNG_VIEWER_GET_PACKET payload.
  */
@@ -19,6 +19,7 @@
  */
 
 #define _LGPL_SOURCE
+#include <ctype.h>
 #include <getopt.h>
 #include <grp.h>
 #include <limits.h>
@@ -55,6 +56,7 @@
 #include <common/uri.h>
 #include <common/utils.h>
 #include <common/config/session-config.h>
+#include <common/index/tracefile-prepare.h>
 #include <urcu/rculist.h>
 
 #include "cmd.h"
@@ -83,6 +85,37 @@ NULL
 char *opt_output_path;
 static int opt_daemon, opt_background;
 
+/*
+ * Move the trace data from the data sockets to the stream files with
+ * splice(2) instead of copying it through a user space buffer.
+ */
+static int opt_splice;
+
+/* Number of worker threads. Defaults to the number of online CPUs. */
+static unsigned int opt_worker_threads;
+
+/* Number of live worker threads. Defaults to the number of online CPUs. */
+static unsigned int opt_live_worker_threads;
+
+/*
+ * Number of writer threads. The worker threads write the data to the stream
+ * files themselves when it is 0.
+ */
+static unsigned int opt_writer_threads;
+
+/*
+ * Memory budget of the data received and waiting for a writer thread. The
+ * data connections are not read while it is exhausted.
+ */
+#define DEFAULT_WRITE_MEMORY_SIZE	(64UL * 1024 * 1024)
+static unsigned long opt_write_memory = DEFAULT_WRITE_MEMORY_SIZE;
+
+/*
+ * Truncate the tracefiles of the streams in tracefile rotation in place
+ * instead of unlinking them.
+ */
+int opt_tracefile_reuse;
+
 /*
  * We need to wait for listener and live listener threads, as well as
  * health check thread, before being ready to signal readiness.
@@ -93,6 +126,12 @@ static int lttng_relay_ready = NR_LTTNG_RELAY_READY;
 /* Size of receive buffer. */
 #define RECV_DATA_BUFFER_SIZE		65536
 
+/* Maximal number of buffers written by a single writev(2) of padding. */
+#define PADDING_IOV_MAX			64
+
+/* Zeroes written as padding after the trace data, never modified. */
+static const char zero_padding[RECV_DATA_BUFFER_SIZE];
+
 static int recv_child_signal;	/* Set to 1 when a SIGUSR1 signal is received. */
 static pid_t child_ppid;	/* Internal parent PID use with daemonize. */
 
@@ -114,17 +153,33 @@ const char * const config_section_name = "relayd";
 int thread_quit_pipe[2] = { -1, -1 };
 
 /*
- * This pipe is used to inform the worker thread that a command is queued and
- * ready to be processed.
+ * Worker threads handling the control and data connections. Connections
+ * are handed to a worker through its connection pipe.
  */
-static int relay_conn_pipe[2] = { -1, -1 };
+static struct relay_worker *relay_workers;
+static unsigned int nr_relay_workers;
+
+/*
+ * Writer threads writing the data received by the worker threads, if
+ * enabled, and memory used by the data they have yet to write.
+ */
+static struct relay_writer *relay_writers;
+static unsigned int nr_relay_writers;
+static unsigned long write_memory_used;
+
+/*
+ * Cleared when splicing to a stream file fails because the output file
+ * system does not support it. The relay then falls back on copying the
+ * data through a user space buffer.
+ */
+static bool splice_supported = true;
 
 /* Shared between threads */
 static int dispatch_thread_exit;
+static int writer_thread_exit;
 
 static pthread_t listener_thread;
 static pthread_t dispatcher_thread;
-static pthread_t worker_thread;
 static pthread_t health_thread;
 
 /*
@@ -142,10 +197,6 @@ static uint64_t last_relay_stream_id;
  */
 static struct relay_conn_queue relay_conn_queue;
 
-/* buffer allocated at startup, used to store the trace data */
-static char *data_buffer;
-static unsigned int data_buffer_size;
-
 /* Global relay stream hash table. */
 struct lttng_ht *relay_streams_ht;
 
@@ -170,6 +221,12 @@ static struct option long_options[] = {
 	{ "verbose", 0, 0, 'v', },
 	{ "config", 1, 0, 'f' },
 	{ "version", 0, 0, 'V' },
+	{ "splice", 0, 0, 0 },
+	{ "worker-threads", 1, 0, 0 },
+	{ "live-worker-threads", 1, 0, 0 },
+	{ "tracefile-reuse", 0, 0, 0 },
+	{ "writer-threads", 1, 0, 0 },
+	{ "write-memory", 1, 0, 0 },
 	{ NULL, 0, 0, 0, },
 };
 
@@ -187,6 +244,68 @@ static int set_option(int opt, const char *arg, const char *optname)
 
 	switch (opt) {
 	case 0:
+		if (!strcmp(optname, "splice")) {
+			opt_splice = 1;
+			break;
+		} else if (!strcmp(optname, "worker-threads")) {
+			unsigned long v;
+
+			errno = 0;
+			v = strtoul(arg, NULL, 0);
+			if (errno != 0 || !isdigit(arg[0]) || v == 0 ||
+					v > UINT_MAX) {
+				ERR("Wrong value in --worker-threads parameter: %s",
+						arg);
+				ret = -1;
+				goto end;
+			}
+			opt_worker_threads = (unsigned int) v;
+			break;
+		} else if (!strcmp(optname, "live-worker-threads")) {
+			unsigned long v;
+
+			errno = 0;
+			v = strtoul(arg, NULL, 0);
+			if (errno != 0 || !isdigit(arg[0]) || v == 0 ||
+					v > UINT_MAX) {
+				ERR("Wrong value in --live-worker-threads parameter: %s",
+						arg);
+				ret = -1;
+				goto end;
+			}
+			opt_live_worker_threads = (unsigned int) v;
+			break;
+		} else if (!strcmp(optname, "tracefile-reuse")) {
+			opt_tracefile_reuse = 1;
+			break;
+		} else if (!strcmp(optname, "writer-threads")) {
+			unsigned long v;
+
+			errno = 0;
+			v = strtoul(arg, NULL, 0);
+			if (errno != 0 || !isdigit(arg[0]) || v > UINT_MAX) {
+				ERR("Wrong value in --writer-threads parameter: %s",
+						arg);
+				ret = -1;
+				goto end;
+			}
+			opt_writer_threads = (unsigned int) v;
+			break;
+		} else if (!strcmp(optname, "write-memory")) {
+			uint64_t size;
+
+			/* A data bundle must fit in the write memory. */
+			if (utils_parse_size_suffix(arg, &size) ||
+					size < RELAYD_DATA_BUNDLE_MAX_SIZE ||
+					size > ULONG_MAX) {
+				ERR("Wrong value in --write-memory parameter: %s",
+						arg);
+				ret = -1;
+				goto end;
+			}
+			opt_write_memory = (unsigned long) size;
+			break;
+		}
 		fprintf(stderr, "option %s", optname);
 		if (arg) {
 			fprintf(stderr, " with arg %s\n", arg);
@@ -494,6 +613,158 @@ static void print_global_objects(void)
 	rcu_unregister_thread();
 }
 
+/*
+ * Allocate the worker threads state and create their pipes. The number of
+ * workers defaults to the number of online CPUs.
+ *
+ * Return 0 on success else a negative value.
+ */
+static int init_relay_workers(void)
+{
+	int ret = 0;
+	unsigned int i;
+
+	nr_relay_workers = opt_worker_threads;
+	if (!nr_relay_workers) {
+		long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		nr_relay_workers = nr_cpus > 0 ? (unsigned int) nr_cpus : 1;
+	}
+
+	relay_workers = zmalloc(nr_relay_workers * sizeof(*relay_workers));
+	if (!relay_workers) {
+		PERROR("zmalloc relay workers");
+		ret = -1;
+		goto end;
+	}
+
+	for (i = 0; i < nr_relay_workers; i++) {
+		struct relay_worker *worker = &relay_workers[i];
+
+		worker->index = i;
+		worker->conn_pipe[0] = worker->conn_pipe[1] = -1;
+		worker->splice_pipe[0] = worker->splice_pipe[1] = -1;
+
+		ret = utils_create_pipe_cloexec(worker->conn_pipe);
+		if (ret < 0) {
+			goto end;
+		}
+		if (opt_splice) {
+			ret = utils_create_pipe_cloexec(worker->splice_pipe);
+			if (ret < 0) {
+				goto end;
+			}
+		}
+	}
+	DBG("Relay using %u worker threads%s", nr_relay_workers,
+			opt_splice ? ", receiving data with splice" : "");
+end:
+	return ret;
+}
+
+/*
+ * Allocate the writer threads state, if writer threads are enabled.
+ *
+ * Return 0 on success else a negative value.
+ */
+static int init_relay_writers(void)
+{
+	int ret = 0;
+	unsigned int i;
+
+	nr_relay_writers = opt_writer_threads;
+	if (!nr_relay_writers) {
+		goto end;
+	}
+	if (opt_splice) {
+		WARN("The data is not received with splice by the writer threads");
+	}
+
+	relay_writers = zmalloc(nr_relay_writers * sizeof(*relay_writers));
+	if (!relay_writers) {
+		PERROR("zmalloc relay writers");
+		ret = -1;
+		goto end;
+	}
+
+	for (i = 0; i < nr_relay_writers; i++) {
+		struct relay_writer *writer = &relay_writers[i];
+
+		writer->index = i;
+		cds_wfcq_init(&writer->head, &writer->tail);
+	}
+	DBG("Relay using %u writer threads with %lu bytes of write memory",
+			nr_relay_writers, opt_write_memory);
+end:
+	return ret;
+}
+
+/*
+ * Close the pipes of the worker threads and free their state. Called once
+ * every worker thread has been joined.
+ */
+static void fini_relay_workers(void)
+{
+	unsigned int i;
+
+	if (!relay_workers) {
+		return;
+	}
+
+	for (i = 0; i < nr_relay_workers; i++) {
+		struct relay_worker *worker = &relay_workers[i];
+
+		DBG("Worker %u: %lu control commands, %lu data packets, %" PRIu64 " data bytes, %lu connections handed off, %lu write memory waits",
+				worker->index, worker->stats.nr_control_cmds,
+				worker->stats.nr_data_packets,
+				worker->stats.data_bytes,
+				worker->stats.nr_handoffs,
+				worker->stats.nr_write_memory_waits);
+		utils_close_pipe(worker->conn_pipe);
+		utils_close_pipe(worker->splice_pipe);
+		free(worker->data_buffer);
+	}
+	free(relay_workers);
+	relay_workers = NULL;
+}
+
+/*
+ * Free the state of the writer threads. Called once every writer thread has
+ * been joined, their queues being empty.
+ */
+static void fini_relay_writers(void)
+{
+	unsigned int i;
+
+	if (!relay_writers) {
+		return;
+	}
+
+	for (i = 0; i < nr_relay_writers; i++) {
+		struct relay_writer *writer = &relay_writers[i];
+
+		DBG("Writer %u: %lu data packets, %" PRIu64 " data bytes",
+				writer->index, writer->stats.nr_data_packets,
+				writer->stats.data_bytes);
+	}
+	free(relay_writers);
+	relay_writers = NULL;
+}
+
+/*
+ * Stop the writer threads once the data already queued is written. Called
+ * once the worker threads, which queue the data, have been joined.
+ */
+static void stop_relay_writers(void)
+{
+	unsigned int i;
+
+	CMM_STORE_SHARED(writer_thread_exit, 1);
+	for (i = 0; i < nr_relay_writers; i++) {
+		futex_nto1_wake(&relay_writers[i].futex);
+	}
+}
+
 /*
  * Cleanup the daemon
  */
@@ -513,6 +784,9 @@ static void relayd_cleanup(void)
 	/* free the dynamically allocated opt_output_path */
 	free(opt_output_path);
 
+	fini_relay_writers();
+	fini_relay_workers();
+
 	/* Close thread quit pipes */
 	utils_close_pipe(thread_quit_pipe);
 
@@ -766,6 +1040,31 @@ error:
 	return NULL;
 }
 
+/*
+ * Set the O_NONBLOCK flag on a socket.
+ *
+ * Return 0 on success else a negative value.
+ */
+static int set_socket_nonblocking(int fd)
+{
+	int ret, flags;
+
+	ret = fcntl(fd, F_GETFL, 0);
+	if (ret == -1) {
+		PERROR("fcntl get socket flags");
+		goto end;
+	}
+	flags = ret;
+
+	ret = fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	if (ret == -1) {
+		PERROR("fcntl set O_NONBLOCK socket flag");
+		goto end;
+	}
+end:
+	return ret;
+}
+
 /*
  * This thread manages the listening for new connections on the network
  */
@@ -899,6 +1198,18 @@ restart:
 					lttcomm_destroy_sock(newsock);
 					goto error;
 				}
+				if (type == RELAY_DATA) {
+					/*
+					 * Data connections are read incrementally by
+					 * the worker thread which must never block
+					 * on them.
+					 */
+					ret = set_socket_nonblocking(newsock->fd);
+					if (ret < 0) {
+						lttcomm_destroy_sock(newsock);
+						goto error;
+					}
+				}
 				new_conn = connection_create(newsock, type);
 				if (!new_conn) {
 					lttcomm_destroy_sock(newsock);
@@ -957,6 +1268,25 @@ error_sock_control:
 	return NULL;
 }
 
+/*
+ * Select the worker thread handling the fewest connections.
+ */
+static struct relay_worker *relay_worker_select(void)
+{
+	unsigned int i;
+	struct relay_worker *selected = &relay_workers[0];
+
+	for (i = 1; i < nr_relay_workers; i++) {
+		struct relay_worker *worker = &relay_workers[i];
+
+		if (uatomic_read(&worker->stats.nr_connections) <
+				uatomic_read(&selected->stats.nr_connections)) {
+			selected = worker;
+		}
+	}
+	return selected;
+}
+
 /*
  * This thread manages the dispatching of the requests to worker threads
  */
@@ -966,6 +1296,7 @@ static void *relay_thread_dispatcher(void *data)
 	ssize_t ret;
 	struct cds_wfcq_node *node;
 	struct relay_connection *new_conn = NULL;
+	struct relay_worker *worker;
 
 	DBG("[thread] Relay dispatcher started");
 
@@ -999,8 +1330,10 @@ static void *relay_thread_dispatcher(void *data)
 				break;
 			}
 			new_conn = caa_container_of(node, struct relay_connection, qnode);
+			worker = relay_worker_select();
 
-			DBG("Dispatching request waiting on sock %d", new_conn->sock->fd);
+			DBG("Dispatching request waiting on sock %d to worker %u",
+					new_conn->sock->fd, worker->index);
 
 			/*
 			 * Inform worker thread of the new request. This
@@ -1008,9 +1341,11 @@ static void *relay_thread_dispatcher(void *data)
 			 * the data will be read at some point in time
 			 * or wait to the end of the world :)
 			 */
-			ret = lttng_write(relay_conn_pipe[1], &new_conn, sizeof(new_conn));
+			uatomic_inc(&worker->stats.nr_connections);
+			ret = lttng_write(worker->conn_pipe[1], &new_conn, sizeof(new_conn));
 			if (ret < 0) {
 				PERROR("write connection pipe");
+				uatomic_dec(&worker->stats.nr_connections);
 				connection_put(new_conn);
 				goto error;
 			}
@@ -1110,7 +1445,10 @@ static int relay_create_session(struct lttcomm_relayd_hdr *recv_hdr,
 	}
 	assert(!conn->session);
 	conn->session = session;
-	DBG("Created session %" PRIu64, session->id);
+	/* The data connections of the session follow its control connection. */
+	session->worker_index = conn->worker->index;
+	DBG("Created session %" PRIu64 " on worker %u", session->id,
+			session->worker_index);
 
 	reply.session_id = htobe64(session->id);
 
@@ -1390,7 +1728,7 @@ int relay_reset_metadata(struct lttcomm_relayd_hdr *recv_hdr,
 
 	ret = utils_rotate_stream_file(stream->path_name, stream->channel_name,
 			0, 0, -1, -1, stream->stream_fd->fd, NULL,
-			&stream->stream_fd->fd);
+			&stream->stream_fd->fd, false);
 	if (ret < 0) {
 		ERR("Failed to rotate metadata file %s of channel %s",
 				stream->path_name, stream->channel_name);
@@ -1464,35 +1802,60 @@ static int relay_start(struct lttcomm_relayd_hdr *recv_hdr,
 }
 
 /*
- * Append padding to the file pointed by the file descriptor fd.
+ * Write len bytes of buf followed by padding_size zero bytes to the file
+ * pointed by the file descriptor fd. The padding is taken from a shared
+ * zeroed buffer so that, for most packets, the data and its padding are
+ * written by a single writev(2) call without any allocation.
+ *
+ * Return 0 on success else a negative value.
  */
-static int write_padding_to_file(int fd, uint32_t size)
+static int write_data_and_padding_to_file(int fd, const void *buf, size_t len,
+		uint32_t padding_size)
 {
-	ssize_t ret = 0;
-	char *zeros;
-
-	if (size == 0) {
-		goto end;
-	}
+	int ret = 0, iovcnt = 0;
+	ssize_t size_ret;
+	size_t total = 0;
+	struct iovec iov[PADDING_IOV_MAX];
 
-	zeros = zmalloc(size);
-	if (zeros == NULL) {
-		PERROR("zmalloc zeros for padding");
-		ret = -1;
-		goto end;
+	if (len > 0) {
+		iov[0].iov_base = (void *) buf;
+		iov[0].iov_len = len;
+		total = len;
+		iovcnt = 1;
 	}
 
-	ret = lttng_write(fd, zeros, size);
-	if (ret < size) {
-		PERROR("write padding to file");
-	}
+	while (iovcnt > 0 || padding_size > 0) {
+		while (padding_size > 0 && iovcnt < PADDING_IOV_MAX) {
+			size_t chunk = min(padding_size, sizeof(zero_padding));
 
-	free(zeros);
+			iov[iovcnt].iov_base = (void *) zero_padding;
+			iov[iovcnt].iov_len = chunk;
+			padding_size -= chunk;
+			total += chunk;
+			iovcnt++;
+		}
 
+		size_ret = lttng_writev(fd, iov, iovcnt);
+		if (size_ret < 0 || size_ret != total) {
+			PERROR("write data and padding to file");
+			ret = -1;
+			goto end;
+		}
+		iovcnt = 0;
+		total = 0;
+	}
 end:
 	return ret;
 }
 
+/*
+ * Append padding to the file pointed by the file descriptor fd.
+ */
+static int write_padding_to_file(int fd, uint32_t size)
+{
+	return write_data_and_padding_to_file(fd, NULL, 0, size);
+}
+
 /*
  * relay_recv_metadata: receive the metadata for the session.
  */
@@ -1502,7 +1865,9 @@ static int relay_recv_metadata(struct lttcomm_relayd_hdr *recv_hdr,
 	int ret = 0;
 	ssize_t size_ret;
 	struct relay_session *session = conn->session;
+	struct relay_worker *worker = conn->worker;
 	struct lttcomm_relayd_metadata_payload *metadata_struct;
+	char *data_buffer;
 	struct relay_stream *metadata_stream;
 	uint64_t data_size, payload_size;
 
@@ -1520,20 +1885,23 @@ static int relay_recv_metadata(struct lttcomm_relayd_hdr *recv_hdr,
 	}
 	payload_size -= sizeof(struct lttcomm_relayd_metadata_payload);
 
-	if (data_buffer_size < data_size) {
+	if (worker->data_buffer_size < data_size) {
 		/* In case the realloc fails, we can free the memory */
 		char *tmp_data_ptr;
 
-		tmp_data_ptr = realloc(data_buffer, data_size);
+		tmp_data_ptr = realloc(worker->data_buffer, data_size);
 		if (!tmp_data_ptr) {
 			ERR("Allocating data buffer");
-			free(data_buffer);
+			free(worker->data_buffer);
+			worker->data_buffer = NULL;
+			worker->data_buffer_size = 0;
 			ret = -1;
 			goto end;
 		}
-		data_buffer = tmp_data_ptr;
-		data_buffer_size = data_size;
+		worker->data_buffer = tmp_data_ptr;
+		worker->data_buffer_size = data_size;
 	}
+	data_buffer = worker->data_buffer;
 	memset(data_buffer, 0, data_size);
 	DBG2("Relay receiving metadata, waiting for %" PRIu64 " bytes", data_size);
 	size_ret = conn->sock->ops->recvmsg(conn->sock, data_buffer, data_size, 0);
@@ -1557,17 +1925,11 @@ static int relay_recv_metadata(struct lttcomm_relayd_hdr *recv_hdr,
 
 	pthread_mutex_lock(&metadata_stream->lock);
 
-	size_ret = lttng_write(metadata_stream->stream_fd->fd, metadata_struct->payload,
-			payload_size);
-	if (size_ret < payload_size) {
-		ERR("Relay error writing metadata on file");
-		ret = -1;
-		goto end_put;
-	}
-
-	size_ret = write_padding_to_file(metadata_stream->stream_fd->fd,
+	ret = write_data_and_padding_to_file(metadata_stream->stream_fd->fd,
+			metadata_struct->payload, payload_size,
 			be32toh(metadata_struct->padding_size));
-	if (size_ret < 0) {
+	if (ret < 0) {
+		ERR("Relay error writing metadata on file");
 		goto end_put;
 	}
 
@@ -1628,6 +1990,16 @@ static int relay_send_version(struct lttcomm_relayd_hdr *recv_hdr,
 		conn->minor = be32toh(msg.minor);
 	}
 
+	/*
+	 * The protocol extensions are only announced to peers asking for
+	 * them, older peers would mistake them for a minor version.
+	 */
+	if (be32toh(recv_hdr->cmd_version) == RELAYD_VERSION_CMD_CAPABILITIES) {
+		conn->capabilities = RELAYD_CAPABILITIES_ALL;
+		reply.minor |= conn->capabilities <<
+				RELAYD_VERSION_CAPABILITIES_SHIFT;
+	}
+
 	reply.major = htobe32(reply.major);
 	reply.minor = htobe32(reply.minor);
 	ret = conn->sock->ops->sendmsg(conn->sock, &reply,
@@ -1636,8 +2008,8 @@ static int relay_send_version(struct lttcomm_relayd_hdr *recv_hdr,
 		ERR("Relay sending version");
 	}
 
-	DBG("Version check done using protocol %u.%u", conn->major,
-			conn->minor);
+	DBG("Version check done using protocol %u.%u (capabilities 0x%x)",
+			conn->major, conn->minor, conn->capabilities);
 
 end:
 	return ret;
@@ -1943,6 +2315,27 @@ end_no_session:
 	return ret;
 }
 
+/*
+ * Handle the live beacon of a stream, telling that the stream has no data
+ * up to timestamp_end.
+ *
+ * Called with the stream lock held.
+ */
+static void handle_live_beacon(struct relay_stream *stream,
+		uint64_t timestamp_end)
+{
+	DBG("Received live beacon for stream %" PRIu64, stream->stream_handle);
+
+	/*
+	 * Only flag a stream inactive when it has already
+	 * received data and no indexes are in flight.
+	 */
+	if (stream->index_received_seqcount > 0
+			&& stream->indexes_in_flight == 0) {
+		stream->beacon_ts_end = timestamp_end;
+	}
+}
+
 /*
  * Receive an index for a specific stream.
  *
@@ -1998,18 +2391,7 @@ static int relay_recv_index(struct lttcomm_relayd_hdr *recv_hdr,
 
 	/* Live beacon handling */
 	if (index_info.packet_size == 0) {
-		DBG("Received live beacon for stream %" PRIu64,
-				stream->stream_handle);
-
-		/*
-		 * Only flag a stream inactive when it has already
-		 * received data and no indexes are in flight.
-		 */
-		if (stream->index_received_seqcount > 0
-				&& stream->indexes_in_flight == 0) {
-			stream->beacon_ts_end =
-				be64toh(index_info.timestamp_end);
-		}
+		handle_live_beacon(stream, be64toh(index_info.timestamp_end));
 		ret = 0;
 		goto end_stream_put;
 	} else {
@@ -2035,6 +2417,7 @@ static int relay_recv_index(struct lttcomm_relayd_hdr *recv_hdr,
 	if (ret == 0) {
 		tracefile_array_commit_seq(stream->tfa);
 		stream->index_received_seqcount++;
+		relayd_live_notify_index(stream->trace->session);
 	} else if (ret > 0) {
 		/* no flush. */
 		ret = 0;
@@ -2049,6 +2432,17 @@ end_stream_put:
 	stream_put(stream);
 
 end:
+	if ((conn->capabilities & RELAYD_CAPABILITY_INDEX_ACK_WINDOW) &&
+			ret >= 0) {
+		/*
+		 * Pipelined indexes are only acknowledged once per window.
+		 * Errors are replied to right away and close the connection.
+		 */
+		if (++conn->indexes_unacked < RELAYD_INDEX_ACK_WINDOW) {
+			goto end_no_session;
+		}
+		conn->indexes_unacked = 0;
+	}
 
 	memset(&reply, 0, sizeof(reply));
 	if (ret < 0) {
@@ -2067,57 +2461,183 @@ end_no_session:
 }
 
 /*
- * Receive the streams_sent message.
+ * Receive the live beacons of many streams.
  *
  * Return 0 on success else a negative value.
  */
-static int relay_streams_sent(struct lttcomm_relayd_hdr *recv_hdr,
+static int relay_recv_beacons(struct lttcomm_relayd_hdr *recv_hdr,
 		struct relay_connection *conn)
 {
-	int ret, send_ret;
+	int ret = 0, send_ret;
+	ssize_t size_ret;
+	struct relay_worker *worker = conn->worker;
+	struct lttcomm_relayd_beacon *beacons;
 	struct lttcomm_relayd_generic_reply reply;
+	uint64_t data_size, i, count;
 
-	assert(conn);
+	if (!conn->session || conn->version_check_done == 0) {
+		ERR("Trying to send beacons before version check");
+		ret = -1;
+		goto end_no_session;
+	}
 
-	DBG("Relay receiving streams_sent");
+	if (!(conn->capabilities & RELAYD_CAPABILITY_SEND_BEACONS)) {
+		ERR("Beacons received on a control connection which did not negotiate them");
+		ret = -1;
+		goto end_no_session;
+	}
 
-	if (!conn->session || conn->version_check_done == 0) {
-		ERR("Trying to close a stream before version check");
+	data_size = be64toh(recv_hdr->data_size);
+	count = data_size / sizeof(*beacons);
+	if (data_size % sizeof(*beacons) || count == 0 ||
+			count > RELAYD_BEACONS_MAX_COUNT) {
+		ERR("Incorrect beacons size %" PRIu64, data_size);
 		ret = -1;
 		goto end_no_session;
 	}
 
-	/*
-	 * Publish every pending stream in the connection recv list which are
-	 * now ready to be used by the viewer.
-	 */
-	publish_connection_local_streams(conn);
+	if (worker->data_buffer_size < data_size) {
+		/* In case the realloc fails, we can free the memory */
+		char *tmp_data_ptr;
 
-	memset(&reply, 0, sizeof(reply));
-	reply.ret_code = htobe32(LTTNG_OK);
-	send_ret = conn->sock->ops->sendmsg(conn->sock, &reply, sizeof(reply), 0);
-	if (send_ret < 0) {
-		ERR("Relay sending sent_stream reply");
-		ret = send_ret;
-	} else {
-		/* Success. */
-		ret = 0;
+		tmp_data_ptr = realloc(worker->data_buffer, data_size);
+		if (!tmp_data_ptr) {
+			ERR("Allocating data buffer");
+			free(worker->data_buffer);
+			worker->data_buffer = NULL;
+			worker->data_buffer_size = 0;
+			ret = -1;
+			goto end_no_session;
+		}
+		worker->data_buffer = tmp_data_ptr;
+		worker->data_buffer_size = data_size;
 	}
+	beacons = (struct lttcomm_relayd_beacon *) worker->data_buffer;
 
-end_no_session:
-	return ret;
-}
+	size_ret = conn->sock->ops->recvmsg(conn->sock, beacons, data_size, 0);
+	if (size_ret < 0 || size_ret != data_size) {
+		if (size_ret == 0) {
+			/* Orderly shutdown. Not necessary to print an error. */
+			DBG("Socket %d did an orderly shutdown", conn->sock->fd);
+		} else {
+			ERR("Relay didn't receive the whole beacons");
+		}
+		ret = -1;
+		goto end_no_session;
+	}
 
-/*
- * Process the commands received on the control socket
- */
-static int relay_process_control(struct lttcomm_relayd_hdr *recv_hdr,
-		struct relay_connection *conn)
-{
-	int ret = 0;
+	DBG("Relay receiving %" PRIu64 " beacons", count);
 
-	switch (be32toh(recv_hdr->cmd)) {
-	case RELAYD_CREATE_SESSION:
+	for (i = 0; i < count; i++) {
+		struct relay_stream *stream;
+		uint64_t net_seq_num = be64toh(beacons[i].net_seq_num);
+
+		stream = stream_get_by_id(be64toh(beacons[i].relay_stream_id));
+		if (!stream) {
+			/*
+			 * The stream may have been closed after the batch was
+			 * sampled. Its beacon is stale, the others still apply.
+			 */
+			DBG("Skipping beacon of unknown stream %" PRIu64,
+					be64toh(beacons[i].relay_stream_id));
+			continue;
+		}
+		pthread_mutex_lock(&stream->lock);
+		/*
+		 * The beacons of a batch are sampled before it is sent. Skip
+		 * the beacon of a stream whose data, sent after the beacon
+		 * was sampled, was already received.
+		 */
+		if (stream->prev_seq == -1ULL ||
+				((int64_t) (stream->prev_seq - net_seq_num)) <= 0) {
+			if (stream->ctf_stream_id == -1ULL) {
+				stream->ctf_stream_id =
+						be64toh(beacons[i].stream_id);
+			}
+			handle_live_beacon(stream,
+					be64toh(beacons[i].timestamp_end));
+		}
+		pthread_mutex_unlock(&stream->lock);
+		stream_put(stream);
+	}
+
+	if ((conn->capabilities & RELAYD_CAPABILITY_INDEX_ACK_WINDOW) &&
+			ret >= 0) {
+		/* Acknowledged like a single pipelined index. */
+		if (++conn->indexes_unacked < RELAYD_INDEX_ACK_WINDOW) {
+			goto end_no_session;
+		}
+		conn->indexes_unacked = 0;
+	}
+
+	memset(&reply, 0, sizeof(reply));
+	if (ret < 0) {
+		reply.ret_code = htobe32(LTTNG_ERR_UNK);
+	} else {
+		reply.ret_code = htobe32(LTTNG_OK);
+	}
+	send_ret = conn->sock->ops->sendmsg(conn->sock, &reply, sizeof(reply), 0);
+	if (send_ret < 0) {
+		ERR("Relay sending beacons reply");
+		ret = send_ret;
+	}
+
+end_no_session:
+	return ret;
+}
+
+/*
+ * Receive the streams_sent message.
+ *
+ * Return 0 on success else a negative value.
+ */
+static int relay_streams_sent(struct lttcomm_relayd_hdr *recv_hdr,
+		struct relay_connection *conn)
+{
+	int ret, send_ret;
+	struct lttcomm_relayd_generic_reply reply;
+
+	assert(conn);
+
+	DBG("Relay receiving streams_sent");
+
+	if (!conn->session || conn->version_check_done == 0) {
+		ERR("Trying to close a stream before version check");
+		ret = -1;
+		goto end_no_session;
+	}
+
+	/*
+	 * Publish every pending stream in the connection recv list which are
+	 * now ready to be used by the viewer.
+	 */
+	publish_connection_local_streams(conn);
+
+	memset(&reply, 0, sizeof(reply));
+	reply.ret_code = htobe32(LTTNG_OK);
+	send_ret = conn->sock->ops->sendmsg(conn->sock, &reply, sizeof(reply), 0);
+	if (send_ret < 0) {
+		ERR("Relay sending sent_stream reply");
+		ret = send_ret;
+	} else {
+		/* Success. */
+		ret = 0;
+	}
+
+end_no_session:
+	return ret;
+}
+
+/*
+ * Process the commands received on the control socket
+ */
+static int relay_process_control(struct lttcomm_relayd_hdr *recv_hdr,
+		struct relay_connection *conn)
+{
+	int ret = 0;
+
+	switch (be32toh(recv_hdr->cmd)) {
+	case RELAYD_CREATE_SESSION:
 		ret = relay_create_session(recv_hdr, conn);
 		break;
 	case RELAYD_ADD_STREAM:
@@ -2150,6 +2670,9 @@ static int relay_process_control(struct lttcomm_relayd_hdr *recv_hdr,
 	case RELAYD_SEND_INDEX:
 		ret = relay_recv_index(recv_hdr, conn);
 		break;
+	case RELAYD_SEND_BEACONS:
+		ret = relay_recv_beacons(recv_hdr, conn);
+		break;
 	case RELAYD_STREAMS_SENT:
 		ret = relay_streams_sent(recv_hdr, conn);
 		break;
@@ -2199,202 +2722,1063 @@ static int handle_index_data(struct relay_stream *stream, uint64_t net_seq_num,
 		goto end;
 	}
 
-	if (rotate_index || !stream->index_file) {
-		uint32_t major, minor;
+	if (rotate_index || !stream->index_file) {
+		uint32_t major, minor;
+
+		/* Put ref on previous index_file. */
+		if (stream->index_file) {
+			lttng_index_file_put(stream->index_file);
+			stream->index_file = NULL;
+		}
+		major = stream->trace->session->major;
+		minor = stream->trace->session->minor;
+		if (rotate_index && stream->prepared_index_file) {
+			/* Prepared along with the tracefile. */
+			stream->index_file = stream->prepared_index_file;
+			stream->prepared_index_file = NULL;
+		} else {
+			stream->index_file = lttng_index_file_create(
+					stream->path_name,
+					stream->channel_name,
+					-1, -1, stream->tracefile_size,
+					tracefile_array_get_file_index_head(stream->tfa),
+					lttng_to_index_major(major, minor),
+					lttng_to_index_minor(major, minor),
+					stream_reuse_tracefiles(stream));
+		}
+		if (!stream->index_file) {
+			ret = -1;
+			/* Put self-ref for this index due to error. */
+			relay_index_put(index);
+			index = NULL;
+			goto end;
+		}
+	}
+
+	if (relay_index_set_file(index, stream->index_file, data_offset)) {
+		ret = -1;
+		/* Put self-ref for this index due to error. */
+		relay_index_put(index);
+		index = NULL;
+		goto end;
+	}
+
+	ret = relay_index_try_flush(index);
+	if (ret == 0) {
+		tracefile_array_commit_seq(stream->tfa);
+		stream->index_received_seqcount++;
+		relayd_live_notify_index(stream->trace->session);
+	} else if (ret > 0) {
+		/* No flush. */
+		ret = 0;
+	} else {
+		/* Put self-ref for this index due to error. */
+		relay_index_put(index);
+		index = NULL;
+		ret = -1;
+	}
+end:
+	return ret;
+}
+
+/*
+ * Receive at most len bytes already available on a data connection and
+ * write them to the stream file descriptor fd through a user space buffer.
+ * If the received data completes the len bytes, padding_size zero bytes are
+ * appended by the same write.
+ *
+ * Return the number of bytes received, 0 if no data is available on the
+ * connection, else a negative value.
+ */
+static ssize_t copy_data_to_file(struct relay_connection *conn, int fd,
+		uint64_t len, uint32_t padding_size)
+{
+	ssize_t ret, size_ret;
+	char data_buffer[RECV_DATA_BUFFER_SIZE];
+	size_t recv_size = min(len, sizeof(data_buffer));
+
+	ret = conn->sock->ops->recvmsg(conn->sock, data_buffer, recv_size,
+			MSG_DONTWAIT);
+	if (ret < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			ret = 0;
+			goto end;
+		}
+		ERR("Socket %d error %zd", conn->sock->fd, ret);
+		goto end;
+	} else if (ret == 0) {
+		/* Orderly shutdown. Not necessary to print an error. */
+		DBG("Socket %d did an orderly shutdown", conn->sock->fd);
+		ret = -1;
+		goto end;
+	}
+
+	/* Write data to stream output fd. */
+	size_ret = write_data_and_padding_to_file(fd, data_buffer, ret,
+			ret == len ? padding_size : 0);
+	if (size_ret < 0) {
+		ERR("Relay error writing data to file");
+		ret = -1;
+		goto end;
+	}
+end:
+	return ret;
+}
+
+/*
+ * Write len bytes pending in the splice pipe read end pipe_fd to the stream
+ * file descriptor fd through a user space buffer. Used when the output file
+ * does not support splice(2).
+ *
+ * Return 0 on success else a negative value.
+ */
+static int drain_splice_pipe_to_file(int pipe_fd, int fd, size_t len)
+{
+	int ret = 0;
+	ssize_t size_ret;
+	char data_buffer[RECV_DATA_BUFFER_SIZE];
+
+	while (len > 0) {
+		size_t read_size = min(len, sizeof(data_buffer));
+
+		size_ret = lttng_read(pipe_fd, data_buffer, read_size);
+		if (size_ret != read_size) {
+			PERROR("read splice pipe");
+			ret = -1;
+			goto end;
+		}
+		size_ret = lttng_write(fd, data_buffer, read_size);
+		if (size_ret != read_size) {
+			ERR("Relay error writing data to file");
+			ret = -1;
+			goto end;
+		}
+		len -= read_size;
+	}
+end:
+	return ret;
+}
+
+/*
+ * Replace the splice pipe of a worker to discard the data left in it by a
+ * failed transfer. The pipe is shared by all the connections of the worker,
+ * so that data would otherwise be written to the file of another stream
+ * ahead of its next packet. Splice is disabled if the pipe can't be
+ * created again.
+ */
+static void reset_splice_pipe(struct relay_worker *worker)
+{
+	int ret;
+
+	utils_close_pipe(worker->splice_pipe);
+	worker->splice_pipe[0] = worker->splice_pipe[1] = -1;
+
+	ret = utils_create_pipe_cloexec(worker->splice_pipe);
+	if (ret < 0) {
+		ERR("Creating splice pipe of worker %u, falling back on copy",
+				worker->index);
+		utils_close_pipe(worker->splice_pipe);
+		worker->splice_pipe[0] = worker->splice_pipe[1] = -1;
+		CMM_STORE_SHARED(splice_supported, false);
+	}
+}
+
+/*
+ * Move at most len bytes already available on a data connection to the
+ * stream file descriptor fd with splice(2), using the splice pipe of the
+ * worker handling the connection. The data never crosses into user space
+ * unless the output file does not support splice, in which case the splice
+ * mode is disabled and the data already in the pipe is copied.
+ *
+ * Return the number of bytes written, 0 if no data is available on the
+ * connection, else a negative value.
+ */
+static ssize_t splice_data_to_file(struct relay_connection *conn, int fd,
+		uint64_t len)
+{
+	ssize_t in_pipe, moved, left;
+	int *splice_pipe = conn->worker->splice_pipe;
+
+	do {
+		in_pipe = splice(conn->sock->fd, NULL, splice_pipe[1], NULL,
+				len, SPLICE_F_MOVE | SPLICE_F_MORE | SPLICE_F_NONBLOCK);
+	} while (in_pipe < 0 && errno == EINTR);
+	if (in_pipe < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			in_pipe = 0;
+			goto end;
+		}
+		PERROR("splice socket %d to pipe", conn->sock->fd);
+		goto end;
+	} else if (in_pipe == 0) {
+		/* Orderly shutdown. Not necessary to print an error. */
+		DBG("Socket %d did an orderly shutdown", conn->sock->fd);
+		in_pipe = -1;
+		goto end;
+	}
+
+	left = in_pipe;
+	while (left > 0) {
+		moved = splice(splice_pipe[0], NULL, fd, NULL,
+				left, SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (moved < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EINVAL) {
+				WARN("Output file system does not support splice, falling back on copy");
+				CMM_STORE_SHARED(splice_supported, false);
+				if (drain_splice_pipe_to_file(splice_pipe[0],
+						fd, left)) {
+					reset_splice_pipe(conn->worker);
+					in_pipe = -1;
+				}
+				goto end;
+			}
+			PERROR("splice pipe to file");
+			reset_splice_pipe(conn->worker);
+			in_pipe = -1;
+			goto end;
+		}
+		left -= moved;
+	}
+end:
+	return in_pipe;
+}
+
+/*
+ * Rotate the output file of a stream if writing data_size more bytes to it
+ * would exceed its maximal size. rotated is set if a rotation occurred.
+ *
+ * Called with the stream lock held.
+ *
+ * Return 0 on success else a negative value.
+ */
+static int stream_rotate_output_if_needed(struct relay_stream *stream,
+		uint64_t data_size, bool *rotated)
+{
+	int ret = 0, fd;
+	uint64_t old_id, new_id;
+	struct lttng_index_file *index_file = NULL;
+
+	*rotated = false;
+	if (stream->tracefile_size == 0 ||
+			(stream->tracefile_size_current + data_size) <=
+			stream->tracefile_size) {
+		goto end;
+	}
+
+	old_id = tracefile_array_get_file_index_head(stream->tfa);
+	tracefile_array_file_rotate(stream->tfa);
+
+	new_id = stream->tracefile_count ?
+			(old_id + 1) % stream->tracefile_count : old_id + 1;
+	if (stream->tracefile_prepared) {
+		/* Free the blocks allocated past the end of the tracefile. */
+		(void) utils_trim_stream_file(stream->stream_fd->fd);
+	}
+	if (stream->tracefile_prepare &&
+			tracefile_prepare_take(stream->tracefile_prepare,
+				new_id, &fd, &index_file)) {
+		/* The tracefile was prepared in the background. */
+		if (close(stream->stream_fd->fd)) {
+			PERROR("Closing tracefile");
+		}
+		stream->stream_fd->fd = fd;
+		stream->tracefile_prepared = true;
+	} else {
+		/* new_id is updated by utils_rotate_stream_file. */
+		new_id = old_id;
+
+		ret = utils_rotate_stream_file(stream->path_name,
+				stream->channel_name, stream->tracefile_size,
+				stream->tracefile_count, -1,
+				-1, stream->stream_fd->fd,
+				&new_id, &stream->stream_fd->fd,
+				stream_reuse_tracefiles(stream));
+		if (ret < 0) {
+			ERR("Rotating stream output file");
+			goto end;
+		}
+		stream->tracefile_prepared = false;
+	}
+	/* Used by handle_index_data() when the index file is switched. */
+	if (stream->prepared_index_file) {
+		lttng_index_file_put(stream->prepared_index_file);
+	}
+	stream->prepared_index_file = index_file;
+	/*
+	 * Reset current size because we just performed a stream
+	 * rotation.
+	 */
+	stream->tracefile_size_current = 0;
+	*rotated = true;
+	stream_prepare_next_tracefile(stream);
+end:
+	return ret;
+}
+
+/*
+ * Account for a data packet whose payload was written to the output file of
+ * a stream: handle its index, write its padding unless padding_written is
+ * set, and update the stream's bookkeeping and the statistics of the thread
+ * which wrote it. new_stream is set if it is the first packet of the stream.
+ *
+ * Called with the stream lock held.
+ *
+ * Return 0 on success else a negative value.
+ */
+static int stream_complete_packet(struct relay_worker_stats *stats,
+		struct relay_stream *stream,
+		const struct lttcomm_relayd_data_hdr *header,
+		bool rotate_index, bool padding_written, bool *new_stream)
+{
+	int ret = 0;
+	struct relay_session *session = stream->trace->session;
+
+	DBG2("Relay wrote %" PRIu32 " bytes to tracefile for stream id %" PRIu64,
+			header->data_size, stream->stream_handle);
+
+	/*
+	 * Index are handled in protocol version 2.4 and above. Also,
+	 * snapshot and index are NOT supported.
+	 */
+	if (session->minor >= 4 && !session->snapshot) {
+		ret = handle_index_data(stream, header->net_seq_num,
+				rotate_index);
+		if (ret < 0) {
+			ERR("handle_index_data: fail stream %" PRIu64 " net_seq_num %" PRIu64 " ret %d",
+					stream->stream_handle, header->net_seq_num, ret);
+			goto end;
+		}
+	}
+
+	if (!padding_written) {
+		ret = write_padding_to_file(stream->stream_fd->fd,
+				header->padding_size);
+		if (ret < 0) {
+			ERR("write_padding_to_file: fail stream %" PRIu64 " net_seq_num %" PRIu64 " ret %d",
+					stream->stream_handle, header->net_seq_num, ret);
+			goto end;
+		}
+	}
+	stream->tracefile_size_current +=
+			header->data_size + header->padding_size;
+	if (stream->prev_seq == -1ULL) {
+		*new_stream = true;
+	}
+
+	stream->prev_seq = header->net_seq_num;
+	stats->nr_data_packets++;
+	stats->data_bytes += header->data_size;
+end:
+	return ret;
+}
+
+/*
+ * Write a complete data packet to the output file of a stream, rotating it
+ * if needed, and account for it. new_stream is set if it is the first packet
+ * of the stream.
+ *
+ * Called with the stream lock held.
+ *
+ * Return 0 on success else a negative value.
+ */
+static int stream_write_packet(struct relay_worker_stats *stats,
+		struct relay_stream *stream,
+		const struct lttcomm_relayd_data_hdr *header, const char *data,
+		bool *new_stream)
+{
+	int ret;
+	bool rotated;
+
+	ret = stream_rotate_output_if_needed(stream, header->data_size,
+			&rotated);
+	if (ret < 0) {
+		goto end;
+	}
+	ret = write_data_and_padding_to_file(stream->stream_fd->fd, data,
+			header->data_size, header->padding_size);
+	if (ret < 0) {
+		ERR("Relay error writing data to file");
+		goto end;
+	}
+	ret = stream_complete_packet(stats, stream, header, rotated, true,
+			new_stream);
+end:
+	return ret;
+}
+
+/*
+ * Release the lock of a stream to which packets were written, closing the
+ * stream if its close was requested and telling live viewers about it if it
+ * just received its first packet.
+ */
+static void stream_unlock_after_packets(struct relay_stream *stream,
+		bool new_stream)
+{
+	bool close_requested = stream->close_requested;
+	struct relay_session *session = stream->trace->session;
+
+	pthread_mutex_unlock(&stream->lock);
+	if (close_requested) {
+		try_stream_close(stream);
+	}
+
+	if (new_stream) {
+		pthread_mutex_lock(&session->lock);
+		uatomic_set(&session->new_streams, 1);
+		pthread_mutex_unlock(&session->lock);
+	}
+}
+
+/*
+ * Receive the header of a data packet. Once it is complete, the stream
+ * output file is rotated if needed and the connection moves on to the
+ * reception of the payload.
+ *
+ * If the stream belongs to a session handled by another worker thread,
+ * handoff_worker is set to that worker; the connection must be handed off
+ * to it before its payload is received.
+ *
+ * Return 0 on success, which includes not having received the complete
+ * header yet, else a negative value.
+ */
+static int relay_process_data_receive_header(struct relay_connection *conn,
+		struct relay_worker **handoff_worker)
+{
+	int ret;
+	ssize_t recv_ret;
+	struct data_connection_state *state = &conn->data_state;
+	struct lttcomm_relayd_data_hdr *header = &state->header;
+	struct relay_stream *stream;
+
+	recv_ret = conn->sock->ops->recvmsg(conn->sock,
+			(char *) header + state->received,
+			state->left_to_receive, MSG_DONTWAIT);
+	if (recv_ret < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			ret = 0;
+			goto end;
+		}
+		ERR("Unable to receive data header on sock %d", conn->sock->fd);
+		ret = -1;
+		goto end;
+	} else if (recv_ret == 0) {
+		/* Orderly shutdown. Not necessary to print an error. */
+		DBG("Socket %d did an orderly shutdown", conn->sock->fd);
+		ret = -1;
+		goto end;
+	}
+
+	state->received += recv_ret;
+	state->left_to_receive -= recv_ret;
+	if (state->left_to_receive > 0) {
+		DBG3("Partial data header received on sock %d (%" PRIu64 " bytes left)",
+				conn->sock->fd, state->left_to_receive);
+		ret = 0;
+		goto end;
+	}
+
+	header->circuit_id = be64toh(header->circuit_id);
+	header->stream_id = be64toh(header->stream_id);
+	header->net_seq_num = be64toh(header->net_seq_num);
+	header->data_size = be32toh(header->data_size);
+	header->padding_size = be32toh(header->padding_size);
+
+	DBG3("Receiving data of size %u for stream id %" PRIu64 " seqnum %" PRIu64,
+		header->data_size, header->stream_id, header->net_seq_num);
+
+	stream = stream_get_by_id(header->stream_id);
+	if (!stream) {
+		ERR("relay_process_data: Cannot find stream %" PRIu64,
+				header->stream_id);
+		ret = -1;
+		goto end;
+	}
+
+	pthread_mutex_lock(&stream->lock);
+	state->rotate_index = false;
+
+	if (header->net_seq_num == RELAYD_DATA_BUNDLE_SEQ_NUM) {
+		/*
+		 * The packets of the bundle are only looked at once it is
+		 * complete, the stream is only used to find its worker. The
+		 * reception buffer is sized once for the largest bundle; the
+		 * writer threads receive it in a write item instead.
+		 */
+		if (header->data_size > RELAYD_DATA_BUNDLE_MAX_SIZE ||
+				(!nr_relay_writers &&
+				lttng_dynamic_buffer_set_capacity(&state->bundle,
+					RELAYD_DATA_BUNDLE_MAX_SIZE))) {
+			ERR("Invalid data bundle of size %" PRIu32 " on sock %d",
+					header->data_size, conn->sock->fd);
+			ret = -1;
+			goto end_stream_unlock;
+		}
+		state->id = DATA_CONNECTION_STATE_RECEIVE_BUNDLE;
+	} else {
+		/* The writer threads rotate the output when writing. */
+		if (!nr_relay_writers) {
+			ret = stream_rotate_output_if_needed(stream,
+					header->data_size,
+					&state->rotate_index);
+			if (ret < 0) {
+				goto end_stream_unlock;
+			}
+		}
+		state->id = DATA_CONNECTION_STATE_RECEIVE_PAYLOAD;
+	}
+	state->received = 0;
+	state->left_to_receive = header->data_size;
+	state->session_id = stream->trace->session->id;
+	if (stream->trace->session->worker_index != conn->worker->index) {
+		*handoff_worker =
+				&relay_workers[stream->trace->session->worker_index];
+	}
+	ret = 0;
+
+end_stream_unlock:
+	pthread_mutex_unlock(&stream->lock);
+	stream_put(stream);
+end:
+	return ret;
+}
+
+/*
+ * Receive the payload of a data packet, writing it to the stream output
+ * file as it arrives. Once it is complete, the padding and index of the
+ * packet are written and the connection moves on to the reception of the
+ * next header.
+ *
+ * Return 0 on success, which includes not having received the complete
+ * payload yet, else a negative value.
+ */
+static int relay_process_data_receive_payload(struct relay_connection *conn)
+{
+	int ret = 0;
+	struct data_connection_state *state = &conn->data_state;
+	struct lttcomm_relayd_data_hdr *header = &state->header;
+	struct relay_stream *stream;
+	bool new_stream = false;
+	bool padding_written = false;
+
+	stream = stream_get_by_id(header->stream_id);
+	if (!stream) {
+		ERR("relay_process_data: Cannot find stream %" PRIu64,
+				header->stream_id);
+		ret = -1;
+		goto end;
+	}
+
+	pthread_mutex_lock(&stream->lock);
+
+	while (state->left_to_receive > 0) {
+		ssize_t written;
+
+		if (opt_splice && CMM_LOAD_SHARED(splice_supported)) {
+			written = splice_data_to_file(conn,
+					stream->stream_fd->fd,
+					state->left_to_receive);
+		} else {
+			written = copy_data_to_file(conn,
+					stream->stream_fd->fd,
+					state->left_to_receive,
+					header->padding_size);
+			padding_written = written == state->left_to_receive;
+		}
+		if (written < 0) {
+			ret = -1;
+			goto end_stream_unlock;
+		} else if (written == 0) {
+			/* Wait for the sender to provide more data. */
+			break;
+		}
+		state->received += written;
+		state->left_to_receive -= written;
+	}
+
+	if (state->left_to_receive > 0) {
+		DBG3("Partial data received for stream id %" PRIu64 " (%" PRIu64 " of %" PRIu32 " bytes)",
+				stream->stream_handle, state->received,
+				header->data_size);
+		goto end_stream_unlock;
+	}
+
+	ret = stream_complete_packet(&conn->worker->stats, stream, header,
+			state->rotate_index, padding_written, &new_stream);
+	if (ret < 0) {
+		goto end_stream_unlock;
+	}
+
+	/* The packet is complete; wait for the next header. */
+	state->id = DATA_CONNECTION_STATE_RECEIVE_HEADER;
+	state->received = 0;
+	state->left_to_receive = sizeof(*header);
+
+end_stream_unlock:
+	stream_unlock_after_packets(stream, new_stream);
+	stream_put(stream);
+end:
+	return ret;
+}
+
+/*
+ * Write the packets of a complete bundle, received on the connection conn,
+ * to their streams. Consecutive packets of the same stream are written under
+ * a single stream lookup and lock.
+ *
+ * Return 0 on success else a negative value.
+ */
+static int write_data_bundle(struct relay_worker_stats *stats,
+		struct relay_connection *conn, const char *bundle,
+		uint64_t bundle_size)
+{
+	int ret = 0;
+	uint64_t offset = 0;
+	struct relay_stream *stream = NULL;
+	struct relay_session *session = NULL;
+	bool new_stream = false;
+
+	while (offset < bundle_size) {
+		struct lttcomm_relayd_data_hdr header;
+
+		if (bundle_size - offset < sizeof(header)) {
+			ERR("Truncated packet header in data bundle on sock %d",
+					conn->sock->fd);
+			ret = -1;
+			goto end;
+		}
+		memcpy(&header, bundle + offset, sizeof(header));
+		offset += sizeof(header);
+		header.stream_id = be64toh(header.stream_id);
+		header.net_seq_num = be64toh(header.net_seq_num);
+		header.data_size = be32toh(header.data_size);
+		header.padding_size = be32toh(header.padding_size);
+		if (bundle_size - offset < header.data_size) {
+			ERR("Truncated packet in data bundle on sock %d",
+					conn->sock->fd);
+			ret = -1;
+			goto end;
+		}
+
+		if (!stream || stream->stream_handle != header.stream_id) {
+			if (stream) {
+				stream_unlock_after_packets(stream, new_stream);
+				stream_put(stream);
+				new_stream = false;
+			}
+			stream = stream_get_by_id(header.stream_id);
+			if (!stream) {
+				ERR("relay_process_data: Cannot find stream %" PRIu64,
+						header.stream_id);
+				ret = -1;
+				goto end;
+			}
+			/* A bundle only holds packets of a single session. */
+			if (session && stream->trace->session != session) {
+				ERR("Data bundle on sock %d spans many sessions",
+						conn->sock->fd);
+				stream_put(stream);
+				stream = NULL;
+				ret = -1;
+				goto end;
+			}
+			session = stream->trace->session;
+			pthread_mutex_lock(&stream->lock);
+		}
+
+		ret = stream_write_packet(stats, stream, &header,
+				bundle + offset, &new_stream);
+		if (ret < 0) {
+			goto end;
+		}
+		offset += header.data_size;
+	}
+	ret = 0;
+end:
+	if (stream) {
+		stream_unlock_after_packets(stream, new_stream);
+		stream_put(stream);
+	}
+	return ret;
+}
+
+/*
+ * Receive a bundle of data packets. It is received whole before its packets
+ * are written, which allows the bundle to be read with few large reads.
+ *
+ * Return 0 on success, which includes not having received the complete
+ * bundle yet, else a negative value.
+ */
+static int relay_process_data_receive_bundle(struct relay_connection *conn)
+{
+	int ret = 0;
+	ssize_t recv_ret;
+	struct data_connection_state *state = &conn->data_state;
+
+	while (state->left_to_receive > 0) {
+		recv_ret = conn->sock->ops->recvmsg(conn->sock,
+				state->bundle.data + state->received,
+				state->left_to_receive, MSG_DONTWAIT);
+		if (recv_ret < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				goto end;
+			}
+			ERR("Unable to receive data bundle on sock %d",
+					conn->sock->fd);
+			ret = -1;
+			goto end;
+		} else if (recv_ret == 0) {
+			/* Orderly shutdown. Not necessary to print an error. */
+			DBG("Socket %d did an orderly shutdown", conn->sock->fd);
+			ret = -1;
+			goto end;
+		}
+		state->received += recv_ret;
+		state->left_to_receive -= recv_ret;
+	}
+
+	DBG3("Data bundle of %" PRIu32 " bytes received on sock %d",
+			state->header.data_size, conn->sock->fd);
+	ret = write_data_bundle(&conn->worker->stats, conn, state->bundle.data,
+			state->header.data_size);
+	if (ret < 0) {
+		goto end;
+	}
+
+	/* The bundle is complete; wait for the next header. */
+	state->id = DATA_CONNECTION_STATE_RECEIVE_HEADER;
+	state->received = 0;
+	state->left_to_receive = sizeof(state->header);
+end:
+	return ret;
+}
+
+/*
+ * Reserve size bytes of the write memory budget. The size must not exceed the
+ * budget.
+ *
+ * Return true if the memory is reserved.
+ */
+static bool write_memory_reserve(unsigned long size)
+{
+	unsigned long used, old;
+
+	assert(size <= opt_write_memory);
+
+	used = uatomic_read(&write_memory_used);
+	for (;;) {
+		if (used > opt_write_memory - size) {
+			return false;
+		}
+		old = uatomic_cmpxchg(&write_memory_used, used, used + size);
+		if (old == used) {
+			return true;
+		}
+		used = old;
+	}
+}
+
+/*
+ * Wake up a worker thread through its connection pipe, with a NULL
+ * connection, unless a wakeup is already pending.
+ */
+static void relay_worker_wakeup(struct relay_worker *worker)
+{
+	struct relay_connection *wakeup = NULL;
+	ssize_t ret;
+
+	if (uatomic_cmpxchg(&worker->write_memory_wakeup_pending, 0, 1)) {
+		return;
+	}
+	ret = lttng_write(worker->conn_pipe[1], &wakeup, sizeof(wakeup));
+	if (ret != sizeof(wakeup)) {
+		PERROR("write connection pipe");
+	}
+}
+
+/*
+ * Release write memory and wake up the worker threads having data
+ * connections waiting for it.
+ */
+static void write_memory_release(unsigned long size)
+{
+	unsigned int i;
+
+	/* Implies a full barrier, paired with relay_thread_wait_write_memory. */
+	(void) uatomic_sub_return(&write_memory_used, size);
+
+	for (i = 0; i < nr_relay_workers; i++) {
+		struct relay_worker *worker = &relay_workers[i];
+
+		if (!uatomic_read(&worker->nr_write_memory_waiters)) {
+			continue;
+		}
+		relay_worker_wakeup(worker);
+	}
+}
+
+/*
+ * Allocate the write item receiving the payload of a data connection if
+ * the write memory budget allows it. Otherwise, the connection is flagged
+ * as waiting for write memory. A payload larger than the whole budget is
+ * refused since the size is chosen by the peer.
+ *
+ * Return 0 on success, which includes waiting for write memory, else a
+ * negative value.
+ */
+static int relay_data_alloc_write_item(struct relay_connection *conn)
+{
+	int ret = 0;
+	struct data_connection_state *state = &conn->data_state;
+	unsigned long size = state->header.data_size;
+
+	if (size > opt_write_memory) {
+		ERR("Data of %lu bytes received on sock %d exceeds the write memory of %lu bytes",
+				size, conn->sock->fd, opt_write_memory);
+		ret = -1;
+		goto end;
+	}
+
+	if (!write_memory_reserve(size)) {
+		state->waiting_write_memory = true;
+		goto end;
+	}
+
+	state->write_item = malloc(sizeof(*state->write_item) + size);
+	if (!state->write_item) {
+		PERROR("malloc write item");
+		write_memory_release(size);
+		ret = -1;
+		goto end;
+	}
+	state->write_item->header = state->header;
+end:
+	return ret;
+}
+
+/*
+ * Discard the write item being received on a data connection, if any.
+ */
+static void relay_data_discard_write_item(struct relay_connection *conn)
+{
+	struct data_connection_state *state = &conn->data_state;
+
+	if (!state->write_item) {
+		return;
+	}
+	write_memory_release(state->header.data_size);
+	free(state->write_item);
+	state->write_item = NULL;
+}
+
+/*
+ * Queue a complete write item to the writer thread of its session.
+ */
+static void relay_writer_enqueue(struct relay_connection *conn)
+{
+	struct data_connection_state *state = &conn->data_state;
+	struct relay_write_item *item = state->write_item;
+	struct relay_writer *writer =
+			&relay_writers[state->session_id % nr_relay_writers];
+
+	state->write_item = NULL;
+	/* Cannot fail, the worker holds a reference. */
+	(void) connection_get(conn);
+	item->conn = conn;
+	cds_wfcq_node_init(&item->node);
+	cds_wfcq_enqueue(&writer->head, &writer->tail, &item->node);
+	futex_nto1_wake(&writer->futex);
+}
 
-		/* Put ref on previous index_file. */
-		if (stream->index_file) {
-			lttng_index_file_put(stream->index_file);
-			stream->index_file = NULL;
+/*
+ * Receive the payload of a data packet, or a bundle of data packets, in a
+ * write item which is queued to a writer thread once it is complete. The
+ * connection waits, without being read, if the write memory budget is
+ * exhausted; the sender is thus held back by TCP flow control.
+ *
+ * Return 0 on success, which includes not having received the complete
+ * payload yet, else a negative value.
+ */
+static int relay_process_data_receive_write_item(struct relay_connection *conn)
+{
+	int ret = 0;
+	ssize_t recv_ret;
+	struct data_connection_state *state = &conn->data_state;
+
+	if (state->waiting_write_memory) {
+		/* Resumed by relay_thread_resume_write_memory_waiters(). */
+		goto end;
+	}
+	if (!state->write_item) {
+		ret = relay_data_alloc_write_item(conn);
+		if (ret < 0 || state->waiting_write_memory) {
+			goto end;
 		}
-		major = stream->trace->session->major;
-		minor = stream->trace->session->minor;
-		stream->index_file = lttng_index_file_create(stream->path_name,
-				stream->channel_name,
-			        -1, -1, stream->tracefile_size,
-				tracefile_array_get_file_index_head(stream->tfa),
-				lttng_to_index_major(major, minor),
-				lttng_to_index_minor(major, minor));
-		if (!stream->index_file) {
+	}
+
+	while (state->left_to_receive > 0) {
+		recv_ret = conn->sock->ops->recvmsg(conn->sock,
+				state->write_item->data + state->received,
+				state->left_to_receive, MSG_DONTWAIT);
+		if (recv_ret < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				goto end;
+			}
+			ERR("Unable to receive data on sock %d",
+					conn->sock->fd);
+			ret = -1;
+			goto end;
+		} else if (recv_ret == 0) {
+			/* Orderly shutdown. Not necessary to print an error. */
+			DBG("Socket %d did an orderly shutdown", conn->sock->fd);
 			ret = -1;
-			/* Put self-ref for this index due to error. */
-			relay_index_put(index);
-			index = NULL;
 			goto end;
 		}
+		state->received += recv_ret;
+		state->left_to_receive -= recv_ret;
 	}
 
-	if (relay_index_set_file(index, stream->index_file, data_offset)) {
-		ret = -1;
-		/* Put self-ref for this index due to error. */
-		relay_index_put(index);
-		index = NULL;
-		goto end;
+	if (state->header.net_seq_num != RELAYD_DATA_BUNDLE_SEQ_NUM) {
+		conn->worker->stats.nr_data_packets++;
+		conn->worker->stats.data_bytes += state->header.data_size;
 	}
+	relay_writer_enqueue(conn);
 
-	ret = relay_index_try_flush(index);
-	if (ret == 0) {
-		tracefile_array_commit_seq(stream->tfa);
-		stream->index_received_seqcount++;
-	} else if (ret > 0) {
-		/* No flush. */
-		ret = 0;
-	} else {
-		/* Put self-ref for this index due to error. */
-		relay_index_put(index);
-		index = NULL;
-		ret = -1;
-	}
+	/* The payload is queued; wait for the next header. */
+	state->id = DATA_CONNECTION_STATE_RECEIVE_HEADER;
+	state->received = 0;
+	state->left_to_receive = sizeof(state->header);
 end:
 	return ret;
 }
 
 /*
- * relay_process_data: Process the data received on the data socket
+ * Write a write item to the stream files. On error, the connection on which
+ * it was received is flagged to be closed by its worker thread.
  */
-static int relay_process_data(struct relay_connection *conn)
+static void relay_writer_write_item(struct relay_writer *writer,
+		struct relay_write_item *item)
 {
-	int ret = 0, rotate_index = 0;
-	ssize_t size_ret;
+	int ret;
 	struct relay_stream *stream;
-	struct lttcomm_relayd_data_hdr data_hdr;
-	uint64_t stream_id;
-	uint64_t net_seq_num;
-	uint32_t data_size;
-	struct relay_session *session;
-	bool new_stream = false, close_requested = false;
-	size_t chunk_size = RECV_DATA_BUFFER_SIZE;
-	size_t recv_off = 0;
-	char data_buffer[chunk_size];
-
-	ret = conn->sock->ops->recvmsg(conn->sock, &data_hdr,
-			sizeof(struct lttcomm_relayd_data_hdr), 0);
-	if (ret <= 0) {
-		if (ret == 0) {
-			/* Orderly shutdown. Not necessary to print an error. */
-			DBG("Socket %d did an orderly shutdown", conn->sock->fd);
-		} else {
-			ERR("Unable to receive data header on sock %d", conn->sock->fd);
-		}
-		ret = -1;
+	bool new_stream = false;
+
+	if (item->header.net_seq_num == RELAYD_DATA_BUNDLE_SEQ_NUM) {
+		ret = write_data_bundle(&writer->stats, item->conn, item->data,
+				item->header.data_size);
 		goto end;
 	}
 
-	stream_id = be64toh(data_hdr.stream_id);
-	stream = stream_get_by_id(stream_id);
+	stream = stream_get_by_id(item->header.stream_id);
 	if (!stream) {
-		ERR("relay_process_data: Cannot find stream %" PRIu64, stream_id);
+		ERR("relay_process_data: Cannot find stream %" PRIu64,
+				item->header.stream_id);
 		ret = -1;
 		goto end;
 	}
-	session = stream->trace->session;
-	data_size = be32toh(data_hdr.data_size);
-
-	net_seq_num = be64toh(data_hdr.net_seq_num);
-
-	DBG3("Receiving data of size %u for stream id %" PRIu64 " seqnum %" PRIu64,
-		data_size, stream_id, net_seq_num);
-
 	pthread_mutex_lock(&stream->lock);
+	ret = stream_write_packet(&writer->stats, stream, &item->header,
+			item->data, &new_stream);
+	stream_unlock_after_packets(stream, new_stream);
+	stream_put(stream);
+end:
+	if (ret < 0) {
+		ERR("Writer %u failed to write data received on sock %d",
+				writer->index, item->conn->sock->fd);
+		uatomic_set(&item->conn->data_state.write_error, 1);
+		/* Have the connection closed without waiting for more data. */
+		relay_worker_wakeup(CMM_LOAD_SHARED(item->conn->worker));
+	}
+	connection_put(item->conn);
+	write_memory_release(item->header.data_size);
+	free(item);
+}
 
-	/* Check if a rotation is needed. */
-	if (stream->tracefile_size > 0 &&
-			(stream->tracefile_size_current + data_size) >
-			stream->tracefile_size) {
-		uint64_t old_id, new_id;
+/*
+ * Writer thread writing the data queued by the worker threads. It exits
+ * once stopped by stop_relay_writers() and its queue is empty.
+ */
+static void *relay_thread_writer(void *data)
+{
+	struct relay_writer *writer = data;
+	struct cds_wfcq_node *node;
 
-		old_id = tracefile_array_get_file_index_head(stream->tfa);
-		tracefile_array_file_rotate(stream->tfa);
+	DBG("[thread] Relay writer %u started", writer->index);
 
-		/* new_id is updated by utils_rotate_stream_file. */
-		new_id = old_id;
+	rcu_register_thread();
 
-		ret = utils_rotate_stream_file(stream->path_name,
-				stream->channel_name, stream->tracefile_size,
-				stream->tracefile_count, -1,
-			        -1, stream->stream_fd->fd,
-				&new_id, &stream->stream_fd->fd);
-		if (ret < 0) {
-			ERR("Rotating stream output file");
-			goto end_stream_unlock;
-		}
-		/*
-		 * Reset current size because we just performed a stream
-		 * rotation.
-		 */
-		stream->tracefile_size_current = 0;
-		rotate_index = 1;
-	}
+	health_register(health_relayd, HEALTH_RELAYD_TYPE_WRITER);
 
-	/*
-	 * Index are handled in protocol version 2.4 and above. Also,
-	 * snapshot and index are NOT supported.
-	 */
-	if (session->minor >= 4 && !session->snapshot) {
-		ret = handle_index_data(stream, net_seq_num, rotate_index);
-		if (ret < 0) {
-			ERR("handle_index_data: fail stream %" PRIu64 " net_seq_num %" PRIu64 " ret %d",
-					stream->stream_handle, net_seq_num, ret);
-			goto end_stream_unlock;
-		}
-	}
+	for (;;) {
+		health_code_update();
 
-	for (recv_off = 0; recv_off < data_size; recv_off += chunk_size) {
-		size_t recv_size = min(data_size - recv_off, chunk_size);
+		/* Atomically prepare the queue futex */
+		futex_nto1_prepare(&writer->futex);
 
-		ret = conn->sock->ops->recvmsg(conn->sock, data_buffer, recv_size, 0);
-		if (ret <= 0) {
-			if (ret == 0) {
-				/* Orderly shutdown. Not necessary to print an error. */
-				DBG("Socket %d did an orderly shutdown", conn->sock->fd);
-			} else {
-				ERR("Socket %d error %d", conn->sock->fd, ret);
-			}
-			ret = -1;
-			goto end_stream_unlock;
+		while ((node = cds_wfcq_dequeue_blocking(&writer->head,
+				&writer->tail))) {
+			health_code_update();
+			relay_writer_write_item(writer, caa_container_of(node,
+					struct relay_write_item, node));
 		}
 
-		/* Write data to stream output fd. */
-		size_ret = lttng_write(stream->stream_fd->fd, data_buffer,
-				recv_size);
-		if (size_ret < recv_size) {
-			ERR("Relay error writing data to file");
-			ret = -1;
-			goto end_stream_unlock;
+		if (CMM_LOAD_SHARED(writer_thread_exit)) {
+			break;
 		}
 
-		DBG2("Relay wrote %zd bytes to tracefile for stream id %" PRIu64,
-				size_ret, stream->stream_handle);
+		health_poll_entry();
+		futex_nto1_wait(&writer->futex);
+		health_poll_exit();
 	}
 
-	ret = write_padding_to_file(stream->stream_fd->fd,
-			be32toh(data_hdr.padding_size));
-	if (ret < 0) {
-		ERR("write_padding_to_file: fail stream %" PRIu64 " net_seq_num %" PRIu64 " ret %d",
-				stream->stream_handle, net_seq_num, ret);
-		goto end_stream_unlock;
-	}
-	stream->tracefile_size_current +=
-			data_size + be32toh(data_hdr.padding_size);
-	if (stream->prev_seq == -1ULL) {
-		new_stream = true;
-	}
+	DBG("Writer thread %u cleanup complete", writer->index);
+	health_unregister(health_relayd);
+	rcu_unregister_thread();
+	return NULL;
+}
 
-	stream->prev_seq = net_seq_num;
+/*
+ * relay_process_data: Process the data available on the data socket
+ *
+ * Only the bytes which can be read without blocking are processed; the
+ * state of a partially received packet is kept in the connection so a slow
+ * sender never stalls the worker thread.
+ *
+ * handoff_worker is set if the connection must be handed off to another
+ * worker thread, in which case it must not be processed any further by the
+ * current one. The waiting_write_memory flag of the connection is set if it
+ * must not be polled until the writer threads release write memory.
+ *
+ * Return 0 on success else a negative value, in which case the connection
+ * must be closed.
+ */
+static int relay_process_data(struct relay_connection *conn,
+		struct relay_worker **handoff_worker)
+{
+	int ret;
 
-end_stream_unlock:
-	close_requested = stream->close_requested;
-	pthread_mutex_unlock(&stream->lock);
-	if (close_requested) {
-		try_stream_close(stream);
+	*handoff_worker = NULL;
+	if (uatomic_read(&conn->data_state.write_error)) {
+		ret = -1;
+		goto end;
 	}
-
-	if (new_stream) {
-		pthread_mutex_lock(&session->lock);
-		uatomic_set(&session->new_streams, 1);
-		pthread_mutex_unlock(&session->lock);
+	if (conn->data_state.id == DATA_CONNECTION_STATE_RECEIVE_HEADER) {
+		ret = relay_process_data_receive_header(conn, handoff_worker);
+		if (ret < 0 || *handoff_worker || conn->data_state.id ==
+				DATA_CONNECTION_STATE_RECEIVE_HEADER) {
+			goto end;
+		}
+	}
+	/* Carry on with the payload which often arrives with its header. */
+	if (nr_relay_writers) {
+		ret = relay_process_data_receive_write_item(conn);
+	} else if (conn->data_state.id == DATA_CONNECTION_STATE_RECEIVE_BUNDLE) {
+		ret = relay_process_data_receive_bundle(conn);
+	} else {
+		ret = relay_process_data_receive_payload(conn);
 	}
-	stream_put(stream);
 end:
 	return ret;
 }
@@ -2433,10 +3817,149 @@ static void relay_thread_close_connection(struct lttng_poll_event *events,
 		type_str = "Unknown";
 	}
 	cleanup_connection_pollfd(events, pollfd);
+	if (conn->worker) {
+		uatomic_dec(&conn->worker->stats.nr_connections);
+		if (conn->data_state.waiting_write_memory) {
+			uatomic_dec(&conn->worker->nr_write_memory_waiters);
+		}
+	}
+	relay_data_discard_write_item(conn);
+	/*
+	 * The writer threads may hold the connection a while longer; its
+	 * closed socket must not be found, nor its fd collide, in the table.
+	 */
+	if (conn->in_socket_ht) {
+		connection_ht_del(conn);
+	}
 	connection_put(conn);
 	DBG("%s connection closed with %d", type_str, pollfd);
 }
 
+/*
+ * Resume polling a data connection waiting for write memory if memory can
+ * now be reserved for its payload. On error, the connection is flagged to
+ * be closed on its next poll event.
+ */
+static void relay_thread_retry_write_memory(struct relay_worker *worker,
+		struct lttng_poll_event *events, struct relay_connection *conn)
+{
+	struct data_connection_state *state = &conn->data_state;
+
+	state->waiting_write_memory = false;
+	if (relay_data_alloc_write_item(conn)) {
+		uatomic_set(&state->write_error, 1);
+	} else if (state->waiting_write_memory) {
+		return;
+	}
+	uatomic_dec(&worker->nr_write_memory_waiters);
+	(void) lttng_poll_mod(events, conn->sock->fd, LPOLLIN | LPOLLRDHUP);
+}
+
+/*
+ * Stop polling a data connection until the writer threads release enough
+ * write memory for its payload.
+ */
+static void relay_thread_wait_write_memory(struct relay_worker *worker,
+		struct lttng_poll_event *events, struct relay_connection *conn)
+{
+	DBG3("Data connection %d waiting for write memory", conn->sock->fd);
+	worker->stats.nr_write_memory_waits++;
+	(void) lttng_poll_mod(events, conn->sock->fd, 0);
+	uatomic_inc(&worker->nr_write_memory_waiters);
+	/*
+	 * Paired with the barrier of write_memory_release(): either the
+	 * memory released is seen here or the waiter is seen there.
+	 */
+	cmm_smp_mb();
+	relay_thread_retry_write_memory(worker, events, conn);
+}
+
+/*
+ * Resume the data connections of a worker waiting for write memory, as long
+ * as memory can be reserved for them.
+ */
+static void relay_thread_resume_write_memory_waiters(
+		struct relay_worker *worker, struct lttng_poll_event *events,
+		struct lttng_ht *relay_connections_ht)
+{
+	struct lttng_ht_iter iter;
+	struct relay_connection *conn;
+
+	uatomic_set(&worker->write_memory_wakeup_pending, 0);
+	/* Order the wakeup acknowledgement before the reservations. */
+	cmm_smp_mb();
+
+	rcu_read_lock();
+	cds_lfht_for_each_entry(relay_connections_ht->ht, &iter.iter, conn,
+			sock_n.node) {
+		if (conn->type != RELAY_DATA ||
+				!conn->data_state.waiting_write_memory) {
+			continue;
+		}
+		relay_thread_retry_write_memory(worker, events, conn);
+		if (conn->data_state.waiting_write_memory) {
+			/* The budget is exhausted again. */
+			break;
+		}
+	}
+	rcu_read_unlock();
+}
+
+/*
+ * Close the data connections of a worker on which a writer thread failed to
+ * write data.
+ */
+static void relay_thread_close_write_errors(struct lttng_poll_event *events,
+		struct lttng_ht *relay_connections_ht)
+{
+	struct lttng_ht_iter iter;
+	struct relay_connection *conn;
+
+	rcu_read_lock();
+	cds_lfht_for_each_entry(relay_connections_ht->ht, &iter.iter, conn,
+			sock_n.node) {
+		if (conn->type != RELAY_DATA ||
+				!uatomic_read(&conn->data_state.write_error)) {
+			continue;
+		}
+		relay_thread_close_connection(events, conn->sock->fd, conn);
+	}
+	rcu_read_unlock();
+}
+
+/*
+ * Hand off a data connection to the worker thread handling its session.
+ * The connection is removed from the poll set and connection table of the
+ * current worker and its reference is transferred to the target worker.
+ */
+static void relay_thread_handoff_connection(struct relay_worker *worker,
+		struct lttng_poll_event *events, struct relay_connection *conn,
+		struct relay_worker *target)
+{
+	ssize_t ret;
+	int pollfd = conn->sock->fd;
+
+	DBG("Handing off data connection %d from worker %u to worker %u",
+			pollfd, worker->index, target->index);
+
+	(void) lttng_poll_del(events, pollfd);
+	/*
+	 * Only the worker owning a connection table looks it up, so the
+	 * connection can be added to the table of the target right away.
+	 */
+	connection_ht_del(conn);
+	uatomic_dec(&worker->stats.nr_connections);
+	uatomic_inc(&target->stats.nr_connections);
+	worker->stats.nr_handoffs++;
+
+	ret = lttng_write(target->conn_pipe[1], &conn, sizeof(conn));
+	if (ret != sizeof(conn)) {
+		PERROR("write connection pipe");
+		uatomic_dec(&target->stats.nr_connections);
+		connection_put(conn);
+	}
+}
+
 /*
  * This thread does the actual work
  */
@@ -2449,8 +3972,9 @@ static void *relay_thread_worker(void *data)
 	struct lttng_ht_iter iter;
 	struct lttcomm_relayd_hdr recv_hdr;
 	struct relay_connection *destroy_conn = NULL;
+	struct relay_worker *worker = data;
 
-	DBG("[thread] Relay worker started");
+	DBG("[thread] Relay worker %u started", worker->index);
 
 	rcu_register_thread();
 
@@ -2473,7 +3997,7 @@ static void *relay_thread_worker(void *data)
 		goto error_poll_create;
 	}
 
-	ret = lttng_poll_add(&events, relay_conn_pipe[0], LPOLLIN | LPOLLRDHUP);
+	ret = lttng_poll_add(&events, worker->conn_pipe[0], LPOLLIN | LPOLLRDHUP);
 	if (ret < 0) {
 		goto error;
 	}
@@ -2529,14 +4053,27 @@ restart:
 			}
 
 			/* Inspect the relay conn pipe for new connection */
-			if (pollfd == relay_conn_pipe[0]) {
+			if (pollfd == worker->conn_pipe[0]) {
 				if (revents & LPOLLIN) {
 					struct relay_connection *conn;
 
-					ret = lttng_read(relay_conn_pipe[0], &conn, sizeof(conn));
+					ret = lttng_read(worker->conn_pipe[0], &conn, sizeof(conn));
 					if (ret < 0) {
 						goto error;
 					}
+					if (!conn) {
+						/*
+						 * Write memory was released or a
+						 * writer thread failed.
+						 */
+						relay_thread_resume_write_memory_waiters(
+								worker, &events,
+								relay_connections_ht);
+						relay_thread_close_write_errors(&events,
+								relay_connections_ht);
+						continue;
+					}
+					conn->worker = worker;
 					lttng_poll_add(&events, conn->sock->fd,
 							LPOLLIN | LPOLLRDHUP);
 					connection_ht_add(relay_connections_ht, conn);
@@ -2576,6 +4113,7 @@ restart:
 						relay_thread_close_connection(&events, pollfd,
 								ctrl_conn);
 					} else {
+						worker->stats.nr_control_cmds++;
 						ret = relay_process_control(&recv_hdr, ctrl_conn);
 						if (ret < 0) {
 							/* Clear the session on error. */
@@ -2637,7 +4175,7 @@ restart:
 			}
 
 			/* Skip the command pipe. It's handled in the first loop. */
-			if (pollfd == relay_conn_pipe[0]) {
+			if (pollfd == worker->conn_pipe[0]) {
 				continue;
 			}
 
@@ -2652,7 +4190,11 @@ restart:
 			assert(data_conn->type == RELAY_DATA);
 
 			if (revents & LPOLLIN) {
-				ret = relay_process_data(data_conn);
+				struct relay_worker *handoff_worker;
+				bool was_waiting =
+						data_conn->data_state.waiting_write_memory;
+
+				ret = relay_process_data(data_conn, &handoff_worker);
 				/* Connection closed */
 				if (ret < 0) {
 					relay_thread_close_connection(&events, pollfd,
@@ -2662,7 +4204,17 @@ restart:
 					 * here we don't really care since we gracefully
 					 * continue the loop after the connection is deleted.
 					 */
+				} else if (handoff_worker) {
+					/* The session is handled by another worker. */
+					relay_thread_handoff_connection(worker,
+							&events, data_conn,
+							handoff_worker);
 				} else {
+					if (!was_waiting && data_conn->
+							data_state.waiting_write_memory) {
+						relay_thread_wait_write_memory(worker,
+								&events, data_conn);
+					}
 					/* Keep last seen port. */
 					last_seen_data_fd = pollfd;
 					connection_put(data_conn);
@@ -2710,12 +4262,10 @@ error:
 error_poll_create:
 	lttng_ht_destroy(relay_connections_ht);
 relay_connections_ht_error:
-	/* Close relay conn pipes */
-	utils_close_pipe(relay_conn_pipe);
 	if (err) {
 		DBG("Thread exited with error");
 	}
-	DBG("Worker thread cleanup complete");
+	DBG("Worker thread %u cleanup complete", worker->index);
 error_testpoint:
 	if (err) {
 		health_error();
@@ -2727,25 +4277,13 @@ error_testpoint:
 	return NULL;
 }
 
-/*
- * Create the relay command pipe to wake thread_manage_apps.
- * Closed in cleanup().
- */
-static int create_relay_conn_pipe(void)
-{
-	int ret;
-
-	ret = utils_create_pipe_cloexec(relay_conn_pipe);
-
-	return ret;
-}
-
 /*
  * main
  */
 int main(int argc, char **argv)
 {
 	int ret = 0, retval = 0;
+	unsigned int i, nr_workers_started = 0, nr_writers_started = 0;
 	void *status;
 
 	/* Parse arguments */
@@ -2812,8 +4350,13 @@ int main(int argc, char **argv)
 		goto exit_init_data;
 	}
 
-	/* Setup the thread apps communication pipe. */
-	if (create_relay_conn_pipe()) {
+	/* Setup the worker threads communication pipes. */
+	if (init_relay_workers()) {
+		retval = -1;
+		goto exit_init_data;
+	}
+
+	if (init_relay_writers()) {
 		retval = -1;
 		goto exit_init_data;
 	}
@@ -2872,14 +4415,34 @@ int main(int argc, char **argv)
 		goto exit_dispatcher_thread;
 	}
 
-	/* Setup the worker thread */
-	ret = pthread_create(&worker_thread, default_pthread_attr(),
-			relay_thread_worker, NULL);
-	if (ret) {
-		errno = ret;
-		PERROR("pthread_create worker");
-		retval = -1;
-		goto exit_worker_thread;
+	/* Setup the writer threads, before the workers queuing to them. */
+	for (nr_writers_started = 0; nr_writers_started < nr_relay_writers;
+			nr_writers_started++) {
+		struct relay_writer *writer = &relay_writers[nr_writers_started];
+
+		ret = pthread_create(&writer->thread, default_pthread_attr(),
+				relay_thread_writer, writer);
+		if (ret) {
+			errno = ret;
+			PERROR("pthread_create writer");
+			retval = -1;
+			goto exit_writer_thread;
+		}
+	}
+
+	/* Setup the worker threads */
+	for (nr_workers_started = 0; nr_workers_started < nr_relay_workers;
+			nr_workers_started++) {
+		struct relay_worker *worker = &relay_workers[nr_workers_started];
+
+		ret = pthread_create(&worker->thread, default_pthread_attr(),
+				relay_thread_worker, worker);
+		if (ret) {
+			errno = ret;
+			PERROR("pthread_create worker");
+			retval = -1;
+			goto exit_worker_thread;
+		}
 	}
 
 	/* Setup the listener thread */
@@ -2892,7 +4455,7 @@ int main(int argc, char **argv)
 		goto exit_listener_thread;
 	}
 
-	ret = relayd_live_create(live_uri);
+	ret = relayd_live_create(live_uri, opt_live_worker_threads);
 	if (ret) {
 		ERR("Starting live viewer threads");
 		retval = -1;
@@ -2918,14 +4481,27 @@ exit_live:
 	}
 
 exit_listener_thread:
-	ret = pthread_join(worker_thread, &status);
-	if (ret) {
-		errno = ret;
-		PERROR("pthread_join worker_thread");
-		retval = -1;
+exit_worker_thread:
+	for (i = 0; i < nr_workers_started; i++) {
+		ret = pthread_join(relay_workers[i].thread, &status);
+		if (ret) {
+			errno = ret;
+			PERROR("pthread_join worker_thread");
+			retval = -1;
+		}
+	}
+
+exit_writer_thread:
+	stop_relay_writers();
+	for (i = 0; i < nr_writers_started; i++) {
+		ret = pthread_join(relay_writers[i].thread, &status);
+		if (ret) {
+			errno = ret;
+			PERROR("pthread_join writer_thread");
+			retval = -1;
+		}
 	}
 
-exit_worker_thread:
 	ret = pthread_join(dispatcher_thread, &status);
 	if (ret) {
 		errno = ret;
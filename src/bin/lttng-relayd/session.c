@@ -23,6 +23,7 @@
 
 #include "lttng-relayd.h"
 #include "ctf-trace.h"
+#include "live.h"
 #include "session.h"
 #include "stream.h"
 
@@ -204,6 +205,7 @@ unlock:
 	if (ret) {
 		return ret;
 	}
+	relayd_live_notify_index(session);
 
 	rcu_read_lock();
 	cds_lfht_for_each_entry(session->ctf_traces_ht->ht,
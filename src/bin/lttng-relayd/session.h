@@ -46,6 +46,12 @@ struct relay_session {
 	/* Session in snapshot mode. */
 	bool snapshot;
 
+	/*
+	 * Index of the worker thread handling the connections of the
+	 * session. Set at creation and never changed afterwards.
+	 */
+	unsigned int worker_index;
+
 	/*
 	 * Session has no back reference to its connection because it
 	 * has a life-time that can be longer than the consumer connection's
@@ -97,6 +103,12 @@ struct relay_session {
 	 */
 	unsigned long new_streams;
 
+	/*
+	 * Number of viewer connections waiting for an index of this
+	 * session to be published. Updated atomically by the live workers.
+	 */
+	unsigned long nr_index_waiters;
+
 	/*
 	 * Node in the global session hash table.
 	 */
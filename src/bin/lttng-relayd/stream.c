@@ -21,11 +21,13 @@
 #include <common/common.h>
 #include <common/utils.h>
 #include <common/defaults.h>
+#include <common/index/tracefile-prepare.h>
 #include <urcu/rculist.h>
 #include <sys/stat.h>
 
 #include "lttng-relayd.h"
 #include "index.h"
+#include "live.h"
 #include "stream.h"
 #include "viewer-stream.h"
 
@@ -151,6 +153,7 @@ struct relay_stream *stream_create(struct ctf_trace *trace,
 	if (!strncmp(stream->channel_name, DEFAULT_METADATA_NAME, LTTNG_NAME_MAX)) {
 		stream->is_metadata = 1;
 	}
+	stream_prepare_next_tracefile(stream);
 
 	stream->in_recv_list = true;
 
@@ -303,6 +306,10 @@ static void stream_release(struct urcu_ref *ref)
 	stream_unpublish(stream);
 
 	if (stream->stream_fd) {
+		/* Free the blocks allocated past the end of the tracefile. */
+		if (stream->tracefile_prepared) {
+			(void) utils_trim_stream_file(stream->stream_fd->fd);
+		}
 		stream_fd_put(stream->stream_fd);
 		stream->stream_fd = NULL;
 	}
@@ -310,6 +317,12 @@ static void stream_release(struct urcu_ref *ref)
 		lttng_index_file_put(stream->index_file);
 		stream->index_file = NULL;
 	}
+	if (stream->prepared_index_file) {
+		lttng_index_file_put(stream->prepared_index_file);
+		stream->prepared_index_file = NULL;
+	}
+	tracefile_prepare_destroy(stream->tracefile_prepare);
+	stream->tracefile_prepare = NULL;
 	if (stream->trace) {
 		ctf_trace_put(stream->trace);
 		stream->trace = NULL;
@@ -424,6 +437,8 @@ void try_stream_close(struct relay_stream *stream)
 	stream->closed = true;
 	/* Relay indexes are only used by the "consumer/sessiond" end. */
 	relay_index_close_all(stream);
+	/* Viewers waiting on the stream can now be told it hung up. */
+	relayd_live_notify_index(stream->trace->session);
 	pthread_mutex_unlock(&stream->lock);
 	DBG("Succeeded in closing stream %" PRIu64, stream->stream_handle);
 	stream_put(stream);
@@ -450,6 +465,56 @@ static void print_stream_indexes(struct relay_stream *stream)
 	rcu_read_unlock();
 }
 
+/*
+ * Return true if the tracefiles of a stream in tracefile rotation are
+ * truncated in place rather than unlinked. Live viewers may be reading the
+ * tracefiles of live sessions, which are thus always unlinked.
+ */
+bool stream_reuse_tracefiles(struct relay_stream *stream)
+{
+	return opt_tracefile_reuse && stream->tracefile_count > 0 &&
+			stream->trace->session->live_timer == 0;
+}
+
+/*
+ * Start preparing, in the background, the tracefile following the current
+ * one of a stream split in many tracefiles.
+ *
+ * Called with the stream lock held, or before the stream is published.
+ */
+void stream_prepare_next_tracefile(struct relay_stream *stream)
+{
+	uint64_t head, next_id;
+	struct relay_session *session = stream->trace->session;
+
+	/* Reused tracefiles are not replaced by prepared ones. */
+	if (!stream->tracefile_size || stream->is_metadata ||
+			stream_reuse_tracefiles(stream)) {
+		return;
+	}
+
+	if (!stream->tracefile_prepare) {
+		/* Index are handled as in handle_index_data(). */
+		stream->tracefile_prepare = tracefile_prepare_create(
+				stream->path_name, stream->channel_name,
+				stream->tracefile_size, -1, -1,
+				session->minor >= 4 && !session->snapshot,
+				lttng_to_index_major(session->major,
+					session->minor),
+				lttng_to_index_minor(session->major,
+					session->minor));
+		if (!stream->tracefile_prepare) {
+			/* The tracefiles are created on rotation. */
+			return;
+		}
+	}
+
+	head = tracefile_array_get_file_index_head(stream->tfa);
+	next_id = stream->tracefile_count ?
+			(head + 1) % stream->tracefile_count : head + 1;
+	tracefile_prepare_next(stream->tracefile_prepare, next_id);
+}
+
 void print_relay_streams(void)
 {
 	struct lttng_ht_iter iter;
@@ -60,6 +60,18 @@ struct relay_stream {
 	struct stream_fd *stream_fd;
 	/* index file on which to write the index data. */
 	struct lttng_index_file *index_file;
+	/*
+	 * Background preparation of the next tracefile when the stream is
+	 * split in many tracefiles, and index file prepared along with the
+	 * current tracefile, used when its first index is received.
+	 */
+	struct tracefile_prepare *tracefile_prepare;
+	struct lttng_index_file *prepared_index_file;
+	/*
+	 * The current tracefile was taken from the preparation and has blocks
+	 * allocated past its end, which are freed when it is closed.
+	 */
+	bool tracefile_prepared;
 
 	char *path_name;
 	char *channel_name;
@@ -146,6 +158,8 @@ struct relay_stream *stream_get_by_id(uint64_t stream_id);
 bool stream_get(struct relay_stream *stream);
 void stream_put(struct relay_stream *stream);
 void try_stream_close(struct relay_stream *stream);
+bool stream_reuse_tracefiles(struct relay_stream *stream);
+void stream_prepare_next_tracefile(struct relay_stream *stream);
 void stream_publish(struct relay_stream *stream);
 void print_relay_streams(void);
 
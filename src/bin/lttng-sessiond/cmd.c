@@ -876,7 +876,7 @@ static int create_connect_relayd(struct lttng_uri *uri,
 		DBG3("Creating relayd stream socket from URI");
 
 		/* Check relayd version */
-		ret = relayd_version_check(rsock);
+		ret = relayd_version_check(rsock, &consumer->relay_capabilities);
 		if (ret < 0) {
 			ret = LTTNG_ERR_RELAYD_VERSION_FAIL;
 			goto close_sock;
@@ -1057,6 +1057,8 @@ int cmd_setup_relayd(struct ltt_session *session)
 			usess->consumer->relay_major_version;
 		session->consumer->relay_minor_version =
 			usess->consumer->relay_minor_version;
+		session->consumer->relay_capabilities =
+			usess->consumer->relay_capabilities;
 	}
 
 	if (ksess && ksess->consumer && ksess->consumer->type == CONSUMER_DST_NET
@@ -1079,6 +1081,8 @@ int cmd_setup_relayd(struct ltt_session *session)
 			ksess->consumer->relay_major_version;
 		session->consumer->relay_minor_version =
 			ksess->consumer->relay_minor_version;
+		session->consumer->relay_capabilities =
+			ksess->consumer->relay_capabilities;
 	}
 
 error:
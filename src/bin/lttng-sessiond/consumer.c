@@ -565,6 +565,7 @@ struct consumer_output *consumer_copy_output(struct consumer_output *obj)
 	output->snapshot = obj->snapshot;
 	output->relay_major_version = obj->relay_major_version;
 	output->relay_minor_version = obj->relay_minor_version;
+	output->relay_capabilities = obj->relay_capabilities;
 	memcpy(&output->dst, &obj->dst, sizeof(output->dst));
 	ret = consumer_copy_sockets(output, obj);
 	if (ret < 0) {
@@ -1033,6 +1034,7 @@ int consumer_send_relayd_socket(struct consumer_socket *consumer_sock,
 	msg.u.relayd_sock.net_index = consumer->net_seq_index;
 	msg.u.relayd_sock.type = type;
 	msg.u.relayd_sock.session_id = session_id;
+	msg.u.relayd_sock.relayd_capabilities = consumer->relay_capabilities;
 	memcpy(&msg.u.relayd_sock.sock, rsock, sizeof(msg.u.relayd_sock.sock));
 
 	DBG3("Sending relayd sock info to consumer on %d", *consumer_sock->fd_ptr);
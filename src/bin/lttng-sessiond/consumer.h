@@ -161,6 +161,8 @@ struct consumer_output {
 	/* Store the relay protocol in use if the session is remote. */
 	uint32_t relay_major_version;
 	uint32_t relay_minor_version;
+	/* RELAYD_CAPABILITY_* negotiated with the relay. */
+	uint32_t relay_capabilities;
 
 	/*
 	 * Subdirectory path name used for both local and network consumer.
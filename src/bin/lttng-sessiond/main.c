@@ -711,6 +711,7 @@ static void sessiond_cleanup(void)
 	DBG("Closing all UST sockets");
 	ust_app_clean_list();
 	buffer_reg_destroy_registries();
+	ust_metadata_fragment_cache_destroy();
 
 	if (is_root && !opt_no_kernel) {
 		DBG2("Closing kernel fd");
@@ -543,6 +543,11 @@ int ust_app_release_object(struct ust_app *app, struct lttng_ust_object_data *da
  * Must be called with the ust app session lock held.
  * Must be called with the registry lock held.
  *
+ * Unless send_zero_data is set, which answers a metadata request of the
+ * consumer on its socket, concurrent pushes for the same registry are
+ * batched: a push waits for the one in progress and returns without sending
+ * anything if the latter covered all the metadata it had to push.
+ *
  * On success, return the len of metadata pushed or else a negative value.
  * Returning a -EPIPE return value means we could not send the metadata,
  * but it can be caused by recoverable errors (e.g. the application has
@@ -556,6 +561,7 @@ ssize_t ust_app_push_metadata(struct ust_registry_session *registry,
 	size_t len, offset, new_metadata_len_sent;
 	ssize_t ret_val;
 	uint64_t metadata_key, metadata_version;
+	bool batch = false;
 
 	assert(registry);
 	assert(socket);
@@ -570,6 +576,29 @@ ssize_t ust_app_push_metadata(struct ust_registry_session *registry,
 		return 0;
 	}
 
+	if (!send_zero_data) {
+		size_t target_len = registry->metadata_len;
+
+		/*
+		 * The push in progress may already cover what we have to push.
+		 * Otherwise, the first waiter to get the lock pushes everything
+		 * generated meanwhile on behalf of the others.
+		 */
+		while (registry->metadata_push_in_progress) {
+			pthread_cond_wait(&registry->metadata_push_cond,
+					&registry->lock);
+		}
+		if (registry->metadata_closed) {
+			return -EPIPE;
+		}
+		if (registry->metadata_len_sent >= target_len) {
+			DBG3("Metadata of key %" PRIu64 " pushed concurrently",
+					registry->metadata_key);
+			return 0;
+		}
+		batch = true;
+	}
+
 	offset = registry->metadata_len_sent;
 	len = registry->metadata_len - registry->metadata_len_sent;
 	new_metadata_len_sent = registry->metadata_len;
@@ -596,6 +625,9 @@ ssize_t ust_app_push_metadata(struct ust_registry_session *registry,
 	memcpy(metadata_str, registry->metadata + offset, len);
 
 push_data:
+	if (batch) {
+		registry->metadata_push_in_progress = 1;
+	}
 	pthread_mutex_unlock(&registry->lock);
 	/*
 	 * We need to unlock the registry while we push metadata to
@@ -612,6 +644,10 @@ push_data:
 	ret = consumer_push_metadata(socket, metadata_key,
 			metadata_str, len, offset, metadata_version);
 	pthread_mutex_lock(&registry->lock);
+	if (batch) {
+		registry->metadata_push_in_progress = 0;
+		pthread_cond_broadcast(&registry->metadata_push_cond);
+	}
 	if (ret < 0) {
 		/*
 		 * There is an acceptable race here between the registry
@@ -27,8 +27,11 @@
 #include <limits.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <common/common.h>
 #include <common/time.h>
+#include <common/hashtable/hashtable.h>
+#include <common/hashtable/utils.h>
 
 #include "ust-registry.h"
 #include "ust-clock.h"
@@ -40,11 +43,41 @@
 
 #define NR_CLOCK_OFFSET_SAMPLES		10
 
+/* Total size of the fragments kept by the fragment cache. */
+#define METADATA_FRAGMENT_CACHE_MAX_SIZE	(16 * 1024 * 1024)
+
 struct offset_sample {
 	int64_t offset;			/* correlation offset */
 	uint64_t measure_delta;		/* lower is better */
 };
 
+/*
+ * Rendered TSDL declaration of the fields of an event. With per-PID buffers,
+ * every instance of an application registers the same events in its own
+ * registry: the declaration of their fields is rendered once and copied in
+ * the metadata of the others.
+ */
+struct metadata_fragment {
+	/* Signature of the fields the TSDL is rendered from. */
+	const void *key;
+	size_t key_len;
+	const char *tsdl;
+	size_t tsdl_len;
+	struct lttng_ht_node_u64 node;
+	/* The key and TSDL follow. */
+	char data[];
+};
+
+/* Fragment cache shared by the registries of all sessions. */
+static struct {
+	/* Protects the whole cache, nests within the registry locks. */
+	pthread_mutex_t lock;
+	struct lttng_ht *ht;
+	size_t size;
+} fragment_cache = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
 static
 int _lttng_field_statedump(struct ust_registry_session *session,
 		const struct ustctl_field *fields, size_t nr_fields,
@@ -91,15 +124,16 @@ int get_count_order(unsigned int count)
 }
 
 /*
- * Returns offset where to write in metadata array, or negative error value on error.
+ * Make room for len more bytes of metadata.
+ *
+ * Returns 0 on success, or negative error value on error.
  */
 static
-ssize_t metadata_reserve(struct ust_registry_session *session, size_t len)
+int metadata_grow(struct ust_registry_session *session, size_t len)
 {
 	size_t new_len = session->metadata_len + len;
 	size_t new_alloc_len = new_len;
 	size_t old_alloc_len = session->metadata_alloc_len;
-	ssize_t ret;
 
 	if (new_alloc_len > (UINT32_MAX >> 1))
 		return -EINVAL;
@@ -119,6 +153,20 @@ ssize_t metadata_reserve(struct ust_registry_session *session, size_t len)
 		memset(&session->metadata[old_alloc_len], 0, new_alloc_len - old_alloc_len);
 		session->metadata_alloc_len = new_alloc_len;
 	}
+	return 0;
+}
+
+/*
+ * Returns offset where to write in metadata array, or negative error value on error.
+ */
+static
+ssize_t metadata_reserve(struct ust_registry_session *session, size_t len)
+{
+	ssize_t ret;
+
+	ret = metadata_grow(session, len);
+	if (ret < 0)
+		return ret;
 	ret = session->metadata_len;
 	session->metadata_len += len;
 	return ret;
@@ -141,60 +189,102 @@ int metadata_file_append(struct ust_registry_session *session,
 	return 0;
 }
 
+/*
+ * Commit len bytes already written at the end of the metadata buffer.
+ */
+static
+int metadata_commit(struct ust_registry_session *session, size_t len)
+{
+	ssize_t offset;
+	int ret;
+
+	offset = metadata_reserve(session, len);
+	if (offset < 0) {
+		return offset;
+	}
+	ret = metadata_file_append(session, &session->metadata[offset], len);
+	if (ret) {
+		PERROR("Error appending to metadata file");
+		return ret;
+	}
+	DBG3("Append to metadata: \"%.*s\"", (int) len,
+			&session->metadata[offset]);
+	return 0;
+}
+
+/*
+ * Append a string of known length to the metadata.
+ */
+static
+int lttng_metadata_append(struct ust_registry_session *session,
+		const char *str, size_t len)
+{
+	int ret;
+
+	if (!len) {
+		return 0;
+	}
+	ret = metadata_grow(session, len);
+	if (ret) {
+		return ret;
+	}
+	memcpy(&session->metadata[session->metadata_len], str, len);
+	return metadata_commit(session, len);
+}
+
 /*
  * We have exclusive access to our metadata buffer (protected by the
  * ust_lock), so we can do racy operations such as looking for
  * remaining space left in packet and write, since mutual exclusion
  * protects us from concurrent writes.
+ *
+ * The string is formatted in place, at the end of the metadata buffer, which
+ * is only grown when the remaining space is too small.
  */
 static
 int lttng_metadata_printf(struct ust_registry_session *session,
 		const char *fmt, ...)
 {
-	char *str = NULL;
-	size_t len;
+	size_t room = session->metadata_alloc_len - session->metadata_len;
 	va_list ap;
-	ssize_t offset;
-	int ret;
+	int len, ret;
 
 	va_start(ap, fmt);
-	ret = vasprintf(&str, fmt, ap);
+	len = vsnprintf(room ? &session->metadata[session->metadata_len] : NULL,
+			room, fmt, ap);
 	va_end(ap);
-	if (ret < 0)
-		return -ENOMEM;
+	if (len < 0)
+		return -EINVAL;
 
-	len = strlen(str);
-	offset = metadata_reserve(session, len);
-	if (offset < 0) {
-		ret = offset;
-		goto end;
-	}
-	memcpy(&session->metadata[offset], str, len);
-	ret = metadata_file_append(session, str, len);
-	if (ret) {
-		PERROR("Error appending to metadata file");
-		goto end;
+	if (len >= room) {
+		/* Room for the terminating null byte as well. */
+		ret = metadata_grow(session, len + 1);
+		if (ret)
+			return ret;
+		va_start(ap, fmt);
+		len = vsnprintf(&session->metadata[session->metadata_len],
+				len + 1, fmt, ap);
+		va_end(ap);
+		if (len < 0)
+			return -EINVAL;
 	}
-	DBG3("Append to metadata: \"%s\"", str);
-	ret = 0;
-
-end:
-	free(str);
-	return ret;
+	return metadata_commit(session, len);
 }
 
 static
 int print_tabs(struct ust_registry_session *session, size_t nesting)
 {
-	size_t i;
+	static const char tabs[] = "\t\t\t\t\t\t\t\t";
 
-	for (i = 0; i < nesting; i++) {
+	while (nesting) {
+		size_t len = min(nesting, sizeof(tabs) - 1);
 		int ret;
 
-		ret = lttng_metadata_printf(session, "	");
+		ret = lttng_metadata_append(session, tabs, len);
 		if (ret) {
 			return ret;
 		}
+		nesting -= len;
 	}
 	return 0;
 }
@@ -265,41 +355,42 @@ int ust_metadata_enum_statedump(struct ust_registry_session *session,
 	/* Dump all entries */
 	for (i = 0; i < nr_entries; i++) {
 		const struct ustctl_enum_entry *entry = &entries[i];
-		int j, len;
+		int j, len, start;
 
 		ret = print_tabs(session, nesting);
 		if (ret) {
 			goto end;
 		}
-		ret = lttng_metadata_printf(session,
-				"\"");
+		ret = lttng_metadata_append(session, "\"", 1);
 		if (ret) {
 			goto end;
 		}
 		len = strlen(entry->string);
-		/* Escape the character '"' */
-		for (j = 0; j < len; j++) {
+		/* Escape the characters '"' and '\\', copy the others as is. */
+		for (j = 0, start = 0; j < len; j++) {
 			char c = entry->string[j];
 
-			switch (c) {
-			case '"':
-				ret = lttng_metadata_printf(session,
-						"\\\"");
-				break;
-			case '\\':
-				ret = lttng_metadata_printf(session,
-						"\\\\");
-				break;
-			default:
-				ret = lttng_metadata_printf(session,
-						"%c", c);
-				break;
+			if (c != '"' && c != '\\') {
+				continue;
+			}
+			ret = lttng_metadata_append(session,
+					&entry->string[start], j - start);
+			if (ret) {
+				goto end;
 			}
+			ret = lttng_metadata_append(session,
+					c == '"' ? "\\\"" : "\\\\", 2);
 			if (ret) {
 				goto end;
 			}
+			start = j + 1;
+		}
+		ret = lttng_metadata_append(session, &entry->string[start],
+				len - start);
+		if (ret) {
+			goto end;
 		}
-		ret = lttng_metadata_printf(session, "\"");
+		ret = lttng_metadata_append(session, "\"", 1);
 		if (ret) {
 			goto end;
 		}
@@ -613,13 +704,244 @@ int _lttng_context_metadata_statedump(struct ust_registry_session *session,
 	return ret;
 }
 
+struct fragment_key {
+	const void *data;
+	size_t len;
+};
+
+static
+int ht_match_fragment(struct cds_lfht_node *node, const void *_key)
+{
+	struct metadata_fragment *fragment;
+	const struct fragment_key *key = _key;
+
+	fragment = caa_container_of(node, struct metadata_fragment, node.node);
+	return fragment->key_len == key->len &&
+			!memcmp(fragment->key, key->data, key->len);
+}
+
+/*
+ * Build the signature of the fields of an event: everything their rendered
+ * TSDL depends on. That is the byte order of the session, the fields, and the
+ * entries of their enumerations, whose IDs are specific to the session.
+ *
+ * Return the signature, to be freed by the caller, or NULL if it could not
+ * be built.
+ *
+ * Called with session registry mutex held.
+ */
+static
+void *fragment_key_create(struct ust_registry_session *session,
+		struct ust_registry_event *event, size_t *key_len)
+{
+	size_t i, len, fields_len;
+	char *key = NULL, *pos;
+	struct ustctl_field *key_fields;
+
+	fields_len = event->nr_fields * sizeof(*event->fields);
+	len = sizeof(session->byte_order) + fields_len;
+
+	rcu_read_lock();
+	for (i = 0; i < event->nr_fields; i++) {
+		const struct ustctl_field *field = &event->fields[i];
+		struct ust_registry_enum *reg_enum;
+
+		if (field->type.atype != ustctl_atype_enum) {
+			continue;
+		}
+		reg_enum = ust_registry_lookup_enum_by_id(session,
+				field->type.u.basic.enumeration.name,
+				field->type.u.basic.enumeration.id);
+		if (!reg_enum) {
+			goto end;
+		}
+		len += sizeof(reg_enum->nr_entries) +
+				reg_enum->nr_entries * sizeof(*reg_enum->entries);
+	}
+
+	key = zmalloc(len);
+	if (!key) {
+		goto end;
+	}
+	pos = key;
+	memcpy(pos, &session->byte_order, sizeof(session->byte_order));
+	pos += sizeof(session->byte_order);
+	key_fields = (struct ustctl_field *) pos;
+	memcpy(pos, event->fields, fields_len);
+	pos += fields_len;
+	for (i = 0; i < event->nr_fields; i++) {
+		const struct ustctl_field *field = &event->fields[i];
+		struct ust_registry_enum *reg_enum;
+
+		if (field->type.atype != ustctl_atype_enum) {
+			continue;
+		}
+		/* Registry mutex held, the enumeration is still there. */
+		reg_enum = ust_registry_lookup_enum_by_id(session,
+				field->type.u.basic.enumeration.name,
+				field->type.u.basic.enumeration.id);
+		assert(reg_enum);
+		key_fields[i].type.u.basic.enumeration.id = 0;
+		memcpy(pos, &reg_enum->nr_entries, sizeof(reg_enum->nr_entries));
+		pos += sizeof(reg_enum->nr_entries);
+		memcpy(pos, reg_enum->entries,
+				reg_enum->nr_entries * sizeof(*reg_enum->entries));
+		pos += reg_enum->nr_entries * sizeof(*reg_enum->entries);
+	}
+	assert(pos == key + len);
+	*key_len = len;
+
+end:
+	rcu_read_unlock();
+	return key;
+}
+
+/*
+ * Append the cached TSDL of the fields matching a signature to the metadata.
+ *
+ * Return 1 if the fields are cached, 0 if not, or a negative value on error.
+ */
+static
+int fragment_cache_append(struct ust_registry_session *session,
+		const void *key, size_t key_len)
+{
+	int ret = 0;
+	struct fragment_key lookup = { .data = key, .len = key_len };
+	struct lttng_ht_iter iter;
+	struct cds_lfht_node *node = NULL;
+	struct metadata_fragment *fragment;
+
+	pthread_mutex_lock(&fragment_cache.lock);
+	if (fragment_cache.ht) {
+		rcu_read_lock();
+		cds_lfht_lookup(fragment_cache.ht->ht,
+				hash_key_buf(key, key_len, lttng_ht_seed),
+				ht_match_fragment, &lookup, &iter.iter);
+		node = cds_lfht_iter_get_node(&iter.iter);
+		rcu_read_unlock();
+	}
+	pthread_mutex_unlock(&fragment_cache.lock);
+	if (!node) {
+		goto end;
+	}
+
+	/*
+	 * Fragments are only freed when the cache is destroyed, on teardown,
+	 * so the TSDL is copied without holding the cache lock.
+	 */
+	fragment = caa_container_of(node, struct metadata_fragment, node.node);
+	ret = lttng_metadata_append(session, fragment->tsdl,
+			fragment->tsdl_len);
+	if (!ret) {
+		ret = 1;
+	}
+end:
+	return ret;
+}
+
+/*
+ * Keep a copy of the TSDL rendered for the fields matching a signature. The
+ * cache stops growing once it reaches its maximal size.
+ */
+static
+void fragment_cache_add(const void *key, size_t key_len,
+		const char *tsdl, size_t tsdl_len)
+{
+	struct fragment_key lookup = { .data = key, .len = key_len };
+	struct metadata_fragment *fragment;
+	struct cds_lfht_node *node;
+
+	pthread_mutex_lock(&fragment_cache.lock);
+	if (fragment_cache.size + key_len + tsdl_len >
+			METADATA_FRAGMENT_CACHE_MAX_SIZE) {
+		goto end;
+	}
+	if (!fragment_cache.ht) {
+		fragment_cache.ht = lttng_ht_new(0, LTTNG_HT_TYPE_U64);
+		if (!fragment_cache.ht) {
+			goto end;
+		}
+	}
+
+	fragment = zmalloc(sizeof(*fragment) + key_len + tsdl_len);
+	if (!fragment) {
+		goto end;
+	}
+	memcpy(fragment->data, key, key_len);
+	memcpy(fragment->data + key_len, tsdl, tsdl_len);
+	fragment->key = fragment->data;
+	fragment->key_len = key_len;
+	fragment->tsdl = fragment->data + key_len;
+	fragment->tsdl_len = tsdl_len;
+	lttng_ht_node_init_u64(&fragment->node, 0);
+
+	rcu_read_lock();
+	node = cds_lfht_add_unique(fragment_cache.ht->ht,
+			hash_key_buf(key, key_len, lttng_ht_seed),
+			ht_match_fragment, &lookup, &fragment->node.node);
+	rcu_read_unlock();
+	if (node != &fragment->node.node) {
+		/* Rendered concurrently for another session. */
+		free(fragment);
+		goto end;
+	}
+	fragment_cache.size += key_len + tsdl_len;
+end:
+	pthread_mutex_unlock(&fragment_cache.lock);
+}
+
+/*
+ * Destroy the fragment cache. No metadata must be generated concurrently.
+ */
+void ust_metadata_fragment_cache_destroy(void)
+{
+	struct lttng_ht_iter iter;
+	struct metadata_fragment *fragment;
+
+	if (!fragment_cache.ht) {
+		return;
+	}
+
+	rcu_read_lock();
+	cds_lfht_for_each_entry(fragment_cache.ht->ht, &iter.iter, fragment,
+			node.node) {
+		int ret;
+
+		ret = lttng_ht_del(fragment_cache.ht, &iter);
+		assert(!ret);
+		free(fragment);
+	}
+	rcu_read_unlock();
+	lttng_ht_destroy(fragment_cache.ht);
+	fragment_cache.ht = NULL;
+	fragment_cache.size = 0;
+}
+
+/*
+ * Called with session registry mutex held.
+ */
 static
 int _lttng_fields_metadata_statedump(struct ust_registry_session *session,
 		struct ust_registry_event *event)
 {
 	int ret = 0;
-	size_t i = 0;
+	size_t i = 0, start, key_len;
+	void *key;
 
+	/*
+	 * Without a signature, the fields are rendered as usual but not
+	 * cached.
+	 */
+	key = fragment_key_create(session, event, &key_len);
+	if (key) {
+		ret = fragment_cache_append(session, key, key_len);
+		if (ret) {
+			ret = ret < 0 ? ret : 0;
+			goto end;
+		}
+	}
+
+	start = session->metadata_len;
 	for (;;) {
 		if (i >= event->nr_fields) {
 			break;
@@ -627,9 +949,15 @@ int _lttng_fields_metadata_statedump(struct ust_registry_session *session,
 		ret = _lttng_field_statedump(session, event->fields,
 				event->nr_fields, &i, 2);
 		if (ret) {
-			break;
+			goto end;
 		}
 	}
+	if (key) {
+		fragment_cache_add(key, key_len, &session->metadata[start],
+				session->metadata_len - start);
+	}
+end:
+	free(key);
 	return ret;
 }
 
@@ -870,6 +870,7 @@ int ust_registry_session_init(struct ust_registry_session **sessionp,
 	}
 
 	pthread_mutex_init(&session->lock, NULL);
+	pthread_cond_init(&session->metadata_push_cond, NULL);
 	session->bits_per_long = bits_per_long;
 	session->uint8_t_alignment = uint8_t_alignment;
 	session->uint16_t_alignment = uint16_t_alignment;
@@ -975,6 +976,8 @@ void ust_registry_session_destroy(struct ust_registry_session *reg)
 	/* On error, EBUSY can be returned if lock. Code flow error. */
 	ret = pthread_mutex_destroy(&reg->lock);
 	assert(!ret);
+	ret = pthread_cond_destroy(&reg->metadata_push_cond);
+	assert(!ret);
 
 	if (reg->channels) {
 		rcu_read_lock();
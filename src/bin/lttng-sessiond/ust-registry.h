@@ -68,6 +68,14 @@ struct ust_registry_session {
 	size_t metadata_len, metadata_alloc_len;
 	/* Length of bytes sent to the consumer. */
 	size_t metadata_len_sent;
+	/*
+	 * Set while a thread pushes metadata to the consumer without the
+	 * registry lock held. The other threads pushing metadata wait on the
+	 * condition for it to be done, and only push what was generated
+	 * meanwhile, in a single batch.
+	 */
+	unsigned int metadata_push_in_progress;
+	pthread_cond_t metadata_push_cond;
 	/* Current version of the metadata. */
 	uint64_t metadata_version;
 
@@ -286,6 +294,7 @@ int ust_metadata_channel_statedump(struct ust_registry_session *session,
 int ust_metadata_event_statedump(struct ust_registry_session *session,
 		struct ust_registry_channel *chan,
 		struct ust_registry_event *event);
+void ust_metadata_fragment_cache_destroy(void);
 int ust_registry_create_or_find_enum(struct ust_registry_session *session,
 		int session_objd, char *name,
 		struct ustctl_enum_entry *entries, size_t nr_entries,
@@ -373,6 +382,9 @@ int ust_metadata_event_statedump(struct ust_registry_session *session,
 	return 0;
 }
 static inline
+void ust_metadata_fragment_cache_destroy(void)
+{}
+static inline
 int ust_registry_create_or_find_enum(struct ust_registry_session *session,
 		int session_objd, char *name,
 		struct ustctl_enum_entry *entries, size_t nr_entries,
@@ -19,6 +19,10 @@
 #include <common/compat/fcntl.h>
 #include <unistd.h>
 
+#ifdef HAVE_FALLOCATE
+#include <linux/falloc.h>
+#endif
+
 #ifdef __linux__
 
 int compat_sync_file_range(int fd, off64_t offset, off64_t nbytes,
@@ -31,4 +35,14 @@ int compat_sync_file_range(int fd, off64_t offset, off64_t nbytes,
 #endif
 }
 
+int compat_fallocate_keep_size(int fd, off64_t offset, off64_t len)
+{
+#ifdef HAVE_FALLOCATE
+	return fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, len);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
 #endif /* __linux__ */
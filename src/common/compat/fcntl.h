@@ -36,6 +36,13 @@ extern int compat_sync_file_range(int fd, off64_t offset, off64_t nbytes,
 #define lttng_sync_file_range(fd, offset, nbytes, flags) \
 	compat_sync_file_range(fd, offset, nbytes, flags)
 
+/*
+ * Allocate the blocks of a file range without changing the file size.
+ */
+extern int compat_fallocate_keep_size(int fd, off64_t offset, off64_t len);
+#define lttng_fallocate_keep_size(fd, offset, len) \
+	compat_fallocate_keep_size(fd, offset, len)
+
 #endif /* __linux__ */
 
 #if (defined(__FreeBSD__) || defined(__CYGWIN__) || defined(__sun__))
@@ -53,6 +60,15 @@ static inline int lttng_sync_file_range(int fd, off64_t offset,
 }
 #endif
 
+#if (defined(__FreeBSD__) || defined(__CYGWIN__) || defined(__sun__))
+static inline int lttng_fallocate_keep_size(int fd, off64_t offset,
+		off64_t len)
+{
+	errno = ENOSYS;
+	return -1;
+}
+#endif
+
 #if (defined(__FreeBSD__) || defined(__CYGWIN__) || defined(__sun__))
 /*
  * Possible flags under Linux. Simply nullify them and avoid wrappers.
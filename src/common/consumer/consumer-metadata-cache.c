@@ -36,47 +36,115 @@
 extern struct lttng_consumer_global_data consumer_data;
 
 /*
- * Extend the allocated size of the metadata cache. Called only from
- * lttng_ustconsumer_write_metadata_cache.
+ * Return the index of the chunk of the cache holding an offset.
+ */
+static
+unsigned int chunk_index(uint64_t offset)
+{
+	uint64_t quotient = offset / DEFAULT_METADATA_CACHE_SIZE;
+
+	return quotient ? 64 - __builtin_clzll(quotient) : 0;
+}
+
+/*
+ * Return the offset of the first byte of a chunk of the cache.
+ */
+static
+uint64_t chunk_start(unsigned int index)
+{
+	return index ? (uint64_t) DEFAULT_METADATA_CACHE_SIZE << (index - 1) : 0;
+}
+
+/*
+ * Return the size of a chunk of the cache.
+ */
+static
+uint64_t chunk_size(unsigned int index)
+{
+	return index ? chunk_start(index) : DEFAULT_METADATA_CACHE_SIZE;
+}
+
+/*
+ * Extend the allocated size of the metadata cache up to at least size bytes
+ * by allocating new chunks. The existing contents are left in place.
  *
  * Return 0 on success, a negative value on error.
  */
-static int extend_metadata_cache(struct lttng_consumer_channel *channel,
-		unsigned int size)
+static int extend_metadata_cache(struct consumer_metadata_cache *cache,
+		uint64_t size)
 {
 	int ret = 0;
-	char *tmp_data_ptr;
-	unsigned int new_size, old_size;
 
-	assert(channel);
-	assert(channel->metadata_cache);
+	while (cache->cache_alloc_size < size) {
+		unsigned int index = cache->nr_chunks;
 
-	old_size = channel->metadata_cache->cache_alloc_size;
-	new_size = max_t(unsigned int, old_size + size, old_size << 1);
-	DBG("Extending metadata cache to %u", new_size);
-	tmp_data_ptr = realloc(channel->metadata_cache->data, new_size);
-	if (!tmp_data_ptr) {
-		ERR("Reallocating metadata cache");
-		free(channel->metadata_cache->data);
-		ret = -1;
-		goto end;
+		if (index == METADATA_CACHE_MAX_CHUNKS) {
+			ERR("Metadata cache can't grow beyond %" PRIu64 " bytes",
+					cache->cache_alloc_size);
+			ret = -1;
+			goto end;
+		}
+		cache->chunks[index] = malloc(chunk_size(index));
+		if (!cache->chunks[index]) {
+			PERROR("malloc metadata cache chunk");
+			ret = -1;
+			goto end;
+		}
+		cache->nr_chunks++;
+		cache->cache_alloc_size += chunk_size(index);
+		DBG("Extending metadata cache to %" PRIu64,
+				cache->cache_alloc_size);
 	}
-	/* Zero newly allocated memory */
-	memset(tmp_data_ptr + old_size, 0, new_size - old_size);
-	channel->metadata_cache->data = tmp_data_ptr;
-	channel->metadata_cache->cache_alloc_size = new_size;
 
 end:
 	return ret;
 }
 
 /*
- * Reset the metadata cache.
+ * Copy a buffer to the cache at the given offset. The cache must be large
+ * enough.
+ */
+static
+void metadata_cache_copy_in(struct consumer_metadata_cache *cache,
+		uint64_t offset, const char *data, uint64_t len)
+{
+	while (len) {
+		unsigned int index = chunk_index(offset);
+		uint64_t chunk_offset = offset - chunk_start(index);
+		uint64_t copy_len = min(len, chunk_size(index) - chunk_offset);
+
+		memcpy(cache->chunks[index] + chunk_offset, data, copy_len);
+		offset += copy_len;
+		data += copy_len;
+		len -= copy_len;
+	}
+}
+
+/*
+ * Zero a range of the cache. The cache must be large enough.
+ */
+static
+void metadata_cache_zero(struct consumer_metadata_cache *cache,
+		uint64_t offset, uint64_t len)
+{
+	while (len) {
+		unsigned int index = chunk_index(offset);
+		uint64_t chunk_offset = offset - chunk_start(index);
+		uint64_t zero_len = min(len, chunk_size(index) - chunk_offset);
+
+		memset(cache->chunks[index] + chunk_offset, 0, zero_len);
+		offset += zero_len;
+		len -= zero_len;
+	}
+}
+
+/*
+ * Reset the metadata cache. The chunks are kept for the new contents, which
+ * overwrite the previous ones as they are written.
  */
 static
 void metadata_cache_reset(struct consumer_metadata_cache *cache)
 {
-	memset(cache->data, 0, cache->cache_alloc_size);
 	cache->max_offset = 0;
 }
 
@@ -133,21 +201,30 @@ int consumer_metadata_cache_write(struct lttng_consumer_channel *channel,
 
 	DBG("Writing %u bytes from offset %u in metadata cache", len, offset);
 
-	if (offset + len > cache->cache_alloc_size) {
-		ret = extend_metadata_cache(channel,
-				len - cache->cache_alloc_size + offset);
+	if ((uint64_t) offset + len > cache->cache_alloc_size) {
+		ret = extend_metadata_cache(cache, (uint64_t) offset + len);
 		if (ret < 0) {
 			ERR("Extending metadata cache");
 			goto end;
 		}
 	}
 
-	memcpy(cache->data + offset, data, len);
+	if (offset > cache->max_offset) {
+		/* Don't expose the previous contents of the chunks. */
+		metadata_cache_zero(cache, cache->max_offset,
+				offset - cache->max_offset);
+	}
+	metadata_cache_copy_in(cache, offset, data, len);
 	if (offset + len > cache->max_offset) {
 		char dummy = 'c';
 
 		cache->max_offset = offset + len;
-		if (channel->monitor && channel->metadata_stream) {
+		/*
+		 * Only wake up the metadata thread if it was not already: it
+		 * writes everything up to max_offset once awake.
+		 */
+		if (channel->monitor && channel->metadata_stream &&
+				!uatomic_xchg(&channel->metadata_stream->ust_metadata_wakeup_pending, 1)) {
 			size_ret = lttng_write(channel->metadata_stream->ust_metadata_poll_pipe[1],
 					&dummy, 1);
 			if (size_ret < 1) {
@@ -186,12 +263,9 @@ int consumer_metadata_cache_allocate(struct lttng_consumer_channel *channel)
 		goto end_free_cache;
 	}
 
-	channel->metadata_cache->cache_alloc_size = DEFAULT_METADATA_CACHE_SIZE;
-	channel->metadata_cache->data = zmalloc(
-			channel->metadata_cache->cache_alloc_size * sizeof(char));
-	if (!channel->metadata_cache->data) {
-		PERROR("zmalloc metadata cache data");
-		ret = -1;
+	ret = extend_metadata_cache(channel->metadata_cache,
+			DEFAULT_METADATA_CACHE_SIZE);
+	if (ret < 0) {
 		goto end_free_mutex;
 	}
 	DBG("Allocated metadata cache of %" PRIu64 " bytes",
@@ -213,6 +287,8 @@ end:
  */
 void consumer_metadata_cache_destroy(struct lttng_consumer_channel *channel)
 {
+	unsigned int i;
+
 	if (!channel || !channel->metadata_cache) {
 		return;
 	}
@@ -220,10 +296,63 @@ void consumer_metadata_cache_destroy(struct lttng_consumer_channel *channel)
 	DBG("Destroying metadata cache");
 
 	pthread_mutex_destroy(&channel->metadata_cache->lock);
-	free(channel->metadata_cache->data);
+	for (i = 0; i < channel->metadata_cache->nr_chunks; i++) {
+		free(channel->metadata_cache->chunks[i]);
+	}
 	free(channel->metadata_cache);
 }
 
+/*
+ * Return a pointer to the contents of the cache at the given offset, which
+ * must be lower than max_offset, and set len to the number of contiguous
+ * bytes of contents available from there.
+ *
+ * The metadata cache lock MUST be held.
+ */
+const char *consumer_metadata_cache_get_contents(
+		struct consumer_metadata_cache *cache, uint64_t offset,
+		uint64_t *len)
+{
+	unsigned int index;
+	uint64_t chunk_offset;
+
+	assert(cache);
+	assert(len);
+	assert(offset < cache->max_offset);
+
+	index = chunk_index(offset);
+	chunk_offset = offset - chunk_start(index);
+	*len = min(cache->max_offset - offset,
+			chunk_size(index) - chunk_offset);
+	return cache->chunks[index] + chunk_offset;
+}
+
+/*
+ * Copy len bytes of contents of the cache from the given offset to a buffer.
+ * The range must be below max_offset.
+ *
+ * The metadata cache lock MUST be held.
+ */
+void consumer_metadata_cache_read(struct consumer_metadata_cache *cache,
+		uint64_t offset, char *buf, uint64_t len)
+{
+	assert(cache);
+	assert(offset + len <= cache->max_offset);
+
+	while (len) {
+		uint64_t contents_len;
+		const char *contents;
+
+		contents = consumer_metadata_cache_get_contents(cache, offset,
+				&contents_len);
+		contents_len = min(contents_len, len);
+		memcpy(buf, contents, contents_len);
+		offset += contents_len;
+		buf += contents_len;
+		len -= contents_len;
+	}
+}
+
 /*
  * Check if the cache is flushed up to the offset passed in parameter.
  *
@@ -21,8 +21,18 @@
 
 #include <common/consumer/consumer.h>
 
+/*
+ * The metadata cache is stored in chunks which are never moved nor copied
+ * once allocated. Chunk 0 holds the first DEFAULT_METADATA_CACHE_SIZE bytes of
+ * the cache and each following chunk is as large as all the previous ones
+ * together, so that the chunk holding an offset is found in constant time.
+ */
+#define METADATA_CACHE_MAX_CHUNKS	48
+
 struct consumer_metadata_cache {
-	char *data;
+	char *chunks[METADATA_CACHE_MAX_CHUNKS];
+	unsigned int nr_chunks;
+	/* Size of the allocated chunks. */
 	uint64_t cache_alloc_size;
 	/*
 	 * Current version of the metadata cache.
@@ -50,6 +60,11 @@ int consumer_metadata_cache_write(struct lttng_consumer_channel *channel,
 		char *data);
 int consumer_metadata_cache_allocate(struct lttng_consumer_channel *channel);
 void consumer_metadata_cache_destroy(struct lttng_consumer_channel *channel);
+const char *consumer_metadata_cache_get_contents(
+		struct consumer_metadata_cache *cache, uint64_t offset,
+		uint64_t *len);
+void consumer_metadata_cache_read(struct consumer_metadata_cache *cache,
+		uint64_t offset, char *buf, uint64_t len);
 int consumer_metadata_cache_flushed(struct lttng_consumer_channel *channel,
 		uint64_t offset, int timer);
 
@@ -25,6 +25,7 @@
 
 #include <common/common.h>
 #include <common/index/index.h>
+#include <common/index/tracefile-prepare.h>
 #include <common/kernel-consumer/kernel-consumer.h>
 #include <common/relayd/relayd.h>
 #include <common/ust-consumer/ust-consumer.h>
@@ -156,6 +157,13 @@ void consumer_stream_close(struct lttng_consumer_stream *stream)
 
 	/* Close output fd. Could be a socket or local file at this point. */
 	if (stream->out_fd >= 0) {
+		if (stream->net_seq_idx == (uint64_t) -1ULL) {
+			consumer_stream_writeback_flush(stream);
+			/* Free the blocks allocated past its end. */
+			if (stream->out_fd_prepared) {
+				(void) utils_trim_stream_file(stream->out_fd);
+			}
+		}
 		ret = close(stream->out_fd);
 		if (ret) {
 			PERROR("close");
@@ -168,6 +176,9 @@ void consumer_stream_close(struct lttng_consumer_stream *stream)
 		stream->index_file = NULL;
 	}
 
+	tracefile_prepare_destroy(stream->tracefile_prepare);
+	stream->tracefile_prepare = NULL;
+
 	/* Check and cleanup relayd if needed. */
 	rcu_read_lock();
 	relayd = consumer_find_relayd(stream->net_seq_idx);
@@ -325,9 +336,6 @@ void consumer_stream_destroy(struct lttng_consumer_stream *stream,
 			/* Update channel's refcount of the stream. */
 			free_chan = unref_channel(stream);
 
-			/* Indicates that the consumer data state MUST be updated after this. */
-			consumer_data.need_update = 1;
-
 			pthread_mutex_unlock(&stream->lock);
 			pthread_mutex_unlock(&stream->chan->lock);
 			pthread_mutex_unlock(&consumer_data.lock);
@@ -370,7 +378,10 @@ int consumer_stream_write_index(struct lttng_consumer_stream *stream,
 		if (relayd) {
 			pthread_mutex_lock(&relayd->ctrl_sock_mutex);
 			ret = relayd_send_index(&relayd->control_sock, element,
-				stream->relayd_stream_id, stream->next_net_seq_num - 1);
+				stream->relayd_stream_id, stream->next_net_seq_num - 1,
+				(relayd->capabilities &
+					RELAYD_CAPABILITY_INDEX_ACK_WINDOW) ?
+					&relayd->indexes_unacked : NULL);
 			pthread_mutex_unlock(&relayd->ctrl_sock_mutex);
 		} else {
 			ERR("Stream %" PRIu64 " relayd ID %" PRIu64 " unknown. Can't write index.",
@@ -409,9 +420,9 @@ static int do_sync_metadata(struct lttng_consumer_stream *metadata,
 	assert(ctx);
 
 	/*
-	 * In UST, since we have to write the metadata from the cache packet
-	 * by packet, we might need to start this procedure multiple times
-	 * until all the metadata from the cache has been extracted.
+	 * In UST, the metadata is written from the cache by the sync itself,
+	 * packet by packet. A positive return value other than ENODATA means
+	 * the metadata thread has to consume what was flushed before we retry.
 	 */
 	do {
 		/*
@@ -551,3 +562,120 @@ end:
 	rcu_read_unlock();
 	return ret;
 }
+
+static uint64_t next_tracefile_count(struct lttng_consumer_stream *stream)
+{
+	if (stream->chan->tracefile_count > 0) {
+		return (stream->tracefile_count_current + 1) %
+				stream->chan->tracefile_count;
+	}
+	return stream->tracefile_count_current + 1;
+}
+
+bool consumer_stream_reuse_tracefiles(struct lttng_consumer_stream *stream)
+{
+	return consumer_data.tracefile_reuse &&
+			stream->chan->tracefile_count > 0;
+}
+
+void consumer_stream_prepare_next_tracefile(
+		struct lttng_consumer_stream *stream)
+{
+	assert(stream);
+
+	/*
+	 * Reused tracefiles are truncated in place, replacing them by a
+	 * prepared file would defeat their reuse.
+	 */
+	if (stream->chan->tracefile_size == 0 || stream->metadata_flag ||
+			stream->out_fd < 0 ||
+			consumer_stream_reuse_tracefiles(stream)) {
+		return;
+	}
+
+	if (!stream->tracefile_prepare) {
+		stream->tracefile_prepare = tracefile_prepare_create(
+				stream->chan->pathname, stream->name,
+				stream->chan->tracefile_size, stream->uid,
+				stream->gid, stream->index_file != NULL,
+				CTF_INDEX_MAJOR, CTF_INDEX_MINOR);
+		if (!stream->tracefile_prepare) {
+			/* The tracefiles are created on rotation. */
+			return;
+		}
+	}
+	tracefile_prepare_next(stream->tracefile_prepare,
+			next_tracefile_count(stream));
+}
+
+int consumer_stream_rotate_output(struct lttng_consumer_stream *stream)
+{
+	int ret, fd;
+	uint64_t next_count = next_tracefile_count(stream);
+	struct lttng_index_file *index_file = NULL;
+
+	assert(stream);
+
+	/* The current tracefile is closed by both rotation paths. */
+	consumer_stream_writeback_flush(stream);
+	if (stream->out_fd_prepared) {
+		/* Free the blocks allocated past its end. */
+		(void) utils_trim_stream_file(stream->out_fd);
+	}
+
+	if (stream->tracefile_prepare &&
+			tracefile_prepare_take(stream->tracefile_prepare,
+				next_count, &fd, &index_file)) {
+		ret = close(stream->out_fd);
+		if (ret < 0) {
+			PERROR("Closing tracefile");
+		}
+		stream->out_fd = fd;
+		stream->out_fd_prepared = true;
+		stream->tracefile_count_current = next_count;
+	} else {
+		ret = utils_rotate_stream_file(stream->chan->pathname,
+				stream->name, stream->chan->tracefile_size,
+				stream->chan->tracefile_count, stream->uid,
+				stream->gid, stream->out_fd,
+				&stream->tracefile_count_current,
+				&stream->out_fd,
+				consumer_stream_reuse_tracefiles(stream));
+		if (ret < 0) {
+			ERR("Rotating output file");
+			goto end;
+		}
+		stream->out_fd_prepared = false;
+	}
+
+	if (stream->index_file) {
+		lttng_index_file_put(stream->index_file);
+		if (!index_file) {
+			index_file = lttng_index_file_create(
+					stream->chan->pathname, stream->name,
+					stream->uid, stream->gid,
+					stream->chan->tracefile_size,
+					stream->tracefile_count_current,
+					CTF_INDEX_MAJOR, CTF_INDEX_MINOR,
+					consumer_stream_reuse_tracefiles(stream));
+		}
+		stream->index_file = index_file;
+		if (!stream->index_file) {
+			ret = -1;
+			goto end;
+		}
+	} else if (index_file) {
+		lttng_index_file_put(index_file);
+	}
+
+	/* Reset current size because we just perform a rotation. */
+	stream->tracefile_size_current = 0;
+	stream->out_fd_offset = 0;
+	stream->out_fd_writeback_offset = 0;
+	stream->out_fd_prev_writeback_offset = 0;
+
+	consumer_stream_prepare_next_tracefile(stream);
+	ret = 0;
+end:
+	return ret;
+}
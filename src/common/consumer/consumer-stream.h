@@ -74,6 +74,32 @@ void consumer_stream_destroy_buffers(struct lttng_consumer_stream *stream);
 int consumer_stream_write_index(struct lttng_consumer_stream *stream,
 		struct ctf_packet_index *index);
 
+/*
+ * Return true if the tracefiles of a stream in tracefile rotation are reused
+ * rather than unlinked and created again.
+ */
+bool consumer_stream_reuse_tracefiles(struct lttng_consumer_stream *stream);
+
+/*
+ * Start preparing the next tracefile of a stream written locally in many
+ * tracefiles. Nothing is done for the other streams.
+ *
+ * The stream lock MUST be acquired.
+ */
+void consumer_stream_prepare_next_tracefile(
+		struct lttng_consumer_stream *stream);
+
+/*
+ * Switch the output of a stream written locally to its next tracefile, and
+ * its index file to the matching one. The tracefile prepared in the
+ * background is used if it is ready, else it is created right away.
+ *
+ * The stream lock MUST be acquired.
+ *
+ * Return 0 on success or else a negative value.
+ */
+int consumer_stream_rotate_output(struct lttng_consumer_stream *stream);
+
 int consumer_stream_sync_metadata(struct lttng_consumer_local_data *ctx,
 		uint64_t session_id);
 
@@ -19,17 +19,19 @@
 #define _LGPL_SOURCE
 #include <assert.h>
 #include <inttypes.h>
-#include <signal.h>
+#include <sys/timerfd.h>
 
 #include <bin/lttng-sessiond/ust-ctl.h>
 #include <bin/lttng-consumerd/health-consumerd.h>
 #include <common/common.h>
 #include <common/compat/endian.h>
+#include <common/compat/time.h>
 #include <common/kernel-ctl/kernel-ctl.h>
 #include <common/kernel-consumer/kernel-consumer.h>
 #include <common/consumer/consumer-stream.h>
 #include <common/consumer/consumer-timer.h>
 #include <common/consumer/consumer-testpoint.h>
+#include <common/relayd/relayd.h>
 #include <common/ust-consumer/ust-consumer.h>
 
 typedef int (*sample_positions_cb)(struct lttng_consumer_stream *stream);
@@ -38,43 +40,45 @@ typedef int (*get_consumed_cb)(struct lttng_consumer_stream *stream,
 typedef int (*get_produced_cb)(struct lttng_consumer_stream *stream,
 		unsigned long *produced);
 
-static struct timer_signal_data timer_signal = {
-	.tid = 0,
-	.setup_done = 0,
-	.qs_done = 0,
+/*
+ * The timers of all the channels are kept in a single timer wheel, with a
+ * tick of CONSUMER_TIMER_TICK_US, serviced by the timer thread. A timerfd is
+ * armed on the next tick at which the wheel must advance, so that the timers
+ * expiring at the same tick are handled in a single wakeup.
+ */
+static struct consumer_timer_wheel {
+	/* Protects the wheel, the timers' entry and armed flag and running. */
+	pthread_mutex_t lock;
+	/* Signaled when the handler of a timer completes. */
+	pthread_cond_t handler_done;
+	struct timer_wheel wheel;
+	/* Timer whose handler is running, NULL if none. */
+	struct consumer_timer *running;
+	int timerfd;
+} timers = {
 	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.handler_done = PTHREAD_COND_INITIALIZER,
+	.running = NULL,
+	.timerfd = -1,
 };
 
+static int channel_monitor_pipe = -1;
+
 /*
- * Set custom signal mask to current thread.
+ * Live beacons of the idle streams of a relayd, staged by the live timers
+ * expiring at the same tick and sent in a single RELAYD_SEND_BEACONS
+ * command once they are all handled.
+ *
+ * Only accessed by the timer thread.
  */
-static void setmask(sigset_t *mask)
-{
-	int ret;
-
-	ret = sigemptyset(mask);
-	if (ret) {
-		PERROR("sigemptyset");
-	}
-	ret = sigaddset(mask, LTTNG_CONSUMER_SIG_SWITCH);
-	if (ret) {
-		PERROR("sigaddset switch");
-	}
-	ret = sigaddset(mask, LTTNG_CONSUMER_SIG_TEARDOWN);
-	if (ret) {
-		PERROR("sigaddset teardown");
-	}
-	ret = sigaddset(mask, LTTNG_CONSUMER_SIG_LIVE);
-	if (ret) {
-		PERROR("sigaddset live");
-	}
-	ret = sigaddset(mask, LTTNG_CONSUMER_SIG_MONITOR);
-	if (ret) {
-		PERROR("sigaddset monitor");
-	}
-}
+struct beacon_batch {
+	uint64_t net_seq_idx;
+	/* Array of struct lttcomm_relayd_beacon. */
+	struct lttng_dynamic_buffer beacons;
+	struct cds_list_head node;
+};
 
-static int channel_monitor_pipe = -1;
+static CDS_LIST_HEAD(beacon_batches);
 
 /*
  * Execute action on a timer switch.
@@ -84,12 +88,10 @@ static int channel_monitor_pipe = -1;
  * deadlocks.
  */
 static void metadata_switch_timer(struct lttng_consumer_local_data *ctx,
-		int sig, siginfo_t *si)
+		struct lttng_consumer_channel *channel)
 {
 	int ret;
-	struct lttng_consumer_channel *channel;
 
-	channel = si->si_value.sival_ptr;
 	assert(channel);
 
 	if (channel->switch_timer_error) {
@@ -126,12 +128,146 @@ static void metadata_switch_timer(struct lttng_consumer_local_data *ctx,
 	}
 }
 
-static int send_empty_index(struct lttng_consumer_stream *stream, uint64_t ts,
+/*
+ * Send the beacons staged for a relayd and release the batch.
+ */
+static int send_beacon_batch(struct beacon_batch *batch)
+{
+	int ret = 0;
+	unsigned int count;
+	struct consumer_relayd_sock_pair *relayd;
+
+	count = batch->beacons.size / sizeof(struct lttcomm_relayd_beacon);
+	if (!count) {
+		goto end;
+	}
+
+	rcu_read_lock();
+	relayd = consumer_find_relayd(batch->net_seq_idx);
+	if (relayd) {
+		pthread_mutex_lock(&relayd->ctrl_sock_mutex);
+		ret = relayd_send_beacons(&relayd->control_sock,
+				(struct lttcomm_relayd_beacon *) batch->beacons.data,
+				count,
+				(relayd->capabilities &
+					RELAYD_CAPABILITY_INDEX_ACK_WINDOW) ?
+					&relayd->indexes_unacked : NULL);
+		pthread_mutex_unlock(&relayd->ctrl_sock_mutex);
+		if (ret < 0) {
+			ERR("Failed to send %u beacons to relayd %" PRIu64,
+					count, batch->net_seq_idx);
+		}
+	} else {
+		DBG("Relayd %" PRIu64 " destroyed, dropping %u beacons",
+				batch->net_seq_idx, count);
+	}
+	rcu_read_unlock();
+end:
+	cds_list_del(&batch->node);
+	lttng_dynamic_buffer_reset(&batch->beacons);
+	free(batch);
+	return ret;
+}
+
+/*
+ * Send the beacons staged by the live timers.
+ */
+static void send_beacon_batches(void)
+{
+	struct beacon_batch *batch, *tmp;
+
+	cds_list_for_each_entry_safe(batch, tmp, &beacon_batches, node) {
+		(void) send_beacon_batch(batch);
+	}
+}
+
+/*
+ * Stage the beacon of a stream sent to a relayd supporting batched beacons.
+ *
+ * Return 1 if the beacon was staged, 0 if it must be sent on its own, or a
+ * negative value on error.
+ *
+ * Called with the stream lock and the RCU read-side lock held.
+ */
+static int stage_beacon(struct lttng_consumer_stream *stream, uint64_t ts,
 		uint64_t stream_id)
+{
+	int ret;
+	struct consumer_relayd_sock_pair *relayd;
+	struct beacon_batch *batch;
+	struct lttcomm_relayd_beacon beacon;
+
+	if (stream->net_seq_idx == (uint64_t) -1ULL) {
+		ret = 0;
+		goto end;
+	}
+	relayd = consumer_find_relayd(stream->net_seq_idx);
+	if (!relayd ||
+			!(relayd->capabilities & RELAYD_CAPABILITY_SEND_BEACONS)) {
+		ret = 0;
+		goto end;
+	}
+
+	cds_list_for_each_entry(batch, &beacon_batches, node) {
+		if (batch->net_seq_idx == stream->net_seq_idx) {
+			goto append;
+		}
+	}
+	batch = zmalloc(sizeof(*batch));
+	if (!batch) {
+		PERROR("zmalloc beacon batch");
+		ret = -1;
+		goto end;
+	}
+	batch->net_seq_idx = stream->net_seq_idx;
+	lttng_dynamic_buffer_init(&batch->beacons);
+	cds_list_add_tail(&batch->node, &beacon_batches);
+
+append:
+	memset(&beacon, 0, sizeof(beacon));
+	beacon.relay_stream_id = htobe64(stream->relayd_stream_id);
+	beacon.net_seq_num = htobe64(stream->next_net_seq_num - 1);
+	beacon.timestamp_end = htobe64(ts);
+	beacon.stream_id = htobe64(stream_id);
+	ret = lttng_dynamic_buffer_append(&batch->beacons, &beacon,
+			sizeof(beacon));
+	if (ret) {
+		ERR("Failed to stage the beacon of stream %" PRIu64,
+				stream->key);
+		ret = -1;
+		goto end;
+	}
+
+	if (batch->beacons.size / sizeof(beacon) == RELAYD_BEACONS_MAX_COUNT) {
+		ret = send_beacon_batch(batch);
+		if (ret < 0) {
+			goto end;
+		}
+	}
+	ret = 1;
+end:
+	return ret;
+}
+
+/*
+ * Send the empty index of an idle stream, telling the live readers that the
+ * stream has no data up to ts. If batch is set, the index is staged as a
+ * beacon sent with the other beacons of the relayd.
+ */
+static int send_empty_index(struct lttng_consumer_stream *stream, uint64_t ts,
+		uint64_t stream_id, bool batch)
 {
 	int ret;
 	struct ctf_packet_index index;
 
+	if (batch) {
+		ret = stage_beacon(stream, ts, stream_id);
+		if (ret) {
+			ret = ret < 0 ? ret : 0;
+			goto error;
+		}
+	}
+
 	memset(&index, 0, sizeof(index));
 	index.stream_id = htobe64(stream_id);
 	index.timestamp_end = htobe64(ts);
@@ -144,7 +280,8 @@ error:
 	return ret;
 }
 
-int consumer_flush_kernel_index(struct lttng_consumer_stream *stream)
+static int flush_kernel_index(struct lttng_consumer_stream *stream,
+		bool batch)
 {
 	uint64_t ts, stream_id;
 	int ret;
@@ -172,7 +309,7 @@ int consumer_flush_kernel_index(struct lttng_consumer_stream *stream)
 			goto end;
 		}
 		DBG("Stream %" PRIu64 " empty, sending beacon", stream->key);
-		ret = send_empty_index(stream, ts, stream_id);
+		ret = send_empty_index(stream, ts, stream_id, batch);
 		if (ret < 0) {
 			goto end;
 		}
@@ -182,6 +319,11 @@ end:
 	return ret;
 }
 
+int consumer_flush_kernel_index(struct lttng_consumer_stream *stream)
+{
+	return flush_kernel_index(stream, false);
+}
+
 static int check_kernel_stream(struct lttng_consumer_stream *stream)
 {
 	int ret;
@@ -221,13 +363,13 @@ static int check_kernel_stream(struct lttng_consumer_stream *stream)
 		}
 		break;
 	}
-	ret = consumer_flush_kernel_index(stream);
+	ret = flush_kernel_index(stream, true);
 	pthread_mutex_unlock(&stream->lock);
 end:
 	return ret;
 }
 
-int consumer_flush_ust_index(struct lttng_consumer_stream *stream)
+static int flush_ust_index(struct lttng_consumer_stream *stream, bool batch)
 {
 	uint64_t ts, stream_id;
 	int ret;
@@ -256,7 +398,7 @@ int consumer_flush_ust_index(struct lttng_consumer_stream *stream)
 			goto end;
 		}
 		DBG("Stream %" PRIu64 " empty, sending beacon", stream->key);
-		ret = send_empty_index(stream, ts, stream_id);
+		ret = send_empty_index(stream, ts, stream_id, batch);
 		if (ret < 0) {
 			goto end;
 		}
@@ -266,6 +408,11 @@ end:
 	return ret;
 }
 
+int consumer_flush_ust_index(struct lttng_consumer_stream *stream)
+{
+	return flush_ust_index(stream, false);
+}
+
 static int check_ust_stream(struct lttng_consumer_stream *stream)
 {
 	int ret;
@@ -307,7 +454,7 @@ static int check_ust_stream(struct lttng_consumer_stream *stream)
 		}
 		break;
 	}
-	ret = consumer_flush_ust_index(stream);
+	ret = flush_ust_index(stream, true);
 	pthread_mutex_unlock(&stream->lock);
 end:
 	return ret;
@@ -317,15 +464,13 @@ end:
  * Execute action on a live timer
  */
 static void live_timer(struct lttng_consumer_local_data *ctx,
-		int sig, siginfo_t *si)
+		struct lttng_consumer_channel *channel)
 {
 	int ret;
-	struct lttng_consumer_channel *channel;
 	struct lttng_consumer_stream *stream;
 	struct lttng_ht *ht;
 	struct lttng_ht_iter iter;
 
-	channel = si->si_value.sival_ptr;
 	assert(channel);
 
 	if (channel->switch_timer_error) {
@@ -372,72 +517,76 @@ error:
 	return;
 }
 
+/*
+ * Return the current tick of the timer wheel.
+ */
 static
-void consumer_timer_signal_thread_qs(unsigned int signr)
+int get_current_tick(uint64_t *tick)
 {
-	sigset_t pending_set;
 	int ret;
+	struct timespec now;
 
-	/*
-	 * We need to be the only thread interacting with the thread
-	 * that manages signals for teardown synchronization.
-	 */
-	pthread_mutex_lock(&timer_signal.lock);
-
-	/* Ensure we don't have any signal queued for this channel. */
-	for (;;) {
-		ret = sigemptyset(&pending_set);
-		if (ret == -1) {
-			PERROR("sigemptyset");
-		}
-		ret = sigpending(&pending_set);
-		if (ret == -1) {
-			PERROR("sigpending");
-		}
-		if (!sigismember(&pending_set, signr)) {
-			break;
-		}
-		caa_cpu_relax();
+	ret = lttng_clock_gettime(CLOCK_MONOTONIC, &now);
+	if (ret) {
+		PERROR("clock_gettime");
+		goto end;
 	}
+	*tick = ((uint64_t) now.tv_sec * 1000000ULL + now.tv_nsec / 1000) /
+			CONSUMER_TIMER_TICK_US;
+end:
+	return ret;
+}
 
-	/*
-	 * From this point, no new signal handler will be fired that would try to
-	 * access "chan". However, we still need to wait for any currently
-	 * executing handler to complete.
-	 */
-	cmm_smp_mb();
-	CMM_STORE_SHARED(timer_signal.qs_done, 0);
-	cmm_smp_mb();
-
-	/*
-	 * Kill with LTTNG_CONSUMER_SIG_TEARDOWN, so signal management thread wakes
-	 * up.
-	 */
-	kill(getpid(), LTTNG_CONSUMER_SIG_TEARDOWN);
+/*
+ * Arm the timerfd on the next tick at which the wheel must advance, or
+ * disarm it if the wheel is empty.
+ *
+ * Called with the timer wheel lock held.
+ */
+static
+int arm_timerfd(void)
+{
+	int ret;
+	uint64_t next_tick, next_us;
+	struct itimerspec its;
 
-	while (!CMM_LOAD_SHARED(timer_signal.qs_done)) {
-		caa_cpu_relax();
+	memset(&its, 0, sizeof(its));
+	next_tick = timer_wheel_next_tick(&timers.wheel);
+	if (next_tick != UINT64_MAX) {
+		next_us = next_tick * CONSUMER_TIMER_TICK_US;
+		its.it_value.tv_sec = next_us / 1000000;
+		its.it_value.tv_nsec = (next_us % 1000000) * 1000;
+		if (!its.it_value.tv_sec && !its.it_value.tv_nsec) {
+			/* A zero value disarms the timerfd. */
+			its.it_value.tv_nsec = 1;
+		}
 	}
-	cmm_smp_mb();
 
-	pthread_mutex_unlock(&timer_signal.lock);
+	ret = timerfd_settime(timers.timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+	if (ret == -1) {
+		PERROR("timerfd_settime");
+	}
+	return ret;
 }
 
 /*
- * Start a timer channel timer which will fire at a given interval
- * (timer_interval_us)and fire a given signal (signal).
+ * Start a channel timer which will fire at a given interval
+ * (timer_interval_us).
  *
- * Returns a negative value on error, 0 if a timer was created, and
- * a positive value if no timer was created (not an error).
+ * The first expiration is aligned on a multiple of the interval so that the
+ * timers of the channels sharing an interval expire at the same ticks and
+ * are handled in a single wakeup of the timer thread.
+ *
+ * Returns a negative value on error, 0 if a timer was started, and
+ * a positive value if no timer was started (not an error).
  */
 static
-int consumer_channel_timer_start(timer_t *timer_id,
+int consumer_channel_timer_start(struct consumer_timer *timer,
 		struct lttng_consumer_channel *channel,
-		unsigned int timer_interval_us, int signal)
+		enum consumer_timer_type type, unsigned int timer_interval_us)
 {
-	int ret = 0, delete_ret;
-	struct sigevent sev;
-	struct itimerspec its;
+	int ret = 0;
+	uint64_t now;
 
 	assert(channel);
 	assert(channel->key);
@@ -448,50 +597,50 @@ int consumer_channel_timer_start(timer_t *timer_id,
 		goto end;
 	}
 
-	sev.sigev_notify = SIGEV_SIGNAL;
-	sev.sigev_signo = signal;
-	sev.sigev_value.sival_ptr = channel;
-	ret = timer_create(CLOCKID, &sev, timer_id);
-	if (ret == -1) {
-		PERROR("timer_create");
+	ret = get_current_tick(&now);
+	if (ret) {
 		goto end;
 	}
 
-	its.it_value.tv_sec = timer_interval_us / 1000000;
-	its.it_value.tv_nsec = (timer_interval_us % 1000000) * 1000;
-	its.it_interval.tv_sec = its.it_value.tv_sec;
-	its.it_interval.tv_nsec = its.it_value.tv_nsec;
-
-	ret = timer_settime(*timer_id, 0, &its, NULL);
-	if (ret == -1) {
-		PERROR("timer_settime");
-		goto error_destroy_timer;
+	timer_wheel_entry_init(&timer->entry);
+	timer->type = type;
+	timer->channel = channel;
+	timer->period = (timer_interval_us + CONSUMER_TIMER_TICK_US - 1) /
+			CONSUMER_TIMER_TICK_US;
+	timer->armed = true;
+
+	pthread_mutex_lock(&timers.lock);
+	/* The wheel is not advanced while it has no timer. */
+	timer_wheel_fast_forward(&timers.wheel, now);
+	timer_wheel_add(&timers.wheel, &timer->entry,
+			(now / timer->period + 1) * timer->period);
+	ret = arm_timerfd();
+	if (ret) {
+		timer->armed = false;
+		timer_wheel_del(&timers.wheel, &timer->entry);
 	}
+	pthread_mutex_unlock(&timers.lock);
 end:
 	return ret;
-error_destroy_timer:
-	delete_ret = timer_delete(*timer_id);
-	if (delete_ret == -1) {
-		PERROR("timer_delete");
-	}
-	goto end;
 }
 
+/*
+ * Stop a channel timer. On return, the timer's handler is not running and
+ * will not run anymore, so the channel can be freed.
+ *
+ * The caller must not hold a lock taken by the timer's handler.
+ */
 static
-int consumer_channel_timer_stop(timer_t *timer_id, int signal)
+int consumer_channel_timer_stop(struct consumer_timer *timer)
 {
-	int ret = 0;
-
-	ret = timer_delete(*timer_id);
-	if (ret == -1) {
-		PERROR("timer_delete");
-		goto end;
+	pthread_mutex_lock(&timers.lock);
+	timer->armed = false;
+	timer_wheel_del(&timers.wheel, &timer->entry);
+	while (timers.running == timer) {
+		pthread_cond_wait(&timers.handler_done, &timers.lock);
 	}
-
-	consumer_timer_signal_thread_qs(signal);
-	*timer_id = 0;
-end:
-	return ret;
+	pthread_mutex_unlock(&timers.lock);
+	return 0;
 }
 
 /*
@@ -506,7 +655,7 @@ void consumer_timer_switch_start(struct lttng_consumer_channel *channel,
 	assert(channel->key);
 
 	ret = consumer_channel_timer_start(&channel->switch_timer, channel,
-			switch_timer_interval_us, LTTNG_CONSUMER_SIG_SWITCH);
+			CONSUMER_TIMER_SWITCH, switch_timer_interval_us);
 
 	channel->switch_timer_enabled = !!(ret == 0);
 }
@@ -520,8 +669,7 @@ void consumer_timer_switch_stop(struct lttng_consumer_channel *channel)
 
 	assert(channel);
 
-	ret = consumer_channel_timer_stop(&channel->switch_timer,
-			LTTNG_CONSUMER_SIG_SWITCH);
+	ret = consumer_channel_timer_stop(&channel->switch_timer);
 	if (ret == -1) {
 		ERR("Failed to stop switch timer");
 	}
@@ -541,7 +689,7 @@ void consumer_timer_live_start(struct lttng_consumer_channel *channel,
 	assert(channel->key);
 
 	ret = consumer_channel_timer_start(&channel->live_timer, channel,
-			live_timer_interval_us, LTTNG_CONSUMER_SIG_LIVE);
+			CONSUMER_TIMER_LIVE, live_timer_interval_us);
 
 	channel->live_timer_enabled = !!(ret == 0);
 }
@@ -555,8 +703,7 @@ void consumer_timer_live_stop(struct lttng_consumer_channel *channel)
 
 	assert(channel);
 
-	ret = consumer_channel_timer_stop(&channel->live_timer,
-			LTTNG_CONSUMER_SIG_LIVE);
+	ret = consumer_channel_timer_stop(&channel->live_timer);
 	if (ret == -1) {
 		ERR("Failed to stop live timer");
 	}
@@ -580,7 +727,7 @@ int consumer_timer_monitor_start(struct lttng_consumer_channel *channel,
 	assert(!channel->monitor_timer_enabled);
 
 	ret = consumer_channel_timer_start(&channel->monitor_timer, channel,
-			monitor_timer_interval_us, LTTNG_CONSUMER_SIG_MONITOR);
+			CONSUMER_TIMER_MONITOR, monitor_timer_interval_us);
 	channel->monitor_timer_enabled = !!(ret == 0);
 	return ret;
 }
@@ -595,8 +742,7 @@ int consumer_timer_monitor_stop(struct lttng_consumer_channel *channel)
 	assert(channel);
 	assert(channel->monitor_timer_enabled);
 
-	ret = consumer_channel_timer_stop(&channel->monitor_timer,
-			LTTNG_CONSUMER_SIG_MONITOR);
+	ret = consumer_channel_timer_stop(&channel->monitor_timer);
 	if (ret == -1) {
 		ERR("Failed to stop live timer");
 		goto end;
@@ -608,23 +754,28 @@ end:
 }
 
 /*
- * Block the RT signals for the entire process. It must be called from the
- * consumer main before creating the threads
+ * Create the timerfd of the timer wheel. It must be called from the consumer
+ * main before creating the threads.
  */
-int consumer_signal_init(void)
+int consumer_timer_init(void)
 {
 	int ret;
-	sigset_t mask;
+	uint64_t now;
 
-	/* Block signal for entire process, so only our thread processes it. */
-	setmask(&mask);
-	ret = pthread_sigmask(SIG_BLOCK, &mask, NULL);
+	ret = get_current_tick(&now);
 	if (ret) {
-		errno = ret;
-		PERROR("pthread_sigmask");
-		return -1;
+		goto end;
 	}
-	return 0;
+	timer_wheel_init(&timers.wheel, now);
+
+	timers.timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (timers.timerfd < 0) {
+		PERROR("timerfd_create");
+		ret = -1;
+		goto end;
+	}
+end:
+	return ret;
 }
 
 static
@@ -780,15 +931,95 @@ end:
 }
 
 /*
- * This thread is the sighandler for signals LTTNG_CONSUMER_SIG_SWITCH,
- * LTTNG_CONSUMER_SIG_TEARDOWN, LTTNG_CONSUMER_SIG_LIVE, and
- * LTTNG_CONSUMER_SIG_MONITOR.
+ * Run the handler of an expired timer.
+ */
+static
+void handle_timer(struct lttng_consumer_local_data *ctx,
+		struct consumer_timer *timer)
+{
+	switch (timer->type) {
+	case CONSUMER_TIMER_SWITCH:
+		metadata_switch_timer(ctx, timer->channel);
+		break;
+	case CONSUMER_TIMER_LIVE:
+		live_timer(ctx, timer->channel);
+		break;
+	case CONSUMER_TIMER_MONITOR:
+		monitor_timer(ctx, timer->channel);
+		break;
+	default:
+		abort();
+	}
+}
+
+/*
+ * Advance the timer wheel to the current tick and run the handlers of the
+ * expired timers, then re-arm them on their next period.
+ */
+static
+int handle_expired_timers(struct lttng_consumer_local_data *ctx)
+{
+	int ret;
+	uint64_t now;
+	struct cds_list_head expired;
+
+	CDS_INIT_LIST_HEAD(&expired);
+
+	ret = get_current_tick(&now);
+	if (ret) {
+		goto end;
+	}
+
+	pthread_mutex_lock(&timers.lock);
+	timer_wheel_advance(&timers.wheel, now, &expired);
+	while (!cds_list_empty(&expired)) {
+		struct consumer_timer *timer;
+		uint64_t expires;
+
+		/*
+		 * A timer stopped while its handler is pending is removed from
+		 * the expired list by consumer_channel_timer_stop().
+		 */
+		timer = caa_container_of(expired.next, struct consumer_timer,
+				entry.node);
+		expires = timer->entry.expires;
+		timer_wheel_del(&timers.wheel, &timer->entry);
+		timers.running = timer;
+		pthread_mutex_unlock(&timers.lock);
+
+		handle_timer(ctx, timer);
+		health_code_update();
+
+		pthread_mutex_lock(&timers.lock);
+		if (timer->armed) {
+			expires += timer->period;
+			if (expires <= now) {
+				/* Skip the periods missed while falling behind. */
+				expires = now + timer->period -
+						(now - expires) % timer->period;
+			}
+			timer_wheel_add(&timers.wheel, &timer->entry, expires);
+		}
+		timers.running = NULL;
+		pthread_cond_broadcast(&timers.handler_done);
+	}
+	ret = arm_timerfd();
+	pthread_mutex_unlock(&timers.lock);
+
+	/* The beacons of the live timers of this tick, one command per relayd. */
+	send_beacon_batches();
+end:
+	return ret;
+}
+
+/*
+ * This thread services the switch, live and monitoring timers of the
+ * channels from the timer wheel.
  */
 void *consumer_timer_thread(void *data)
 {
-	int signr;
-	sigset_t mask;
-	siginfo_t info;
+	ssize_t ret;
+	uint64_t nr_expirations;
 	struct lttng_consumer_local_data *ctx = data;
 
 	rcu_register_thread();
@@ -801,43 +1032,20 @@ void *consumer_timer_thread(void *data)
 
 	health_code_update();
 
-	/* Only self thread will receive signal mask. */
-	setmask(&mask);
-	CMM_STORE_SHARED(timer_signal.tid, pthread_self());
-
 	while (1) {
 		health_code_update();
 
 		health_poll_entry();
-		signr = sigwaitinfo(&mask, &info);
+		ret = lttng_read(timers.timerfd, &nr_expirations,
+				sizeof(nr_expirations));
 		health_poll_exit();
-
-		/*
-		 * NOTE: cascading conditions are used instead of a switch case
-		 * since the use of SIGRTMIN in the definition of the signals'
-		 * values prevents the reduction to an integer constant.
-		 */
-		if (signr == -1) {
-			if (errno != EINTR) {
-				PERROR("sigwaitinfo");
-			}
+		if (ret != sizeof(nr_expirations)) {
+			PERROR("read timerfd");
 			continue;
-		} else if (signr == LTTNG_CONSUMER_SIG_SWITCH) {
-			metadata_switch_timer(ctx, info.si_signo, &info);
-		} else if (signr == LTTNG_CONSUMER_SIG_TEARDOWN) {
-			cmm_smp_mb();
-			CMM_STORE_SHARED(timer_signal.qs_done, 1);
-			cmm_smp_mb();
-			DBG("Signal timer metadata thread teardown");
-		} else if (signr == LTTNG_CONSUMER_SIG_LIVE) {
-			live_timer(ctx, info.si_signo, &info);
-		} else if (signr == LTTNG_CONSUMER_SIG_MONITOR) {
-			struct lttng_consumer_channel *channel;
-
-			channel = info.si_value.sival_ptr;
-			monitor_timer(ctx, channel);
-		} else {
-			ERR("Unexpected signal %d\n", info.si_signo);
+		}
+
+		if (handle_expired_timers(ctx)) {
+			ERR("Failed to handle the expired channel timers");
 		}
 	}
 
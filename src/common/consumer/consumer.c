@@ -35,6 +35,7 @@
 #include <common/utils.h>
 #include <common/compat/poll.h>
 #include <common/compat/endian.h>
+#include <common/compat/time.h>
 #include <common/index/index.h>
 #include <common/kernel-ctl/kernel-ctl.h>
 #include <common/sessiond-comm/relayd.h>
@@ -51,8 +52,8 @@
 
 struct lttng_consumer_global_data consumer_data = {
 	.stream_count = 0,
-	.need_update = 1,
 	.type = LTTNG_CONSUMER_UNKNOWN,
+	.drain_budget = DEFAULT_CONSUMERD_DRAIN_BUDGET,
 };
 
 enum consumer_channel_action {
@@ -100,6 +101,18 @@ static void notify_thread_lttng_pipe(struct lttng_pipe *pipe)
 	(void) lttng_pipe_write(pipe, &null_stream, sizeof(null_stream));
 }
 
+/*
+ * Notify every data thread to poll back again.
+ */
+static void notify_data_threads(struct lttng_consumer_local_data *ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < ctx->nr_data_threads; i++) {
+		notify_thread_lttng_pipe(ctx->data_threads[i].stream_pipe);
+	}
+}
+
 static void notify_health_quit_pipe(int *pipe)
 {
 	ssize_t ret;
@@ -323,6 +336,7 @@ static void free_relayd_rcu(struct rcu_head *head)
 	(void) relayd_close(&relayd->control_sock);
 	(void) relayd_close(&relayd->data_sock);
 
+	lttng_dynamic_buffer_reset(&relayd->bundle);
 	free(relayd);
 }
 
@@ -492,7 +506,7 @@ static void cleanup_relayd(struct consumer_relayd_sock_pair *relayd,
 	 * read of this status which happens AFTER receiving this notify.
 	 */
 	if (ctx) {
-		notify_thread_lttng_pipe(ctx->consumer_data_pipe);
+		notify_data_threads(ctx);
 		notify_thread_lttng_pipe(ctx->consumer_metadata_pipe);
 	}
 }
@@ -579,6 +593,11 @@ struct lttng_consumer_stream *consumer_allocate_stream(uint64_t channel_key,
 	stream->endpoint_status = CONSUMER_ENDPOINT_ACTIVE;
 	stream->index_file = NULL;
 	stream->last_sequence_number = -1ULL;
+	stream->cpu = cpu;
+	CDS_INIT_LIST_HEAD(&stream->data_pending_node);
+	CDS_INIT_LIST_HEAD(&stream->writer_node);
+	CDS_INIT_LIST_HEAD(&stream->read_timer_node);
+	cds_wfcq_node_init(&stream->written_node);
 	pthread_mutex_init(&stream->lock, NULL);
 	pthread_mutex_init(&stream->metadata_timer_lock, NULL);
 
@@ -628,13 +647,50 @@ end:
 }
 
 /*
- * Add a stream to the global list protected by a mutex.
+ * Select the data thread in charge of a data stream. Streams are sharded by
+ * the CPU of their buffer so the per-CPU streams of all channels and
+ * applications get spread evenly across the data threads.
+ */
+static struct lttng_consumer_data_thread *select_data_thread(
+		struct lttng_consumer_local_data *ctx,
+		struct lttng_consumer_stream *stream)
+{
+	unsigned int index = 0;
+
+	if (stream->cpu > 0) {
+		index = (unsigned int) stream->cpu % ctx->nr_data_threads;
+	}
+	return &ctx->data_threads[index];
+}
+
+/*
+ * Select the writer thread of a data stream, NULL if there is none. The
+ * streams are spread across the writer threads by key, including the streams
+ * sent to the same relayd since the data socket of a relayd is protected by
+ * its own mutex.
+ */
+static struct lttng_consumer_writer *select_writer(
+		struct lttng_consumer_local_data *ctx,
+		struct lttng_consumer_stream *stream)
+{
+	if (ctx->nr_writers == 0) {
+		return NULL;
+	}
+
+	return &ctx->writers[stream->key % ctx->nr_writers];
+}
+
+/*
+ * Add a stream to the global list protected by a mutex and assign it to one
+ * of the data threads of the context.
  */
-int consumer_add_data_stream(struct lttng_consumer_stream *stream)
+int consumer_add_data_stream(struct lttng_consumer_local_data *ctx,
+		struct lttng_consumer_stream *stream)
 {
 	struct lttng_ht *ht = data_ht;
 	int ret = 0;
 
+	assert(ctx);
 	assert(stream);
 	assert(ht);
 
@@ -676,7 +732,8 @@ int consumer_add_data_stream(struct lttng_consumer_stream *stream)
 
 	/* Update consumer data once the node is inserted. */
 	consumer_data.stream_count++;
-	consumer_data.need_update = 1;
+	stream->data_thread = select_data_thread(ctx, stream);
+	stream->writer = select_writer(ctx, stream);
 
 	rcu_read_unlock();
 	pthread_mutex_unlock(&stream->lock);
@@ -742,6 +799,8 @@ static struct consumer_relayd_sock_pair *consumer_allocate_relayd_sock_pair(
 	obj->data_sock.sock.fd = -1;
 	lttng_ht_node_init_u64(&obj->node, obj->net_seq_idx);
 	pthread_mutex_init(&obj->ctrl_sock_mutex, NULL);
+	pthread_mutex_init(&obj->data_sock_mutex, NULL);
+	lttng_dynamic_buffer_init(&obj->bundle);
 
 error:
 	return obj;
@@ -876,6 +935,34 @@ void close_relayd_stream(struct lttng_consumer_stream *stream)
 	rcu_read_unlock();
 }
 
+/*
+ * Fill up the header of a data packet of a stream sent to the relayd and
+ * consume the packet's network sequence number.
+ */
+static void init_relayd_data_header(struct lttng_consumer_stream *stream,
+		struct lttcomm_relayd_data_hdr *data_hdr, size_t data_size,
+		unsigned long padding)
+{
+	/* Reset data header */
+	memset(data_hdr, 0, sizeof(*data_hdr));
+
+	/* Set header with stream information */
+	data_hdr->stream_id = htobe64(stream->relayd_stream_id);
+	data_hdr->data_size = htobe32(data_size);
+	data_hdr->padding_size = htobe32(padding);
+	/*
+	 * Note that net_seq_num below is assigned with the *current* value of
+	 * next_net_seq_num and only after that the next_net_seq_num will be
+	 * increment. This is why when issuing a command on the relayd using
+	 * this next value, 1 should always be substracted in order to compare
+	 * the last seen sequence number on the relayd side to the last sent.
+	 */
+	data_hdr->net_seq_num = htobe64(stream->next_net_seq_num);
+	/* Other fields are zeroed previously */
+
+	++stream->next_net_seq_num;
+}
+
 /*
  * Handle stream for relayd transmission if the stream applies for network
  * streaming where the net sequence index is set.
@@ -893,9 +980,6 @@ static int write_relayd_stream_header(struct lttng_consumer_stream *stream,
 	assert(stream);
 	assert(relayd);
 
-	/* Reset data header */
-	memset(&data_hdr, 0, sizeof(data_hdr));
-
 	if (stream->metadata_flag) {
 		/* Caller MUST acquire the relayd control socket lock */
 		ret = relayd_send_metadata(&relayd->control_sock, data_size);
@@ -906,19 +990,7 @@ static int write_relayd_stream_header(struct lttng_consumer_stream *stream,
 		/* Metadata are always sent on the control socket. */
 		outfd = relayd->control_sock.sock.fd;
 	} else {
-		/* Set header with stream information */
-		data_hdr.stream_id = htobe64(stream->relayd_stream_id);
-		data_hdr.data_size = htobe32(data_size);
-		data_hdr.padding_size = htobe32(padding);
-		/*
-		 * Note that net_seq_num below is assigned with the *current* value of
-		 * next_net_seq_num and only after that the next_net_seq_num will be
-		 * increment. This is why when issuing a command on the relayd using
-		 * this next value, 1 should always be substracted in order to compare
-		 * the last seen sequence number on the relayd side to the last sent.
-		 */
-		data_hdr.net_seq_num = htobe64(stream->next_net_seq_num);
-		/* Other fields are zeroed previously */
+		init_relayd_data_header(stream, &data_hdr, data_size, padding);
 
 		ret = relayd_send_data_hdr(&relayd->data_sock, &data_hdr,
 				sizeof(data_hdr));
@@ -926,8 +998,6 @@ static int write_relayd_stream_header(struct lttng_consumer_stream *stream,
 			goto error;
 		}
 
-		++stream->next_net_seq_num;
-
 		/* Set to go on data socket */
 		outfd = relayd->data_sock.sock.fd;
 	}
@@ -936,6 +1006,115 @@ error:
 	return outfd;
 }
 
+/*
+ * Send the packets staged in the bundle of a relayd, if any.
+ *
+ * The relayd data socket lock MUST be acquired before calling this.
+ *
+ * Return 0 on success else a negative value.
+ */
+static int relayd_flush_data_bundle(struct consumer_relayd_sock_pair *relayd)
+{
+	ssize_t ret;
+	struct lttcomm_relayd_data_hdr data_hdr;
+	struct iovec iov[2];
+	size_t bundle_size = relayd->bundle.size;
+
+	if (bundle_size == 0) {
+		return 0;
+	}
+	if (relayd->data_sock.sock.fd < 0) {
+		return -ECONNRESET;
+	}
+
+	memset(&data_hdr, 0, sizeof(data_hdr));
+	data_hdr.stream_id = htobe64(relayd->bundle_stream_id);
+	data_hdr.net_seq_num = htobe64(RELAYD_DATA_BUNDLE_SEQ_NUM);
+	data_hdr.data_size = htobe32(bundle_size);
+	iov[0].iov_base = &data_hdr;
+	iov[0].iov_len = sizeof(data_hdr);
+	iov[1].iov_base = relayd->bundle.data;
+	iov[1].iov_len = bundle_size;
+
+	/* The staged packets are dropped if the bundle can't be sent. */
+	(void) lttng_dynamic_buffer_set_size(&relayd->bundle, 0);
+	ret = lttng_writev(relayd->data_sock.sock.fd, iov, 2);
+	if (ret < 0 || (size_t) ret != sizeof(data_hdr) + bundle_size) {
+		DBG("Consumer failed to send data bundle of %zu bytes (errno: %d)",
+				bundle_size, errno);
+		return -EPIPE;
+	}
+	DBG3("Consumer sent data bundle of %zu bytes to relayd", bundle_size);
+	return 0;
+}
+
+/*
+ * Stage a small data packet of a stream in the bundle of its relayd. The
+ * bundle is sent first if the packet does not fit in it.
+ *
+ * The relayd data socket lock MUST be acquired before calling this.
+ *
+ * Return 0 on success else a negative value.
+ */
+static int relayd_bundle_data(struct consumer_relayd_sock_pair *relayd,
+		struct lttng_consumer_stream *stream, const void *data,
+		unsigned long len, unsigned long padding)
+{
+	int ret;
+	struct lttcomm_relayd_data_hdr data_hdr;
+
+	/*
+	 * The bundle is sized once for the largest bundle so the packet can
+	 * always be appended once its sequence number is assigned.
+	 */
+	ret = lttng_dynamic_buffer_set_capacity(&relayd->bundle,
+			RELAYD_DATA_BUNDLE_MAX_SIZE);
+	if (ret) {
+		ret = -ENOMEM;
+		goto end;
+	}
+	if (relayd->bundle.size + sizeof(data_hdr) + len >
+			RELAYD_DATA_BUNDLE_MAX_SIZE) {
+		ret = relayd_flush_data_bundle(relayd);
+		if (ret < 0) {
+			goto end;
+		}
+	}
+	if (relayd->bundle.size == 0) {
+		relayd->bundle_stream_id = stream->relayd_stream_id;
+	}
+
+	init_relayd_data_header(stream, &data_hdr, len, padding);
+	(void) lttng_dynamic_buffer_append(&relayd->bundle, &data_hdr,
+			sizeof(data_hdr));
+	(void) lttng_dynamic_buffer_append(&relayd->bundle, data, len);
+end:
+	return ret;
+}
+
+/*
+ * Send the bundles staged for every relayd. A relayd to which its bundle
+ * can't be sent is cleaned up.
+ */
+static void consumer_flush_relayd_bundles(struct lttng_consumer_local_data *ctx)
+{
+	int ret;
+	struct lttng_ht_iter iter;
+	struct consumer_relayd_sock_pair *relayd;
+
+	rcu_read_lock();
+	cds_lfht_for_each_entry(consumer_data.relayd_ht->ht, &iter.iter, relayd,
+			node.node) {
+		pthread_mutex_lock(&relayd->data_sock_mutex);
+		ret = relayd_flush_data_bundle(relayd);
+		pthread_mutex_unlock(&relayd->data_sock_mutex);
+		if (ret < 0) {
+			cleanup_relayd(relayd, ctx);
+		}
+	}
+	rcu_read_unlock();
+}
+
 /*
  * Allocate and return a new lttng_consumer_channel object using the given key
  * to initialize the hash table node.
@@ -1068,67 +1247,6 @@ int consumer_add_channel(struct lttng_consumer_channel *channel,
 	return 0;
 }
 
-/*
- * Allocate the pollfd structure and the local view of the out fds to avoid
- * doing a lookup in the linked list and concurrency issues when writing is
- * needed. Called with consumer_data.lock held.
- *
- * Returns the number of fds in the structures.
- */
-static int update_poll_array(struct lttng_consumer_local_data *ctx,
-		struct pollfd **pollfd, struct lttng_consumer_stream **local_stream,
-		struct lttng_ht *ht)
-{
-	int i = 0;
-	struct lttng_ht_iter iter;
-	struct lttng_consumer_stream *stream;
-
-	assert(ctx);
-	assert(ht);
-	assert(pollfd);
-	assert(local_stream);
-
-	DBG("Updating poll fd array");
-	rcu_read_lock();
-	cds_lfht_for_each_entry(ht->ht, &iter.iter, stream, node.node) {
-		/*
-		 * Only active streams with an active end point can be added to the
-		 * poll set and local stream storage of the thread.
-		 *
-		 * There is a potential race here for endpoint_status to be updated
-		 * just after the check. However, this is OK since the stream(s) will
-		 * be deleted once the thread is notified that the end point state has
-		 * changed where this function will be called back again.
-		 */
-		if (stream->state != LTTNG_CONSUMER_ACTIVE_STREAM ||
-				stream->endpoint_status == CONSUMER_ENDPOINT_INACTIVE) {
-			continue;
-		}
-		/*
-		 * This clobbers way too much the debug output. Uncomment that if you
-		 * need it for debugging purposes.
-		 *
-		 * DBG("Active FD %d", stream->wait_fd);
-		 */
-		(*pollfd)[i].fd = stream->wait_fd;
-		(*pollfd)[i].events = POLLIN | POLLPRI;
-		local_stream[i] = stream;
-		i++;
-	}
-	rcu_read_unlock();
-
-	/*
-	 * Insert the consumer_data_pipe at the end of the array and don't
-	 * increment i so nb_fd is the number of real FD.
-	 */
-	(*pollfd)[i].fd = lttng_pipe_get_readfd(ctx->consumer_data_pipe);
-	(*pollfd)[i].events = POLLIN | POLLPRI;
-
-	(*pollfd)[i + 1].fd = lttng_pipe_get_readfd(ctx->consumer_wakeup_pipe);
-	(*pollfd)[i + 1].events = POLLIN | POLLPRI;
-	return i;
-}
-
 /*
  * Poll on the should_quit pipe and the command socket return -1 on
  * error, 1 if should exit, 0 if data is available on the command socket
@@ -1174,6 +1292,24 @@ void lttng_consumer_set_command_sock_path(
 	ctx->consumer_command_sock_path = sock;
 }
 
+/*
+ * Set whether the tracefiles of the streams in tracefile rotation are reused.
+ * Must be called before any stream is received.
+ */
+void lttng_consumer_set_tracefile_reuse(bool reuse)
+{
+	consumer_data.tracefile_reuse = reuse;
+}
+
+/*
+ * Set the number of bytes read from a data stream each time it is found
+ * ready. Must be called before the data threads are started.
+ */
+void lttng_consumer_set_drain_budget(uint64_t budget)
+{
+	consumer_data.drain_budget = budget;
+}
+
 /*
  * Send return code to the session daemon.
  * If the socket is not defined, we return 0, it is not a fatal error
@@ -1283,10 +1419,149 @@ void lttng_consumer_sync_trace_file(struct lttng_consumer_stream *stream,
 	}
 }
 
+/*
+ * Submit the data written to the output file of a stream for writeback once
+ * at least a sub-buffer or DEFAULT_CONSUMER_WRITEBACK_BATCH_SIZE bytes are
+ * pending, and wait for the writeback of the previous batch to limit the
+ * amount of page cache used. This amortizes the cost of these calls over
+ * many sub-buffers when the sub-buffers are small.
+ */
+static void consumer_stream_writeback(struct lttng_consumer_stream *stream)
+{
+	int ret;
+	int outfd = stream->out_fd;
+	off_t batch_size, pending, prev_len;
+
+	batch_size = max_t(off_t, stream->max_sb_size,
+			DEFAULT_CONSUMER_WRITEBACK_BATCH_SIZE);
+
+	if (stream->out_fd_writeback_offset > stream->out_fd_offset) {
+		/* The output file was truncated. */
+		stream->out_fd_writeback_offset = 0;
+		stream->out_fd_prev_writeback_offset = 0;
+	}
+
+	pending = stream->out_fd_offset - stream->out_fd_writeback_offset;
+	if (pending < batch_size) {
+		return;
+	}
+
+	/* This won't block, but will start writeout asynchronously */
+	lttng_sync_file_range(outfd, stream->out_fd_writeback_offset, pending,
+			SYNC_FILE_RANGE_WRITE);
+
+	/*
+	 * Same as lttng_consumer_sync_trace_file(), for the previous batch:
+	 * write-and-wait on its pages and tell the kernel we won't access
+	 * them in a near future. Don't care about error values, as these are
+	 * just hints and ways to limit the amount of page cache used.
+	 */
+	prev_len = stream->out_fd_writeback_offset -
+			stream->out_fd_prev_writeback_offset;
+	if (prev_len > 0) {
+		lttng_sync_file_range(outfd,
+				stream->out_fd_prev_writeback_offset, prev_len,
+				SYNC_FILE_RANGE_WAIT_BEFORE
+				| SYNC_FILE_RANGE_WRITE
+				| SYNC_FILE_RANGE_WAIT_AFTER);
+		ret = posix_fadvise(outfd, stream->out_fd_prev_writeback_offset,
+				prev_len, POSIX_FADV_DONTNEED);
+		if (ret && ret != -ENOSYS) {
+			errno = ret;
+			PERROR("posix_fadvise on fd %i", outfd);
+		}
+	}
+
+	stream->out_fd_prev_writeback_offset = stream->out_fd_writeback_offset;
+	stream->out_fd_writeback_offset = stream->out_fd_offset;
+}
+
+/*
+ * Write-and-wait on the data of the output file of a stream that is not
+ * synced yet, that is the previous and the last partial writeback batch, and
+ * drop it from the page cache. Called before the output file is closed on
+ * rotation or on stream close so its tail does not linger in the page cache.
+ */
+void consumer_stream_writeback_flush(struct lttng_consumer_stream *stream)
+{
+	int ret;
+	int outfd = stream->out_fd;
+	off_t len;
+
+	if (outfd < 0) {
+		return;
+	}
+
+	if (stream->out_fd_writeback_offset > stream->out_fd_offset) {
+		/* The output file was truncated. */
+		stream->out_fd_writeback_offset = 0;
+		stream->out_fd_prev_writeback_offset = 0;
+	}
+
+	len = stream->out_fd_offset - stream->out_fd_prev_writeback_offset;
+	if (len > 0) {
+		lttng_sync_file_range(outfd,
+				stream->out_fd_prev_writeback_offset, len,
+				SYNC_FILE_RANGE_WAIT_BEFORE
+				| SYNC_FILE_RANGE_WRITE
+				| SYNC_FILE_RANGE_WAIT_AFTER);
+		ret = posix_fadvise(outfd, stream->out_fd_prev_writeback_offset,
+				len, POSIX_FADV_DONTNEED);
+		if (ret && ret != -ENOSYS) {
+			errno = ret;
+			PERROR("posix_fadvise on fd %i", outfd);
+		}
+	}
+
+	stream->out_fd_prev_writeback_offset = stream->out_fd_offset;
+	stream->out_fd_writeback_offset = stream->out_fd_offset;
+}
+
+/*
+ * Close the pipes of the data threads of a context and free them.
+ */
+static void destroy_data_threads(struct lttng_consumer_local_data *ctx)
+{
+	unsigned int i;
+
+	if (!ctx->data_threads) {
+		return;
+	}
+
+	for (i = 0; i < ctx->nr_data_threads; i++) {
+		lttng_pipe_destroy(ctx->data_threads[i].stream_pipe);
+		lttng_pipe_destroy(ctx->data_threads[i].wakeup_pipe);
+	}
+	free(ctx->data_threads);
+	ctx->data_threads = NULL;
+	ctx->nr_data_threads = 0;
+}
+
+/*
+ * Free the writer threads of a context.
+ */
+static void destroy_writers(struct lttng_consumer_local_data *ctx)
+{
+	unsigned int i;
+
+	if (!ctx->writers) {
+		return;
+	}
+
+	for (i = 0; i < ctx->nr_writers; i++) {
+		pthread_mutex_destroy(&ctx->writers[i].lock);
+		pthread_cond_destroy(&ctx->writers[i].cond);
+	}
+	free(ctx->writers);
+	ctx->writers = NULL;
+	ctx->nr_writers = 0;
+}
+
 /*
  * Initialise the necessary environnement :
  * - create a new context
- * - create the poll_pipe
+ * - create the data threads' stream and wakeup pipes
+ * - create the writer threads' queues
  * - create the should_quit pipe (for signal handler)
  * - create the thread pipe (for splice)
  *
@@ -1303,9 +1578,11 @@ struct lttng_consumer_local_data *lttng_consumer_create(
 			struct lttng_consumer_local_data *ctx),
 		int (*recv_channel)(struct lttng_consumer_channel *channel),
 		int (*recv_stream)(struct lttng_consumer_stream *stream),
-		int (*update_stream)(uint64_t stream_key, uint32_t state))
+		int (*update_stream)(uint64_t stream_key, uint32_t state),
+		unsigned int nr_data_threads, unsigned int nr_writers)
 {
 	int ret;
+	unsigned int i;
 	struct lttng_consumer_local_data *ctx;
 
 	assert(consumer_data.type == LTTNG_CONSUMER_UNKNOWN ||
@@ -1327,14 +1604,53 @@ struct lttng_consumer_local_data *lttng_consumer_create(
 	ctx->on_recv_stream = recv_stream;
 	ctx->on_update_stream = update_stream;
 
-	ctx->consumer_data_pipe = lttng_pipe_open(0);
-	if (!ctx->consumer_data_pipe) {
-		goto error_poll_pipe;
+	assert(nr_data_threads > 0);
+	ctx->data_threads = zmalloc(nr_data_threads *
+			sizeof(*ctx->data_threads));
+	if (!ctx->data_threads) {
+		PERROR("allocating data threads");
+		goto error_data_threads;
+	}
+	ctx->nr_data_threads = nr_data_threads;
+	ctx->nr_data_threads_running = nr_data_threads;
+
+	for (i = 0; i < nr_data_threads; i++) {
+		struct lttng_consumer_data_thread *thread = &ctx->data_threads[i];
+
+		thread->index = i;
+		thread->ctx = ctx;
+
+		thread->stream_pipe = lttng_pipe_open(0);
+		if (!thread->stream_pipe) {
+			goto error_poll_pipe;
+		}
+
+		thread->wakeup_pipe = lttng_pipe_open(0);
+		if (!thread->wakeup_pipe) {
+			goto error_poll_pipe;
+		}
+
+		cds_wfcq_init(&thread->written_head, &thread->written_tail);
+		CDS_INIT_LIST_HEAD(&thread->writer_parked);
 	}
 
-	ctx->consumer_wakeup_pipe = lttng_pipe_open(0);
-	if (!ctx->consumer_wakeup_pipe) {
-		goto error_wakeup_pipe;
+	if (nr_writers > 0) {
+		ctx->writers = zmalloc(nr_writers * sizeof(*ctx->writers));
+		if (!ctx->writers) {
+			PERROR("allocating writer threads");
+			goto error_writers;
+		}
+		ctx->nr_writers = nr_writers;
+
+		for (i = 0; i < nr_writers; i++) {
+			struct lttng_consumer_writer *writer = &ctx->writers[i];
+
+			writer->index = i;
+			writer->ctx = ctx;
+			pthread_mutex_init(&writer->lock, NULL);
+			pthread_cond_init(&writer->cond, NULL);
+			CDS_INIT_LIST_HEAD(&writer->queue);
+		}
 	}
 
 	ret = pipe(ctx->consumer_should_quit);
@@ -1363,10 +1679,11 @@ error_metadata_pipe:
 error_channel_pipe:
 	utils_close_pipe(ctx->consumer_should_quit);
 error_quit_pipe:
-	lttng_pipe_destroy(ctx->consumer_wakeup_pipe);
-error_wakeup_pipe:
-	lttng_pipe_destroy(ctx->consumer_data_pipe);
+	destroy_writers(ctx);
+error_writers:
 error_poll_pipe:
+	destroy_data_threads(ctx);
+error_data_threads:
 	free(ctx);
 error:
 	return NULL;
@@ -1448,9 +1765,9 @@ void lttng_consumer_destroy(struct lttng_consumer_local_data *ctx)
 		PERROR("close");
 	}
 	utils_close_pipe(ctx->consumer_channel_pipe);
-	lttng_pipe_destroy(ctx->consumer_data_pipe);
+	destroy_data_threads(ctx);
+	destroy_writers(ctx);
 	lttng_pipe_destroy(ctx->consumer_metadata_pipe);
-	lttng_pipe_destroy(ctx->consumer_wakeup_pipe);
 	utils_close_pipe(ctx->consumer_should_quit);
 
 	unlink(ctx->consumer_command_sock_path);
@@ -1502,8 +1819,6 @@ end:
  *
  * It must be called with the stream lock held.
  *
- * Careful review MUST be put if any changes occur!
- *
  * Returns the number of bytes written
  */
 ssize_t lttng_consumer_on_read_subbuffer_mmap(
@@ -1515,23 +1830,6 @@ ssize_t lttng_consumer_on_read_subbuffer_mmap(
 	unsigned long mmap_offset;
 	void *mmap_base;
 	ssize_t ret = 0;
-	off_t orig_offset = stream->out_fd_offset;
-	/* Default is on the disk */
-	int outfd = stream->out_fd;
-	struct consumer_relayd_sock_pair *relayd = NULL;
-	unsigned int relayd_hang_up = 0;
-
-	/* RCU lock for the relayd pointer */
-	rcu_read_lock();
-
-	/* Flag that the current stream if set for network streaming. */
-	if (stream->net_seq_idx != (uint64_t) -1ULL) {
-		relayd = consumer_find_relayd(stream->net_seq_idx);
-		if (relayd == NULL) {
-			ret = -EPIPE;
-			goto end;
-		}
-	}
 
 	/* get the offset inside the fd to mmap */
 	switch (consumer_data.type) {
@@ -1563,6 +1861,56 @@ ssize_t lttng_consumer_on_read_subbuffer_mmap(
 		assert(0);
 	}
 
+	ret = lttng_consumer_on_read_subbuffer_buffer(ctx, stream,
+			mmap_base + mmap_offset, len, padding, index);
+end:
+	return ret;
+}
+
+/*
+ * Write a sub-buffer from memory to the tracefile or the network. The buffer
+ * holds len bytes of data followed by padding bytes.
+ *
+ * When streaming, the relayd headers and the sub-buffer are sent with a
+ * single writev(2).
+ *
+ * It must be called with the stream lock held.
+ *
+ * Careful review MUST be put if any changes occur!
+ *
+ * Returns the number of bytes written
+ */
+ssize_t lttng_consumer_on_read_subbuffer_buffer(
+		struct lttng_consumer_local_data *ctx,
+		struct lttng_consumer_stream *stream, const char *buf,
+		unsigned long len, unsigned long padding,
+		struct ctf_packet_index *index)
+{
+	ssize_t ret = 0;
+	/* Default is on the disk */
+	int outfd = stream->out_fd;
+	struct consumer_relayd_sock_pair *relayd = NULL;
+	unsigned int relayd_hang_up = 0;
+	struct lttcomm_relayd_hdr cmd_hdr;
+	struct lttcomm_relayd_data_hdr data_hdr;
+	struct lttcomm_relayd_metadata_payload metadata_hdr;
+	struct iovec iov[3];
+	int iovcnt = 0;
+	size_t headers_len = 0;
+	bool data_sock_locked = false;
+
+	/* RCU lock for the relayd pointer */
+	rcu_read_lock();
+
+	/* Flag that the current stream if set for network streaming. */
+	if (stream->net_seq_idx != (uint64_t) -1ULL) {
+		relayd = consumer_find_relayd(stream->net_seq_idx);
+		if (relayd == NULL) {
+			ret = -EPIPE;
+			goto end;
+		}
+	}
+
 	/* Handle stream on the relayd if the output is on the network */
 	if (relayd) {
 		unsigned long netlen = len;
@@ -1585,23 +1933,55 @@ ssize_t lttng_consumer_on_read_subbuffer_mmap(
 				stream->reset_metadata_flag = 0;
 			}
 			netlen += sizeof(struct lttcomm_relayd_metadata_payload);
-		}
 
-		ret = write_relayd_stream_header(stream, netlen, padding, relayd);
-		if (ret < 0) {
-			relayd_hang_up = 1;
-			goto write_error;
-		}
-		/* Use the returned socket. */
-		outfd = ret;
-
-		/* Write metadata stream id before payload */
-		if (stream->metadata_flag) {
-			ret = write_relayd_metadata_id(outfd, stream, relayd, padding);
+			/*
+			 * Metadata are always sent on the control socket, preceded
+			 * by the command header and the metadata stream id.
+			 */
+			relayd_init_command_header(&cmd_hdr, RELAYD_SEND_METADATA,
+					netlen);
+			metadata_hdr.stream_id = htobe64(stream->relayd_stream_id);
+			metadata_hdr.padding_size = htobe32(padding);
+			iov[iovcnt].iov_base = &cmd_hdr;
+			iov[iovcnt++].iov_len = sizeof(cmd_hdr);
+			iov[iovcnt].iov_base = &metadata_hdr;
+			iov[iovcnt++].iov_len = sizeof(metadata_hdr);
+			outfd = relayd->control_sock.sock.fd;
+		} else {
+			pthread_mutex_lock(&relayd->data_sock_mutex);
+			data_sock_locked = true;
+			if ((relayd->capabilities &
+					RELAYD_CAPABILITY_DATA_BUNDLE) &&
+					len <= RELAYD_DATA_BUNDLE_PACKET_MAX_SIZE) {
+				/* Small packets are sent together, in a bundle. */
+				ret = relayd_bundle_data(relayd, stream, buf,
+						len, padding);
+				if (ret == -ENOMEM) {
+					goto write_error;
+				} else if (ret < 0) {
+					relayd_hang_up = 1;
+					goto write_error;
+				}
+				ret = len;
+				goto written;
+			}
+			/* Keep the packets ordered on the data socket. */
+			ret = relayd_flush_data_bundle(relayd);
 			if (ret < 0) {
 				relayd_hang_up = 1;
 				goto write_error;
 			}
+			init_relayd_data_header(stream, &data_hdr, netlen, padding);
+			iov[iovcnt].iov_base = &data_hdr;
+			iov[iovcnt++].iov_len = sizeof(data_hdr);
+			outfd = relayd->data_sock.sock.fd;
+		}
+		headers_len = iov[0].iov_len + (iovcnt > 1 ? iov[1].iov_len : 0);
+
+		if (outfd < 0) {
+			ret = -ECONNRESET;
+			relayd_hang_up = 1;
+			goto write_error;
 		}
 	} else {
 		/* No streaming, we have to set the len with the full padding */
@@ -1622,33 +2002,11 @@ ssize_t lttng_consumer_on_read_subbuffer_mmap(
 		if (stream->chan->tracefile_size > 0 &&
 				(stream->tracefile_size_current + len) >
 				stream->chan->tracefile_size) {
-			ret = utils_rotate_stream_file(stream->chan->pathname,
-					stream->name, stream->chan->tracefile_size,
-					stream->chan->tracefile_count, stream->uid, stream->gid,
-					stream->out_fd, &(stream->tracefile_count_current),
-					&stream->out_fd);
+			ret = consumer_stream_rotate_output(stream);
 			if (ret < 0) {
-				ERR("Rotating output file");
 				goto end;
 			}
 			outfd = stream->out_fd;
-
-			if (stream->index_file) {
-				lttng_index_file_put(stream->index_file);
-				stream->index_file = lttng_index_file_create(stream->chan->pathname,
-						stream->name, stream->uid, stream->gid,
-						stream->chan->tracefile_size,
-						stream->tracefile_count_current,
-						CTF_INDEX_MAJOR, CTF_INDEX_MINOR);
-				if (!stream->index_file) {
-					goto end;
-				}
-			}
-
-			/* Reset current size because we just perform a rotation. */
-			stream->tracefile_size_current = 0;
-			stream->out_fd_offset = 0;
-			orig_offset = 0;
 		}
 		stream->tracefile_size_current += len;
 		if (index) {
@@ -1656,11 +2014,17 @@ ssize_t lttng_consumer_on_read_subbuffer_mmap(
 		}
 	}
 
+	iov[iovcnt].iov_base = (void *) buf;
+	iov[iovcnt++].iov_len = len;
+
 	/*
-	 * This call guarantee that len or less is returned. It's impossible to
-	 * receive a ret value that is bigger than len.
+	 * This call guarantee that headers_len + len or less is returned. Only
+	 * the amount of sub-buffer data written is reported.
 	 */
-	ret = lttng_write(outfd, mmap_base + mmap_offset, len);
+	ret = lttng_writev(outfd, iov, iovcnt);
+	if (ret > 0) {
+		ret = ret > headers_len ? ret - headers_len : 0;
+	}
 	DBG("Consumer mmap write() ret %zd (len %lu)", ret, len);
 	if (ret < 0 || ((size_t) ret != len)) {
 		/*
@@ -1687,18 +2051,19 @@ ssize_t lttng_consumer_on_read_subbuffer_mmap(
 		}
 		goto write_error;
 	}
+written:
 	stream->output_written += ret;
 
 	/* This call is useless on a socket so better save a syscall. */
 	if (!relayd) {
-		/* This won't block, but will start writeout asynchronously */
-		lttng_sync_file_range(outfd, stream->out_fd_offset, len,
-				SYNC_FILE_RANGE_WRITE);
 		stream->out_fd_offset += len;
-		lttng_consumer_sync_trace_file(stream, orig_offset);
+		consumer_stream_writeback(stream);
 	}
 
 write_error:
+	if (data_sock_locked) {
+		pthread_mutex_unlock(&relayd->data_sock_mutex);
+	}
 	/*
 	 * This is a special case that the relayd has closed its socket. Let's
 	 * cleanup the relayd object and all associated streams.
@@ -1739,6 +2104,7 @@ ssize_t lttng_consumer_on_read_subbuffer_splice(
 	struct consumer_relayd_sock_pair *relayd = NULL;
 	int *splice_pipe;
 	unsigned int relayd_hang_up = 0;
+	bool data_sock_locked = false;
 
 	switch (consumer_data.type) {
 	case LTTNG_CONSUMER_KERNEL:
@@ -1795,6 +2161,19 @@ ssize_t lttng_consumer_on_read_subbuffer_splice(
 			}
 
 			total_len += sizeof(struct lttcomm_relayd_metadata_payload);
+		} else {
+			/*
+			 * The data socket is used until the whole packet is
+			 * spliced, after the packets staged before it.
+			 */
+			pthread_mutex_lock(&relayd->data_sock_mutex);
+			data_sock_locked = true;
+			ret = relayd_flush_data_bundle(relayd);
+			if (ret < 0) {
+				written = ret;
+				relayd_hang_up = 1;
+				goto write_error;
+			}
 		}
 
 		ret = write_relayd_stream_header(stream, total_len, padding, relayd);
@@ -1823,33 +2202,12 @@ ssize_t lttng_consumer_on_read_subbuffer_splice(
 		if (stream->chan->tracefile_size > 0 &&
 				(stream->tracefile_size_current + len) >
 				stream->chan->tracefile_size) {
-			ret = utils_rotate_stream_file(stream->chan->pathname,
-					stream->name, stream->chan->tracefile_size,
-					stream->chan->tracefile_count, stream->uid, stream->gid,
-					stream->out_fd, &(stream->tracefile_count_current),
-					&stream->out_fd);
+			ret = consumer_stream_rotate_output(stream);
 			if (ret < 0) {
 				written = ret;
-				ERR("Rotating output file");
 				goto end;
 			}
 			outfd = stream->out_fd;
-
-			if (stream->index_file) {
-				lttng_index_file_put(stream->index_file);
-				stream->index_file = lttng_index_file_create(stream->chan->pathname,
-						stream->name, stream->uid, stream->gid,
-						stream->chan->tracefile_size,
-						stream->tracefile_count_current,
-						CTF_INDEX_MAJOR, CTF_INDEX_MINOR);
-				if (!stream->index_file) {
-					goto end;
-				}
-			}
-
-			/* Reset current size because we just perform a rotation. */
-			stream->tracefile_size_current = 0;
-			stream->out_fd_offset = 0;
 			orig_offset = 0;
 		}
 		stream->tracefile_size_current += len;
@@ -1925,6 +2283,10 @@ ssize_t lttng_consumer_on_read_subbuffer_splice(
 	goto end;
 
 write_error:
+	if (data_sock_locked) {
+		pthread_mutex_unlock(&relayd->data_sock_mutex);
+		data_sock_locked = false;
+	}
 	/*
 	 * This is a special case that the relayd has closed its socket. Let's
 	 * cleanup the relayd object and all associated streams.
@@ -1950,6 +2312,9 @@ splice_error:
 	}
 
 end:
+	if (data_sock_locked) {
+		pthread_mutex_unlock(&relayd->data_sock_mutex);
+	}
 	if (relayd && stream->metadata_flag) {
 		pthread_mutex_unlock(&relayd->ctrl_sock_mutex);
 	}
@@ -2172,10 +2537,154 @@ int consumer_add_metadata_stream(struct lttng_consumer_stream *stream)
 	return ret;
 }
 
+/*
+ * Return the current time of the monotonic clock in usec.
+ */
+static uint64_t monotonic_time_us(void)
+{
+	struct timespec ts;
+
+	if (lttng_clock_gettime(CLOCK_MONOTONIC, &ts)) {
+		PERROR("clock_gettime");
+		return 0;
+	}
+	return (uint64_t) ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Events polled on the wait fd of a data stream. The streams of a channel
+ * with a read timer are only polled for hangups and errors, which are always
+ * reported: their data is found by sampling their ring buffer positions.
+ */
+static uint32_t data_stream_poll_events(struct lttng_consumer_stream *stream)
+{
+	return stream->chan->read_timer_interval ? 0 : LPOLLIN | LPOLLPRI;
+}
+
+/*
+ * Add a data stream received by a data thread to its poll set and wait fd hash
+ * table, and to its list of streams polled by a read timer if the channel of
+ * the stream has one.
+ *
+ * Only active streams with an active end point are polled. There is a
+ * potential race here for endpoint_status to be updated just after the check.
+ * However, this is OK since the stream(s) will be deleted once the thread is
+ * notified that the end point state has changed.
+ *
+ * Return 0 on success else a negative value.
+ */
+static int data_thread_add_stream(struct lttng_poll_event *events,
+		struct lttng_ht *wait_fd_ht, struct cds_list_head *read_timer_streams,
+		struct lttng_consumer_stream *stream)
+{
+	int ret;
+
+	if (stream->state != LTTNG_CONSUMER_ACTIVE_STREAM ||
+			stream->endpoint_status == CONSUMER_ENDPOINT_INACTIVE) {
+		ret = 0;
+		goto end;
+	}
+
+	ret = lttng_poll_add(events, stream->wait_fd,
+			data_stream_poll_events(stream));
+	if (ret < 0) {
+		ERR("Adding data stream %" PRIu64 " to poll set", stream->key);
+		goto end;
+	}
+
+	lttng_ht_node_init_u64(&stream->node_wait_fd, stream->wait_fd);
+	rcu_read_lock();
+	lttng_ht_add_unique_u64(wait_fd_ht, &stream->node_wait_fd);
+	rcu_read_unlock();
+
+	if (stream->chan->read_timer_interval) {
+		stream->read_timer_deadline = monotonic_time_us() +
+				stream->chan->read_timer_interval;
+		cds_list_add_tail(&stream->read_timer_node, read_timer_streams);
+	}
+
+end:
+	return ret;
+}
+
+/*
+ * Lookup the data stream polled on the given fd by a data thread. Return NULL
+ * if none is found.
+ */
+static struct lttng_consumer_stream *data_thread_find_stream(
+		struct lttng_ht *wait_fd_ht, int fd)
+{
+	uint64_t key = (uint64_t) fd;
+	struct lttng_ht_iter iter;
+	struct lttng_ht_node_u64 *node;
+	struct lttng_consumer_stream *stream = NULL;
+
+	rcu_read_lock();
+	lttng_ht_lookup(wait_fd_ht, &key, &iter);
+	node = lttng_ht_iter_get_node_u64(&iter);
+	if (node) {
+		stream = caa_container_of(node, struct lttng_consumer_stream,
+				node_wait_fd);
+	}
+	rcu_read_unlock();
+
+	return stream;
+}
+
+/*
+ * Remove a data stream from the poll set, wait fd hash table and pending list
+ * of its data thread and destroy it.
+ */
+static void data_thread_del_stream(struct lttng_poll_event *events,
+		struct lttng_ht *wait_fd_ht, struct lttng_consumer_stream *stream)
+{
+	struct lttng_ht_iter iter;
+
+	cds_list_del_init(&stream->data_pending_node);
+	cds_list_del_init(&stream->read_timer_node);
+
+	/* Inactive streams were never added to the poll set. */
+	if (data_thread_find_stream(wait_fd_ht, stream->wait_fd) == stream) {
+		rcu_read_lock();
+		iter.iter.node = &stream->node_wait_fd.node;
+		(void) lttng_ht_del(wait_fd_ht, &iter);
+		rcu_read_unlock();
+		/* Remove the fd from the poll set before it is closed. */
+		(void) lttng_poll_del(events, stream->wait_fd);
+	}
+
+	consumer_del_stream(stream, data_ht);
+}
+
+/*
+ * Empty the wait fd hash table of a data thread and destroy it. The streams
+ * are left in the data stream hash table.
+ */
+static void data_thread_destroy_wait_fd_ht(struct lttng_ht *wait_fd_ht)
+{
+	struct lttng_ht_iter iter;
+	struct lttng_consumer_stream *stream;
+
+	if (wait_fd_ht == NULL) {
+		return;
+	}
+
+	rcu_read_lock();
+	cds_lfht_for_each_entry(wait_fd_ht->ht, &iter.iter, stream,
+			node_wait_fd.node) {
+		(void) lttng_ht_del(wait_fd_ht, &iter);
+	}
+	rcu_read_unlock();
+
+	lttng_ht_destroy(wait_fd_ht);
+}
+
 /*
  * Delete data stream that are flagged for deletion (endpoint_status).
  */
-static void validate_endpoint_status_data_stream(void)
+static void validate_endpoint_status_data_stream(
+		struct lttng_consumer_data_thread *thread,
+		struct lttng_poll_event *events, struct lttng_ht *wait_fd_ht)
 {
 	struct lttng_ht_iter iter;
 	struct lttng_consumer_stream *stream;
@@ -2184,12 +2693,20 @@ static void validate_endpoint_status_data_stream(void)
 
 	rcu_read_lock();
 	cds_lfht_for_each_entry(data_ht->ht, &iter.iter, stream, node.node) {
+		/* Only the owning data thread may delete a stream. */
+		if (stream->data_thread != thread) {
+			continue;
+		}
 		/* Validate delete flag of the stream */
 		if (stream->endpoint_status == CONSUMER_ENDPOINT_ACTIVE) {
 			continue;
 		}
+		/* Deleted once returned by its writer thread. */
+		if (stream->writer_pending) {
+			continue;
+		}
 		/* Delete it right now */
-		consumer_del_stream(stream, data_ht);
+		data_thread_del_stream(events, wait_fd_ht, stream);
 	}
 	rcu_read_unlock();
 }
@@ -2446,18 +2963,397 @@ error_testpoint:
 }
 
 /*
- * This thread polls the fds in the set to consume the data and write
- * it to tracefile if necessary.
+ * Read the sub-buffers of a data stream until none is left or until the drain
+ * budget is spent, so that a stream producing quickly is not read once per
+ * wakeup of its thread. The budget is converted to a number of sub-buffers
+ * according to the sub-buffer size of the channel of the stream, at least one
+ * sub-buffer being read, so that the other ready streams are read in the same
+ * pass whatever their sub-buffer size.
+ *
+ * Return the sum of the values returned by the on_buffer_ready callback if a
+ * sub-buffer was read, else the value it returned. An error other than an
+ * unavailable sub-buffer is always returned.
+ */
+static ssize_t read_stream_budget(struct lttng_consumer_local_data *ctx,
+		struct lttng_consumer_stream *stream,
+		struct lttng_consumer_read_stats *stats)
+{
+	ssize_t ret, len = 0;
+	uint64_t i, nr_subbufs = 1, written;
+	bool ust = consumer_data.type == LTTNG_CONSUMER32_UST ||
+			consumer_data.type == LTTNG_CONSUMER64_UST;
+
+	if (stream->max_sb_size > 0 &&
+			consumer_data.drain_budget > stream->max_sb_size) {
+		nr_subbufs = consumer_data.drain_budget / stream->max_sb_size;
+	}
+
+	written = stream->output_written;
+	for (i = 0; i < nr_subbufs; i++) {
+		ret = ctx->on_buffer_ready(stream, ctx);
+		if (ret < 0) {
+			/* it's ok to have an unavailable sub-buffer */
+			if (i == 0 || (ret != -EAGAIN && ret != -ENODATA)) {
+				len = ret;
+			}
+			break;
+		}
+		len += ret;
+		/* UST streams flag whether a sub-buffer is left after a read. */
+		if (ust && !stream->has_data) {
+			i++;
+			break;
+		}
+	}
+
+	stats->nr_stream_reads++;
+	stats->nr_subbufs += i;
+	stats->bytes += stream->output_written - written;
+	return len;
+}
+
+/*
+ * Log the read counters of a data or writer thread.
+ */
+static void log_read_stats(const char *name, unsigned int index,
+		const struct lttng_consumer_read_stats *stats)
+{
+	DBG("%s thread %u: %" PRIu64 " wakeups, %" PRIu64 " stream reads, %" PRIu64 " sub-buffers, %" PRIu64 " bytes, %.2f wakeups per MiB",
+			name, index, stats->nr_wakeups, stats->nr_stream_reads,
+			stats->nr_subbufs, stats->bytes,
+			stats->bytes ? (double) stats->nr_wakeups * 1048576.0 /
+				(double) stats->bytes : 0.0);
+}
+
+/*
+ * Queue a data stream to its writer thread unless the queue of the writer is
+ * full.
+ *
+ * Return 0 on success or -1 if the queue is full.
+ */
+static int writer_queue_stream(struct lttng_consumer_writer *writer,
+		struct lttng_consumer_stream *stream)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&writer->lock);
+	if (writer->queue_len >= DEFAULT_CONSUMERD_WRITER_QUEUE_LEN) {
+		writer->has_parked = true;
+		ret = -1;
+		goto end;
+	}
+	cds_list_add_tail(&stream->writer_node, &writer->queue);
+	writer->queue_len++;
+	pthread_cond_signal(&writer->cond);
+end:
+	pthread_mutex_unlock(&writer->lock);
+	return ret;
+}
+
+/*
+ * Hand a data stream having a sub-buffer ready to its writer thread. The
+ * stream is removed from the poll set of its data thread until the writer
+ * thread returns it, so its wait fd is not reported again while the writer
+ * thread holds it. A stream whose writer thread has a full queue waits on the
+ * parked list of the data thread until the writer thread makes room in its
+ * queue and wakes up the data thread.
+ */
+static void data_thread_hand_off_stream(struct lttng_poll_event *events,
+		struct lttng_consumer_stream *stream)
+{
+	(void) lttng_poll_del(events, stream->wait_fd);
+	stream->writer_pending = true;
+	stream->data_thread->nr_writer_pending++;
+
+	if (writer_queue_stream(stream->writer, stream)) {
+		DBG("Writer thread %u queue full, parking data stream %" PRIu64,
+				stream->writer->index, stream->key);
+		cds_list_add_tail(&stream->writer_node,
+				&stream->data_thread->writer_parked);
+	}
+}
+
+/*
+ * Take back the streams returned by the writer threads of a data thread. A
+ * returned stream is put back in the poll set of the data thread, and queued
+ * on its pending list if it still has data. It is destroyed if its read
+ * failed, if its end point is gone or if it hung up and nothing was left to
+ * read, as the hangup handling of the data thread would have done. The parked
+ * streams are then queued again to their writer thread, which wakes up the
+ * data thread once it has room for them.
+ */
+static void data_thread_take_written_streams(
+		struct lttng_consumer_data_thread *thread,
+		struct lttng_poll_event *events, struct lttng_ht *wait_fd_ht,
+		struct cds_list_head *pending_streams)
+{
+	int ret;
+	ssize_t len;
+	struct cds_wfcq_node *node;
+	struct cds_list_head parked;
+	struct lttng_consumer_stream *stream, *tmp_stream;
+
+	while ((node = cds_wfcq_dequeue_blocking(&thread->written_head,
+			&thread->written_tail))) {
+		stream = caa_container_of(node, struct lttng_consumer_stream,
+				written_node);
+		cds_wfcq_node_init(&stream->written_node);
+		stream->writer_pending = false;
+		thread->nr_writer_pending--;
+
+		ret = lttng_poll_add(events, stream->wait_fd,
+				data_stream_poll_events(stream));
+		if (ret < 0) {
+			ERR("Adding data stream %" PRIu64 " back to poll set",
+					stream->key);
+			lttng_consumer_send_error(thread->ctx,
+					LTTCOMM_CONSUMERD_POLL_ERROR);
+		}
+
+		len = stream->written_len;
+		/* it's ok to have an unavailable sub-buffer */
+		if ((len < 0 && len != -EAGAIN && len != -ENODATA) ||
+				(stream->hangup_flush_done && len <= 0) ||
+				stream->endpoint_status != CONSUMER_ENDPOINT_ACTIVE) {
+			data_thread_del_stream(events, wait_fd_ht, stream);
+			continue;
+		}
+
+		if (stream->has_data) {
+			cds_list_add_tail(&stream->data_pending_node,
+					pending_streams);
+		}
+	}
+
+	CDS_INIT_LIST_HEAD(&parked);
+	cds_list_splice(&thread->writer_parked, &parked);
+	CDS_INIT_LIST_HEAD(&thread->writer_parked);
+
+	cds_list_for_each_entry_safe(stream, tmp_stream, &parked, writer_node) {
+		cds_list_del_init(&stream->writer_node);
+		if (writer_queue_stream(stream->writer, stream)) {
+			cds_list_add_tail(&stream->writer_node,
+					&thread->writer_parked);
+		}
+	}
+}
+
+/*
+ * Wait for the writer threads to return the streams handed to them by an
+ * exiting data thread, so that no writer thread still reads a stream once the
+ * data thread let it go. The parked streams are simply taken back since their
+ * writer thread does not know about them.
+ */
+static void data_thread_wait_written_streams(
+		struct lttng_consumer_data_thread *thread)
+{
+	struct cds_wfcq_node *node;
+	struct lttng_consumer_stream *stream, *tmp_stream;
+
+	cds_list_for_each_entry_safe(stream, tmp_stream, &thread->writer_parked,
+			writer_node) {
+		cds_list_del_init(&stream->writer_node);
+		stream->writer_pending = false;
+		thread->nr_writer_pending--;
+	}
+
+	while (thread->nr_writer_pending > 0) {
+		node = cds_wfcq_dequeue_blocking(&thread->written_head,
+				&thread->written_tail);
+		if (!node) {
+			char dummy;
+			ssize_t pipe_readlen;
+
+			/* Woken up when a stream is returned to the empty queue. */
+			pipe_readlen = lttng_pipe_read(thread->wakeup_pipe, &dummy,
+					sizeof(dummy));
+			if (pipe_readlen < 0) {
+				PERROR("Consumer data wakeup pipe");
+				break;
+			}
+			continue;
+		}
+		stream = caa_container_of(node, struct lttng_consumer_stream,
+				written_node);
+		cds_wfcq_node_init(&stream->written_node);
+		stream->writer_pending = false;
+		thread->nr_writer_pending--;
+	}
+}
+
+/*
+ * Sample the ring buffer positions of a UST data stream polled by a read
+ * timer.
+ *
+ * Return true if a complete sub-buffer is ready to be read or if the positions could
+ * not be sampled, in which case the read reports the error.
+ */
+static bool data_stream_has_subbuf(struct lttng_consumer_stream *stream)
+{
+	int ret;
+	bool ready = true;
+	unsigned long consumed, produced;
+
+	pthread_mutex_lock(&stream->lock);
+	ret = lttng_ustconsumer_sample_snapshot_positions(stream);
+	if (ret < 0) {
+		DBG("Sampling the positions of data stream %" PRIu64 " failed",
+				stream->key);
+		goto end;
+	}
+	ret = lttng_ustconsumer_get_consumed_snapshot(stream, &consumed);
+	if (ret < 0) {
+		goto end;
+	}
+	ret = lttng_ustconsumer_get_produced_snapshot(stream, &produced);
+	if (ret < 0) {
+		goto end;
+	}
+	/*
+	 * The produced position is the write position, which is within the
+	 * sub-buffer being written. A sub-buffer can only be read once the
+	 * writer moved past it, so compare the sub-buffers holding both
+	 * positions. The sub-buffer size is a power of two.
+	 */
+	assert(stream->max_sb_size);
+	ready = (produced & ~(stream->max_sb_size - 1)) !=
+			(consumed & ~(stream->max_sb_size - 1));
+end:
+	pthread_mutex_unlock(&stream->lock);
+	return ready;
+}
+
+/*
+ * Check the streams of a data thread polled by the read timer of their
+ * channel. The streams whose read timer expired and which have a sub-buffer
+ * ready are queued on the pending list of the thread to be read in this pass.
+ * The streams held by a writer thread are skipped since they are read anyway.
+ */
+static void data_thread_check_read_timers(
+		struct cds_list_head *read_timer_streams,
+		struct cds_list_head *pending_streams)
+{
+	uint64_t now;
+	struct lttng_consumer_stream *stream;
+
+	if (cds_list_empty(read_timer_streams)) {
+		return;
+	}
+
+	now = monotonic_time_us();
+	cds_list_for_each_entry(stream, read_timer_streams, read_timer_node) {
+		if (stream->read_timer_deadline > now) {
+			continue;
+		}
+		stream->read_timer_deadline = now +
+				stream->chan->read_timer_interval;
+
+		if (stream->writer_pending ||
+				!cds_list_empty(&stream->data_pending_node)) {
+			continue;
+		}
+		if (data_stream_has_subbuf(stream)) {
+			cds_list_add_tail(&stream->data_pending_node,
+					pending_streams);
+		}
+	}
+}
+
+/*
+ * Return the poll timeout of a data thread, in ms, until the next expiration
+ * of the read timer of one of its streams, or -1 if none of its streams is
+ * polled by a read timer.
+ */
+static int data_thread_read_timer_timeout(
+		struct cds_list_head *read_timer_streams)
+{
+	uint64_t now, next = UINT64_MAX;
+	struct lttng_consumer_stream *stream;
+
+	if (cds_list_empty(read_timer_streams)) {
+		return -1;
+	}
+
+	cds_list_for_each_entry(stream, read_timer_streams, read_timer_node) {
+		if (stream->read_timer_deadline < next) {
+			next = stream->read_timer_deadline;
+		}
+	}
+
+	now = monotonic_time_us();
+	if (next <= now) {
+		return 0;
+	}
+	/* Round up so that the timer expired when the poll times out. */
+	return (int) min((next - now + 999) / 1000, (uint64_t) INT_MAX);
+}
+
+/*
+ * Read a sub-buffer of a data stream owned by a data thread. A stream which
+ * still has data after the read is queued on the pending list of the thread
+ * so it is read again on the next pass even if its wait fd is not reported by
+ * the poll set. The stream is destroyed if the read fails.
+ *
+ * When writer threads are enabled, the stream is handed to its writer thread
+ * instead and -EINPROGRESS is returned: the caller must not use the stream
+ * until the writer thread returns it.
+ *
+ * Return the value returned by the on_buffer_ready callback.
+ */
+static ssize_t data_thread_read_stream(struct lttng_consumer_local_data *ctx,
+		struct lttng_poll_event *events, struct lttng_ht *wait_fd_ht,
+		struct cds_list_head *pending_streams,
+		struct lttng_consumer_stream *stream)
+{
+	ssize_t len;
+
+	cds_list_del_init(&stream->data_pending_node);
+
+	if (stream->writer) {
+		data_thread_hand_off_stream(events, stream);
+		len = -EINPROGRESS;
+		goto end;
+	}
+
+	len = read_stream_budget(ctx, stream, &stream->data_thread->stats);
+	/* it's ok to have an unavailable sub-buffer */
+	if (len < 0 && len != -EAGAIN && len != -ENODATA) {
+		/* Clean the stream and free it. */
+		data_thread_del_stream(events, wait_fd_ht, stream);
+		goto end;
+	}
+
+	if (stream->has_data) {
+		cds_list_add_tail(&stream->data_pending_node, pending_streams);
+	}
+
+end:
+	return len;
+}
+
+/*
+ * This thread polls the fds of the data streams it owns to consume the data
+ * and write it to tracefile if necessary. One instance runs per data thread
+ * of the context.
+ *
+ * Streams are registered to the poll set of the thread as they are received
+ * on its stream pipe and removed from it when they are destroyed, so the cost
+ * of a wakeup depends on the number of ready streams only.
  */
 void *consumer_thread_data_poll(void *data)
 {
-	int num_rdy, num_hup, high_prio, ret, i, err = -1;
-	struct pollfd *pollfd = NULL;
-	/* local view of the streams */
+	int ret, i, pollfd, stream_pipe_fd, wakeup_pipe_fd, high_prio, err = -1;
+	int timeout;
+	uint32_t revents, nb_fd;
+	/* local view of the streams matching the events of the poll set */
 	struct lttng_consumer_stream **local_stream = NULL, *new_stream = NULL;
-	/* local view of consumer_data.fds_count */
-	int nb_fd = 0;
-	struct lttng_consumer_local_data *ctx = data;
+	uint32_t local_stream_size = 0;
+	struct lttng_consumer_stream *stream, *tmp_stream;
+	struct lttng_poll_event events;
+	struct lttng_ht *wait_fd_ht;
+	struct cds_list_head pending_streams, pending_pass, read_timer_streams;
+	struct lttng_consumer_data_thread *thread = data;
+	struct lttng_consumer_local_data *ctx = thread->ctx;
 	ssize_t len;
 
 	rcu_register_thread();
@@ -2470,9 +3366,31 @@ void *consumer_thread_data_poll(void *data)
 
 	health_code_update();
 
-	local_stream = zmalloc(sizeof(struct lttng_consumer_stream *));
-	if (local_stream == NULL) {
-		PERROR("local_stream malloc");
+	CDS_INIT_LIST_HEAD(&pending_streams);
+	CDS_INIT_LIST_HEAD(&pending_pass);
+	CDS_INIT_LIST_HEAD(&read_timer_streams);
+
+	wait_fd_ht = lttng_ht_new(0, LTTNG_HT_TYPE_U64);
+	if (!wait_fd_ht) {
+		goto end_ht;
+	}
+
+	/* Size is set to 2 for the stream and wakeup pipes */
+	ret = lttng_poll_create(&events, 2, LTTNG_CLOEXEC);
+	if (ret < 0) {
+		ERR("Poll set creation failed");
+		goto end_poll;
+	}
+
+	stream_pipe_fd = lttng_pipe_get_readfd(thread->stream_pipe);
+	ret = lttng_poll_add(&events, stream_pipe_fd, LPOLLIN | LPOLLPRI);
+	if (ret < 0) {
+		goto end;
+	}
+
+	wakeup_pipe_fd = lttng_pipe_get_readfd(thread->wakeup_pipe);
+	ret = lttng_poll_add(&events, wakeup_pipe_fd, LPOLLIN | LPOLLPRI);
+	if (ret < 0) {
 		goto end;
 	}
 
@@ -2480,97 +3398,73 @@ void *consumer_thread_data_poll(void *data)
 		health_code_update();
 
 		high_prio = 0;
-		num_hup = 0;
-
-		/*
-		 * the fds set has been updated, we need to update our
-		 * local array as well
-		 */
-		pthread_mutex_lock(&consumer_data.lock);
-		if (consumer_data.need_update) {
-			free(pollfd);
-			pollfd = NULL;
-
-			free(local_stream);
-			local_stream = NULL;
-
-			/*
-			 * Allocate for all fds +1 for the consumer_data_pipe and +1 for
-			 * wake up pipe.
-			 */
-			pollfd = zmalloc((consumer_data.stream_count + 2) * sizeof(struct pollfd));
-			if (pollfd == NULL) {
-				PERROR("pollfd malloc");
-				pthread_mutex_unlock(&consumer_data.lock);
-				goto end;
-			}
 
-			local_stream = zmalloc((consumer_data.stream_count + 2) *
-					sizeof(struct lttng_consumer_stream *));
-			if (local_stream == NULL) {
-				PERROR("local_stream malloc");
-				pthread_mutex_unlock(&consumer_data.lock);
-				goto end;
-			}
-			ret = update_poll_array(ctx, &pollfd, local_stream,
-					data_ht);
-			if (ret < 0) {
-				ERR("Error in allocating pollfd or local_outfds");
-				lttng_consumer_send_error(ctx, LTTCOMM_CONSUMERD_POLL_ERROR);
-				pthread_mutex_unlock(&consumer_data.lock);
-				goto end;
-			}
-			nb_fd = ret;
-			consumer_data.need_update = 0;
-		}
-		pthread_mutex_unlock(&consumer_data.lock);
-
-		/* No FDs and consumer_quit, consumer_cleanup the thread */
-		if (nb_fd == 0 && consumer_quit == 1) {
+		/* No streams and consumer_quit, consumer_cleanup the thread */
+		if (consumer_quit == 1 && lttng_ht_get_count(wait_fd_ht) == 0) {
 			err = 0;	/* All is OK */
 			goto end;
 		}
-		/* poll on the array of fds */
+		/* Don't hold the packets read so far while waiting for more. */
+		consumer_flush_relayd_bundles(ctx);
+
+		/* poll on the set of fds */
 	restart:
-		DBG("polling on %d fd", nb_fd + 2);
+		DBG("Data thread %u polling on %u fd", thread->index,
+				LTTNG_POLL_GETNB(&events));
 		if (testpoint(consumerd_thread_data_poll)) {
 			goto end;
 		}
+		timeout = data_thread_read_timer_timeout(&read_timer_streams);
 		health_poll_entry();
-		num_rdy = poll(pollfd, nb_fd + 2, -1);
+		ret = lttng_poll_wait(&events, timeout);
 		health_poll_exit();
-		DBG("poll num_rdy : %d", num_rdy);
-		if (num_rdy == -1) {
+		DBG("poll num_rdy : %d", ret);
+		if (ret < 0) {
 			/*
 			 * Restart interrupted system call.
 			 */
 			if (errno == EINTR) {
 				goto restart;
 			}
-			PERROR("Poll error");
+			ERR("Poll error");
 			lttng_consumer_send_error(ctx, LTTCOMM_CONSUMERD_POLL_ERROR);
 			goto end;
-		} else if (num_rdy == 0) {
+		} else if (ret == 0 && timeout < 0) {
 			DBG("Polling thread timed out");
 			goto end;
 		}
 
+		nb_fd = ret;
+		thread->stats.nr_wakeups++;
+
 		if (caa_unlikely(data_consumption_paused)) {
 			DBG("Data consumption paused, sleeping...");
 			sleep(1);
 			goto restart;
 		}
 
+		if (ctx->nr_writers > 0) {
+			data_thread_take_written_streams(thread, &events, wait_fd_ht,
+					&pending_streams);
+		}
+		data_thread_check_read_timers(&read_timer_streams, &pending_streams);
+
 		/*
-		 * If the consumer_data_pipe triggered poll go directly to the
-		 * beginning of the loop to update the array. We want to prioritize
-		 * array update over low-priority reads.
+		 * If the stream pipe triggered poll, register the new stream and go
+		 * directly to the beginning of the loop. We want to prioritize poll
+		 * set updates over low-priority reads.
 		 */
-		if (pollfd[nb_fd].revents & (POLLIN | POLLPRI)) {
+		for (i = 0; i < nb_fd; i++) {
+			if (LTTNG_POLL_GETFD(&events, i) == stream_pipe_fd &&
+					(LTTNG_POLL_GETEV(&events, i) & (LPOLLIN | LPOLLPRI))) {
+				break;
+			}
+		}
+		if (i < nb_fd) {
 			ssize_t pipe_readlen;
 
-			DBG("consumer_data_pipe wake up");
-			pipe_readlen = lttng_pipe_read(ctx->consumer_data_pipe,
+			DBG("Data thread %u stream pipe wake up", thread->index);
+			pipe_readlen = lttng_pipe_read(thread->stream_pipe,
 					&new_stream, sizeof(new_stream));
 			if (pipe_readlen < sizeof(new_stream)) {
 				PERROR("Consumer data pipe");
@@ -2584,26 +3478,70 @@ void *consumer_thread_data_poll(void *data)
 			 * waking us up to test it.
 			 */
 			if (new_stream == NULL) {
-				validate_endpoint_status_data_stream();
+				validate_endpoint_status_data_stream(thread, &events,
+						wait_fd_ht);
 				continue;
 			}
 
+			DBG("Adding data stream %" PRIu64 " to data thread %u poll set",
+					new_stream->key, thread->index);
+			ret = data_thread_add_stream(&events, wait_fd_ht,
+					&read_timer_streams, new_stream);
+			if (ret < 0) {
+				lttng_consumer_send_error(ctx, LTTCOMM_CONSUMERD_POLL_ERROR);
+				goto end;
+			}
+
 			/* Continue to update the local streams and handle prio ones */
 			continue;
 		}
 
-		/* Handle wakeup pipe. */
-		if (pollfd[nb_fd + 1].revents & (POLLIN | POLLPRI)) {
-			char dummy;
-			ssize_t pipe_readlen;
+		if (nb_fd > local_stream_size) {
+			struct lttng_consumer_stream **new_local_stream;
 
-			pipe_readlen = lttng_pipe_read(ctx->consumer_wakeup_pipe, &dummy,
-					sizeof(dummy));
-			if (pipe_readlen < 0) {
-				PERROR("Consumer data wakeup pipe");
+			new_local_stream = realloc(local_stream,
+					nb_fd * sizeof(*local_stream));
+			if (new_local_stream == NULL) {
+				PERROR("local_stream realloc");
+				goto end;
 			}
-			/* We've been awakened to handle stream(s). */
-			ctx->has_wakeup = 0;
+			local_stream = new_local_stream;
+			local_stream_size = nb_fd;
+		}
+
+		/* Handle the wakeup pipe and lookup the streams of the other fds. */
+		for (i = 0; i < nb_fd; i++) {
+			health_code_update();
+
+			revents = LTTNG_POLL_GETEV(&events, i);
+			pollfd = LTTNG_POLL_GETFD(&events, i);
+			local_stream[i] = NULL;
+
+			if (!revents) {
+				/* No activity for this FD (poll implementation). */
+				continue;
+			}
+
+			if (pollfd == wakeup_pipe_fd) {
+				char dummy;
+				ssize_t pipe_readlen;
+
+				if (!(revents & (LPOLLIN | LPOLLPRI))) {
+					continue;
+				}
+				pipe_readlen = lttng_pipe_read(thread->wakeup_pipe, &dummy,
+						sizeof(dummy));
+				if (pipe_readlen < 0) {
+					PERROR("Consumer data wakeup pipe");
+				}
+				/* We've been awakened to handle stream(s). */
+				thread->has_wakeup = 0;
+				continue;
+			} else if (pollfd == stream_pipe_fd) {
+				continue;
+			}
+
+			local_stream[i] = data_thread_find_stream(wait_fd_ht, pollfd);
 		}
 
 		/* Take care of high priority channels first. */
@@ -2613,14 +3551,12 @@ void *consumer_thread_data_poll(void *data)
 			if (local_stream[i] == NULL) {
 				continue;
 			}
-			if (pollfd[i].revents & POLLPRI) {
-				DBG("Urgent read on fd %d", pollfd[i].fd);
+			if (LTTNG_POLL_GETEV(&events, i) & LPOLLPRI) {
+				DBG("Urgent read on fd %d", local_stream[i]->wait_fd);
 				high_prio = 1;
-				len = ctx->on_buffer_ready(local_stream[i], ctx);
-				/* it's ok to have an unavailable sub-buffer */
+				len = data_thread_read_stream(ctx, &events, wait_fd_ht,
+						&pending_streams, local_stream[i]);
 				if (len < 0 && len != -EAGAIN && len != -ENODATA) {
-					/* Clean the stream and free it. */
-					consumer_del_stream(local_stream[i], data_ht);
 					local_stream[i] = NULL;
 				} else if (len > 0) {
 					local_stream[i]->data_read = 1;
@@ -2636,22 +3572,27 @@ void *consumer_thread_data_poll(void *data)
 			continue;
 		}
 
-		/* Take care of low priority channels. */
+		/*
+		 * Take care of low priority channels. The streams which still had
+		 * data after their last read are read in this pass as well even if
+		 * the poll set did not report them.
+		 */
+		cds_list_splice(&pending_streams, &pending_pass);
+		CDS_INIT_LIST_HEAD(&pending_streams);
+
 		for (i = 0; i < nb_fd; i++) {
 			health_code_update();
 
 			if (local_stream[i] == NULL) {
 				continue;
 			}
-			if ((pollfd[i].revents & POLLIN) ||
+			if ((LTTNG_POLL_GETEV(&events, i) & LPOLLIN) ||
 					local_stream[i]->hangup_flush_done ||
 					local_stream[i]->has_data) {
-				DBG("Normal read on fd %d", pollfd[i].fd);
-				len = ctx->on_buffer_ready(local_stream[i], ctx);
-				/* it's ok to have an unavailable sub-buffer */
+				DBG("Normal read on fd %d", local_stream[i]->wait_fd);
+				len = data_thread_read_stream(ctx, &events, wait_fd_ht,
+						&pending_streams, local_stream[i]);
 				if (len < 0 && len != -EAGAIN && len != -ENODATA) {
-					/* Clean the stream and free it. */
-					consumer_del_stream(local_stream[i], data_ht);
 					local_stream[i] = NULL;
 				} else if (len > 0) {
 					local_stream[i]->data_read = 1;
@@ -2659,6 +3600,15 @@ void *consumer_thread_data_poll(void *data)
 			}
 		}
 
+		cds_list_for_each_entry_safe(stream, tmp_stream, &pending_pass,
+				data_pending_node) {
+			health_code_update();
+
+			DBG("Pending read on fd %d", stream->wait_fd);
+			(void) data_thread_read_stream(ctx, &events, wait_fd_ht,
+					&pending_streams, stream);
+		}
+
 		/* Handle hangup and errors */
 		for (i = 0; i < nb_fd; i++) {
 			health_code_update();
@@ -2666,12 +3616,14 @@ void *consumer_thread_data_poll(void *data)
 			if (local_stream[i] == NULL) {
 				continue;
 			}
+			revents = LTTNG_POLL_GETEV(&events, i);
+			pollfd = local_stream[i]->wait_fd;
 			if (!local_stream[i]->hangup_flush_done
-					&& (pollfd[i].revents & (POLLHUP | POLLERR | POLLNVAL))
+					&& (revents & (LPOLLHUP | LPOLLERR | LPOLLNVAL))
 					&& (consumer_data.type == LTTNG_CONSUMER32_UST
 						|| consumer_data.type == LTTNG_CONSUMER64_UST)) {
 				DBG("fd %d is hup|err|nval. Attempting flush and read.",
-						pollfd[i].fd);
+						pollfd);
 				lttng_ustconsumer_on_stream_hangup(local_stream[i]);
 				/* Attempt read again, for the data we just flushed. */
 				local_stream[i]->data_read = 1;
@@ -2681,26 +3633,26 @@ void *consumer_thread_data_poll(void *data)
 			 * read no data in this pass, we can remove the
 			 * stream from its hash table.
 			 */
-			if ((pollfd[i].revents & POLLHUP)) {
-				DBG("Polling fd %d tells it has hung up.", pollfd[i].fd);
+			if ((revents & LPOLLHUP)) {
+				DBG("Polling fd %d tells it has hung up.", pollfd);
 				if (!local_stream[i]->data_read) {
-					consumer_del_stream(local_stream[i], data_ht);
+					data_thread_del_stream(&events, wait_fd_ht,
+							local_stream[i]);
 					local_stream[i] = NULL;
-					num_hup++;
 				}
-			} else if (pollfd[i].revents & POLLERR) {
-				ERR("Error returned in polling fd %d.", pollfd[i].fd);
+			} else if (revents & LPOLLERR) {
+				ERR("Error returned in polling fd %d.", pollfd);
 				if (!local_stream[i]->data_read) {
-					consumer_del_stream(local_stream[i], data_ht);
+					data_thread_del_stream(&events, wait_fd_ht,
+							local_stream[i]);
 					local_stream[i] = NULL;
-					num_hup++;
 				}
-			} else if (pollfd[i].revents & POLLNVAL) {
-				ERR("Polling fd %d tells fd is not open.", pollfd[i].fd);
+			} else if (revents & LPOLLNVAL) {
+				ERR("Polling fd %d tells fd is not open.", pollfd);
 				if (!local_stream[i]->data_read) {
-					consumer_del_stream(local_stream[i], data_ht);
+					data_thread_del_stream(&events, wait_fd_ht,
+							local_stream[i]);
 					local_stream[i] = NULL;
-					num_hup++;
 				}
 			}
 			if (local_stream[i] != NULL) {
@@ -2711,19 +3663,37 @@ void *consumer_thread_data_poll(void *data)
 	/* All is OK */
 	err = 0;
 end:
-	DBG("polling thread exiting");
-	free(pollfd);
+	DBG("Data thread %u exiting", thread->index);
+	if (ctx->nr_writers > 0) {
+		data_thread_wait_written_streams(thread);
+	}
+	log_read_stats("Data", thread->index, &thread->stats);
+	/* Don't lose the packets staged by this thread on its way out. */
+	consumer_flush_relayd_bundles(ctx);
 	free(local_stream);
-
+	cds_list_for_each_entry_safe(stream, tmp_stream, &pending_streams,
+			data_pending_node) {
+		cds_list_del_init(&stream->data_pending_node);
+	}
+	cds_list_for_each_entry_safe(stream, tmp_stream, &read_timer_streams,
+			read_timer_node) {
+		cds_list_del_init(&stream->read_timer_node);
+	}
+	lttng_poll_clean(&events);
+end_poll:
+	data_thread_destroy_wait_fd_ht(wait_fd_ht);
+end_ht:
 	/*
-	 * Close the write side of the pipe so epoll_wait() in
-	 * consumer_thread_metadata_poll can catch it. The thread is monitoring the
-	 * read side of the pipe. If we close them both, epoll_wait strangely does
-	 * not return and could create a endless wait period if the pipe is the
-	 * only tracked fd in the poll set. The thread will take care of closing
-	 * the read side.
+	 * The last data thread to exit closes the write side of the pipe so
+	 * epoll_wait() in consumer_thread_metadata_poll can catch it. The thread
+	 * is monitoring the read side of the pipe. If we close them both,
+	 * epoll_wait strangely does not return and could create a endless wait
+	 * period if the pipe is the only tracked fd in the poll set. The thread
+	 * will take care of closing the read side.
 	 */
-	(void) lttng_pipe_write_close(ctx->consumer_metadata_pipe);
+	if (uatomic_sub_return(&ctx->nr_data_threads_running, 1) == 0) {
+		(void) lttng_pipe_write_close(ctx->consumer_metadata_pipe);
+	}
 
 error_testpoint:
 	if (err) {
@@ -2736,6 +3706,118 @@ error_testpoint:
 	return NULL;
 }
 
+/*
+ * Wake up the data threads of a context so they queue the streams they parked
+ * again.
+ */
+static void writer_wake_data_threads(struct lttng_consumer_local_data *ctx)
+{
+	unsigned int i;
+	ssize_t writelen;
+
+	for (i = 0; i < ctx->nr_data_threads; i++) {
+		writelen = lttng_pipe_write(ctx->data_threads[i].wakeup_pipe,
+				"!", 1);
+		if (writelen < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+			PERROR("Consumer data wakeup pipe");
+		}
+	}
+}
+
+/*
+ * This thread reads the sub-buffers of the data streams handed to it by the
+ * data threads, writes them to their output and returns the streams to their
+ * data thread. One instance runs per writer thread of the context.
+ */
+void *consumer_thread_writer(void *data)
+{
+	ssize_t writelen;
+	bool wake_parked;
+	struct lttng_consumer_writer *writer = data;
+	struct lttng_consumer_local_data *ctx = writer->ctx;
+	struct lttng_consumer_data_thread *thread;
+	struct lttng_consumer_stream *stream;
+
+	rcu_register_thread();
+
+	health_register(health_consumerd, HEALTH_CONSUMERD_TYPE_WRITER);
+
+	health_code_update();
+
+	while (1) {
+		pthread_mutex_lock(&writer->lock);
+		while (cds_list_empty(&writer->queue) && !writer->quit) {
+			health_poll_entry();
+			pthread_cond_wait(&writer->cond, &writer->lock);
+			health_poll_exit();
+		}
+		if (cds_list_empty(&writer->queue)) {
+			/* Quit only once every queued stream is returned. */
+			pthread_mutex_unlock(&writer->lock);
+			break;
+		}
+		stream = cds_list_entry(writer->queue.next,
+				struct lttng_consumer_stream, writer_node);
+		cds_list_del_init(&stream->writer_node);
+		writer->queue_len--;
+		wake_parked = writer->has_parked;
+		writer->has_parked = false;
+		pthread_mutex_unlock(&writer->lock);
+
+		if (wake_parked) {
+			/* Room was made for a stream parked by a data thread. */
+			writer_wake_data_threads(ctx);
+		}
+
+		health_code_update();
+
+		/*
+		 * The read holds each sub-buffer until it is written to the output
+		 * of the stream and releases it before returning.
+		 */
+		writer->stats.nr_wakeups++;
+		stream->written_len = read_stream_budget(ctx, stream,
+				&writer->stats);
+
+		/* The data thread may destroy the stream once it is returned. */
+		thread = stream->data_thread;
+		if (!cds_wfcq_enqueue(&thread->written_head, &thread->written_tail,
+				&stream->written_node)) {
+			/* The queue was empty, wake up the data thread. */
+			writelen = lttng_pipe_write(thread->wakeup_pipe, "!", 1);
+			if (writelen < 0 && errno != EAGAIN &&
+					errno != EWOULDBLOCK) {
+				PERROR("Consumer data wakeup pipe");
+			}
+		}
+	}
+
+	DBG("Writer thread %u exiting", writer->index);
+	log_read_stats("Writer", writer->index, &writer->stats);
+	health_unregister(health_consumerd);
+	rcu_unregister_thread();
+	return NULL;
+}
+
+/*
+ * Make the writer threads of a context exit once they returned the streams
+ * queued to them. The data threads must have exited so that no stream is
+ * handed to the writer threads anymore.
+ */
+void consumer_stop_writers(struct lttng_consumer_local_data *ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < ctx->nr_writers; i++) {
+		struct lttng_consumer_writer *writer = &ctx->writers[i];
+
+		pthread_mutex_lock(&writer->lock);
+		writer->quit = true;
+		pthread_cond_signal(&writer->cond);
+		pthread_mutex_unlock(&writer->lock);
+	}
+}
+
 /*
  * Close wake-up end of each stream belonging to the channel. This will
  * allow the poll() on the stream read-side to detect when the
@@ -3231,10 +4313,10 @@ end:
 	consumer_quit = 1;
 
 	/*
-	 * Notify the data poll thread to poll back again and test the
+	 * Notify the data poll threads to poll back again and test the
 	 * consumer_quit state that we just set so to quit gracefully.
 	 */
-	notify_thread_lttng_pipe(ctx->consumer_data_pipe);
+	notify_data_threads(ctx);
 
 	notify_channel_pipe(ctx, NULL, -1, CONSUMER_CHANNEL_QUIT);
 
@@ -3364,7 +4446,7 @@ int consumer_add_relayd_socket(uint64_t net_seq_idx, int sock_type,
 		struct lttng_consumer_local_data *ctx, int sock,
 		struct pollfd *consumer_sockpoll,
 		struct lttcomm_relayd_sock *relayd_sock, uint64_t sessiond_id,
-		uint64_t relayd_session_id)
+		uint64_t relayd_session_id, uint32_t capabilities)
 {
 	int fd = -1, ret = -1, relayd_created = 0;
 	enum lttcomm_return_code ret_code = LTTCOMM_CONSUMERD_SUCCESS;
@@ -3467,6 +4549,7 @@ int consumer_add_relayd_socket(uint64_t net_seq_idx, int sock_type,
 		relayd->control_sock.minor = relayd_sock->minor;
 
 		relayd->relayd_session_id = relayd_session_id;
+		relayd->capabilities = capabilities;
 
 		break;
 	case LTTNG_STREAM_DATA:
@@ -3638,6 +4721,15 @@ int consumer_data_pending(uint64_t id)
 
 	relayd = find_relayd_by_session_id(id);
 	if (relayd) {
+		/* Packets staged in a bundle must reach the relayd first. */
+		pthread_mutex_lock(&relayd->data_sock_mutex);
+		ret = relayd_flush_data_bundle(relayd);
+		pthread_mutex_unlock(&relayd->data_sock_mutex);
+		if (ret < 0) {
+			/* Communication error thus the relayd so no data pending. */
+			goto data_not_pending;
+		}
+
 		/* Send init command for data pending. */
 		pthread_mutex_lock(&relayd->ctrl_sock_mutex);
 		ret = relayd_begin_data_pending(&relayd->control_sock,
@@ -24,15 +24,18 @@
 #include <poll.h>
 #include <unistd.h>
 #include <urcu/list.h>
+#include <urcu/wfcqueue.h>
 
 #include <lttng/lttng.h>
 
 #include <common/hashtable/hashtable.h>
+#include <common/dynamic-buffer.h>
 #include <common/compat/fcntl.h>
 #include <common/compat/uuid.h>
 #include <common/sessiond-comm/sessiond-comm.h>
 #include <common/pipe.h>
 #include <common/index/ctf-index.h>
+#include <common/timer-wheel.h>
 
 /* Commands for consumer */
 enum lttng_consumer_command {
@@ -93,6 +96,28 @@ enum consumer_channel_type {
 	CONSUMER_CHANNEL_TYPE_DATA	= 1,
 };
 
+enum consumer_timer_type {
+	CONSUMER_TIMER_SWITCH,
+	CONSUMER_TIMER_LIVE,
+	CONSUMER_TIMER_MONITOR,
+};
+
+struct lttng_consumer_channel;
+
+/*
+ * Periodic timer of a channel, serviced by the consumer timer thread. The
+ * entry and the armed flag are protected by the lock of the timer wheel.
+ */
+struct consumer_timer {
+	struct timer_wheel_entry entry;
+	enum consumer_timer_type type;
+	struct lttng_consumer_channel *channel;
+	/* Period in ticks of the timer wheel. */
+	uint64_t period;
+	/* Cleared when the timer is stopped, prevents its re-arming. */
+	bool armed;
+};
+
 extern struct lttng_consumer_global_data consumer_data;
 
 struct stream_list {
@@ -164,17 +189,17 @@ struct lttng_consumer_channel {
 
 	/* For UST metadata periodical flush */
 	int switch_timer_enabled;
-	timer_t switch_timer;
+	struct consumer_timer switch_timer;
 	int switch_timer_error;
 
 	/* For the live mode */
 	int live_timer_enabled;
-	timer_t live_timer;
+	struct consumer_timer live_timer;
 	int live_timer_error;
 
 	/* For channel monitoring timer. */
 	int monitor_timer_enabled;
-	timer_t monitor_timer;
+	struct consumer_timer monitor_timer;
 
 	/* On-disk circular buffer */
 	uint64_t tracefile_size;
@@ -215,6 +240,13 @@ struct lttng_consumer_channel {
 
 	/* Timer value in usec for live streaming. */
 	unsigned int live_timer_interval;
+	/*
+	 * Read timer value in usec of a UST data channel, 0 if disabled. The
+	 * streams of a channel with a read timer are not polled for the
+	 * wakeups of the applications: their data thread samples their ring
+	 * buffer positions at this interval instead.
+	 */
+	unsigned int read_timer_interval;
 
 	int *stream_fds;
 	int nr_stream_fds;
@@ -251,6 +283,19 @@ struct lttng_consumer_stream {
 	int out_fd; /* output file to write the data */
 	/* Write position in the output file descriptor */
 	off_t out_fd_offset;
+	/*
+	 * Start of the data written to the output file which was not yet
+	 * submitted for writeback, and start of the previous writeback batch.
+	 * Writeback is submitted in batches of at least
+	 * DEFAULT_CONSUMER_WRITEBACK_BATCH_SIZE bytes by the mmap output path.
+	 */
+	off_t out_fd_writeback_offset;
+	off_t out_fd_prev_writeback_offset;
+	/*
+	 * The output file was taken from a tracefile preparation and has
+	 * blocks allocated past its end, which are freed when it is closed.
+	 */
+	bool out_fd_prepared;
 	/* Amount of bytes written to the output */
 	uint64_t output_written;
 	enum lttng_consumer_stream_state state;
@@ -305,6 +350,47 @@ struct lttng_consumer_stream {
 	/* For UST */
 
 	int wait_fd;
+	/* CPU of the buffer backing this stream. */
+	int cpu;
+	/*
+	 * Data thread polling this stream. Assigned when the stream is added to
+	 * the data stream hash table, NULL for metadata streams.
+	 */
+	struct lttng_consumer_data_thread *data_thread;
+	/* HT node used by the wait fd hash table of the data thread. */
+	struct lttng_ht_node_u64 node_wait_fd;
+	/*
+	 * Node in the list of streams that the data thread must read again
+	 * because they still had data after their last read.
+	 */
+	struct cds_list_head data_pending_node;
+	/*
+	 * Writer thread reading and writing the sub-buffers of this stream for
+	 * its data thread, NULL if the data thread does it itself.
+	 */
+	struct lttng_consumer_writer *writer;
+	/*
+	 * Set by the data thread while the stream is handed to its writer
+	 * thread. The stream is out of the poll set of the data thread until
+	 * the writer thread returns it.
+	 */
+	bool writer_pending;
+	/*
+	 * Node in the queue of the writer thread, or in the list of streams
+	 * of the data thread waiting for room in that queue.
+	 */
+	struct cds_list_head writer_node;
+	/* Node in the queue of the streams returned to the data thread. */
+	struct cds_wfcq_node written_node;
+	/* Value returned by the last read of the stream by its writer thread. */
+	ssize_t written_len;
+	/*
+	 * Node in the list of streams of the data thread polled by the read
+	 * timer of their channel, and next expiration of that timer, in usec
+	 * of the monotonic clock.
+	 */
+	struct cds_list_head read_timer_node;
+	uint64_t read_timer_deadline;
 	/* UID/GID of the user owning the session to which stream belongs */
 	uid_t uid;
 	gid_t gid;
@@ -385,6 +471,12 @@ struct lttng_consumer_stream {
 	 * cache is updated.
 	 */
 	int ust_metadata_poll_pipe[2];
+	/*
+	 * Set when a wakeup byte is written in the metadata poll pipe and
+	 * cleared by the metadata thread before it drains the pipe, so that a
+	 * burst of metadata cache writes wakes up the thread only once.
+	 */
+	int ust_metadata_wakeup_pending;
 	/*
 	 * How much metadata was read from the metadata cache and sent
 	 * to the channel.
@@ -401,6 +493,11 @@ struct lttng_consumer_stream {
 	 * Index file object of the index file for this stream.
 	 */
 	struct lttng_index_file *index_file;
+	/*
+	 * Background preparation of the next tracefile of a stream written
+	 * locally in many tracefiles.
+	 */
+	struct tracefile_prepare *tracefile_prepare;
 
 	/*
 	 * Local pipe to extract data when using splice.
@@ -451,18 +548,126 @@ struct consumer_relayd_sock_pair {
 
 	/* Control socket. Command and metadata are passed over it */
 	struct lttcomm_relayd_sock control_sock;
+	/*
+	 * Indexes and beacons sent over the control socket and not
+	 * acknowledged yet when RELAYD_CAPABILITY_INDEX_ACK_WINDOW is used.
+	 * Protected by ctrl_sock_mutex.
+	 */
+	uint32_t indexes_unacked;
 
 	/*
-	 * We don't need a mutex at this point since we only splice or write single
-	 * large chunk of data with a header appended at the begining. Moreover,
-	 * this socket is for now only used in a single thread.
+	 * Mutex protecting the data socket and the bundle since the streams of
+	 * a relayd can be consumed by many data threads. A packet and its header
+	 * are written with a single call but a splice(2) of a packet can take
+	 * many.
+	 *
+	 * This is nested INSIDE the stream lock.
 	 */
+	pthread_mutex_t data_sock_mutex;
 	struct lttcomm_relayd_sock data_sock;
+	/*
+	 * Small data packets staged to be sent together over the data socket,
+	 * each preceded by its data header. See RELAYD_DATA_BUNDLE_SEQ_NUM.
+	 * The bundle is sent before any other data and at the latest at the
+	 * end of the data thread iteration which staged its packets.
+	 */
+	struct lttng_dynamic_buffer bundle;
+	/* Relayd stream id of the first packet of the bundle. */
+	uint64_t bundle_stream_id;
 	struct lttng_ht_node_u64 node;
 
 	/* Session id on both sides for the sockets. */
 	uint64_t relayd_session_id;
 	uint64_t sessiond_session_id;
+
+	/*
+	 * RELAYD_CAPABILITY_* negotiated by the session daemon on the control
+	 * socket. Immutable once the control socket is added.
+	 */
+	uint32_t capabilities;
+};
+
+/*
+ * Counters of the data stream reads of a data or writer thread.
+ */
+struct lttng_consumer_read_stats {
+	/*
+	 * Poll wakeups of a data thread, or streams handed to a writer
+	 * thread.
+	 */
+	uint64_t nr_wakeups;
+	/* Streams read, each read draining one or more sub-buffers. */
+	uint64_t nr_stream_reads;
+	uint64_t nr_subbufs;
+	/* Bytes written to the outputs of the streams. */
+	uint64_t bytes;
+};
+
+/*
+ * Data stream poll thread. The data streams are sharded across a pool of
+ * these threads according to the CPU of their buffer so that each thread
+ * only polls and consumes its own subset of the streams.
+ */
+struct lttng_consumer_data_thread {
+	/* Index of the thread in the data thread pool of the context. */
+	unsigned int index;
+	pthread_t thread;
+	struct lttng_consumer_local_data *ctx;
+	/* Data stream poll thread pipe. To transfer data stream to the thread */
+	struct lttng_pipe *stream_pipe;
+	/*
+	 * Data thread use that pipe to catch wakeup from read subbuffer that
+	 * detects that there is still data to be read for the stream encountered.
+	 * Before doing so, the stream is flagged to indicate that there is still
+	 * data to be read.
+	 *
+	 * Both pipes (read/write) are owned and used inside the data thread.
+	 */
+	struct lttng_pipe *wakeup_pipe;
+	/* Indicate if the wakeup thread has been notified. */
+	unsigned int has_wakeup:1;
+	/*
+	 * Streams returned by the writer threads once their sub-buffer is
+	 * written. The writer threads write to the wakeup pipe when this queue
+	 * becomes non-empty.
+	 */
+	struct cds_wfcq_head written_head;
+	struct cds_wfcq_tail written_tail;
+	/* Streams waiting for room in the queue of their writer thread. */
+	struct cds_list_head writer_parked;
+	/* Streams handed to the writer threads, parked ones included. */
+	unsigned int nr_writer_pending;
+	struct lttng_consumer_read_stats stats;
+};
+
+/*
+ * Sub-buffer writer thread. When writer threads are enabled, the data threads
+ * hand the streams which have a sub-buffer ready to them instead of reading
+ * and writing the sub-buffer themselves, so that a slow output only delays the
+ * streams it serves and not all the streams of a data thread. A stream is
+ * handed to one writer thread at a time and returned to its data thread once
+ * its sub-buffer is written and released.
+ */
+struct lttng_consumer_writer {
+	/* Index of the thread in the writer thread pool of the context. */
+	unsigned int index;
+	pthread_t thread;
+	struct lttng_consumer_local_data *ctx;
+	/* Protects the queue and the quit flag. */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	/* Streams to read, at most DEFAULT_CONSUMERD_WRITER_QUEUE_LEN. */
+	struct cds_list_head queue;
+	unsigned int queue_len;
+	/*
+	 * A stream was parked because the queue was full. The data threads
+	 * are woken up once room is made in the queue so they queue their
+	 * parked streams again.
+	 */
+	bool has_parked;
+	/* Exit once the queue is empty. */
+	bool quit;
+	struct lttng_consumer_read_stats stats;
 };
 
 /*
@@ -528,20 +733,17 @@ struct lttng_consumer_local_data {
 	char *consumer_command_sock_path;
 	/* communication with splice */
 	int consumer_channel_pipe[2];
-	/* Data stream poll thread pipe. To transfer data stream to the thread */
-	struct lttng_pipe *consumer_data_pipe;
-
+	/* Pool of data stream poll threads. */
+	struct lttng_consumer_data_thread *data_threads;
+	unsigned int nr_data_threads;
 	/*
-	 * Data thread use that pipe to catch wakeup from read subbuffer that
-	 * detects that there is still data to be read for the stream encountered.
-	 * Before doing so, the stream is flagged to indicate that there is still
-	 * data to be read.
-	 *
-	 * Both pipes (read/write) are owned and used inside the data thread.
+	 * Number of data threads that did not exit yet. The last one to exit
+	 * notifies the metadata thread.
 	 */
-	struct lttng_pipe *consumer_wakeup_pipe;
-	/* Indicate if the wakeup thread has been notified. */
-	unsigned int has_wakeup:1;
+	unsigned int nr_data_threads_running;
+	/* Pool of sub-buffer writer threads, empty if disabled. */
+	struct lttng_consumer_writer *writers;
+	unsigned int nr_writers;
 
 	/* to let the signal handler wake up the fd receiver thread */
 	int consumer_should_quit[2];
@@ -576,11 +778,6 @@ struct lttng_consumer_global_data {
 
 	/* Channel hash table protected by consumer_data.lock. */
 	struct lttng_ht *channel_ht;
-	/*
-	 * Flag specifying if the local array of FDs needs update in the
-	 * poll function. Protected by consumer_data.lock.
-	 */
-	unsigned int need_update;
 	enum lttng_consumer_type type;
 
 	/*
@@ -602,6 +799,19 @@ struct lttng_consumer_global_data {
 	 * This HT uses the "node_channel_id" of the consumer stream.
 	 */
 	struct lttng_ht *stream_per_chan_id_ht;
+
+	/*
+	 * Reuse the tracefiles of the streams in tracefile rotation (tracefile
+	 * count) instead of unlinking and creating them again. Set once at
+	 * initialization.
+	 */
+	bool tracefile_reuse;
+
+	/*
+	 * Number of bytes read from a data stream each time it is found ready.
+	 * Set once at initialization.
+	 */
+	uint64_t drain_budget;
 };
 
 /* Flag used to temporarily pause data consumption from testpoints. */
@@ -623,6 +833,8 @@ void lttng_consumer_set_error_sock(struct lttng_consumer_local_data *ctx,
  */
 void lttng_consumer_set_command_sock_path(
 		struct lttng_consumer_local_data *ctx, char *sock);
+void lttng_consumer_set_tracefile_reuse(bool reuse);
+void lttng_consumer_set_drain_budget(uint64_t budget);
 
 /*
  * Send return code to session daemon.
@@ -699,18 +911,25 @@ struct lttng_consumer_local_data *lttng_consumer_create(
 			struct lttng_consumer_local_data *ctx),
 		int (*recv_channel)(struct lttng_consumer_channel *channel),
 		int (*recv_stream)(struct lttng_consumer_stream *stream),
-		int (*update_stream)(uint64_t sessiond_key, uint32_t state));
+		int (*update_stream)(uint64_t sessiond_key, uint32_t state),
+		unsigned int nr_data_threads, unsigned int nr_writers);
 void lttng_consumer_destroy(struct lttng_consumer_local_data *ctx);
 ssize_t lttng_consumer_on_read_subbuffer_mmap(
 		struct lttng_consumer_local_data *ctx,
 		struct lttng_consumer_stream *stream, unsigned long len,
 		unsigned long padding,
 		struct ctf_packet_index *index);
+ssize_t lttng_consumer_on_read_subbuffer_buffer(
+		struct lttng_consumer_local_data *ctx,
+		struct lttng_consumer_stream *stream, const char *buf,
+		unsigned long len, unsigned long padding,
+		struct ctf_packet_index *index);
 ssize_t lttng_consumer_on_read_subbuffer_splice(
 		struct lttng_consumer_local_data *ctx,
 		struct lttng_consumer_stream *stream, unsigned long len,
 		unsigned long padding,
 		struct ctf_packet_index *index);
+void consumer_stream_writeback_flush(struct lttng_consumer_stream *stream);
 int lttng_consumer_take_snapshot(struct lttng_consumer_stream *stream);
 int lttng_consumer_get_produced_snapshot(struct lttng_consumer_stream *stream,
 		unsigned long *pos);
@@ -718,6 +937,8 @@ int lttng_ustconsumer_get_wakeup_fd(struct lttng_consumer_stream *stream);
 int lttng_ustconsumer_close_wakeup_fd(struct lttng_consumer_stream *stream);
 void *consumer_thread_metadata_poll(void *data);
 void *consumer_thread_data_poll(void *data);
+void *consumer_thread_writer(void *data);
+void consumer_stop_writers(struct lttng_consumer_local_data *ctx);
 void *consumer_thread_sessiond_poll(void *data);
 void *consumer_thread_channel_poll(void *data);
 int lttng_consumer_recv_cmd(struct lttng_consumer_local_data *ctx,
@@ -729,7 +950,8 @@ int lttng_consumer_on_recv_stream(struct lttng_consumer_stream *stream);
 int consumer_add_relayd_socket(uint64_t net_seq_idx, int sock_type,
 		struct lttng_consumer_local_data *ctx, int sock,
 		struct pollfd *consumer_sockpoll, struct lttcomm_relayd_sock *relayd_sock,
-		uint64_t sessiond_id, uint64_t relayd_session_id);
+		uint64_t sessiond_id, uint64_t relayd_session_id,
+		uint32_t capabilities);
 void consumer_flag_relayd_for_destroy(
 		struct consumer_relayd_sock_pair *relayd);
 int consumer_data_pending(uint64_t id);
@@ -742,7 +964,8 @@ void consumer_destroy_relayd(struct consumer_relayd_sock_pair *relayd);
 unsigned long consumer_get_consume_start_pos(unsigned long consumed_pos,
 		unsigned long produced_pos, uint64_t nb_packets_per_stream,
 		uint64_t max_sb_size);
-int consumer_add_data_stream(struct lttng_consumer_stream *stream);
+int consumer_add_data_stream(struct lttng_consumer_local_data *ctx,
+		struct lttng_consumer_stream *stream);
 void consumer_del_stream_for_data(struct lttng_consumer_stream *stream);
 int consumer_add_metadata_stream(struct lttng_consumer_stream *stream);
 void consumer_del_stream_for_metadata(struct lttng_consumer_stream *stream);
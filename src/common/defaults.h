@@ -288,6 +288,13 @@
  */
 #define DEFAULT_METADATA_AVAILABILITY_WAIT_TIME 200000  /* usec */
 
+/*
+ * Minimal amount of trace data written to a local output file by the
+ * consumer before submitting it for writeback. Sub-buffers smaller than
+ * this are batched so that the writeback is not issued for each of them.
+ */
+#define DEFAULT_CONSUMER_WRITEBACK_BATCH_SIZE	(1024 * 1024)	/* bytes */
+
 /*
  * The usual value for the maximum TCP SYN retries time and TCP FIN timeout is
  * 180 and 60 seconds on most Linux system and the default value since kernel
@@ -301,6 +308,37 @@
 #define DEFAULT_APP_SOCKET_RW_TIMEOUT       CONFIG_DEFAULT_APP_SOCKET_RW_TIMEOUT
 #define DEFAULT_APP_SOCKET_TIMEOUT_ENV      "LTTNG_APP_SOCKET_TIMEOUT"
 
+/*
+ * Default number of data stream poll threads of a consumer daemon and
+ * environment variable overriding it.
+ */
+#define DEFAULT_CONSUMERD_DATA_THREADS      1
+#define DEFAULT_CONSUMERD_DATA_THREADS_ENV  "LTTNG_CONSUMERD_DATA_THREADS"
+
+/*
+ * Default number of sub-buffer writer threads of a consumer daemon (none, the
+ * data threads write the sub-buffers themselves), environment variable
+ * overriding it and maximum number of streams queued to a writer thread.
+ */
+#define DEFAULT_CONSUMERD_WRITER_THREADS      0
+#define DEFAULT_CONSUMERD_WRITER_THREADS_ENV  "LTTNG_CONSUMERD_WRITER_THREADS"
+#define DEFAULT_CONSUMERD_WRITER_QUEUE_LEN    64
+
+/*
+ * Default number of bytes a consumer daemon reads from a data stream each time
+ * the stream is found ready, and environment variable overriding it. The
+ * sub-buffers of a stream are read until none is left or until this budget is
+ * spent, at least one sub-buffer being read.
+ */
+#define DEFAULT_CONSUMERD_DRAIN_BUDGET      (1024 * 1024)	/* 1 MiB */
+#define DEFAULT_CONSUMERD_DRAIN_BUDGET_ENV  "LTTNG_CONSUMERD_DRAIN_BUDGET"
+
+/*
+ * Environment variable making the consumer daemons reuse the tracefiles of
+ * the streams in tracefile rotation instead of unlinking and creating them.
+ */
+#define DEFAULT_CONSUMERD_TRACEFILE_REUSE_ENV "LTTNG_CONSUMERD_TRACEFILE_REUSE"
+
 #define DEFAULT_UST_STREAM_FD_NUM			2 /* Number of fd per UST stream. */
 
 #define DEFAULT_SNAPSHOT_NAME				"snapshot"
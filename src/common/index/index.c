@@ -31,13 +31,15 @@
 #include "index.h"
 
 /*
- * Create the index file associated with a trace file.
+ * Create the index file associated with a trace file. If reuse is set, an
+ * existing index file is truncated in place rather than unlinked.
  *
  * Return allocated struct lttng_index_file, NULL on error.
  */
 struct lttng_index_file *lttng_index_file_create(char *path_name,
 		char *stream_name, int uid, int gid,
-		uint64_t size, uint64_t count, uint32_t major, uint32_t minor)
+		uint64_t size, uint64_t count, uint32_t major, uint32_t minor,
+		bool reuse)
 {
 	struct lttng_index_file *index_file;
 	int ret, fd = -1;
@@ -74,15 +76,22 @@ struct lttng_index_file *lttng_index_file_create(char *path_name,
 	 * live viewer which could be working on this same file.
 	 * By doing so, any reference to the old index file
 	 * stays valid even if we re-create a new file with the
-	 * same name afterwards.
+	 * same name afterwards. Reused index files have no such reader.
 	 */
-	ret = utils_unlink_stream_file(fullpath, stream_name, size, count, uid,
-			gid, DEFAULT_INDEX_FILE_SUFFIX);
-	if (ret < 0 && errno != ENOENT) {
-		goto error;
+	if (!reuse) {
+		ret = utils_unlink_stream_file(fullpath, stream_name, size,
+				count, uid, gid, DEFAULT_INDEX_FILE_SUFFIX);
+		if (ret < 0 && errno != ENOENT) {
+			goto error;
+		}
+	}
+	if (reuse) {
+		ret = utils_reuse_stream_file(fullpath, stream_name, size,
+				count, uid, gid, DEFAULT_INDEX_FILE_SUFFIX);
+	} else {
+		ret = utils_create_stream_file(fullpath, stream_name, size,
+				count, uid, gid, DEFAULT_INDEX_FILE_SUFFIX);
 	}
-	ret = utils_create_stream_file(fullpath, stream_name, size, count, uid,
-			gid, DEFAULT_INDEX_FILE_SUFFIX);
 	if (ret < 0) {
 		goto error;
 	}
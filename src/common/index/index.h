@@ -21,6 +21,7 @@
 #define _INDEX_H
 
 #include <inttypes.h>
+#include <stdbool.h>
 #include <urcu/ref.h>
 
 #include "ctf-index.h"
@@ -39,7 +40,7 @@ struct lttng_index_file {
  */
 struct lttng_index_file *lttng_index_file_create(char *path_name,
 		char *stream_name, int uid, int gid, uint64_t size,
-		uint64_t count, uint32_t major, uint32_t minor);
+		uint64_t count, uint32_t major, uint32_t minor, bool reuse);
 struct lttng_index_file *lttng_index_file_open(const char *path_name,
 		const char *channel_name, uint64_t tracefile_count,
 		uint64_t tracefile_count_current);
@@ -0,0 +1,460 @@
+/*
+ * Copyright (C) 2026 - agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 2 only, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _LGPL_SOURCE
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <urcu/list.h>
+
+#include <common/common.h>
+#include <common/defaults.h>
+#include <common/utils.h>
+#include <common/compat/fcntl.h>
+
+#include "tracefile-prepare.h"
+
+enum tracefile_prepare_state {
+	/* Nothing is prepared. */
+	TRACEFILE_PREPARE_IDLE = 0,
+	/* Waiting in the queue of the preparation thread. */
+	TRACEFILE_PREPARE_QUEUED,
+	/* Being prepared by the preparation thread. */
+	TRACEFILE_PREPARE_BUSY,
+	/* The files are prepared under their temporary name. */
+	TRACEFILE_PREPARE_READY,
+};
+
+struct tracefile_prepare {
+	/* Immutable after creation. */
+	char *path_name;
+	char *index_path_name;
+	char *file_name;
+	/* Hidden name under which the files are prepared. */
+	char *tmp_file_name;
+	uint64_t size;
+	int uid, gid;
+	bool with_index;
+	uint32_t index_major, index_minor;
+
+	/* The fields below are protected by the preparer lock. */
+	enum tracefile_prepare_state state;
+	/* Count of the tracefile requested or prepared. */
+	uint64_t count;
+	/*
+	 * The preparation thread is working on files of the preparation. The
+	 * files are discarded if the state is no longer BUSY once done.
+	 */
+	bool in_progress;
+	/* The owner destroyed the preparation while it was in progress. */
+	bool destroyed;
+	int fd;
+	struct lttng_index_file *index_file;
+	/* Member of the preparer queue while QUEUED. */
+	struct cds_list_head node;
+};
+
+/*
+ * The preparation thread is shared by all the streams of the process. It is
+ * started on the first request and lives as long as the process.
+ */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	/* Signaled each time the preparation thread is done with a request. */
+	pthread_cond_t done_cond;
+	struct cds_list_head queue;
+	pthread_once_t once;
+	bool started;
+} preparer = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.done_cond = PTHREAD_COND_INITIALIZER,
+	.queue = CDS_LIST_HEAD_INIT(preparer.queue),
+	.once = PTHREAD_ONCE_INIT,
+};
+
+/*
+ * Close and remove the prepared files of the given count.
+ */
+static void discard_files(struct tracefile_prepare *prepare, uint64_t count,
+		int fd, struct lttng_index_file *index_file)
+{
+	int ret;
+
+	if (fd >= 0) {
+		ret = close(fd);
+		if (ret < 0) {
+			PERROR("close prepared tracefile");
+		}
+		(void) utils_unlink_stream_file(prepare->path_name,
+				prepare->tmp_file_name, prepare->size, count,
+				prepare->uid, prepare->gid, NULL);
+	}
+	if (index_file) {
+		lttng_index_file_put(index_file);
+		(void) utils_unlink_stream_file(prepare->index_path_name,
+				prepare->tmp_file_name, prepare->size, count,
+				prepare->uid, prepare->gid,
+				DEFAULT_INDEX_FILE_SUFFIX);
+	}
+}
+
+static void destroy_prepare(struct tracefile_prepare *prepare)
+{
+	free(prepare->path_name);
+	free(prepare->index_path_name);
+	free(prepare->file_name);
+	free(prepare->tmp_file_name);
+	free(prepare);
+}
+
+/*
+ * Create the files of the given count under their temporary name and
+ * allocate the blocks of the tracefile. An index file that can't be created
+ * is simply not prepared.
+ *
+ * Return the tracefile fd or a negative value on error.
+ */
+static int prepare_files(struct tracefile_prepare *prepare, uint64_t count,
+		struct lttng_index_file **index_file)
+{
+	int fd, ret;
+
+	fd = utils_create_stream_file(prepare->path_name,
+			prepare->tmp_file_name, prepare->size, count,
+			prepare->uid, prepare->gid, NULL);
+	if (fd < 0) {
+		goto end;
+	}
+
+	/* The size is kept so the tracefile looks empty until written to. */
+	ret = lttng_fallocate_keep_size(fd, 0, prepare->size);
+	if (ret < 0) {
+		DBG("Allocation of tracefile %s_%" PRIu64 " failed (errno: %d)",
+				prepare->file_name, count, errno);
+	}
+
+	*index_file = NULL;
+	if (prepare->with_index) {
+		*index_file = lttng_index_file_create(prepare->path_name,
+				prepare->tmp_file_name, prepare->uid,
+				prepare->gid, prepare->size, count,
+				prepare->index_major, prepare->index_minor,
+				false);
+	}
+end:
+	return fd;
+}
+
+static void *thread_tracefile_prepare(void *data)
+{
+	pthread_mutex_lock(&preparer.lock);
+	for (;;) {
+		int fd;
+		uint64_t count;
+		struct lttng_index_file *index_file = NULL;
+		struct tracefile_prepare *prepare;
+
+		while (cds_list_empty(&preparer.queue)) {
+			pthread_cond_wait(&preparer.cond, &preparer.lock);
+		}
+		prepare = cds_list_first_entry(&preparer.queue,
+				struct tracefile_prepare, node);
+		cds_list_del(&prepare->node);
+		prepare->state = TRACEFILE_PREPARE_BUSY;
+		prepare->in_progress = true;
+		count = prepare->count;
+		pthread_mutex_unlock(&preparer.lock);
+
+		fd = prepare_files(prepare, count, &index_file);
+
+		pthread_mutex_lock(&preparer.lock);
+		prepare->in_progress = false;
+		if (prepare->destroyed) {
+			pthread_mutex_unlock(&preparer.lock);
+			discard_files(prepare, count, fd, index_file);
+			destroy_prepare(prepare);
+			pthread_mutex_lock(&preparer.lock);
+		} else if (prepare->state != TRACEFILE_PREPARE_BUSY ||
+				prepare->count != count || fd < 0) {
+			/* Taken or requested again meanwhile. */
+			if (prepare->state == TRACEFILE_PREPARE_BUSY) {
+				prepare->state = TRACEFILE_PREPARE_IDLE;
+			}
+			pthread_mutex_unlock(&preparer.lock);
+			discard_files(prepare, count, fd, index_file);
+			pthread_mutex_lock(&preparer.lock);
+		} else {
+			prepare->fd = fd;
+			prepare->index_file = index_file;
+			prepare->state = TRACEFILE_PREPARE_READY;
+			DBG("Tracefile %s/%s_%" PRIu64 " prepared",
+					prepare->path_name, prepare->file_name,
+					count);
+		}
+		pthread_cond_broadcast(&preparer.done_cond);
+	}
+	/* Not reached. */
+	pthread_mutex_unlock(&preparer.lock);
+	return NULL;
+}
+
+static void start_preparer(void)
+{
+	int ret;
+	pthread_t thread;
+
+	ret = pthread_create(&thread, NULL, thread_tracefile_prepare, NULL);
+	if (ret) {
+		errno = ret;
+		PERROR("pthread_create tracefile preparation");
+		return;
+	}
+	(void) pthread_detach(thread);
+	preparer.started = true;
+}
+
+struct tracefile_prepare *tracefile_prepare_create(const char *path_name,
+		const char *file_name, uint64_t size, int uid, int gid,
+		bool with_index, uint32_t index_major, uint32_t index_minor)
+{
+	int ret;
+	struct tracefile_prepare *prepare;
+
+	prepare = zmalloc(sizeof(*prepare));
+	if (!prepare) {
+		PERROR("zmalloc tracefile preparation");
+		goto error;
+	}
+	prepare->fd = -1;
+	prepare->size = size;
+	prepare->uid = uid;
+	prepare->gid = gid;
+	prepare->with_index = with_index;
+	prepare->index_major = index_major;
+	prepare->index_minor = index_minor;
+	CDS_INIT_LIST_HEAD(&prepare->node);
+
+	prepare->path_name = strdup(path_name);
+	prepare->file_name = strdup(file_name);
+	ret = asprintf(&prepare->index_path_name, "%s/" DEFAULT_INDEX_DIR,
+			path_name);
+	if (ret < 0) {
+		prepare->index_path_name = NULL;
+	}
+	ret = asprintf(&prepare->tmp_file_name, ".%s", file_name);
+	if (ret < 0) {
+		prepare->tmp_file_name = NULL;
+	}
+	if (!prepare->path_name || !prepare->file_name ||
+			!prepare->index_path_name || !prepare->tmp_file_name) {
+		PERROR("Allocating tracefile preparation names");
+		destroy_prepare(prepare);
+		prepare = NULL;
+	}
+error:
+	return prepare;
+}
+
+void tracefile_prepare_destroy(struct tracefile_prepare *prepare)
+{
+	int fd = -1;
+	uint64_t count;
+	struct lttng_index_file *index_file = NULL;
+
+	if (!prepare) {
+		return;
+	}
+
+	pthread_mutex_lock(&preparer.lock);
+	count = prepare->count;
+	switch (prepare->state) {
+	case TRACEFILE_PREPARE_QUEUED:
+		cds_list_del(&prepare->node);
+		break;
+	case TRACEFILE_PREPARE_READY:
+		fd = prepare->fd;
+		index_file = prepare->index_file;
+		break;
+	case TRACEFILE_PREPARE_BUSY:
+	case TRACEFILE_PREPARE_IDLE:
+		break;
+	}
+	prepare->state = TRACEFILE_PREPARE_IDLE;
+	if (prepare->in_progress) {
+		/* The preparation thread frees it. */
+		prepare->destroyed = true;
+		pthread_mutex_unlock(&preparer.lock);
+		return;
+	}
+	pthread_mutex_unlock(&preparer.lock);
+
+	discard_files(prepare, count, fd, index_file);
+	destroy_prepare(prepare);
+}
+
+void tracefile_prepare_next(struct tracefile_prepare *prepare, uint64_t count)
+{
+	int fd = -1;
+	uint64_t prev_count;
+	struct lttng_index_file *index_file = NULL;
+
+	assert(prepare);
+
+	(void) pthread_once(&preparer.once, start_preparer);
+	if (!preparer.started) {
+		return;
+	}
+
+	pthread_mutex_lock(&preparer.lock);
+	prev_count = prepare->count;
+	switch (prepare->state) {
+	case TRACEFILE_PREPARE_READY:
+		if (prev_count == count) {
+			goto end_unlock;
+		}
+		fd = prepare->fd;
+		index_file = prepare->index_file;
+		prepare->fd = -1;
+		prepare->index_file = NULL;
+		/* Fall-through. */
+	case TRACEFILE_PREPARE_IDLE:
+	case TRACEFILE_PREPARE_BUSY:
+		/* A busy preparation is discarded by the preparation thread. */
+		cds_list_add_tail(&prepare->node, &preparer.queue);
+		pthread_cond_signal(&preparer.cond);
+		break;
+	case TRACEFILE_PREPARE_QUEUED:
+		break;
+	}
+	prepare->state = TRACEFILE_PREPARE_QUEUED;
+	prepare->count = count;
+end_unlock:
+	pthread_mutex_unlock(&preparer.lock);
+
+	discard_files(prepare, prev_count, fd, index_file);
+}
+
+void tracefile_prepare_wait(struct tracefile_prepare *prepare)
+{
+	assert(prepare);
+
+	pthread_mutex_lock(&preparer.lock);
+	while (prepare->state == TRACEFILE_PREPARE_QUEUED ||
+			prepare->state == TRACEFILE_PREPARE_BUSY ||
+			prepare->in_progress) {
+		pthread_cond_wait(&preparer.done_cond, &preparer.lock);
+	}
+	pthread_mutex_unlock(&preparer.lock);
+}
+
+/*
+ * Rename a prepared file to its final name.
+ *
+ * Return 0 on success or else a negative value.
+ */
+static int rename_prepared_file(struct tracefile_prepare *prepare,
+		const char *path_name, uint64_t count, const char *suffix)
+{
+	int ret;
+	char tmp_path[PATH_MAX], path[PATH_MAX];
+
+	ret = utils_stream_file_path(tmp_path, path_name,
+			prepare->tmp_file_name, prepare->size, count, suffix);
+	if (ret < 0) {
+		goto end;
+	}
+	ret = utils_stream_file_path(path, path_name, prepare->file_name,
+			prepare->size, count, suffix);
+	if (ret < 0) {
+		goto end;
+	}
+	/*
+	 * Like the unlink done by a synchronous rotation, the rename keeps the
+	 * content of a replaced file available to its readers.
+	 */
+	ret = rename(tmp_path, path);
+	if (ret < 0) {
+		PERROR("rename prepared file %s", tmp_path);
+	}
+end:
+	return ret;
+}
+
+bool tracefile_prepare_take(struct tracefile_prepare *prepare, uint64_t count,
+		int *fd, struct lttng_index_file **index_file)
+{
+	int ret;
+	bool taken = false;
+	int prepared_fd = -1;
+	uint64_t prepared_count;
+	struct lttng_index_file *prepared_index_file = NULL;
+
+	assert(prepare);
+
+	pthread_mutex_lock(&preparer.lock);
+	prepared_count = prepare->count;
+	switch (prepare->state) {
+	case TRACEFILE_PREPARE_READY:
+		prepared_fd = prepare->fd;
+		prepared_index_file = prepare->index_file;
+		prepare->fd = -1;
+		prepare->index_file = NULL;
+		break;
+	case TRACEFILE_PREPARE_QUEUED:
+		cds_list_del(&prepare->node);
+		break;
+	case TRACEFILE_PREPARE_BUSY:
+		/* The preparation thread discards the stale files. */
+	case TRACEFILE_PREPARE_IDLE:
+		break;
+	}
+	prepare->state = TRACEFILE_PREPARE_IDLE;
+	pthread_mutex_unlock(&preparer.lock);
+
+	if (prepared_fd < 0 || prepared_count != count) {
+		DBG("Tracefile %s/%s_%" PRIu64 " not prepared in time",
+				prepare->path_name, prepare->file_name, count);
+		goto error;
+	}
+
+	ret = rename_prepared_file(prepare, prepare->path_name, count, NULL);
+	if (ret < 0) {
+		goto error;
+	}
+	*fd = prepared_fd;
+	taken = true;
+
+	if (prepared_index_file) {
+		ret = rename_prepared_file(prepare, prepare->index_path_name,
+				count, DEFAULT_INDEX_FILE_SUFFIX);
+		if (ret < 0) {
+			/* The caller creates the index file. */
+			discard_files(prepare, count, -1, prepared_index_file);
+			prepared_index_file = NULL;
+		}
+	}
+	*index_file = prepared_index_file;
+	return taken;
+
+error:
+	discard_files(prepare, prepared_count, prepared_fd, prepared_index_file);
+	return taken;
+}
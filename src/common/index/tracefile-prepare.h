@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2026 - agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 2 only, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _TRACEFILE_PREPARE_H
+#define _TRACEFILE_PREPARE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "index.h"
+
+/*
+ * Background preparation of the next tracefile of a stream split in many
+ * tracefiles (tracefile size). The next tracefile, and its index file, are
+ * created under a hidden temporary name and their blocks are allocated by a
+ * preparation thread, so that rotating the stream output only requires
+ * renaming them.
+ *
+ * A preparation is owned by a single stream and must be used under the lock
+ * of that stream.
+ */
+struct tracefile_prepare;
+
+/*
+ * Create the preparation of the tracefiles of a stream. Index files are
+ * prepared along with the tracefiles if with_index is set.
+ *
+ * Return the preparation or NULL on error.
+ */
+struct tracefile_prepare *tracefile_prepare_create(const char *path_name,
+		const char *file_name, uint64_t size, int uid, int gid,
+		bool with_index, uint32_t index_major, uint32_t index_minor);
+
+/*
+ * Destroy a preparation, removing the files prepared and not taken.
+ */
+void tracefile_prepare_destroy(struct tracefile_prepare *prepare);
+
+/*
+ * Start preparing the tracefile of the given count in the background,
+ * replacing any previous preparation.
+ */
+void tracefile_prepare_next(struct tracefile_prepare *prepare, uint64_t count);
+
+/*
+ * Wait until the preparation requested last, if any, is done, whether the
+ * files could be prepared or not.
+ */
+void tracefile_prepare_wait(struct tracefile_prepare *prepare);
+
+/*
+ * Take the tracefile of the given count if it is prepared, renaming it, and
+ * its index file, to their final names. fd is set to the tracefile file
+ * descriptor and index_file to the index file, or NULL if no index file
+ * could be prepared.
+ *
+ * Return true if the tracefile was taken, false if it must be created by the
+ * caller.
+ */
+bool tracefile_prepare_take(struct tracefile_prepare *prepare, uint64_t count,
+		int *fd, struct lttng_index_file **index_file);
+
+#endif /* _TRACEFILE_PREPARE_H */
@@ -490,7 +490,8 @@ int lttng_kconsumer_recv_cmd(struct lttng_consumer_local_data *ctx,
 		ret = consumer_add_relayd_socket(msg.u.relayd_sock.net_index,
 				msg.u.relayd_sock.type, ctx, sock, consumer_sockpoll,
 				&msg.u.relayd_sock.sock, msg.u.relayd_sock.session_id,
-				 msg.u.relayd_sock.relayd_session_id);
+				 msg.u.relayd_sock.relayd_session_id,
+				msg.u.relayd_sock.relayd_capabilities);
 		goto end_nosignal;
 	}
 	case LTTNG_CONSUMER_ADD_CHANNEL:
@@ -779,14 +780,14 @@ int lttng_kconsumer_recv_cmd(struct lttng_consumer_local_data *ctx,
 			}
 			stream_pipe = ctx->consumer_metadata_pipe;
 		} else {
-			ret = consumer_add_data_stream(new_stream);
+			ret = consumer_add_data_stream(ctx, new_stream);
 			if (ret) {
 				ERR("Consumer add stream %" PRIu64 " failed. Continuing",
 						new_stream->key);
 				consumer_stream_free(new_stream);
 				goto end_nosignal;
 			}
-			stream_pipe = ctx->consumer_data_pipe;
+			stream_pipe = new_stream->data_thread->stream_pipe;
 		}
 
 		/* Vitible to other threads */
@@ -1603,13 +1604,15 @@ int lttng_kconsumer_on_recv_stream(struct lttng_consumer_stream *stream)
 					stream->name, stream->uid, stream->gid,
 					stream->chan->tracefile_size,
 					stream->tracefile_count_current,
-					CTF_INDEX_MAJOR, CTF_INDEX_MINOR);
+					CTF_INDEX_MAJOR, CTF_INDEX_MINOR,
+					consumer_stream_reuse_tracefiles(stream));
 			if (!index_file) {
 				goto error;
 			}
 			assert(!stream->index_file);
 			stream->index_file = index_file;
 		}
+		consumer_stream_prepare_next_tracefile(stream);
 	}
 
 	if (stream->output == LTTNG_EVENT_MMAP) {
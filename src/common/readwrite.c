@@ -19,6 +19,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <limits.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "readwrite.h"
@@ -106,3 +107,53 @@ error:
 		return i;
 	}
 }
+
+/*
+ * lttng_writev writes the iovcnt buffers described by iov, in order, taking
+ * care of EINTR and partial writes. The content of the iov array is
+ * modified as the buffers are written.
+ *
+ * Upon success, it returns the total length of the buffers. A lower value
+ * or a negative value means an error occurred.
+ */
+LTTNG_HIDDEN
+ssize_t lttng_writev(int fd, struct iovec *iov, int iovcnt)
+{
+	size_t i = 0;
+	ssize_t ret;
+
+	assert(iov || iovcnt == 0);
+
+	while (iovcnt > 0) {
+		ret = writev(fd, iov, iovcnt);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;	/* retry operation */
+			} else {
+				goto error;
+			}
+		} else if (ret == 0) {
+			break;
+		}
+		i += ret;
+
+		/* Skip the buffers which were completely written. */
+		while (iovcnt > 0 && ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (ret > 0) {
+			iov->iov_base += ret;
+			iov->iov_len -= ret;
+		}
+	}
+	return i;
+
+error:
+	if (i == 0) {
+		return -1;
+	} else {
+		return i;
+	}
+}
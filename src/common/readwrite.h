@@ -18,6 +18,7 @@
  * Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include <sys/uio.h>
 #include <unistd.h>
 #include <common/macros.h>
 
@@ -34,4 +35,11 @@ ssize_t lttng_read(int fd, void *buf, size_t count);
 LTTNG_HIDDEN
 ssize_t lttng_write(int fd, const void *buf, size_t count);
 
+/*
+ * lttng_writev writes a vector of buffers with the same semantic as
+ * lttng_write. The iov array may be modified.
+ */
+LTTNG_HIDDEN
+ssize_t lttng_writev(int fd, struct iovec *iov, int iovcnt);
+
 #endif /* LTTNG_COMMON_READWRITE_H */
@@ -32,11 +32,27 @@
 #include "relayd.h"
 
 /*
- * Send command. Fill up the header and append the data.
+ * Fill up the header of a command of which the payload has size bytes.
  */
-static int send_command(struct lttcomm_relayd_sock *rsock,
-		enum lttcomm_relayd_command cmd, void *data, size_t size,
-		int flags)
+void relayd_init_command_header(struct lttcomm_relayd_hdr *header,
+		enum lttcomm_relayd_command cmd, size_t size)
+{
+	memset(header, 0, sizeof(*header));
+	header->cmd = htobe32(cmd);
+	header->data_size = htobe64(size);
+
+	/* Zeroed for now since not used. */
+	header->cmd_version = 0;
+	header->circuit_id = 0;
+}
+
+/*
+ * Send command of a given command version. Fill up the header and append the
+ * data.
+ */
+static int send_command_version(struct lttcomm_relayd_sock *rsock,
+		enum lttcomm_relayd_command cmd, uint32_t cmd_version,
+		void *data, size_t size, int flags)
 {
 	int ret;
 	struct lttcomm_relayd_hdr header;
@@ -58,13 +74,8 @@ static int send_command(struct lttcomm_relayd_sock *rsock,
 		goto alloc_error;
 	}
 
-	memset(&header, 0, sizeof(header));
-	header.cmd = htobe32(cmd);
-	header.data_size = htobe64(size);
-
-	/* Zeroed for now since not used. */
-	header.cmd_version = 0;
-	header.circuit_id = 0;
+	relayd_init_command_header(&header, cmd, size);
+	header.cmd_version = htobe32(cmd_version);
 
 	/* Prepare buffer to send. */
 	memcpy(buf, &header, sizeof(header));
@@ -86,6 +97,16 @@ alloc_error:
 	return ret;
 }
 
+/*
+ * Send command. Fill up the header and append the data.
+ */
+static int send_command(struct lttcomm_relayd_sock *rsock,
+		enum lttcomm_relayd_command cmd, void *data, size_t size,
+		int flags)
+{
+	return send_command_version(rsock, cmd, 0, data, size, flags);
+}
+
 /*
  * Receive reply data on socket. This MUST be call after send_command or else
  * could result in unexpected behavior(s).
@@ -378,11 +399,16 @@ end:
  * If major versions are compatible, we assign minor_to_use to the
  * minor version of the procotol we are going to use for this session.
  *
+ * If capabilities is not NULL, the protocol extensions supported by the relayd
+ * are negotiated and returned through it as RELAYD_CAPABILITY_* flags.
+ *
  * Return 0 if compatible else negative value.
  */
-int relayd_version_check(struct lttcomm_relayd_sock *rsock)
+int relayd_version_check(struct lttcomm_relayd_sock *rsock,
+		uint32_t *capabilities)
 {
 	int ret;
+	uint32_t relayd_capabilities;
 	struct lttcomm_relayd_version msg;
 
 	/* Code flow error. Safety net. */
@@ -397,7 +423,9 @@ int relayd_version_check(struct lttcomm_relayd_sock *rsock)
 	msg.minor = htobe32(rsock->minor);
 
 	/* Send command */
-	ret = send_command(rsock, RELAYD_VERSION, (void *) &msg, sizeof(msg), 0);
+	ret = send_command_version(rsock, RELAYD_VERSION,
+			capabilities ? RELAYD_VERSION_CMD_CAPABILITIES : 0,
+			(void *) &msg, sizeof(msg), 0);
 	if (ret < 0) {
 		goto error;
 	}
@@ -412,6 +440,18 @@ int relayd_version_check(struct lttcomm_relayd_sock *rsock)
 	msg.major = be32toh(msg.major);
 	msg.minor = be32toh(msg.minor);
 
+	/*
+	 * The capabilities are only present in the reply when they are asked
+	 * for; an older relayd replies with its plain minor version.
+	 */
+	relayd_capabilities = 0;
+	if (capabilities) {
+		relayd_capabilities = (msg.minor >>
+				RELAYD_VERSION_CAPABILITIES_SHIFT) &
+				RELAYD_CAPABILITIES_ALL;
+		msg.minor &= RELAYD_VERSION_MINOR_MASK;
+	}
+
 	/*
 	 * Only validate the major version. If the other side is higher,
 	 * communication is not possible. Only major version equal can talk to each
@@ -435,9 +475,13 @@ int relayd_version_check(struct lttcomm_relayd_sock *rsock)
 		rsock->minor = msg.minor;
 	}
 
+	if (capabilities) {
+		*capabilities = relayd_capabilities;
+	}
+
 	/* Version number compatible */
-	DBG2("Relayd version is compatible, using protocol version %u.%u",
-			rsock->major, rsock->minor);
+	DBG2("Relayd version is compatible, using protocol version %u.%u (capabilities 0x%x)",
+			rsock->major, rsock->minor, relayd_capabilities);
 	ret = 0;
 
 error:
@@ -818,10 +862,14 @@ error:
 
 /*
  * Send index to the relayd.
+ *
+ * When the RELAYD_CAPABILITY_INDEX_ACK_WINDOW capability was negotiated, the
+ * caller passes the counter of indexes not acknowledged yet on this socket;
+ * NULL waits for the reply of every index.
  */
 int relayd_send_index(struct lttcomm_relayd_sock *rsock,
 		struct ctf_packet_index *index, uint64_t relay_stream_id,
-		uint64_t net_seq_num)
+		uint64_t net_seq_num, uint32_t *indexes_unacked)
 {
 	int ret;
 	struct lttcomm_relayd_index msg;
@@ -865,6 +913,20 @@ int relayd_send_index(struct lttcomm_relayd_sock *rsock,
 		goto error;
 	}
 
+	if (indexes_unacked) {
+		/*
+		 * Indexes are pipelined, the relayd only acknowledges a
+		 * window of them. A failed index closes the connection so the
+		 * error is caught by the next acknowledgement, or by the next
+		 * command.
+		 */
+		if (++(*indexes_unacked) < RELAYD_INDEX_ACK_WINDOW) {
+			ret = 0;
+			goto error;
+		}
+		*indexes_unacked = 0;
+	}
+
 	/* Receive response */
 	ret = recv_reply(rsock, (void *) &reply, sizeof(reply));
 	if (ret < 0) {
@@ -886,6 +948,65 @@ error:
 	return ret;
 }
 
+/*
+ * Send the live beacons of many streams in a single command. The beacons are
+ * in network byte order.
+ *
+ * Only supported by a relayd which has the RELAYD_CAPABILITY_SEND_BEACONS
+ * capability. The command is acknowledged like an index, see
+ * relayd_send_index() for indexes_unacked.
+ */
+int relayd_send_beacons(struct lttcomm_relayd_sock *rsock,
+		struct lttcomm_relayd_beacon *beacons, unsigned int count,
+		uint32_t *indexes_unacked)
+{
+	int ret;
+	struct lttcomm_relayd_generic_reply reply;
+
+	/* Code flow error. Safety net. */
+	assert(rsock);
+	assert(beacons);
+	assert(count > 0 && count <= RELAYD_BEACONS_MAX_COUNT);
+
+	DBG("Relayd sending %u beacons", count);
+
+	/* Send command */
+	ret = send_command(rsock, RELAYD_SEND_BEACONS, beacons,
+			count * sizeof(*beacons), 0);
+	if (ret < 0) {
+		goto error;
+	}
+
+	/* Acknowledged like a single pipelined index. */
+	if (indexes_unacked) {
+		if (++(*indexes_unacked) < RELAYD_INDEX_ACK_WINDOW) {
+			ret = 0;
+			goto error;
+		}
+		*indexes_unacked = 0;
+	}
+
+	/* Receive response */
+	ret = recv_reply(rsock, (void *) &reply, sizeof(reply));
+	if (ret < 0) {
+		goto error;
+	}
+
+	reply.ret_code = be32toh(reply.ret_code);
+
+	/* Return session id or negative ret code. */
+	if (reply.ret_code != LTTNG_OK) {
+		ret = -1;
+		ERR("Relayd send beacons replied error %d", reply.ret_code);
+	} else {
+		/* Success */
+		ret = 0;
+	}
+
+error:
+	return ret;
+}
+
 /*
  * Ask the relay to reset the metadata trace file (regeneration).
  */
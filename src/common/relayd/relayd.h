@@ -34,9 +34,12 @@ int relayd_add_stream(struct lttcomm_relayd_sock *sock, const char *channel_name
 int relayd_streams_sent(struct lttcomm_relayd_sock *rsock);
 int relayd_send_close_stream(struct lttcomm_relayd_sock *sock, uint64_t stream_id,
 		uint64_t last_net_seq_num);
-int relayd_version_check(struct lttcomm_relayd_sock *sock);
+int relayd_version_check(struct lttcomm_relayd_sock *sock,
+		uint32_t *capabilities);
 int relayd_start_data(struct lttcomm_relayd_sock *sock);
 int relayd_send_metadata(struct lttcomm_relayd_sock *sock, size_t len);
+void relayd_init_command_header(struct lttcomm_relayd_hdr *header,
+		enum lttcomm_relayd_command cmd, size_t size);
 int relayd_send_data_hdr(struct lttcomm_relayd_sock *sock,
 		struct lttcomm_relayd_data_hdr *hdr, size_t size);
 int relayd_data_pending(struct lttcomm_relayd_sock *sock, uint64_t stream_id,
@@ -48,7 +51,10 @@ int relayd_end_data_pending(struct lttcomm_relayd_sock *sock, uint64_t id,
 		unsigned int *is_data_inflight);
 int relayd_send_index(struct lttcomm_relayd_sock *rsock,
 		struct ctf_packet_index *index, uint64_t relay_stream_id,
-		uint64_t net_seq_num);
+		uint64_t net_seq_num, uint32_t *indexes_unacked);
+int relayd_send_beacons(struct lttcomm_relayd_sock *rsock,
+		struct lttcomm_relayd_beacon *beacons, unsigned int count,
+		uint32_t *indexes_unacked);
 int relayd_reset_metadata(struct lttcomm_relayd_sock *rsock,
 		uint64_t stream_id, uint64_t version);
 
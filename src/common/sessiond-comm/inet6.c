@@ -339,7 +339,9 @@ end:
  * Receive data of size len in put that data into the buf param. Using recvmsg
  * API.
  *
- * Return the size of received data.
+ * Return the size of received data. With MSG_DONTWAIT, return the size of
+ * the data that could be received without blocking, which may be less than
+ * len, or -1 with errno set to EAGAIN if none was available.
  */
 LTTNG_HIDDEN
 ssize_t lttcomm_recvmsg_inet6_sock(struct lttcomm_sock *sock, void *buf,
@@ -364,18 +366,30 @@ ssize_t lttcomm_recvmsg_inet6_sock(struct lttcomm_sock *sock, void *buf,
 		len_last = iov[0].iov_len;
 		ret = recvmsg(sock->fd, &msg, flags);
 		if (ret > 0) {
+			if (flags & MSG_DONTWAIT) {
+				goto end;
+			}
 			iov[0].iov_base += ret;
 			iov[0].iov_len -= ret;
 			assert(ret <= len_last);
 		}
 	} while ((ret > 0 && ret < len_last) || (ret < 0 && errno == EINTR));
 	if (ret < 0) {
+		if ((flags & MSG_DONTWAIT) &&
+				(errno == EAGAIN || errno == EWOULDBLOCK)) {
+			/*
+			 * Expected in non-blocking mode. Returning 0 here
+			 * would be taken as an orderly shutdown.
+			 */
+			goto end;
+		}
 		PERROR("recvmsg inet");
 	} else if (ret > 0) {
 		ret = len;
 	}
 	/* Else ret = 0 meaning an orderly shutdown. */
 
+end:
 	return ret;
 }
 
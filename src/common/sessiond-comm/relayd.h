@@ -29,6 +29,50 @@
 #define RELAYD_VERSION_COMM_MAJOR             VERSION_MAJOR
 #define RELAYD_VERSION_COMM_MINOR             VERSION_MINOR
 
+/*
+ * Protocol extensions are negotiated independently of the version. A peer
+ * asks for them by setting the cmd_version of its RELAYD_VERSION command to
+ * RELAYD_VERSION_CMD_CAPABILITIES; a relay daemon that knows about them then
+ * replies with the extensions it supports in the bits of the minor version
+ * above RELAYD_VERSION_CAPABILITIES_SHIFT. Older relay daemons ignore the
+ * command version and reply with a plain minor version, i.e. no capability.
+ */
+#define RELAYD_VERSION_CMD_CAPABILITIES       1
+#define RELAYD_VERSION_CAPABILITIES_SHIFT     16
+#define RELAYD_VERSION_MINOR_MASK             ((1U << RELAYD_VERSION_CAPABILITIES_SHIFT) - 1)
+
+/*
+ * RELAYD_SEND_INDEX commands are pipelined: the relay daemon only replies
+ * once every RELAYD_INDEX_ACK_WINDOW indexes received on a control
+ * connection, or when an index can't be handled in which case the connection
+ * is closed after the reply.
+ */
+#define RELAYD_CAPABILITY_INDEX_ACK_WINDOW    (1U << 0)
+/*
+ * Small data packets of a session can be sent in a bundle. A bundle is
+ * announced by a data header whose net_seq_num is RELAYD_DATA_BUNDLE_SEQ_NUM,
+ * whose stream_id is the stream of the first packet of the bundle and whose
+ * data_size is the size of the bundle. It is followed by a sequence of data
+ * headers, in network byte order, each immediately followed by the data of
+ * its packet.
+ *
+ * The packets of a bundle all belong to streams of the same session.
+ */
+#define RELAYD_CAPABILITY_DATA_BUNDLE         (1U << 1)
+/* The RELAYD_SEND_BEACONS command is understood. */
+#define RELAYD_CAPABILITY_SEND_BEACONS        (1U << 2)
+
+#define RELAYD_CAPABILITIES_ALL \
+	(RELAYD_CAPABILITY_INDEX_ACK_WINDOW | RELAYD_CAPABILITY_DATA_BUNDLE | \
+	 RELAYD_CAPABILITY_SEND_BEACONS)
+
+#define RELAYD_INDEX_ACK_WINDOW               64
+
+#define RELAYD_DATA_BUNDLE_SEQ_NUM            ((uint64_t) -1ULL)
+#define RELAYD_DATA_BUNDLE_MAX_SIZE           (1024 * 1024)
+/* Packets larger than this are not worth copying in a bundle. */
+#define RELAYD_DATA_BUNDLE_PACKET_MAX_SIZE    (64 * 1024)
+
 /*
  * lttng-relayd communication header.
  */
@@ -183,6 +227,22 @@ static inline size_t lttcomm_relayd_index_len(uint32_t major, uint32_t minor)
 	abort();
 }
 
+/*
+ * Live beacon of a stream, sent in a RELAYD_SEND_BEACONS command.
+ * The payload of the command is an array of at most RELAYD_BEACONS_MAX_COUNT
+ * beacons, in network byte order, for streams of the session of the control
+ * connection. The command is acknowledged like a single pipelined index.
+ */
+struct lttcomm_relayd_beacon {
+	uint64_t relay_stream_id;
+	/* Sequence number of the last packet sent before the beacon. */
+	uint64_t net_seq_num;
+	uint64_t timestamp_end;
+	uint64_t stream_id;
+} LTTNG_PACKED;
+
+#define RELAYD_BEACONS_MAX_COUNT              1024
+
 /*
  * Create session in 2.4 adds additionnal parameters for live reading.
  */
@@ -123,6 +123,8 @@ enum lttcomm_relayd_command {
 	RELAYD_STREAMS_SENT                 = 16,
 	/* Ask the relay to reset the metadata trace file (2.8+) */
 	RELAYD_RESET_METADATA               = 17,
+	/* Live beacons of many streams in one command (capability) */
+	RELAYD_SEND_BEACONS                 = 18,
 };
 
 /*
@@ -444,6 +446,8 @@ struct lttcomm_consumer_msg {
 			uint64_t session_id;
 			/* Relayd session id, only used with control socket. */
 			uint64_t relayd_session_id;
+			/* RELAYD_CAPABILITY_* negotiated with the relayd. */
+			uint32_t relayd_capabilities;
 		} LTTNG_PACKED relayd_sock;
 		struct {
 			uint64_t net_seq_idx;
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2026 - agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 2 only, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _LGPL_SOURCE
+#include <assert.h>
+
+#include "timer-wheel.h"
+
+#define TIMER_WHEEL_MASK	(TIMER_WHEEL_SLOTS - 1)
+/* Furthest expiration, in ticks from the next tick to process. */
+#define TIMER_WHEEL_MAX_DELTA	((1ULL << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)) - 1)
+
+/*
+ * Put an entry in the slot matching its expiration. The entries expiring
+ * within TIMER_WHEEL_SLOTS ticks go to the lowest level, one slot per tick.
+ * The others go to the level whose slots cover their distance, in the slot
+ * which moves down when the wheel reaches the start of its time range.
+ */
+static void wheel_insert(struct timer_wheel *wheel,
+		struct timer_wheel_entry *entry)
+{
+	unsigned int level;
+	uint64_t delta, expires = entry->expires;
+
+	if (expires < wheel->now) {
+		expires = wheel->now;
+	}
+	delta = expires - wheel->now;
+	if (delta > TIMER_WHEEL_MAX_DELTA) {
+		delta = TIMER_WHEEL_MAX_DELTA;
+		expires = wheel->now + delta;
+		entry->expires = expires;
+	}
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+		if (delta < (1ULL << ((level + 1) * TIMER_WHEEL_BITS))) {
+			break;
+		}
+	}
+
+	cds_list_add_tail(&entry->node, &wheel->slots[level][
+			(expires >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK]);
+}
+
+/*
+ * Move the entries of a slot of an upper level down to the levels matching
+ * their expiration.
+ *
+ * Return the index of the slot.
+ */
+static unsigned int wheel_cascade(struct timer_wheel *wheel,
+		unsigned int level, unsigned int index)
+{
+	struct cds_list_head entries;
+	struct timer_wheel_entry *entry, *tmp;
+
+	CDS_INIT_LIST_HEAD(&entries);
+	cds_list_splice(&wheel->slots[level][index], &entries);
+	CDS_INIT_LIST_HEAD(&wheel->slots[level][index]);
+
+	cds_list_for_each_entry_safe(entry, tmp, &entries, node) {
+		cds_list_del(&entry->node);
+		wheel_insert(wheel, entry);
+	}
+	return index;
+}
+
+LTTNG_HIDDEN
+void timer_wheel_init(struct timer_wheel *wheel, uint64_t now)
+{
+	unsigned int level, index;
+
+	wheel->now = now;
+	wheel->nr_entries = 0;
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		for (index = 0; index < TIMER_WHEEL_SLOTS; index++) {
+			CDS_INIT_LIST_HEAD(&wheel->slots[level][index]);
+		}
+	}
+}
+
+LTTNG_HIDDEN
+void timer_wheel_entry_init(struct timer_wheel_entry *entry)
+{
+	CDS_INIT_LIST_HEAD(&entry->node);
+	entry->expires = 0;
+	entry->in_wheel = false;
+}
+
+LTTNG_HIDDEN
+bool timer_wheel_entry_pending(struct timer_wheel_entry *entry)
+{
+	return !cds_list_empty(&entry->node);
+}
+
+LTTNG_HIDDEN
+void timer_wheel_add(struct timer_wheel *wheel,
+		struct timer_wheel_entry *entry, uint64_t expires)
+{
+	assert(!timer_wheel_entry_pending(entry));
+
+	entry->expires = expires;
+	entry->in_wheel = true;
+	wheel_insert(wheel, entry);
+	wheel->nr_entries++;
+}
+
+LTTNG_HIDDEN
+void timer_wheel_fast_forward(struct timer_wheel *wheel, uint64_t now)
+{
+	/* Every slot is empty, no cascade can be missed. */
+	if (wheel->nr_entries == 0 && now > wheel->now) {
+		wheel->now = now;
+	}
+}
+
+LTTNG_HIDDEN
+void timer_wheel_del(struct timer_wheel *wheel,
+		struct timer_wheel_entry *entry)
+{
+	if (entry->in_wheel) {
+		entry->in_wheel = false;
+		wheel->nr_entries--;
+	}
+	cds_list_del_init(&entry->node);
+}
+
+LTTNG_HIDDEN
+void timer_wheel_advance(struct timer_wheel *wheel, uint64_t now,
+		struct cds_list_head *expired)
+{
+	unsigned int index, level;
+	struct timer_wheel_entry *entry, *tmp;
+
+	while (wheel->now <= now) {
+		if (wheel->nr_entries == 0) {
+			/* Nothing can expire, skip the remaining ticks. */
+			wheel->now = now + 1;
+			break;
+		}
+
+		index = wheel->now & TIMER_WHEEL_MASK;
+		/*
+		 * At the start of the range of a slot of an upper level, its
+		 * entries move down, and so on up the levels.
+		 */
+		for (level = 1; !index && level < TIMER_WHEEL_LEVELS; level++) {
+			index = wheel_cascade(wheel, level,
+					(wheel->now >> (level * TIMER_WHEEL_BITS)) &
+					TIMER_WHEEL_MASK);
+		}
+
+		index = wheel->now & TIMER_WHEEL_MASK;
+		cds_list_for_each_entry_safe(entry, tmp,
+				&wheel->slots[0][index], node) {
+			cds_list_move(&entry->node, expired->prev);
+			entry->in_wheel = false;
+			wheel->nr_entries--;
+		}
+		wheel->now++;
+	}
+}
+
+LTTNG_HIDDEN
+uint64_t timer_wheel_next_tick(struct timer_wheel *wheel)
+{
+	unsigned int index;
+
+	if (wheel->nr_entries == 0) {
+		return UINT64_MAX;
+	}
+
+	/*
+	 * The slots of the lowest level are only scanned up to the next
+	 * cascade, which may bring earlier expirations down.
+	 */
+	for (index = wheel->now & TIMER_WHEEL_MASK; index < TIMER_WHEEL_SLOTS;
+			index++) {
+		if (!cds_list_empty(&wheel->slots[0][index])) {
+			break;
+		}
+	}
+	return wheel->now + index - (wheel->now & TIMER_WHEEL_MASK);
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2026 - agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 2 only, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef LTTNG_TIMER_WHEEL_H
+#define LTTNG_TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <urcu/list.h>
+
+#include "macros.h"
+
+/*
+ * Hierarchical timer wheel. Time is expressed in ticks whose duration is
+ * chosen by the user of the wheel. Each level has TIMER_WHEEL_SLOTS slots,
+ * each slot of a level covering TIMER_WHEEL_SLOTS times the time range of a
+ * slot of the level below it. Timers are added to the level matching how far
+ * their expiration is and move down to the lower levels as the wheel turns,
+ * so adding, removing and expiring a timer take constant time whatever the
+ * number of timers.
+ *
+ * The wheel is not thread-safe; its users must provide mutual exclusion.
+ */
+#define TIMER_WHEEL_BITS	8
+#define TIMER_WHEEL_SLOTS	(1U << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS	4
+
+struct timer_wheel_entry {
+	/* Node in a slot of the wheel or in the list of expired entries. */
+	struct cds_list_head node;
+	/* Tick at which the entry expires. */
+	uint64_t expires;
+	/* Set while the entry is in a slot of the wheel. */
+	bool in_wheel;
+};
+
+struct timer_wheel {
+	/* Next tick to process. Every entry expiring before it is expired. */
+	uint64_t now;
+	unsigned int nr_entries;
+	struct cds_list_head slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+/*
+ * Initialize an empty wheel whose next tick to process is now.
+ */
+LTTNG_HIDDEN
+void timer_wheel_init(struct timer_wheel *wheel, uint64_t now);
+
+LTTNG_HIDDEN
+void timer_wheel_entry_init(struct timer_wheel_entry *entry);
+
+/*
+ * Return true if an entry is in the wheel or in a list of expired entries.
+ */
+LTTNG_HIDDEN
+bool timer_wheel_entry_pending(struct timer_wheel_entry *entry);
+
+/*
+ * Add an entry expiring at the given tick to the wheel. An entry expiring
+ * before the next tick to process expires at that tick. Expirations further
+ * than the range of the wheel are clamped to that range.
+ */
+LTTNG_HIDDEN
+void timer_wheel_add(struct timer_wheel *wheel,
+		struct timer_wheel_entry *entry, uint64_t expires);
+
+/*
+ * Move the next tick to process of an empty wheel forward to the given tick.
+ * A wheel is only advanced while it has entries, so this must be done before
+ * adding an entry after an idle period for its expiration to be placed
+ * relative to the current tick. Has no effect on a wheel having entries.
+ */
+LTTNG_HIDDEN
+void timer_wheel_fast_forward(struct timer_wheel *wheel, uint64_t now);
+
+/*
+ * Remove an entry from the wheel or from a list of expired entries. Removing
+ * an entry which is not pending has no effect.
+ */
+LTTNG_HIDDEN
+void timer_wheel_del(struct timer_wheel *wheel,
+		struct timer_wheel_entry *entry);
+
+/*
+ * Process the ticks of the wheel up to, and including, the given tick. The
+ * entries expiring in that range are removed from the wheel and appended to
+ * the expired list, in the order of their expiration, so that the entries
+ * expiring at the same tick are handled in a single batch.
+ */
+LTTNG_HIDDEN
+void timer_wheel_advance(struct timer_wheel *wheel, uint64_t now,
+		struct cds_list_head *expired);
+
+/*
+ * Return a tick at which the wheel must be advanced next: the tick of the
+ * earliest expiration of the lowest level, or the tick at which the entries
+ * of the upper levels move down if the lowest level is empty. Return
+ * UINT64_MAX if the wheel is empty.
+ */
+LTTNG_HIDDEN
+uint64_t timer_wheel_next_tick(struct timer_wheel *wheel);
+
+#endif /* LTTNG_TIMER_WHEEL_H */
@@ -49,6 +49,27 @@
 
 #define INT_MAX_STR_LEN 12	/* includes \0 */
 
+/*
+ * CTF metadata packet header, laid out as the metadata ring buffer client of
+ * the tracer writes it, in native byte order.
+ */
+struct metadata_packet_header {
+	uint32_t magic;			/* 0x75D11D57 */
+	uint8_t uuid[16];		/* Unique Universal Identifier */
+	uint32_t checksum;		/* 0 if unused */
+	uint32_t content_size;		/* in bits */
+	uint32_t packet_size;		/* in bits */
+	uint8_t compression_scheme;	/* 0 if unused */
+	uint8_t encryption_scheme;	/* 0 if unused */
+	uint8_t checksum_scheme;	/* 0 if unused */
+	uint8_t major;			/* CTF spec major version number */
+	uint8_t minor;			/* CTF spec minor version number */
+} LTTNG_PACKED;
+
+#define METADATA_PACKET_MAGIC		0x75D11D57
+#define METADATA_CTF_SPEC_MAJOR		1
+#define METADATA_CTF_SPEC_MINOR		8
+
 extern struct lttng_consumer_global_data consumer_data;
 extern int consumer_poll_timeout;
 extern volatile int consumer_quit;
@@ -215,13 +236,13 @@ static int send_stream_to_thread(struct lttng_consumer_stream *stream,
 		}
 		stream_pipe = ctx->consumer_metadata_pipe;
 	} else {
-		ret = consumer_add_data_stream(stream);
+		ret = consumer_add_data_stream(ctx, stream);
 		if (ret) {
 			ERR("Consumer add stream %" PRIu64 " failed.",
 					stream->key);
 			goto error;
 		}
-		stream_pipe = ctx->consumer_data_pipe;
+		stream_pipe = stream->data_thread->stream_pipe;
 	}
 
 	/*
@@ -1358,7 +1379,8 @@ int lttng_ustconsumer_recv_cmd(struct lttng_consumer_local_data *ctx,
 		ret = consumer_add_relayd_socket(msg.u.relayd_sock.net_index,
 				msg.u.relayd_sock.type, ctx, sock, consumer_sockpoll,
 				&msg.u.relayd_sock.sock, msg.u.relayd_sock.session_id,
-				msg.u.relayd_sock.relayd_session_id);
+				msg.u.relayd_sock.relayd_session_id,
+				msg.u.relayd_sock.relayd_capabilities);
 		goto end_nosignal;
 	}
 	case LTTNG_CONSUMER_DESTROY_RELAYD:
@@ -1456,6 +1478,9 @@ int lttng_ustconsumer_recv_cmd(struct lttng_consumer_local_data *ctx,
 		attr.read_timer_interval = msg.u.ask_channel.read_timer_interval;
 		attr.chan_id = msg.u.ask_channel.chan_id;
 		memcpy(attr.uuid, msg.u.ask_channel.uuid, sizeof(attr.uuid));
+		/* Needed to write the metadata packet headers. */
+		memcpy(channel->uuid, msg.u.ask_channel.uuid,
+				sizeof(msg.u.ask_channel.uuid));
 		attr.blocking_timeout= msg.u.ask_channel.blocking_timeout;
 
 		/* Match channel buffer type to the UST abi. */
@@ -1505,6 +1530,13 @@ int lttng_ustconsumer_recv_cmd(struct lttng_consumer_local_data *ctx,
 		} else {
 			int monitor_start_ret;
 
+			/*
+			 * The ring buffers of a data channel with a read timer are
+			 * polled by the data threads instead of waiting for the
+			 * wakeups of the applications.
+			 */
+			channel->read_timer_interval =
+					msg.u.ask_channel.read_timer_interval;
 			consumer_timer_live_start(channel,
 					msg.u.ask_channel.live_timer_interval);
 			monitor_start_ret = consumer_timer_monitor_start(
@@ -2276,66 +2308,147 @@ end:
 }
 
 /*
- * Write up to one packet from the metadata cache to the channel.
+ * Write up to one packet of metadata from the cache straight to the output of
+ * the metadata stream, without going through the ring buffer of the stream.
+ * The packet has the size of a sub-buffer of the metadata channel.
+ *
+ * Returns the number of bytes of the cache written, 0 if the whole cache was
+ * already written, or a negative value on error.
  *
- * Returns the number of bytes pushed in the cache, or a negative value
- * on error.
+ * The metadata stream lock MUST be held.
  */
 static
-int commit_one_metadata_packet(struct lttng_consumer_stream *stream)
+ssize_t write_one_metadata_packet(struct lttng_consumer_local_data *ctx,
+		struct lttng_consumer_stream *stream)
 {
-	ssize_t write_len;
-	int ret;
+	ssize_t ret;
+	struct consumer_metadata_cache *cache = stream->chan->metadata_cache;
+	struct metadata_packet_header *header;
+	char *packet = NULL;
+	unsigned long packet_size = stream->max_sb_size;
+	unsigned long content_size, written_size;
+	uint64_t len;
+
+	assert(packet_size > sizeof(*header));
 
-	pthread_mutex_lock(&stream->chan->metadata_cache->lock);
+	packet = zmalloc(packet_size);
+	if (!packet) {
+		PERROR("zmalloc metadata packet");
+		ret = -1;
+		goto end;
+	}
+
+	/*
+	 * The contents are copied in the packet so that the cache lock isn't
+	 * held while writing to the output. A concurrent version change of
+	 * the cache is handled by the next call.
+	 */
+	pthread_mutex_lock(&cache->lock);
 	ret = metadata_stream_check_version(stream);
 	if (ret < 0) {
+		pthread_mutex_unlock(&cache->lock);
 		goto end;
 	}
-	if (stream->chan->metadata_cache->max_offset
-			== stream->ust_metadata_pushed) {
+	len = min(cache->max_offset - stream->ust_metadata_pushed,
+			(uint64_t) (packet_size - sizeof(*header)));
+	if (len) {
+		consumer_metadata_cache_read(cache, stream->ust_metadata_pushed,
+				packet + sizeof(*header), len);
+	}
+	pthread_mutex_unlock(&cache->lock);
+	if (!len) {
 		ret = 0;
 		goto end;
 	}
 
-	write_len = ustctl_write_one_packet_to_channel(stream->chan->uchan,
-			&stream->chan->metadata_cache->data[stream->ust_metadata_pushed],
-			stream->chan->metadata_cache->max_offset
-			- stream->ust_metadata_pushed);
-	assert(write_len != 0);
-	if (write_len < 0) {
-		ERR("Writing one metadata packet");
-		ret = -1;
+	content_size = sizeof(*header) + len;
+	header = (struct metadata_packet_header *) packet;
+	header->magic = METADATA_PACKET_MAGIC;
+	memcpy(header->uuid, stream->chan->uuid, sizeof(header->uuid));
+	header->content_size = content_size * CHAR_BIT;
+	header->packet_size = packet_size * CHAR_BIT;
+	header->major = METADATA_CTF_SPEC_MAJOR;
+	header->minor = METADATA_CTF_SPEC_MINOR;
+
+	ret = lttng_consumer_on_read_subbuffer_buffer(ctx, stream, packet,
+			content_size, packet_size - content_size, NULL);
+	/*
+	 * The padding is only written to the tracefile, the relay daemon
+	 * writes it on its side.
+	 */
+	written_size = stream->net_seq_idx == (uint64_t) -1ULL ?
+			packet_size : content_size;
+	if (ret != written_size) {
+		DBG("Error writing metadata packet (ret: %zd != %lu)",
+				ret, written_size);
+		ret = ret < 0 ? ret : -1;
 		goto end;
 	}
-	stream->ust_metadata_pushed += write_len;
 
-	assert(stream->chan->metadata_cache->max_offset >=
-			stream->ust_metadata_pushed);
-	ret = write_len;
+	pthread_mutex_lock(&cache->lock);
+	/*
+	 * The packet written belongs to a previous version of the metadata if
+	 * the cache was reset meanwhile; the next call resets the stream.
+	 */
+	if (cache->version == stream->metadata_version) {
+		stream->ust_metadata_pushed += len;
+		assert(cache->max_offset >= stream->ust_metadata_pushed);
+	}
+	pthread_mutex_unlock(&cache->lock);
+	ret = len;
 
 end:
-	pthread_mutex_unlock(&stream->chan->metadata_cache->lock);
+	free(packet);
 	return ret;
 }
 
+/*
+ * Clear the wakeup flag of a metadata stream and drain its poll pipe.
+ *
+ * The flag is cleared first so that a cache write racing with the drain
+ * either sees it cleared and writes a new wakeup byte, or is covered by the
+ * cache read which follows. The pipe is drained completely since a byte of
+ * such a write may land after the flag was cleared.
+ *
+ * Return 0 on success or a negative value on error.
+ */
+static
+int drain_metadata_wakeup(struct lttng_consumer_stream *stream)
+{
+	char buf[16];
+	ssize_t readlen;
+
+	uatomic_set(&stream->ust_metadata_wakeup_pending, 0);
+	cmm_smp_mb();
+
+	do {
+		readlen = lttng_read(stream->wait_fd, buf, sizeof(buf));
+	} while (readlen == sizeof(buf));
+	if (readlen < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+		PERROR("Draining UST metadata poll pipe");
+		return -1;
+	}
+	return 0;
+}
 
 /*
- * Sync metadata meaning request them to the session daemon and snapshot to the
- * metadata thread can consumer them.
+ * Sync metadata meaning request them to the session daemon and write them
+ * straight from the cache, so there is nothing left for the metadata thread
+ * to consume.
  *
  * Metadata stream lock is held here, but we need to release it when
  * interacting with sessiond, else we cause a deadlock with live
  * awaiting on metadata to be pushed out.
  *
- * Return 0 if new metadatda is available, EAGAIN if the metadata stream
- * is empty or a negative value on error.
+ * Return 0 once the metadata is written, ENODATA if there was no new
+ * metadata or a negative value on error.
  */
 int lttng_ustconsumer_sync_metadata(struct lttng_consumer_local_data *ctx,
 		struct lttng_consumer_stream *metadata)
 {
 	int ret;
-	int retry = 0;
+	ssize_t write_ret;
+	bool written = false;
 
 	assert(ctx);
 	assert(metadata);
@@ -2351,32 +2464,25 @@ int lttng_ustconsumer_sync_metadata(struct lttng_consumer_local_data *ctx,
 		goto end;
 	}
 
-	ret = commit_one_metadata_packet(metadata);
-	if (ret <= 0) {
+	do {
+		write_ret = write_one_metadata_packet(ctx, metadata);
+		if (write_ret > 0) {
+			written = true;
+		}
+	} while (write_ret > 0);
+	if (write_ret < 0) {
+		ERR("Sync metadata, writing metadata packet");
+		ret = write_ret;
 		goto end;
-	} else if (ret > 0) {
-		retry = 1;
 	}
 
-	ustctl_flush_buffer(metadata->ustream, 1);
-	ret = ustctl_snapshot(metadata->ustream);
-	if (ret < 0) {
-		if (errno != EAGAIN) {
-			ERR("Sync metadata, taking UST snapshot");
-			goto end;
-		}
+	if (!written) {
 		DBG("No new metadata when syncing them.");
 		/* No new metadata, exit. */
 		ret = ENODATA;
 		goto end;
 	}
-
-	/*
-	 * After this flush, we still need to extract metadata.
-	 */
-	if (retry) {
-		ret = EAGAIN;
-	}
+	ret = 0;
 
 end:
 	return ret;
@@ -2412,20 +2518,27 @@ static int notify_if_more_data(struct lttng_consumer_stream *stream,
 	ret = ustctl_put_subbuf(ustream);
 	assert(!ret);
 
-	/* This stream still has data. Flag it and wake up the data thread. */
+	/*
+	 * This stream still has data. Flag it and wake up the data thread. A
+	 * stream read by a writer thread is returned to its data thread which
+	 * is woken up then.
+	 */
 	stream->has_data = 1;
 
-	if (stream->monitor && !stream->hangup_flush_done && !ctx->has_wakeup) {
+	if (stream->monitor && !stream->hangup_flush_done &&
+			!stream->writer_pending &&
+			!stream->data_thread->has_wakeup) {
 		ssize_t writelen;
 
-		writelen = lttng_pipe_write(ctx->consumer_wakeup_pipe, "!", 1);
+		writelen = lttng_pipe_write(stream->data_thread->wakeup_pipe,
+				"!", 1);
 		if (writelen < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
 			ret = writelen;
 			goto end;
 		}
 
 		/* The wake up pipe has been notified. */
-		ctx->has_wakeup = 1;
+		stream->data_thread->has_wakeup = 1;
 	}
 	ret = 0;
 
@@ -2514,6 +2627,21 @@ int lttng_ustconsumer_read_subbuffer(struct lttng_consumer_stream *stream,
 	/* Ease our life for what's next. */
 	ustream = stream->ustream;
 
+	if (stream->metadata_flag) {
+		if (stream->monitor && !stream->hangup_flush_done) {
+			ret = drain_metadata_wakeup(stream);
+			if (ret < 0) {
+				goto end;
+			}
+		}
+		/*
+		 * The metadata is written straight from the cache, the ring
+		 * buffer of the stream is never used.
+		 */
+		ret = write_one_metadata_packet(ctx, stream);
+		goto end;
+	}
+
 	/*
 	 * We can consume the 1 byte written into the wait_fd by UST. Don't trigger
 	 * error if we cannot read this one byte (read returns 0), or if the error
@@ -2535,23 +2663,9 @@ int lttng_ustconsumer_read_subbuffer(struct lttng_consumer_stream *stream,
 		}
 	}
 
-retry:
 	/* Get the next subbuffer */
 	err = ustctl_get_next_subbuf(ustream);
 	if (err != 0) {
-		/*
-		 * Populate metadata info if the existing info has
-		 * already been read.
-		 */
-		if (stream->metadata_flag) {
-			ret = commit_one_metadata_packet(stream);
-			if (ret <= 0) {
-				goto end;
-			}
-			ustctl_flush_buffer(stream->ustream, 1);
-			goto retry;
-		}
-
 		ret = err;	/* ustctl_get_next_subbuf returns negative, caller expect positive. */
 		/*
 		 * This is a debug message even for single-threaded consumer,
@@ -2565,25 +2679,21 @@ retry:
 	}
 	assert(stream->chan->output == CONSUMER_CHANNEL_MMAP);
 
-	if (!stream->metadata_flag) {
-		index.offset = htobe64(stream->out_fd_offset);
-		ret = get_index_values(&index, ustream);
-		if (ret < 0) {
-			err = ustctl_put_subbuf(ustream);
-			assert(err == 0);
-			goto end;
-		}
+	index.offset = htobe64(stream->out_fd_offset);
+	ret = get_index_values(&index, ustream);
+	if (ret < 0) {
+		err = ustctl_put_subbuf(ustream);
+		assert(err == 0);
+		goto end;
+	}
 
-		/* Update the stream's sequence and discarded events count. */
-		ret = update_stream_stats(stream);
-		if (ret < 0) {
-			PERROR("kernctl_get_events_discarded");
-			err = ustctl_put_subbuf(ustream);
-			assert(err == 0);
-			goto end;
-		}
-	} else {
-		write_index = 0;
+	/* Update the stream's sequence and discarded events count. */
+	ret = update_stream_stats(stream);
+	if (ret < 0) {
+		PERROR("kernctl_get_events_discarded");
+		err = ustctl_put_subbuf(ustream);
+		assert(err == 0);
+		goto end;
 	}
 
 	/* Get the full padded subbuffer size */
@@ -2626,11 +2736,9 @@ retry:
 	 * This will consumer the byte on the wait_fd if and only if there is not
 	 * next subbuffer to be acquired.
 	 */
-	if (!stream->metadata_flag) {
-		ret = notify_if_more_data(stream, ctx);
-		if (ret < 0) {
-			goto end;
-		}
+	ret = notify_if_more_data(stream, ctx);
+	if (ret < 0) {
+		goto end;
 	}
 
 	/* Write index if needed. */
@@ -2638,7 +2746,7 @@ retry:
 		goto end;
 	}
 
-	if (stream->chan->live_timer_interval && !stream->metadata_flag) {
+	if (stream->chan->live_timer_interval) {
 		/*
 		 * In live, block until all the metadata is sent.
 		 */
@@ -2664,7 +2772,6 @@ retry:
 		}
 	}
 
-	assert(!stream->metadata_flag);
 	err = consumer_stream_write_index(stream, &index);
 	if (err < 0) {
 		goto end;
@@ -2703,13 +2810,15 @@ int lttng_ustconsumer_on_recv_stream(struct lttng_consumer_stream *stream)
 					stream->name, stream->uid, stream->gid,
 					stream->chan->tracefile_size,
 					stream->tracefile_count_current,
-					CTF_INDEX_MAJOR, CTF_INDEX_MINOR);
+					CTF_INDEX_MAJOR, CTF_INDEX_MINOR,
+					consumer_stream_reuse_tracefiles(stream));
 			if (!index_file) {
 				goto error;
 			}
 			assert(!stream->index_file);
 			stream->index_file = index_file;
 		}
+		consumer_stream_prepare_next_tracefile(stream);
 	}
 	ret = 0;
 
@@ -2748,13 +2857,12 @@ int lttng_ustconsumer_data_pending(struct lttng_consumer_stream *stream)
 
 		/*
 		 * We can simply check whether all contiguously available data
-		 * has been pushed to the ring buffer, since the push operation
-		 * is performed within get_next_subbuf(), and because both
-		 * get_next_subbuf() and put_next_subbuf() are issued atomically
-		 * thanks to the stream lock within
-		 * lttng_ustconsumer_read_subbuffer(). This basically means that
-		 * whetnever ust_metadata_pushed is incremented, the associated
-		 * metadata has been consumed from the metadata stream.
+		 * has been written, since the metadata is written from the
+		 * cache straight to the output of the stream by
+		 * write_one_metadata_packet(), which only increments
+		 * ust_metadata_pushed once the packet is written. This
+		 * basically means that whenever ust_metadata_pushed is
+		 * incremented, the associated metadata has been consumed.
 		 */
 		DBG("UST consumer metadata pending check: contiguous %" PRIu64 " vs pushed %" PRIu64,
 				contiguous, pushed);
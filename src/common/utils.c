@@ -708,11 +708,13 @@ int utils_mkdir_recursive(const char *path, mode_t mode, int uid, int gid)
 }
 
 /*
- * path is the output parameter. It needs to be PATH_MAX len.
+ * Compute the path of a stream file. path is the output parameter. It needs
+ * to be PATH_MAX len.
  *
  * Return 0 on success or else a negative value.
  */
-static int utils_stream_file_name(char *path,
+LTTNG_HIDDEN
+int utils_stream_file_path(char *path,
 		const char *path_name, const char *file_name,
 		uint64_t size, uint64_t count,
 		const char *suffix)
@@ -768,24 +770,24 @@ error:
 }
 
 /*
- * Create the stream file on disk.
+ * Open a stream file for writing with the given open flags, creating it if
+ * needed.
  *
- * Return 0 on success or else a negative value.
+ * Return the file descriptor on success or else a negative value.
  */
-LTTNG_HIDDEN
-int utils_create_stream_file(const char *path_name, char *file_name, uint64_t size,
-		uint64_t count, int uid, int gid, char *suffix)
+static int open_stream_file(const char *path_name, char *file_name,
+		uint64_t size, uint64_t count, int uid, int gid, char *suffix,
+		int flags)
 {
-	int ret, flags, mode;
+	int ret, mode;
 	char path[PATH_MAX];
 
-	ret = utils_stream_file_name(path, path_name, file_name,
+	ret = utils_stream_file_path(path, path_name, file_name,
 			size, count, suffix);
 	if (ret < 0) {
 		goto error;
 	}
 
-	flags = O_WRONLY | O_CREAT | O_TRUNC;
 	/* Open with 660 mode */
 	mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
 
@@ -801,6 +803,75 @@ error:
 	return ret;
 }
 
+/*
+ * Create the stream file on disk.
+ *
+ * Return the file descriptor on success or else a negative value.
+ */
+LTTNG_HIDDEN
+int utils_create_stream_file(const char *path_name, char *file_name, uint64_t size,
+		uint64_t count, int uid, int gid, char *suffix)
+{
+	return open_stream_file(path_name, file_name, size, count, uid, gid,
+			suffix, O_WRONLY | O_CREAT | O_TRUNC);
+}
+
+/*
+ * Open a stream file to write it again from the start, creating it if it
+ * does not exist. An existing file is truncated in place, keeping its inode
+ * and directory entry, so that it never holds contents of its previous use.
+ *
+ * Return the file descriptor on success or else a negative value.
+ */
+LTTNG_HIDDEN
+int utils_reuse_stream_file(const char *path_name, char *file_name,
+		uint64_t size, uint64_t count, int uid, int gid, char *suffix)
+{
+	int fd, ret;
+
+	fd = open_stream_file(path_name, file_name, size, count, uid, gid,
+			suffix, O_WRONLY | O_CREAT);
+	if (fd < 0) {
+		goto end;
+	}
+	ret = ftruncate(fd, 0);
+	if (ret < 0) {
+		PERROR("ftruncate reused stream file");
+		if (close(fd)) {
+			PERROR("close reused stream file");
+		}
+		fd = -1;
+	}
+end:
+	return fd;
+}
+
+/*
+ * Trim a stream file to the current offset of its file descriptor, freeing
+ * the blocks allocated past it.
+ *
+ * Return 0 on success or else a negative value.
+ */
+LTTNG_HIDDEN
+int utils_trim_stream_file(int fd)
+{
+	int ret;
+	off_t offset;
+
+	offset = lseek(fd, 0, SEEK_CUR);
+	if (offset < 0) {
+		PERROR("lseek stream file");
+		ret = -1;
+		goto error;
+	}
+	ret = ftruncate(fd, offset);
+	if (ret < 0) {
+		PERROR("ftruncate stream file");
+	}
+error:
+	return ret;
+}
+
 /*
  * Unlink the stream tracefile from disk.
  *
@@ -813,7 +884,7 @@ int utils_unlink_stream_file(const char *path_name, char *file_name, uint64_t si
 	int ret;
 	char path[PATH_MAX];
 
-	ret = utils_stream_file_name(path, path_name, file_name,
+	ret = utils_stream_file_path(path, path_name, file_name,
 			size, count, suffix);
 	if (ret < 0) {
 		goto error;
@@ -833,7 +904,9 @@ error:
 
 /*
  * Change the output tracefile according to the given size and count The
- * new_count pointer is set during this operation.
+ * new_count pointer is set during this operation. If reuse is set, the
+ * tracefile replaced in tracefile rotation (count > 0) is truncated in place
+ * instead of being unlinked and created again.
  *
  * From the consumer, the stream lock MUST be held before calling this function
  * because we are modifying the stream status.
@@ -843,7 +916,7 @@ error:
 LTTNG_HIDDEN
 int utils_rotate_stream_file(char *path_name, char *file_name, uint64_t size,
 		uint64_t count, int uid, int gid, int out_fd, uint64_t *new_count,
-		int *stream_fd)
+		int *stream_fd, bool reuse)
 {
 	int ret;
 
@@ -869,14 +942,22 @@ int utils_rotate_stream_file(char *path_name, char *file_name, uint64_t size,
 		 * the open of the data file is performed in get_index.
 		 * Unlinking the old file rather than overwriting it
 		 * achieves this.
+		 *
+		 * When the tracefiles are reused, the file is truncated
+		 * in place instead, so that no inode and no directory
+		 * entry is freed and allocated at each rotation. This is
+		 * only done when no reader can have the file open.
 		 */
 		if (new_count) {
 			*new_count = (*new_count + 1) % count;
 		}
-		ret = utils_unlink_stream_file(path_name, file_name, size,
-				new_count ? *new_count : 0, uid, gid, 0);
-		if (ret < 0 && errno != ENOENT) {
-			goto error;
+		if (!reuse) {
+			ret = utils_unlink_stream_file(path_name, file_name,
+					size, new_count ? *new_count : 0,
+					uid, gid, 0);
+			if (ret < 0 && errno != ENOENT) {
+				goto error;
+			}
 		}
 	} else {
 		if (new_count) {
@@ -884,8 +965,13 @@ int utils_rotate_stream_file(char *path_name, char *file_name, uint64_t size,
 		}
 	}
 
-	ret = utils_create_stream_file(path_name, file_name, size,
-			new_count ? *new_count : 0, uid, gid, 0);
+	if (reuse) {
+		ret = utils_reuse_stream_file(path_name, file_name, size,
+				new_count ? *new_count : 0, uid, gid, 0);
+	} else {
+		ret = utils_create_stream_file(path_name, file_name, size,
+				new_count ? *new_count : 0, uid, gid, 0);
+	}
 	if (ret < 0) {
 		goto error;
 	}
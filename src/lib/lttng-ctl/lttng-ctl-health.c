@@ -79,6 +79,7 @@ const char *consumerd_thread_name[NR_HEALTH_CONSUMERD_TYPES] = {
 	[ HEALTH_CONSUMERD_TYPE_DATA ] = "Consumer daemon data",
 	[ HEALTH_CONSUMERD_TYPE_SESSIOND ] = "Consumer daemon session daemon command manager",
 	[ HEALTH_CONSUMERD_TYPE_METADATA_TIMER ] = "Consumer daemon metadata timer",
+	[ HEALTH_CONSUMERD_TYPE_WRITER ] = "Consumer daemon writer",
 };
 
 static
@@ -89,6 +90,7 @@ const char *relayd_thread_name[NR_HEALTH_RELAYD_TYPES] = {
 	[ HEALTH_RELAYD_TYPE_LIVE_DISPATCHER ] = "Relay daemon live dispatcher",
 	[ HEALTH_RELAYD_TYPE_LIVE_WORKER ] = "Relay daemon live worker",
 	[ HEALTH_RELAYD_TYPE_LIVE_LISTENER ] = "Relay daemon live listener",
+	[ HEALTH_RELAYD_TYPE_WRITER ] = "Relay daemon writer",
 };
 
 static
@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2026 - agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 2 only, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Relay daemon live viewer latency benchmark.
+ *
+ * Attaches a number of concurrent viewers to the live port of a running
+ * lttng-relayd. Each viewer issues back-to-back LTTNG_VIEWER_LIST_SESSIONS
+ * commands and the round-trip latency of every command is recorded. The
+ * latency distribution across all the viewers is reported.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <common/common.h>
+#include <common/compat/endian.h>
+#include <common/compat/time.h>
+#include <common/defaults.h>
+#include <bin/lttng-relayd/lttng-viewer-abi.h>
+
+#define DEFAULT_NR_VIEWERS	8
+#define DEFAULT_NR_REQUESTS	10000
+
+struct viewer {
+	pthread_t thread;
+	int sock;
+	/* Latency of each request in nanoseconds. */
+	uint64_t *latencies;
+	int error;
+};
+
+static unsigned int opt_nr_viewers = DEFAULT_NR_VIEWERS;
+static unsigned int opt_nr_requests = DEFAULT_NR_REQUESTS;
+static const char *opt_host = "localhost";
+static const char *opt_port;
+
+static void usage(const char *progname)
+{
+	fprintf(stderr, "Usage: %s [-H HOST] [-p PORT] [-n NR_VIEWERS] [-r NR_REQUESTS]\n"
+			"  -H HOST         Relay daemon host (default: localhost)\n"
+			"  -p PORT         Relay daemon live port (default: %d)\n"
+			"  -n NR_VIEWERS   Number of concurrent viewers (default: %u)\n"
+			"  -r NR_REQUESTS  Number of requests per viewer (default: %u)\n",
+			progname, DEFAULT_NETWORK_VIEWER_PORT,
+			DEFAULT_NR_VIEWERS, DEFAULT_NR_REQUESTS);
+}
+
+static int parse_args(int argc, char **argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "H:p:n:r:h")) != -1) {
+		switch (opt) {
+		case 'H':
+			opt_host = optarg;
+			break;
+		case 'p':
+			opt_port = optarg;
+			break;
+		case 'n':
+			opt_nr_viewers = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			opt_nr_requests = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	if (opt_nr_viewers == 0 || opt_nr_requests == 0) {
+		usage(argv[0]);
+		return -1;
+	}
+	return 0;
+}
+
+static ssize_t viewer_recv(int sock, void *buf, size_t len)
+{
+	ssize_t ret;
+	size_t copied = 0;
+
+	do {
+		ret = recv(sock, buf + copied, len - copied, 0);
+		if (ret > 0) {
+			copied += ret;
+		}
+	} while ((ret > 0 && copied < len) || (ret < 0 && errno == EINTR));
+
+	return ret > 0 ? (ssize_t) copied : -1;
+}
+
+static ssize_t viewer_send(int sock, const void *buf, size_t len)
+{
+	ssize_t ret;
+
+	do {
+		ret = send(sock, buf, len, MSG_NOSIGNAL);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret;
+}
+
+static int viewer_connect(struct viewer *viewer)
+{
+	int ret;
+	char port[16];
+	struct addrinfo hints, *res = NULL;
+	struct lttng_viewer_cmd cmd;
+	struct lttng_viewer_connect connect_msg;
+
+	if (opt_port) {
+		snprintf(port, sizeof(port), "%s", opt_port);
+	} else {
+		snprintf(port, sizeof(port), "%d", DEFAULT_NETWORK_VIEWER_PORT);
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	ret = getaddrinfo(opt_host, port, &hints, &res);
+	if (ret) {
+		fprintf(stderr, "Failed to resolve %s: %s\n", opt_host,
+				gai_strerror(ret));
+		ret = -1;
+		goto end;
+	}
+
+	viewer->sock = socket(res->ai_family, res->ai_socktype,
+			res->ai_protocol);
+	if (viewer->sock < 0) {
+		PERROR("socket");
+		ret = -1;
+		goto end;
+	}
+	ret = connect(viewer->sock, res->ai_addr, res->ai_addrlen);
+	if (ret < 0) {
+		PERROR("connect");
+		goto end;
+	}
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.cmd = htobe32(LTTNG_VIEWER_CONNECT);
+	cmd.data_size = htobe64(sizeof(connect_msg));
+	memset(&connect_msg, 0, sizeof(connect_msg));
+	connect_msg.major = htobe32(VERSION_MAJOR);
+	connect_msg.minor = htobe32(VERSION_MINOR);
+	connect_msg.type = htobe32(LTTNG_VIEWER_CLIENT_COMMAND);
+
+	if (viewer_send(viewer->sock, &cmd, sizeof(cmd)) < 0 ||
+			viewer_send(viewer->sock, &connect_msg,
+				sizeof(connect_msg)) < 0 ||
+			viewer_recv(viewer->sock, &connect_msg,
+				sizeof(connect_msg)) < 0) {
+		fprintf(stderr, "Viewer handshake failed\n");
+		ret = -1;
+		goto end;
+	}
+	ret = 0;
+
+end:
+	if (res) {
+		freeaddrinfo(res);
+	}
+	return ret;
+}
+
+static int viewer_list_sessions(struct viewer *viewer)
+{
+	uint32_t i, count;
+	struct lttng_viewer_cmd cmd;
+	struct lttng_viewer_list_sessions list;
+	struct lttng_viewer_session session;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.cmd = htobe32(LTTNG_VIEWER_LIST_SESSIONS);
+
+	if (viewer_send(viewer->sock, &cmd, sizeof(cmd)) < 0 ||
+			viewer_recv(viewer->sock, &list, sizeof(list)) < 0) {
+		return -1;
+	}
+	count = be32toh(list.sessions_count);
+	for (i = 0; i < count; i++) {
+		if (viewer_recv(viewer->sock, &session, sizeof(session)) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static uint64_t timespec_diff_ns(struct timespec *begin, struct timespec *end)
+{
+	return (uint64_t) (end->tv_sec - begin->tv_sec) * 1000000000ULL +
+		end->tv_nsec - begin->tv_nsec;
+}
+
+static void *viewer_thread(void *data)
+{
+	unsigned int i;
+	struct viewer *viewer = data;
+	struct timespec begin, end;
+
+	for (i = 0; i < opt_nr_requests; i++) {
+		if (lttng_clock_gettime(CLOCK_MONOTONIC, &begin) ||
+				viewer_list_sessions(viewer) ||
+				lttng_clock_gettime(CLOCK_MONOTONIC, &end)) {
+			fprintf(stderr, "Viewer request failed\n");
+			viewer->error = 1;
+			break;
+		}
+		viewer->latencies[i] = timespec_diff_ns(&begin, &end);
+	}
+	return NULL;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t va = *(const uint64_t *) a, vb = *(const uint64_t *) b;
+
+	return va < vb ? -1 : va > vb;
+}
+
+int main(int argc, char **argv)
+{
+	int ret = 0;
+	unsigned int i, nr_started = 0;
+	uint64_t *all = NULL, sum = 0, nr_samples;
+	struct viewer *viewers = NULL;
+	struct timespec begin, end;
+	double elapsed;
+
+	if (parse_args(argc, argv)) {
+		return EXIT_FAILURE;
+	}
+
+	nr_samples = (uint64_t) opt_nr_viewers * opt_nr_requests;
+	viewers = zmalloc(opt_nr_viewers * sizeof(*viewers));
+	all = zmalloc(nr_samples * sizeof(*all));
+	if (!viewers || !all) {
+		ret = -1;
+		goto end;
+	}
+
+	for (i = 0; i < opt_nr_viewers; i++) {
+		viewers[i].sock = -1;
+		viewers[i].latencies = all + (uint64_t) i * opt_nr_requests;
+		ret = viewer_connect(&viewers[i]);
+		if (ret) {
+			goto end;
+		}
+	}
+
+	ret = lttng_clock_gettime(CLOCK_MONOTONIC, &begin);
+	if (ret < 0) {
+		goto end;
+	}
+	for (nr_started = 0; nr_started < opt_nr_viewers; nr_started++) {
+		ret = pthread_create(&viewers[nr_started].thread, NULL,
+				viewer_thread, &viewers[nr_started]);
+		if (ret) {
+			errno = ret;
+			PERROR("pthread_create");
+			ret = -1;
+			goto end;
+		}
+	}
+	for (i = 0; i < nr_started; i++) {
+		(void) pthread_join(viewers[i].thread, NULL);
+		if (viewers[i].error) {
+			ret = -1;
+		}
+	}
+	nr_started = 0;
+	if (ret) {
+		goto end;
+	}
+	ret = lttng_clock_gettime(CLOCK_MONOTONIC, &end);
+	if (ret < 0) {
+		goto end;
+	}
+	elapsed = (double) timespec_diff_ns(&begin, &end) / 1000000000.0;
+
+	qsort(all, nr_samples, sizeof(*all), compare_u64);
+	for (i = 0; i < nr_samples; i++) {
+		sum += all[i];
+	}
+
+	printf("%u viewers, %" PRIu64 " requests in %.3f s: %.0f requests/s, "
+			"latency mean %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us\n",
+			opt_nr_viewers, nr_samples, elapsed,
+			(double) nr_samples / elapsed,
+			(double) sum / nr_samples / 1000.0,
+			(double) all[nr_samples / 2] / 1000.0,
+			(double) all[nr_samples * 99 / 100] / 1000.0,
+			(double) all[nr_samples - 1] / 1000.0);
+
+end:
+	for (i = 0; i < nr_started; i++) {
+		(void) pthread_join(viewers[i].thread, NULL);
+	}
+	if (viewers) {
+		for (i = 0; i < opt_nr_viewers; i++) {
+			if (viewers[i].sock >= 0) {
+				(void) close(viewers[i].sock);
+			}
+		}
+	}
+	free(viewers);
+	free(all);
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
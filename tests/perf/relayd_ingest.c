@@ -0,0 +1,385 @@
+/*
+ * Copyright (C) 2026 - agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 2 only, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Relay daemon ingest benchmark.
+ *
+ * Acts as a consumer daemon streaming synthetic packets to a running
+ * lttng-relayd and reports the rate at which the relay daemon accepted
+ * and wrote them. The time is measured until the relay daemon reports
+ * that no data is pending anymore for any of the streams.
+ *
+ * With -i, an index is sent on the control connection for every packet, as
+ * a consumer daemon does for live and indexed sessions. The negotiation of
+ * the protocol extensions can be disabled with -n to compare the index
+ * protocols.
+ *
+ * With -b, packets are sent in bundles of up to RELAYD_DATA_BUNDLE_MAX_SIZE
+ * bytes, as a consumer daemon does for small packets.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <common/common.h>
+#include <common/compat/endian.h>
+#include <common/compat/time.h>
+#include <common/dynamic-buffer.h>
+#include <common/readwrite.h>
+#include <common/relayd/relayd.h>
+#include <common/sessiond-comm/relayd.h>
+#include <common/sessiond-comm/sessiond-comm.h>
+#include <common/uri.h>
+
+#define DEFAULT_NR_STREAMS	4
+#define DEFAULT_PACKET_SIZE	(256 * 1024)
+#define DEFAULT_TOTAL_SIZE	(1024ULL * 1024 * 1024)
+
+static unsigned int opt_nr_streams = DEFAULT_NR_STREAMS;
+static size_t opt_packet_size = DEFAULT_PACKET_SIZE;
+static uint64_t opt_total_size = DEFAULT_TOTAL_SIZE;
+static const char *opt_url = "net://localhost";
+static int opt_send_indexes;
+static int opt_bundle;
+static int opt_no_capabilities;
+
+static char session_name[] = "relayd-ingest";
+static char hostname[] = "localhost";
+
+static void usage(const char *progname)
+{
+	fprintf(stderr, "Usage: %s [-u URL] [-s NR_STREAMS] [-p PACKET_SIZE] [-t TOTAL_SIZE] [-i] [-n] [-b]\n"
+			"  -u URL          Relay daemon URL (default: net://localhost)\n"
+			"  -s NR_STREAMS   Number of streams (default: %u)\n"
+			"  -p PACKET_SIZE  Packet size in bytes (default: %u)\n"
+			"  -t TOTAL_SIZE   Amount of data to send in bytes (default: %llu)\n"
+			"  -i              Send an index for every packet\n"
+			"  -n              Don't negotiate the protocol extensions\n"
+			"  -b              Send the packets in bundles\n",
+			progname, DEFAULT_NR_STREAMS, DEFAULT_PACKET_SIZE,
+			DEFAULT_TOTAL_SIZE);
+}
+
+static int parse_args(int argc, char **argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "u:s:p:t:inbh")) != -1) {
+		switch (opt) {
+		case 'u':
+			opt_url = optarg;
+			break;
+		case 's':
+			opt_nr_streams = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			opt_packet_size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			opt_total_size = strtoull(optarg, NULL, 0);
+			break;
+		case 'i':
+			opt_send_indexes = 1;
+			break;
+		case 'n':
+			opt_no_capabilities = 1;
+			break;
+		case 'b':
+			opt_bundle = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	if (opt_nr_streams == 0 || opt_packet_size == 0 ||
+			opt_total_size < opt_packet_size ||
+			(opt_bundle && opt_packet_size +
+				sizeof(struct lttcomm_relayd_data_hdr) >
+				RELAYD_DATA_BUNDLE_MAX_SIZE)) {
+		usage(argv[0]);
+		return -1;
+	}
+	return 0;
+}
+
+static struct lttcomm_relayd_sock *connect_relayd(struct lttng_uri *uri)
+{
+	int ret;
+	struct lttcomm_relayd_sock *rsock;
+
+	rsock = lttcomm_alloc_relayd_sock(uri, RELAYD_VERSION_COMM_MAJOR,
+			RELAYD_VERSION_COMM_MINOR);
+	if (!rsock) {
+		goto error;
+	}
+	ret = relayd_connect(rsock);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to connect to the relay daemon\n");
+		goto error_free;
+	}
+	return rsock;
+
+error_free:
+	free(rsock);
+error:
+	return NULL;
+}
+
+/*
+ * Send the packets staged in a bundle, announced by a data header carrying
+ * the bundle sequence number.
+ */
+static int flush_bundle(struct lttcomm_relayd_sock *data,
+		struct lttng_dynamic_buffer *bundle, uint64_t stream_id)
+{
+	ssize_t ret;
+	struct lttcomm_relayd_data_hdr hdr;
+	struct iovec iov[2];
+
+	if (bundle->size == 0) {
+		return 0;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.stream_id = htobe64(stream_id);
+	hdr.net_seq_num = htobe64(RELAYD_DATA_BUNDLE_SEQ_NUM);
+	hdr.data_size = htobe32(bundle->size);
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = bundle->data;
+	iov[1].iov_len = bundle->size;
+	ret = lttng_writev(data->sock.fd, iov, 2);
+	if (ret != sizeof(hdr) + bundle->size) {
+		fprintf(stderr, "Failed to send data bundle\n");
+		return -1;
+	}
+	return lttng_dynamic_buffer_set_size(bundle, 0);
+}
+
+static double timespec_diff(struct timespec *begin, struct timespec *end)
+{
+	return (double) (end->tv_sec - begin->tv_sec) +
+		(double) (end->tv_nsec - begin->tv_nsec) / 1000000000.0;
+}
+
+int main(int argc, char **argv)
+{
+	int ret, i;
+	ssize_t nb_uri;
+	struct lttng_uri *uris = NULL;
+	struct lttcomm_relayd_sock *ctrl = NULL, *data = NULL;
+	uint64_t session_id, *stream_ids = NULL, *seq_nums = NULL;
+	uint64_t sent = 0, nr_packets = 0, bundle_stream_id = 0;
+	uint32_t capabilities = 0, indexes_unacked = 0;
+	char *payload = NULL;
+	struct lttng_dynamic_buffer bundle;
+	struct timespec begin, end;
+	double elapsed;
+
+	if (parse_args(argc, argv)) {
+		return EXIT_FAILURE;
+	}
+	lttng_dynamic_buffer_init(&bundle);
+
+	lttcomm_init();
+	lttcomm_inet_init();
+
+	nb_uri = uri_parse_str_urls(opt_url, NULL, &uris);
+	if (nb_uri != 2) {
+		fprintf(stderr, "Invalid relay daemon URL %s\n", opt_url);
+		ret = -1;
+		goto end;
+	}
+
+	ctrl = connect_relayd(&uris[0]);
+	data = connect_relayd(&uris[1]);
+	if (!ctrl || !data) {
+		ret = -1;
+		goto end;
+	}
+
+	ret = relayd_version_check(ctrl,
+			opt_no_capabilities ? NULL : &capabilities);
+	if (ret < 0) {
+		fprintf(stderr, "Relay daemon version check failed\n");
+		goto end;
+	}
+	if (opt_bundle && !(capabilities & RELAYD_CAPABILITY_DATA_BUNDLE)) {
+		fprintf(stderr, "Relay daemon does not support data bundles\n");
+		ret = -1;
+		goto end;
+	}
+
+	/*
+	 * Unless indexes are sent, create a snapshot session so the relay
+	 * daemon does not wait for the indexes of the packets.
+	 */
+	ret = relayd_create_session(ctrl, &session_id, session_name,
+			hostname, 0, !opt_send_indexes);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to create relay session\n");
+		goto end;
+	}
+
+	stream_ids = zmalloc(opt_nr_streams * sizeof(*stream_ids));
+	seq_nums = zmalloc(opt_nr_streams * sizeof(*seq_nums));
+	payload = zmalloc(opt_packet_size);
+	if (!stream_ids || !seq_nums || !payload) {
+		ret = -1;
+		goto end;
+	}
+	memset(payload, 0x5a, opt_packet_size);
+
+	for (i = 0; i < opt_nr_streams; i++) {
+		char channel_name[DEFAULT_STREAM_NAME_LEN];
+
+		snprintf(channel_name, sizeof(channel_name), "channel0_%d", i);
+		ret = relayd_add_stream(ctrl, channel_name, session_name,
+				&stream_ids[i], 0, 0);
+		if (ret < 0) {
+			fprintf(stderr, "Failed to add stream %d\n", i);
+			goto end;
+		}
+	}
+	ret = relayd_streams_sent(ctrl);
+	if (ret < 0) {
+		goto end;
+	}
+
+	ret = lttng_clock_gettime(CLOCK_MONOTONIC, &begin);
+	if (ret < 0) {
+		goto end;
+	}
+
+	while (sent < opt_total_size) {
+		struct lttcomm_relayd_data_hdr hdr;
+		unsigned int stream_idx = nr_packets % opt_nr_streams;
+
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.stream_id = htobe64(stream_ids[stream_idx]);
+		hdr.net_seq_num = htobe64(seq_nums[stream_idx]++);
+		hdr.data_size = htobe32(opt_packet_size);
+
+		if (opt_bundle) {
+			if (bundle.size + sizeof(hdr) + opt_packet_size >
+					RELAYD_DATA_BUNDLE_MAX_SIZE) {
+				ret = flush_bundle(data, &bundle,
+						bundle_stream_id);
+				if (ret < 0) {
+					goto end;
+				}
+			}
+			if (bundle.size == 0) {
+				bundle_stream_id = stream_ids[stream_idx];
+			}
+			if (lttng_dynamic_buffer_append(&bundle, &hdr,
+					sizeof(hdr)) ||
+					lttng_dynamic_buffer_append(&bundle,
+						payload, opt_packet_size)) {
+				ret = -1;
+				goto end;
+			}
+		} else {
+			ret = relayd_send_data_hdr(data, &hdr, sizeof(hdr));
+			if (ret < 0) {
+				goto end;
+			}
+			ret = data->sock.ops->sendmsg(&data->sock, payload,
+					opt_packet_size, 0);
+			if (ret < 0) {
+				goto end;
+			}
+		}
+		if (opt_send_indexes) {
+			struct ctf_packet_index index;
+
+			memset(&index, 0, sizeof(index));
+			index.packet_size = htobe64(opt_packet_size * CHAR_BIT);
+			index.content_size = index.packet_size;
+			index.timestamp_begin = htobe64(nr_packets);
+			index.timestamp_end = htobe64(nr_packets + 1);
+			ret = relayd_send_index(ctrl, &index,
+					stream_ids[stream_idx],
+					seq_nums[stream_idx] - 1,
+					(capabilities &
+						RELAYD_CAPABILITY_INDEX_ACK_WINDOW) ?
+						&indexes_unacked : NULL);
+			if (ret < 0) {
+				fprintf(stderr, "Failed to send index\n");
+				goto end;
+			}
+		}
+		sent += opt_packet_size;
+		nr_packets++;
+	}
+	ret = flush_bundle(data, &bundle, bundle_stream_id);
+	if (ret < 0) {
+		goto end;
+	}
+
+	/* Wait for the relay daemon to have written every packet. */
+	for (i = 0; i < opt_nr_streams; i++) {
+		do {
+			ret = relayd_data_pending(ctrl, stream_ids[i],
+					seq_nums[i] - 1);
+			if (ret < 0) {
+				goto end;
+			}
+		} while (ret == 1);
+	}
+
+	ret = lttng_clock_gettime(CLOCK_MONOTONIC, &end);
+	if (ret < 0) {
+		goto end;
+	}
+	elapsed = timespec_diff(&begin, &end);
+
+	printf("%" PRIu64 " packets, %" PRIu64 " bytes in %.3f s: %.1f MB/s, %.0f packets/s%s%s\n",
+			nr_packets, sent, elapsed,
+			(double) sent / elapsed / (1024 * 1024),
+			(double) nr_packets / elapsed,
+			opt_send_indexes ? " (with indexes)" : "",
+			opt_bundle ? " (bundled)" : "");
+
+	for (i = 0; i < opt_nr_streams; i++) {
+		(void) relayd_send_close_stream(ctrl, stream_ids[i],
+				seq_nums[i] - 1);
+	}
+	ret = 0;
+
+end:
+	if (data) {
+		(void) relayd_close(data);
+		free(data);
+	}
+	if (ctrl) {
+		(void) relayd_close(ctrl);
+		free(ctrl);
+	}
+	free(uris);
+	free(payload);
+	lttng_dynamic_buffer_reset(&bundle);
+	free(seq_nums);
+	free(stream_ids);
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -49,13 +49,15 @@
 #define LIVE_TIMER 2000000
 
 /* Number of TAP tests in this file */
-#define NUM_TESTS 11
+#define NUM_TESTS 13
 #define mmap_size 524288
 
 int ust_consumerd32_fd;
 int ust_consumerd64_fd;
 
 static int control_sock;
+/* LTTNG_VIEWER_CAPABILITY_* advertised by the relay. */
+static uint32_t viewer_capabilities;
 struct live_session *session;
 
 static int first_packet_offset;
@@ -160,7 +162,7 @@ int establish_connection(void)
 
 	cmd.cmd = htobe32(LTTNG_VIEWER_CONNECT);
 	cmd.data_size = htobe64(sizeof(connect));
-	cmd.cmd_version = htobe32(0);
+	cmd.cmd_version = htobe32(LTTNG_VIEWER_CONNECT_CMD_CAPABILITIES);
 
 	memset(&connect, 0, sizeof(connect));
 	connect.major = htobe32(VERSION_MAJOR);
@@ -187,6 +189,8 @@ int establish_connection(void)
 		diag("Error receiving version");
 		goto error;
 	}
+	viewer_capabilities = be32toh(connect.minor) >>
+			LTTNG_VIEWER_CAPABILITIES_SHIFT;
 	return 0;
 
 error:
@@ -546,6 +550,105 @@ error:
 	return -1;
 }
 
+/*
+ * Wait for the next indexes of the session. Returns the number of indexes
+ * received, or a negative value on error or if a stream got more than one
+ * index.
+ */
+static
+int get_next_indexes(uint64_t id, uint32_t timeout_ms)
+{
+	struct lttng_viewer_cmd cmd;
+	struct lttng_viewer_get_next_indexes rq;
+	struct lttng_viewer_indexes rp;
+	struct lttng_viewer_stream_index index;
+	ssize_t ret_len;
+	uint32_t i, count;
+	int j;
+	char *received = NULL;
+
+	received = zmalloc(session->stream_count);
+	if (!received) {
+		PERROR("zmalloc received indexes");
+		goto error;
+	}
+
+	cmd.cmd = htobe32(LTTNG_VIEWER_GET_NEXT_INDEXES);
+	cmd.data_size = htobe64(sizeof(rq));
+	cmd.cmd_version = htobe32(0);
+
+	memset(&rq, 0, sizeof(rq));
+	rq.session_id = htobe64(id);
+	rq.timeout_ms = htobe32(timeout_ms);
+
+	ret_len = lttng_live_send(control_sock, &cmd, sizeof(cmd));
+	if (ret_len < 0) {
+		diag("Error sending cmd");
+		goto error;
+	}
+	ret_len = lttng_live_send(control_sock, &rq, sizeof(rq));
+	if (ret_len < 0) {
+		diag("Error sending get_next_indexes request");
+		goto error;
+	}
+	ret_len = lttng_live_recv(control_sock, &rp, sizeof(rp));
+	if (ret_len == 0) {
+		diag("[error] Remote side has closed connection");
+		goto error;
+	}
+	if (ret_len < 0) {
+		diag("Error receiving indexes response");
+		goto error;
+	}
+
+	switch (be32toh(rp.status)) {
+	case LTTNG_VIEWER_INDEXES_OK:
+	case LTTNG_VIEWER_INDEXES_TIMEOUT:
+		break;
+	case LTTNG_VIEWER_INDEXES_HUP:
+		diag("Got LTTNG_VIEWER_INDEXES_HUP");
+		goto error;
+	case LTTNG_VIEWER_INDEXES_ERR:
+		diag("Got LTTNG_VIEWER_INDEXES_ERR");
+		goto error;
+	default:
+		diag("Unknown reply status during LTTNG_VIEWER_GET_NEXT_INDEXES (%d)", be32toh(rp.status));
+		goto error;
+	}
+
+	count = be32toh(rp.indexes_count);
+	for (i = 0; i < count; i++) {
+		ret_len = lttng_live_recv(control_sock, &index, sizeof(index));
+		if (ret_len <= 0) {
+			diag("Error receiving stream index");
+			goto error;
+		}
+		for (j = 0; j < session->stream_count; j++) {
+			if (session->streams[j].id ==
+					be64toh(index.viewer_stream_id)) {
+				break;
+			}
+		}
+		if (j == session->stream_count) {
+			diag("Got index of unknown stream %" PRIu64,
+					be64toh(index.viewer_stream_id));
+			goto error;
+		}
+		if (received[j]) {
+			diag("Got more than one index of stream %" PRIu64,
+					be64toh(index.viewer_stream_id));
+			goto error;
+		}
+		received[j] = 1;
+	}
+	free(received);
+	return count;
+
+error:
+	free(received);
+	return -1;
+}
+
 static
 int get_data_packet(int id, uint64_t offset,
 		uint64_t len)
@@ -691,6 +794,8 @@ int main(int argc, char **argv)
 	ret = establish_connection();
 	ok(ret == 0, "Established connection and version check with %d.%d",
 			VERSION_MAJOR, VERSION_MINOR);
+	ok(viewer_capabilities & LTTNG_VIEWER_CAPABILITY_GET_NEXT_INDEXES,
+			"Relay advertises waiting for the next indexes");
 
 	ret = list_sessions(&session_id);
 	ok(ret > 0, "List sessions : %d session(s)", ret);
@@ -714,6 +819,19 @@ int main(int argc, char **argv)
 			first_packet_stream_id, first_packet_offset,
 			first_packet_len);
 
+	/*
+	 * Every stream gets an index, or a beacon, each live timer period, so
+	 * waiting for two periods returns an index for at least one stream.
+	 */
+	if (viewer_capabilities & LTTNG_VIEWER_CAPABILITY_GET_NEXT_INDEXES) {
+		ret = get_next_indexes(session_id, 2 * LIVE_TIMER / 1000);
+		ok(ret > 0 && ret <= session->stream_count,
+				"Wait for the next indexes of the session, %d received",
+				ret);
+	} else {
+		skip(1, "Relay does not support waiting for the next indexes");
+	}
+
 	ret = detach_viewer_session(session_id);
 	ok(ret == 0, "Detach viewer session");
 
@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2026 - agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 2 only, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <tap/tap.h>
+
+#include <common/common.h>
+#include <common/defaults.h>
+#include <common/consumer/consumer.h>
+#include <common/consumer/consumer-metadata-cache.h>
+
+/* For error.h */
+int lttng_opt_quiet = 1;
+int lttng_opt_verbose;
+int lttng_opt_mi;
+
+/* For the consumer library, defined by the consumer daemon. */
+struct health_app *health_consumerd;
+int health_quit_pipe[2] = { -1, -1 };
+
+/* Spans the first three chunks of the cache. */
+#define METADATA_LEN	(4 * DEFAULT_METADATA_CACHE_SIZE - 100)
+/* Odd size so that the writes straddle the chunk boundaries. */
+#define WRITE_LEN	333
+
+#define NUM_TESTS 13
+
+static char metadata[METADATA_LEN];
+
+/*
+ * Return the number of bytes which can be read from the metadata wakeup pipe
+ * of a stream without blocking.
+ */
+static int drain_wakeups(struct lttng_consumer_stream *stream)
+{
+	int count = 0;
+	char c;
+
+	while (read(stream->ust_metadata_poll_pipe[0], &c, 1) == 1) {
+		count++;
+	}
+	return count;
+}
+
+/*
+ * Check that the contents of the cache, read both at once and one contiguous
+ * range at a time, match the given buffer.
+ */
+static bool cache_matches(struct consumer_metadata_cache *cache,
+		const char *expected, uint64_t len)
+{
+	bool match;
+	uint64_t offset = 0;
+	char *buf;
+
+	if (cache->max_offset != len) {
+		return false;
+	}
+	buf = zmalloc(len);
+	if (!buf) {
+		return false;
+	}
+	consumer_metadata_cache_read(cache, 0, buf, len);
+	match = !memcmp(buf, expected, len);
+	free(buf);
+
+	while (match && offset < len) {
+		uint64_t contents_len;
+		const char *contents;
+
+		contents = consumer_metadata_cache_get_contents(cache, offset,
+				&contents_len);
+		match = contents_len > 0 && offset + contents_len <= len &&
+				!memcmp(contents, expected + offset,
+					contents_len);
+		offset += contents_len;
+	}
+	return match;
+}
+
+static int write_all(struct lttng_consumer_channel *channel,
+		uint64_t version, const char *data, unsigned int len)
+{
+	int ret = 0;
+	unsigned int offset;
+
+	for (offset = 0; offset < len && !ret; offset += WRITE_LEN) {
+		unsigned int write_len = len - offset < WRITE_LEN ?
+				len - offset : WRITE_LEN;
+
+		ret = consumer_metadata_cache_write(channel, offset, write_len,
+				version, (char *) data + offset);
+	}
+	return ret;
+}
+
+static void test_chunks(struct lttng_consumer_channel *channel)
+{
+	int ret;
+	uint64_t len;
+	const char *contents;
+	struct consumer_metadata_cache *cache = channel->metadata_cache;
+
+	ret = write_all(channel, 1, metadata, METADATA_LEN);
+	ok(ret == 0, "Write metadata across chunk boundaries");
+	ok(cache->nr_chunks == 3 &&
+			cache->cache_alloc_size ==
+				4 * DEFAULT_METADATA_CACHE_SIZE,
+			"Cache extended by chunks of doubling size");
+	ok(cache_matches(cache, metadata, METADATA_LEN),
+			"Read metadata back across chunk boundaries");
+
+	contents = consumer_metadata_cache_get_contents(cache,
+			DEFAULT_METADATA_CACHE_SIZE - 10, &len);
+	ok(len == 10 && !memcmp(contents,
+				metadata + DEFAULT_METADATA_CACHE_SIZE - 10, 10),
+			"Contiguous contents end at the chunk boundary");
+
+	/* Overlapping rewrite of the same contents. */
+	ret = consumer_metadata_cache_write(channel,
+			DEFAULT_METADATA_CACHE_SIZE - 50, 100, 1,
+			metadata + DEFAULT_METADATA_CACHE_SIZE - 50);
+	ok(ret == 0 && cache_matches(cache, metadata, METADATA_LEN),
+			"Overlapping write leaves the contents unchanged");
+}
+
+static void test_version_reset(struct lttng_consumer_channel *channel)
+{
+	int ret;
+	unsigned int i;
+	char *chunks[METADATA_CACHE_MAX_CHUNKS];
+	char *new_metadata, *expected;
+	const unsigned int new_len = DEFAULT_METADATA_CACHE_SIZE + 10;
+	const unsigned int gap_offset = 2 * DEFAULT_METADATA_CACHE_SIZE;
+	struct consumer_metadata_cache *cache = channel->metadata_cache;
+
+	memcpy(chunks, cache->chunks, sizeof(chunks));
+
+	new_metadata = zmalloc(new_len);
+	expected = zmalloc(gap_offset + new_len);
+	if (!new_metadata || !expected) {
+		skip(4, "Allocating test buffers");
+		goto end;
+	}
+	for (i = 0; i < new_len; i++) {
+		new_metadata[i] = ~metadata[i];
+	}
+
+	ret = write_all(channel, 2, new_metadata, new_len);
+	ok(ret == 0 && cache->version == 2,
+			"Write metadata of a new version");
+	ok(cache_matches(cache, new_metadata, new_len),
+			"New version replaces the previous contents");
+	ok(cache->nr_chunks == 3 &&
+			!memcmp(chunks, cache->chunks, sizeof(chunks)),
+			"Chunks are kept across a version reset");
+
+	/*
+	 * A write past the end of the new contents must not expose the
+	 * contents of the previous version in between.
+	 */
+	ret = consumer_metadata_cache_write(channel, 0, 1, 3, new_metadata);
+	ret |= consumer_metadata_cache_write(channel, gap_offset, new_len, 3,
+			new_metadata);
+	expected[0] = new_metadata[0];
+	memcpy(expected + gap_offset, new_metadata, new_len);
+	ok(ret == 0 && cache_matches(cache, expected, gap_offset + new_len),
+			"Gap left by a write is zeroed");
+end:
+	free(new_metadata);
+	free(expected);
+}
+
+static void test_wakeup(struct lttng_consumer_channel *channel,
+		struct lttng_consumer_stream *stream)
+{
+	int ret;
+
+	channel->monitor = 1;
+	channel->metadata_stream = stream;
+
+	ret = write_all(channel, 4, metadata, 3 * WRITE_LEN);
+	ok(ret == 0 && drain_wakeups(stream) == 1 &&
+			stream->ust_metadata_wakeup_pending,
+			"Many writes wake up the metadata thread once");
+
+	/* The metadata thread clears the flag once it is awake. */
+	stream->ust_metadata_wakeup_pending = 0;
+	ret = consumer_metadata_cache_write(channel, 0, WRITE_LEN, 4,
+			metadata);
+	ok(ret == 0 && drain_wakeups(stream) == 0,
+			"Rewrite of cached contents does not wake up");
+
+	ret = consumer_metadata_cache_write(channel, 3 * WRITE_LEN,
+			WRITE_LEN, 4, metadata + 3 * WRITE_LEN);
+	ok(ret == 0 && drain_wakeups(stream) == 1,
+			"New contents wake up the metadata thread again");
+
+	channel->monitor = 0;
+	channel->metadata_stream = NULL;
+}
+
+int main(int argc, char **argv)
+{
+	int ret;
+	unsigned int i;
+	struct lttng_consumer_channel *channel;
+	struct lttng_consumer_stream *stream;
+
+	plan_tests(NUM_TESTS);
+
+	diag("Consumer metadata cache unit tests");
+
+	for (i = 0; i < METADATA_LEN; i++) {
+		metadata[i] = (char) (i * 7 + i / 251);
+	}
+
+	channel = zmalloc(sizeof(*channel));
+	stream = zmalloc(sizeof(*stream));
+	if (!channel || !stream) {
+		diag("Allocating the channel and stream");
+		return EXIT_FAILURE;
+	}
+	ret = pipe2(stream->ust_metadata_poll_pipe, O_NONBLOCK);
+	if (ret < 0) {
+		diag("Creating the metadata wakeup pipe");
+		return EXIT_FAILURE;
+	}
+
+	ret = consumer_metadata_cache_allocate(channel);
+	ok(ret == 0 && channel->metadata_cache->nr_chunks == 1,
+			"Allocate metadata cache");
+	if (ret) {
+		return exit_status();
+	}
+
+	test_chunks(channel);
+	test_version_reset(channel);
+	test_wakeup(channel, stream);
+
+	consumer_metadata_cache_destroy(channel);
+	(void) close(stream->ust_metadata_poll_pipe[0]);
+	(void) close(stream->ust_metadata_poll_pipe[1]);
+	free(stream);
+	free(channel);
+	return exit_status();
+}
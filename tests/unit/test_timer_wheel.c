@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2026 - agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 2 only, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdbool.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <tap/tap.h>
+
+#include <common/timer-wheel.h>
+
+/* For error.h */
+int lttng_opt_quiet = 1;
+int lttng_opt_verbose;
+int lttng_opt_mi;
+
+#define NUM_TESTS 17
+
+/* Start away from 0 so that the wheel does not begin on a cascade. */
+#define START_TICK	1000
+
+static struct timer_wheel wheel;
+
+/*
+ * Advance the wheel from one wakeup to the next, as a timer thread would,
+ * until the entry expires or the limit is reached.
+ *
+ * Return the tick at which the entry expired, or UINT64_MAX.
+ */
+static uint64_t run_until_expired(struct timer_wheel_entry *entry,
+		uint64_t limit)
+{
+	uint64_t tick;
+	struct cds_list_head expired;
+
+	CDS_INIT_LIST_HEAD(&expired);
+	while ((tick = timer_wheel_next_tick(&wheel)) <= limit) {
+		timer_wheel_advance(&wheel, tick, &expired);
+		if (!cds_list_empty(&expired)) {
+			bool found = false;
+			struct timer_wheel_entry *pos, *tmp;
+
+			cds_list_for_each_entry_safe(pos, tmp, &expired, node) {
+				if (pos == entry) {
+					found = true;
+				}
+				timer_wheel_del(&wheel, pos);
+			}
+			if (found) {
+				return tick;
+			}
+		}
+	}
+	return UINT64_MAX;
+}
+
+static void test_expiration(void)
+{
+	unsigned int i;
+	struct timer_wheel_entry entry;
+	const uint64_t deltas[] = { 0, 10, 300, 70000, 20000000 };
+
+	timer_wheel_init(&wheel, START_TICK);
+	timer_wheel_entry_init(&entry);
+	ok(timer_wheel_next_tick(&wheel) == UINT64_MAX,
+			"An empty wheel has no next tick");
+
+	for (i = 0; i < sizeof(deltas) / sizeof(deltas[0]); i++) {
+		uint64_t expires = wheel.now + deltas[i];
+
+		timer_wheel_add(&wheel, &entry, expires);
+		ok(run_until_expired(&entry, expires + 1) == expires,
+				"Entry expiring in %" PRIu64 " ticks expires on time",
+				deltas[i]);
+	}
+}
+
+static void test_late_add(void)
+{
+	struct timer_wheel_entry entry;
+	struct cds_list_head expired;
+
+	CDS_INIT_LIST_HEAD(&expired);
+	timer_wheel_init(&wheel, START_TICK);
+	timer_wheel_entry_init(&entry);
+
+	timer_wheel_add(&wheel, &entry, START_TICK - 10);
+	ok(timer_wheel_next_tick(&wheel) == START_TICK,
+			"Entry added in the past expires at the next tick");
+	timer_wheel_advance(&wheel, START_TICK, &expired);
+	ok(expired.next == &entry.node && !entry.in_wheel,
+			"Entry added in the past is expired");
+	timer_wheel_del(&wheel, &entry);
+}
+
+static void test_batch(void)
+{
+	unsigned int i, nr_expired = 0;
+	struct timer_wheel_entry entries[3], *pos;
+	struct cds_list_head expired;
+
+	CDS_INIT_LIST_HEAD(&expired);
+	timer_wheel_init(&wheel, START_TICK);
+
+	/* Added at different times, from different levels. */
+	for (i = 0; i < 3; i++) {
+		timer_wheel_entry_init(&entries[i]);
+		timer_wheel_add(&wheel, &entries[i], START_TICK + 1000);
+		timer_wheel_advance(&wheel, wheel.now + 300, &expired);
+	}
+	ok(cds_list_empty(&expired), "No entry expires early");
+
+	timer_wheel_advance(&wheel, START_TICK + 1000, &expired);
+	cds_list_for_each_entry(pos, &expired, node) {
+		nr_expired++;
+	}
+	ok(nr_expired == 3 && wheel.nr_entries == 0,
+			"Entries expiring at the same tick expire together");
+}
+
+static void test_del(void)
+{
+	struct timer_wheel_entry entry, other;
+	struct cds_list_head expired;
+
+	CDS_INIT_LIST_HEAD(&expired);
+	timer_wheel_init(&wheel, START_TICK);
+	timer_wheel_entry_init(&entry);
+	timer_wheel_entry_init(&other);
+
+	timer_wheel_add(&wheel, &entry, START_TICK + 5000);
+	timer_wheel_add(&wheel, &other, START_TICK + 6000);
+	timer_wheel_del(&wheel, &entry);
+	ok(!timer_wheel_entry_pending(&entry) && wheel.nr_entries == 1,
+			"Removed entry is not pending");
+
+	timer_wheel_advance(&wheel, START_TICK + 5500, &expired);
+	ok(cds_list_empty(&expired), "Removed entry does not expire");
+	ok(run_until_expired(&other, START_TICK + 6001) == START_TICK + 6000,
+			"Remaining entry expires on time");
+	ok(timer_wheel_next_tick(&wheel) == UINT64_MAX,
+			"Wheel is empty once every entry expired");
+}
+
+static void test_fast_forward(void)
+{
+	struct timer_wheel_entry entry;
+	const uint64_t idle_tick = START_TICK + 50000000;
+
+	timer_wheel_init(&wheel, START_TICK);
+	timer_wheel_entry_init(&entry);
+
+	timer_wheel_fast_forward(&wheel, idle_tick);
+	ok(wheel.now == idle_tick, "Empty wheel is fast-forwarded");
+	timer_wheel_add(&wheel, &entry, idle_tick + 10);
+	ok(timer_wheel_next_tick(&wheel) == idle_tick + 10,
+			"Entry added after an idle period expires relative to it");
+
+	timer_wheel_fast_forward(&wheel, idle_tick + 100);
+	ok(wheel.now == idle_tick,
+			"Wheel having entries is not fast-forwarded");
+	timer_wheel_del(&wheel, &entry);
+}
+
+int main(int argc, char **argv)
+{
+	plan_tests(NUM_TESTS);
+
+	diag("Timer wheel unit tests");
+
+	test_expiration();
+	test_late_add();
+	test_batch();
+	test_del();
+	test_fast_forward();
+
+	return exit_status();
+}
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2026 - agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 2 only, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <tap/tap.h>
+
+#include <common/defaults.h>
+#include <common/readwrite.h>
+#include <common/utils.h>
+#include <common/index/tracefile-prepare.h>
+
+/* For error.h */
+int lttng_opt_quiet = 1;
+int lttng_opt_verbose;
+int lttng_opt_mi;
+
+#define TRACEFILE_SIZE		(1024 * 1024)
+#define STREAM_NAME		"channel0_0"
+/* Size written to a prepared tracefile, a small part of it. */
+#define WRITTEN_SIZE		(64 * 1024)
+
+#define NUM_TESTS 11
+
+static char trace_path[] = "/tmp/test_tracefile_prepare.XXXXXX";
+
+static int write_data(int fd, size_t len)
+{
+	char buf[4096];
+
+	memset(buf, 0x5a, sizeof(buf));
+	while (len > 0) {
+		size_t write_len = len < sizeof(buf) ? len : sizeof(buf);
+
+		if (lttng_write(fd, buf, write_len) != (ssize_t) write_len) {
+			return -1;
+		}
+		len -= write_len;
+	}
+	return 0;
+}
+
+static bool file_exists(const char *path_name, const char *file_name,
+		uint64_t count, const char *suffix)
+{
+	struct stat st;
+	char path[PATH_MAX];
+
+	if (utils_stream_file_path(path, path_name, file_name, TRACEFILE_SIZE,
+			count, suffix)) {
+		return false;
+	}
+	return stat(path, &st) == 0;
+}
+
+static void test_take(void)
+{
+	int fd = -1;
+	bool taken;
+	char index_path[PATH_MAX];
+	struct stat st;
+	struct tracefile_prepare *prepare;
+	struct lttng_index_file *index_file = NULL;
+
+	snprintf(index_path, sizeof(index_path), "%s/" DEFAULT_INDEX_DIR,
+			trace_path);
+
+	prepare = tracefile_prepare_create(trace_path, STREAM_NAME,
+			TRACEFILE_SIZE, -1, -1, true, CTF_INDEX_MAJOR,
+			CTF_INDEX_MINOR);
+	ok(prepare != NULL, "Create a tracefile preparation");
+	if (!prepare) {
+		skip(9, "No tracefile preparation");
+		return;
+	}
+
+	/* The tracefile is prepared by a background thread. */
+	tracefile_prepare_next(prepare, 1);
+	tracefile_prepare_wait(prepare);
+	taken = tracefile_prepare_take(prepare, 1, &fd, &index_file);
+	ok(taken && fd >= 0, "Take the prepared tracefile");
+	ok(index_file != NULL, "Take the prepared index file");
+	ok(file_exists(trace_path, STREAM_NAME, 1, NULL),
+			"Prepared tracefile has its final name");
+	ok(!file_exists(trace_path, "." STREAM_NAME, 1, NULL),
+			"Temporary tracefile is renamed");
+	ok(file_exists(index_path, STREAM_NAME, 1, DEFAULT_INDEX_FILE_SUFFIX),
+			"Prepared index file has its final name");
+	ok(fd >= 0 && fstat(fd, &st) == 0 && st.st_size == 0,
+			"Prepared tracefile is empty");
+	if (fd >= 0) {
+		diag("Prepared tracefile has %" PRIu64 " bytes allocated",
+				(uint64_t) st.st_blocks * 512);
+	}
+
+	/*
+	 * Written to partially and closed as the last tracefile of a stream,
+	 * the tracefile must not keep the blocks allocated past its end.
+	 */
+	ok(fd >= 0 && write_data(fd, WRITTEN_SIZE) == 0 &&
+			utils_trim_stream_file(fd) == 0 &&
+			fstat(fd, &st) == 0 && st.st_size == WRITTEN_SIZE &&
+			st.st_blocks * 512 < TRACEFILE_SIZE,
+			"Prepared tracefile is trimmed to its written size");
+	if (fd >= 0) {
+		(void) close(fd);
+	}
+	if (index_file) {
+		lttng_index_file_put(index_file);
+	}
+
+	/* A preparation left untaken is removed on destruction. */
+	tracefile_prepare_next(prepare, 2);
+	tracefile_prepare_wait(prepare);
+	ok(file_exists(trace_path, "." STREAM_NAME, 2, NULL),
+			"Next tracefile is prepared under its temporary name");
+	tracefile_prepare_destroy(prepare);
+	ok(!file_exists(trace_path, "." STREAM_NAME, 2, NULL),
+			"Untaken tracefile is removed on destruction");
+}
+
+static void test_take_unprepared(void)
+{
+	int fd = -1;
+	struct tracefile_prepare *prepare;
+	struct lttng_index_file *index_file = NULL;
+
+	prepare = tracefile_prepare_create(trace_path, STREAM_NAME,
+			TRACEFILE_SIZE, -1, -1, false, CTF_INDEX_MAJOR,
+			CTF_INDEX_MINOR);
+	ok(prepare && !tracefile_prepare_take(prepare, 3, &fd, &index_file),
+			"An unprepared tracefile is not taken");
+	tracefile_prepare_destroy(prepare);
+}
+
+static void cleanup(void)
+{
+	char index_path[PATH_MAX];
+
+	snprintf(index_path, sizeof(index_path), "%s/" DEFAULT_INDEX_DIR,
+			trace_path);
+	(void) utils_unlink_stream_file(trace_path, STREAM_NAME,
+			TRACEFILE_SIZE, 1, -1, -1, NULL);
+	(void) utils_unlink_stream_file(index_path, STREAM_NAME,
+			TRACEFILE_SIZE, 1, -1, -1, DEFAULT_INDEX_FILE_SUFFIX);
+	(void) utils_recursive_rmdir(trace_path);
+}
+
+int main(int argc, char **argv)
+{
+	plan_tests(NUM_TESTS);
+
+	diag("Tracefile preparation unit tests");
+
+	if (!mkdtemp(trace_path)) {
+		diag("Failed to create temporary trace directory");
+		return EXIT_FAILURE;
+	}
+
+	test_take();
+	test_take_unprepared();
+
+	cleanup();
+	return exit_status();
+}